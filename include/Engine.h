@@ -36,6 +36,7 @@ extern int g_subwindow_try;
 
 extern float time;
 extern float dt;
+extern bool g_headless; // No window, GL calls go to the null backend, and time is simulated.
 
 extern float ASPECT_RATIO;
 extern DataDictionary *g_data;
@@ -63,6 +64,7 @@ vec2 pixel_to_rect(int pixel_x, int pixel_y, float blx, float bly, float trx, fl
 
 #include "Engine/gameobjects.h"
 #include "Engine/game_renderer.h"
+#include "Engine/scene_bvh.h"
 #include "Engine/helper.h"
 #include "Engine/testing.h"
 #include "Engine/scenes.h"
@@ -5,21 +5,159 @@
 #define HEADER_DEFINED_GAME_RENDERER
 void init_game_renderer(void);
 void render_body_with_material(mat4x4 vp_matrix, Body *body, Material *material);
+void render_body_with_material_state(mat4x4 vp_matrix, Body *body, Material *material, GMDrawState *state);
 void render_body(mat4x4 vp_matrix, Body *body);
+void set_geometry_uniforms(Geometry *geometry);
 void render(void);
 
 
 void render_paint2d();
+/*--------------------------------------------------------------------------------
+    Render queue
+--------------------------------------------------------------------------------*/
+// Bodies are queued with sort keys, sorted to group draws sharing state, then submitted with only the state changes.
+typedef uint8_t RenderPass;
+enum RenderPasses {
+    RenderPassShadow,
+    RenderPassOpaque,
+};
+typedef struct RenderItem_s {
+    Body *body;
+    Material *material;
+    // After batching, the first item of a run drawn with one instanced draw call holds the run length and where its
+    // model matrices start in the instance buffer, and the rest of the run have instances = 0. Others have instances = 1.
+    int instances;
+    int base_instance;
+} RenderItem;
+typedef struct RenderQueue_s {
+    int length;
+    int capacity;
+    RenderItem *items;
+    uint64_t *keys;
+    uint32_t *order; // After sorting, the item indices in draw order.
+    uint64_t *scratch_keys;
+    uint32_t *scratch_order;
+    // Per-instance model matrices for the instanced runs, uploaded when the queue is batched.
+    int num_instances;
+    int instances_capacity;
+    mat4x4 *instance_matrices;
+    GLuint instance_buffer;
+} RenderQueue;
+// If false, bodies are drawn in storage order with no queue, for comparison.
+extern bool g_render_queue;
+// Counts the calls to render, so that work can be shared within a frame.
+extern uint64_t g_render_frame;
+// If false, batching never forms instanced runs.
+extern bool g_render_instancing;
+// Runs of at least this many bodies with the same geometry and equivalent materials are drawn instanced,
+// if the material type has an instanced program.
+#define RENDER_INSTANCING_MIN_RUN 2
+// depth is in [0, 1], e.g. distance over the far plane distance.
+uint64_t render_key(RenderPass pass, Material *material, Geometry *geometry, float depth);
+void render_queue_clear(RenderQueue *queue);
+void render_queue_destroy(RenderQueue *queue);
+void render_queue_add(RenderQueue *queue, uint64_t key, Body *body, Material *material);
+void render_queue_sort(RenderQueue *queue);
+void render_queue_batch(RenderQueue *queue); // After sorting. Submitting without batching draws every item separately.
+void render_queue_submit(RenderQueue *queue, mat4x4 vp_matrix);
+
+/*--------------------------------------------------------------------------------
+    Frustum culling
+--------------------------------------------------------------------------------*/
+// The bodies' world-space bounding spheres, in flat arrays so they can be tested four at a time.
+typedef struct CullSpheres_s {
+    int length;
+    int capacity;
+    float *x;
+    float *y;
+    float *z;
+    float *r;
+    Body **bodies;
+    // Changes when the set of gathered static bodies (Body.is_static) changes, including when their geometry finishes loading.
+    uint32_t static_signature;
+} CullSpheres;
+// Normalized planes, with inward normals.
+typedef struct Frustum_s {
+    float nx[6];
+    float ny[6];
+    float nz[6];
+    float d[6];
+} Frustum;
+#define MAX_NUM_CULL_VIEWS 64
+#define CULL_VIEW_NAME_LENGTH 47
+typedef struct CullView_s {
+    char name[CULL_VIEW_NAME_LENGTH + 1];
+    Frustum frustum;
+    // The bodies which passed the last run.
+    int num_visible;
+    int visible_capacity;
+    Body **visible;
+    // Statistics, summed over every run.
+    uint64_t runs;
+    uint64_t tested;
+    uint64_t passed;
+} CullView;
+// If false, views pass every body, for comparison.
+extern bool g_frustum_culling;
+// Gathered once per frame, before the views are culled.
+extern CullSpheres g_cull_spheres;
+void cull_gather_bodies(CullSpheres *spheres);
+Frustum frustum_from_matrix(mat4x4 matrix);
+bool frustum_sphere_visible(Frustum *frustum, vec3 center, float radius);
+// Find or create the view with this name.
+CullView *cull_view(char *name);
+// visible_only: Skip bodies with visible = false (shadow casters are drawn whether or not they are visible).
+void cull_view_run(CullView *view, mat4x4 vp_matrix, CullSpheres *spheres, bool visible_only);
+void cull_print_stats(FILE *file);
+
 /*--------------------------------------------------------------------------------
     Shadows
 --------------------------------------------------------------------------------*/
 #define SHADOW_MAP_TEXTURE_WIDTH 4096
 #define SHADOW_MAP_TEXTURE_HEIGHT 4096
+// What was last drawn into a segment's quadrant of a shadow map.
+typedef struct ShadowSegmentCache_s {
+    bool valid;
+    uint64_t frame;         // The g_render_frame it was drawn in. Cameras drawing the same segment in a frame share it.
+    mat4x4 shadow_matrix;
+    mat4x4 light_matrix;
+    // For segments which cache static depth: the camera it is kept for, the static bodies (CullSpheres.static_signature)
+    // and where the camera was when they were drawn, and the box they were drawn into.
+    bool static_valid;
+    Camera *static_camera;
+    uint64_t static_frame;  // The last g_render_frame the static camera drew the segment in.
+    uint32_t static_signature;
+    vec3 camera_position;
+    vec3 camera_forward;
+    vec3 box_corners[2];
+} ShadowSegmentCache;
+// Segments from this one on (the distant ones) keep the depth of static bodies (Body.is_static) in a separate texture,
+// and only redraw it when the camera has moved past a fraction of the segment's length or turned past an angle (in radians),
+// or the light has changed, or static bodies have been added or removed. Each frame the static depth is copied into the quadrant
+// and the dynamic casters are drawn on top.
+// There is one static depth texture per shadow map, so it is kept for one camera at a time. Other cameras drawing the segment
+// in the same frame draw all of the casters without it. If the camera stops drawing the segment, the next camera to draw it takes the cache.
+#define SHADOW_CACHE_FIRST_SEGMENT 2
+#define SHADOW_CACHE_MOVE_FRACTION 0.1
+#define SHADOW_CACHE_TURN_ANGLE 0.08
+extern bool g_shadow_caching;
+typedef struct ShadowStats_s {
+    uint64_t segments_drawn;
+    uint64_t segments_shared; // Skipped, since another camera had drawn them this frame.
+    uint64_t static_refreshes;
+    uint64_t static_reuses;
+} ShadowStats;
+extern ShadowStats g_shadow_stats;
+void shadow_print_stats(FILE *file);
+
 // Currently only doing directional light shadows.
 typedef struct ShadowMap_s {
     GLuint framebuffer;
     GLuint depth_texture;
     GLuint color_texture;
+    GLuint static_framebuffer;
+    GLuint static_depth_texture;
+    ShadowSegmentCache segments[NUM_FRUSTUM_SEGMENTS];
     // For debugging purposes, the shadow map keeps a resource handle for a material which has the depth texture attached.
     // This won't be destroyed, and can be used to render the depth map to a quad.
     ResourceHandle depth_texture_material; // Resource: Material
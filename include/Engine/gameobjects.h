@@ -92,6 +92,7 @@ ASPECT_PROPERTIES()
     ResourceHandle material; /* Resource: Material */
     ResourceHandle geometry; /* Resource: Geometry */
     bool is_ground;
+    bool is_static; // A promise that the body won't move, so that its shadows can be cached.
 } Body;
 void Body_init(Body *body, char *material_path, char *mesh_path);
 float Body_radius(Body *body);
@@ -275,6 +276,10 @@ ASPECT_PROPERTIES()
 void Text_bake(Text *text);
 void Text_init(Text *text, TextType type, char *font_path, char *string, float scale);
 void Text_set(Text *text, char *string);
+// For text which changes every frame. The geometry goes into the frame ring (see gm_done_frame) instead of buffers of its own
+// (unless the ring is full, when it is freed by the next Text_set_frame or Text_bake),
+// so it is only valid for this frame, and the text must be set each frame before rendering, e.g. from a Logic update.
+void Text_set_frame(Text *text, char *string);
 void Text_render(mat4x4 matrix, Text *text);
 
 //--------------------------------------------------------------------------------
@@ -0,0 +1,64 @@
+#ifndef HEADER_DEFINED_SCENE_BVH
+#define HEADER_DEFINED_SCENE_BVH
+
+/*================================================================================
+    Scene bounding volume hierarchy.
+================================================================================*/
+// A binary BVH over the bodies' world-space bounding spheres (the same as frustum culling uses), built with a binned
+// surface-area heuristic. Bodies which move are handled by refitting the boxes, and the tree is rebuilt when the
+// set of bodies changes or refitting has made it too loose.
+// Leaves hold ranges of the bodies array. Internal nodes have count = 0, and their children are at first and first + 1.
+typedef struct SceneBVHNode_s {
+    float min[3];
+    int32_t first;
+    float max[3];
+    int32_t count;
+} SceneBVHNode;
+typedef struct SceneBVH_s {
+    int num_nodes;
+    int nodes_capacity;
+    SceneBVHNode *nodes;
+    int num_bodies;
+    int bodies_capacity;
+    Body **bodies; // In leaf order.
+    int *sphere_indices; // Where each body was in the CullSpheres it was built from, for refitting.
+    vec3 *centers;
+    float *radii;
+    int depth;
+    float built_area; // The root's surface area when built, to tell how much refitting has loosened the tree.
+} SceneBVH;
+#define SCENE_BVH_LEAF_SIZE 4
+#define SCENE_BVH_NUM_BINS 16
+// Rebuild rather than refit when the root has grown by this factor in surface area since the build.
+#define SCENE_BVH_REBUILD_GROWTH 2.0
+// If true, the cull views traverse g_scene_bvh instead of testing every sphere.
+extern bool g_scene_bvh_culling;
+extern SceneBVH g_scene_bvh;
+
+void scene_bvh_build(SceneBVH *bvh, CullSpheres *spheres);
+// Refit to the spheres gathered this frame. Returns false if the bodies have changed, so that it needs rebuilding.
+bool scene_bvh_refit(SceneBVH *bvh, CullSpheres *spheres);
+// Refit, or rebuild if the bodies have changed or the tree has become too loose. Returns true if rebuilt.
+bool scene_bvh_update(SceneBVH *bvh, CullSpheres *spheres);
+void scene_bvh_destroy(SceneBVH *bvh);
+
+// Batched queries. Up to 32 queries are traversed together, so nodes which fail every query are visited once.
+// visit is called for each body whose bounding sphere passes a query, with the index of that query.
+typedef void (*SceneBVHVisit)(Body *body, int query_index, void *data);
+void scene_bvh_query_frustums(SceneBVH *bvh, int num_frustums, Frustum *frustums, SceneBVHVisit visit, void *data);
+void scene_bvh_query_aabbs(SceneBVH *bvh, int num_boxes, vec3 *box_mins, vec3 *box_maxs, SceneBVHVisit visit, void *data);
+
+// Ray queries find the nearest body along each ray. Without a hit test this is the nearest bounding sphere, otherwise
+// the hit test is called on bodies whose sphere the ray passes through, nearest first, and gives the exact distance.
+// Distances are in units of the direction vector, which need not be normalized.
+typedef bool (*SceneBVHHitTest)(Body *body, vec3 origin, vec3 direction, float *t, void *data);
+typedef struct SceneRayHit_s {
+    Body *body; // NULL if nothing was hit.
+    float t;
+} SceneRayHit;
+void scene_bvh_raycast(SceneBVH *bvh, int num_rays, vec3 *origins, vec3 *directions, SceneRayHit *hits, SceneBVHHitTest hit_test, void *data);
+// Mouse picking: the nearest body under the screen point (as given to Camera_ray). This updates g_scene_bvh to where the
+// bodies are now, so it shouldn't be called while rendering.
+Body *Camera_pick(Camera *camera, float x, float y, SceneBVHHitTest hit_test, void *data);
+
+#endif // HEADER_DEFINED_SCENE_BVH
@@ -85,6 +85,7 @@ stuff.dd
 // AST
 struct DictExpression_s;
 struct EntryNode_s;
+struct DataDictionary_s;
 typedef struct DictExpression_s {
     struct DictExpression_s *next;
     bool is_name;
@@ -104,31 +105,62 @@ typedef struct EntryNode_s {
     struct DictExpression_s *dict_expression;
 } EntryNode;
 // Dictionary tables (hash table where dictionaries are masked together)
+#define DD_VALUE_MAX_SIZE 16 // size of the largest pre-parsed value type (vec4, ivec4).
 typedef struct DictionaryTableCell_s {
     int name; // -1: empty cell.
+    uint32_t hash; // hash of the name, compared before the names are.
     union {
         struct {
             int32_t type;
             int32_t value_text;
+            // Typed values are parsed when they are masked, so queries just copy out the data.
+            uint8_t data[DD_VALUE_MAX_SIZE];
+            int16_t type_id; // index of the type reader, -1 if there is none.
+            bool parsed;
         } value;
         struct {
             DictExpression *dict_expression;
             int num_types;
             int *types; //dynamic array, consisting of all names of named dictionaries in expanded dict-expression.
+            struct DataDictionary_s *opened; // The resolved dictionary, if it is currently open. Repeated opens share this.
+            // A compiled image can hold the already resolved table of this dictionary, see dd_compile.
+            struct DictionaryTableCell_s *prebuilt_table;
+            int prebuilt_table_size;
+            int prebuilt_num_entries;
         } dict;
     } contents;
     bool is_dict;
 } DictionaryTableCell;
 typedef struct DataDictionary_s {
-    // Be careful when allocating memory for this "variable-size struct".
-    int table_size;
+    // The table is resized while masking, keeping the load factor below DD_TABLE_MAX_LOAD. After the dictionary is resolved it
+    // doesn't change, so opened subdictionaries can point to their cell.
+    int table_size; // power of two.
+    int num_entries;
     struct DataDictionary_s *parent_dictionary; // for scoping.
+    // Opened dictionaries are cached in the cell of their parent they were resolved from, and are shared
+    // until the last reference is released with dd_close.
+    int refcount;
+    DictionaryTableCell *parent_cell;
+    // Named dictionaries masked in when resolving this one. These are held open so that, for example, a thousand
+    // instances of the same prefab only resolve the prefab once.
+    int num_bases;
+    int bases_size;
+    struct DataDictionary_s **bases;
     DictionaryTableCell *table;
-    DictionaryTableCell ___table;
+    // If mapped, the table (and the expressions and types in its cells) are in a compiled image and are not freed.
+    // The root dictionary of an image holds the mapping.
+    bool mapped;
+    void *image;
+    size_t image_size;
 } DataDictionary;
 
 // Open a dictionary from an actual path, e.g. a .dd file.
+// If there is an up-to-date compiled image of a .dd file next to it (the path with a "b" appended, e.g. Engine.ddb),
+// that is mapped instead of parsing the text. A .ddb path can also be given directly.
 DataDictionary *dd_fopen(char *path);
+// Compile a .dd file (and the files it includes) into an image which can be mapped by dd_fopen. The tables of subdictionaries
+// are resolved ahead of time up to prebuilt_depth levels below the root.
+bool dd_compile(char *path, char *ddb_path, int prebuilt_depth);
 
 //--- Possibly shouldn't have this here. But it is useful for debugging.
 //The actual printing should probably not show the hash-table data structure.
@@ -136,13 +168,17 @@ void dd_print_table(DataDictionary *dict_table);
 
 // The proper printing utility for users.
 void dd_print(DataDictionary *dd);
+// Print the table load and probe lengths.
+void dd_stats(DataDictionary *dd);
 
-// Open a subdictionary.
+// Open a subdictionary. Each open takes a reference to the dictionary, which should be released with dd_close.
 DataDictionary *dd_open(DataDictionary *dict, char *name);
+void dd_close(DataDictionary *dict);
 // Query for a value.
 bool dd_get(DataDictionary *dict, char *name, char *type, void *data);
 
 // Scan for dictionaries matching a type string in a given dictionary. Similar to C library's scandir.
+// Each scanned dictionary is opened, so should be closed, and the array freed.
 int dd_scan(DataDictionary *dd, DataDictionary ***scanned, const char *type_string);
 
 
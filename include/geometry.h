@@ -152,6 +152,8 @@ bool ray_rectangle_plane_coordinates(vec3 origin, vec3 direction, vec3 tl, vec3
 bool ray_rectangle_coordinates(vec3 origin, vec3 direction, vec3 tl, vec3 bl, vec3 br, vec3 tr, float *x, float *y);
 bool ray_rectangle_intersection(vec3 origin, vec3 direction, vec3 tl, vec3 bl, vec3 br, vec3 tr, vec3 *intersection);
 bool ray_sphere_intersection(vec3 origin, vec3 direction, vec3 center, float radius, vec3 *intersection);
+// Many rays against one mesh should go through a triangle BVH instead of testing every triangle.
+#include "triangle_bvh.h"
 
 /*================================================================================
     Testing utilities.
@@ -73,5 +73,6 @@
 /* } */
 
 uint32_t hash_crc32(char *string);
+uint32_t hash_mix32(uint32_t h);
 
 #endif // HEADER_DEFINED_HELPER_DEFINITIONS
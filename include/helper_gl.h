@@ -4,6 +4,9 @@
 #ifndef HEADER_DEFINED_HELPER_GL
 #define HEADER_DEFINED_HELPER_GL
 #include <GLFW/glfw3.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 // Got this just from checking, --- get the actual ratio
 #define SCREEN_ASPECT_RATIO 0.5615835777126099
@@ -21,5 +24,47 @@ GLFWwindow *gl_core_standard_window(char *name, void (*init_function)(void), voi
 /* double dt(void); */
 void loop_time(GLFWwindow *window, void (*inner_func)(void), GLbitfield clear_mask);
 
+//================================================================================
+// GL dispatch
+//================================================================================
+// The gl* functions are pointers loaded by glad. Instead of the driver's functions these can be
+// no-ops, so the engine can run headless, and either can be wrapped to count what the renderer does.
+typedef enum GLDispatchBackend_e {
+    GL_DISPATCH_NATIVE, // Needs a current context.
+    GL_DISPATCH_NULL,
+} GLDispatchBackend;
+void gl_dispatch_load(GLDispatchBackend backend);
+GLDispatchBackend gl_dispatch_backend(void);
+void gl_dispatch_record(void);
+bool gl_dispatch_recording(void);
+
+typedef struct GLDispatchStats_s {
+    uint64_t frames;
+    uint64_t draw_calls;
+    uint64_t instances;
+    uint64_t vertices;                // Vertices or indices drawn, over all instances.
+    uint64_t clears;
+    uint64_t state_changes;           // Program, texture, VAO, buffer, framebuffer and fixed-function state.
+    uint64_t redundant_state_changes; // Those which set what was already set (where this is tracked).
+    uint64_t program_changes;
+    uint64_t texture_changes;
+    uint64_t vao_changes;
+    uint64_t buffer_changes;
+    uint64_t uniform_uploads;         // Loose uniforms, not shader blocks.
+    uint64_t bytes_uploaded;          // Buffer data, texture images, and loose uniforms.
+    uint64_t bytes_allocated;         // Buffer and texture storage, whether or not it was given data.
+    uint64_t objects_created;
+    uint64_t objects_deleted;
+} GLDispatchStats;
+void gl_dispatch_end_frame(void);
+GLDispatchStats gl_dispatch_stats(void);
+void gl_dispatch_reset_stats(void);
+void gl_dispatch_print_stats(FILE *file);
+// Compare the frames, draw_calls, state_changes and objects_created totals with those in a file of "name value" lines,
+// printing any which differ. A missing file counts as a mismatch.
+bool gl_dispatch_check_stats(char *path);
+// Write these totals to a file, to be kept as the expected values.
+void gl_dispatch_write_stats(char *path);
+
 
 #endif // HEADER_DEFINED_HELPER_GL
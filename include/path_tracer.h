@@ -0,0 +1,99 @@
+#ifndef HEADER_DEFINED_PATH_TRACER
+#define HEADER_DEFINED_PATH_TRACER
+/*================================================================================
+    CPU path tracer.
+================================================================================*/
+// Renders a scene of instanced triangle meshes with diffuse path tracing, without a GPU, for reference images and
+// for stress-testing the geometry code.
+// The image is split into tiles, which a pool of threads take in turn. Each call to path_tracer_render adds samples
+// to every pixel, and these are accumulated until the camera or scene changes, so the image converges progressively.
+//
+//     PTScene scene;
+//     pt_scene_init(&scene);
+//     PTMesh *mesh = pt_mesh_create(num_vertices, positions, NULL, num_triangles, triangles);
+//     pt_scene_add(&scene, mesh, Transform_matrix(transform), new_vec3(0.8,0.8,0.8), vec3_zero());
+//     PathTracer pt;
+//     path_tracer_init(&pt, &scene, 640, 360);
+//     path_tracer_set_camera(&pt, camera_matrix, 0.5);
+//     for (int i = 0; i < 64; i++) path_tracer_render(&pt, 4);
+//     path_tracer_write_png(&pt, "render.png");
+#include <stdbool.h>
+#include <stdint.h>
+#include "matrix_mathematics.h"
+#include "triangle_bvh.h"
+
+// A mesh can be instanced any number of times. The arrays are copied, and normals are optional (NULL gives flat shading).
+typedef struct PTMesh_s {
+    int num_vertices;
+    float *positions;
+    float *normals;
+    int num_triangles;
+    uint32_t *triangles;
+    TriangleBVH bvh;
+    float box_min[3];
+    float box_max[3];
+} PTMesh;
+PTMesh *pt_mesh_create(int num_vertices, float *positions, float *normals, int num_triangles, uint32_t *triangles);
+void pt_mesh_destroy(PTMesh *mesh);
+
+// Instances place a mesh by an affine matrix (e.g. from Transform_matrix), with a diffuse albedo and an emitted radiance.
+typedef struct PTInstance_s {
+    PTMesh *mesh;
+    mat4x4 matrix;
+    mat4x4 inverse_matrix;
+    vec3 albedo;
+    vec3 emission;
+    float box_min[3]; // World-space bounds.
+    float box_max[3];
+} PTInstance;
+// Rays which leave the scene take their radiance from a sky, blended from the horizon to the zenith (+y).
+typedef struct PTScene_s {
+    int num_instances;
+    int instances_capacity;
+    PTInstance *instances;
+    vec3 sky_horizon;
+    vec3 sky_zenith;
+} PTScene;
+void pt_scene_init(PTScene *scene);
+// Returns the instance index.
+int pt_scene_add(PTScene *scene, PTMesh *mesh, mat4x4 matrix, vec3 albedo, vec3 emission);
+// Instances can be moved (e.g. following their Transform). This doesn't reset any accumulated images.
+void pt_scene_set_matrix(PTScene *scene, int instance, mat4x4 matrix);
+// This doesn't destroy the meshes, which may be shared.
+void pt_scene_destroy(PTScene *scene);
+
+#define PATH_TRACER_TILE_SIZE 32
+#define PATH_TRACER_MAX_THREADS 64
+#define PATH_TRACER_MAX_BOUNCES 8
+// Paths are randomly terminated after this many bounces (Russian roulette), in proportion to their throughput.
+#define PATH_TRACER_ROULETTE_BOUNCES 3
+typedef struct PathTracer_s {
+    PTScene *scene;
+    int width;
+    int height;
+    int num_threads; // 0 (the default) uses one per core.
+    int max_bounces;
+    // The camera looks down its -z axis, as Camera does, and half_width is the tangent of half the horizontal field of view.
+    mat4x4 camera_matrix;
+    float half_width;
+    // Sums of the samples of each pixel, as RGB.
+    float *accumulation;
+    int num_samples;
+    // Counts for benchmarking, over all of the renders.
+    uint64_t num_rays;
+    double render_time;
+} PathTracer;
+void path_tracer_init(PathTracer *pt, PTScene *scene, int width, int height);
+void path_tracer_destroy(PathTracer *pt);
+// Setting the camera discards the accumulated samples.
+void path_tracer_set_camera(PathTracer *pt, mat4x4 camera_matrix, float half_width);
+void path_tracer_reset(PathTracer *pt);
+// Add samples_per_pixel samples to every pixel.
+void path_tracer_render(PathTracer *pt, int samples_per_pixel);
+// The average of the samples, clamped and gamma-encoded, as 8-bit RGB rows from the top.
+void path_tracer_resolve(PathTracer *pt, uint8_t *rgb);
+// The average of the samples at a pixel, in linear radiance.
+vec3 path_tracer_pixel(PathTracer *pt, int x, int y);
+bool path_tracer_write_png(PathTracer *pt, char *path);
+
+#endif // HEADER_DEFINED_PATH_TRACER
@@ -45,6 +45,12 @@ end_header
 #include <stdint.h>
 #include <stdbool.h>
 
+// Debug output of the PLY module is compiled out unless PLY_DEBUG is defined nonzero, e.g. with CFLAGS=-DPLY_DEBUG=1.
+#ifndef PLY_DEBUG
+#define PLY_DEBUG 0
+#endif
+#define ply_debug(...) do { if (PLY_DEBUG) printf(__VA_ARGS__); } while (0)
+
 typedef uint8_t PLYFormat;
 enum PLY_FORMATS { // do not shuffle these!
     PLY_FORMAT_NONE,
@@ -89,6 +95,11 @@ typedef struct PLYElement_s {
      * to an array of locations of [count] length, the locations as offsets of the i'th property at i.
      */
     size_t **property_offsets;
+    /* If none of the properties are lists, every entry has the same size. Then property_offsets is left NULL,
+     * and the data of the k'th property of the i'th entry is at offset + i*stride + property_stride_offsets[k].
+     */
+    size_t stride;
+    size_t *property_stride_offsets;
 } PLYElement;
 typedef struct PLY_s {
     PLYFormat format;
@@ -137,13 +148,46 @@ PLY *read_ply(FILE *file);
 //================================================================================
 // Data extraction
 //================================================================================
+// Decode the body of an ASCII, binary_little_endian or binary_big_endian file into ply->data.
+// This is done by ply_get if it hasn't been already.
 void ply_get_binary_data(FILE *file, PLY *ply);
+// Large ASCII bodies (by ply_get_binary_data and ply_get_many) are parsed by this many threads, one share of the lines
+// of each element each. 0, the default, uses a thread per core, and 1 always parses serially.
+void ply_set_num_threads(int num_threads);
 
 //================================================================================
 // Querying
 //================================================================================
 PLYQuery *read_ply_query(char *query_string);
 void *ply_get(FILE *file, PLY *ply, char *query_string, int *num_entries);
+/* Several single-element queries can be answered with one pass over the file, each packed into its own array
+ * laid out as by ply_get. The arrays are sized from the element counts and returned in data, or data can be set
+ * beforehand to fill an array of that size. List properties are packed without their counts, and every entry
+ * must have list_length values, e.g. "[face]: list int vertex_indices" with list_length 3 for triangles.
+ */
+typedef struct PLYRequest_s {
+    char *query_string;
+    int list_length;
+    // Filled by ply_get_many.
+    void *data;
+    int num_entries;
+} PLYRequest;
+void ply_get_many(FILE *file, PLY *ply, int num_requests, PLYRequest *requests);
+// The matching of requests against a header layout is cached (see ply.c). This frees the cached query plans.
+void ply_clear_query_plans(void);
+/* A cursor streams the entries of one queried element in batches of up to batch_size records, packed as by ply_get_many,
+ * reading the file through a bounded window so that files larger than memory can be processed.
+ *     PLYCursor *cursor = ply_cursor_open(file, ply, "[vertex]: float x, float y, float z", 0, 65536);
+ *     int n;
+ *     float *xyz;
+ *     while ((xyz = ply_cursor_next(cursor, &n)) != NULL) { ... }
+ *     ply_cursor_close(cursor);
+ * The returned records are overwritten by the next batch.
+ */
+typedef struct PLYCursor_s PLYCursor;
+PLYCursor *ply_cursor_open(FILE *file, PLY *ply, char *query_string, int list_length, int batch_size);
+void *ply_cursor_next(PLYCursor *cursor, int *num_records);
+void ply_cursor_close(PLYCursor *cursor);
 // Search through the PLY object
 void *ply_get_element(PLY *ply, char *element_name);
 void *ply_get_property(PLYElement *element, char *property_name);
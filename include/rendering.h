@@ -13,6 +13,8 @@
 // note: It may be a convenient dependency to have the matrix types in this module. If arithmetic isn't done with them,
 // then this will just require a header include.
 #include "matrix_mathematics.h"
+// Meshes can be ray-queried through a triangle BVH, which only needs the vector types.
+#include "triangle_bvh.h"
 
 /*--------------------------------------------------------------------------------
     Resources
@@ -245,6 +247,10 @@ typedef struct /* Resource */ MaterialType_s {
 
     GraphicsProgramType program_type;
     GLuint program_id;
+    // Optionally, a variant of the program whose vertex shader takes a per-instance model matrix,
+    // so that many bodies using the same geometry and material can be drawn in one instanced draw call.
+    ResourceHandle instanced_vertex_shader;
+    GLuint instanced_program_id; // 0 if the material type has no instanced variant.
 
     // A material-type can force geometry it is used to render to be interpreted as patch data.
     bool force_patches;
@@ -300,8 +306,7 @@ static char *ShaderBlockSamplerNames_MaterialProperties[] = { };
 // MeshData is the application-level data for triangle meshes, intended for standard
 // mesh+material pair rendering.
 // --- Right now a PLY upload looks like this:
-// ---      - Read into some queried format
-// ---      - Format into a MeshData
+// ---      - Decode the queried properties straight into a MeshData (ply_get_many)
 // ---      - Pass into geometry specifying stuff
 // ---      - That passes it into vram
 // ---      This is too many copies ...
@@ -321,6 +326,17 @@ void MeshData_calculate_uv_orthographic(MeshData *mesh_data, vec3 direction, flo
 void MeshData_calculate_tangents(MeshData *mesh_data);
 // Debugging and visualization.
 void MeshData_draw_wireframe(MeshData *mesh, mat4x4 matrix, vec4 color, float line_width);
+// Ray queries, in the mesh's own coordinates. MeshData is often a temporary, so the BVH is not kept in it, and should be
+// built once with MeshData_build_bvh and kept alongside (it doesn't reference the MeshData after being built).
+typedef struct MeshRayHit_s {
+    uint32_t triangle;
+    float t;
+    vec3 barycentric;
+    vec3 position;
+    vec3 normal; // Interpolated if the mesh has vertex normals, otherwise the triangle's normal.
+} MeshRayHit;
+void MeshData_build_bvh(MeshData *mesh_data, TriangleBVH *bvh);
+bool MeshData_raycast(MeshData *mesh_data, TriangleBVH *bvh, vec3 origin, vec3 direction, MeshRayHit *hit);
 
 extern ResourceType Geometry_RTID;
 typedef struct /* Resource */ Geometry_s {
@@ -335,6 +351,17 @@ typedef struct /* Resource */ Geometry_s {
     int num_vertices;
     float radius;
     int patch_vertices; // meaningful only if primitive_type is Patches.
+    // Geometry from gm_done_frame is in the frame ring rather than buffers of its own, at these byte offsets,
+    // and shares vao_id with all frame geometry of its vertex format.
+    bool transient;
+    uint32_t attribute_offsets[NUM_ATTRIBUTE_TYPES];
+    uint32_t indices_offset;
+    // Quantized geometry (from upload_mesh_quantized) has all of its attributes interleaved in one buffer, in packed encodings.
+    // Positions are 16-bit fractions of the bounding box, and decode to quantization_offset + quantization_scale * fraction.
+    bool quantized;
+    GLuint vertex_buffer_id;
+    vec3 quantization_offset;
+    vec3 quantization_scale;
 
     MeshData *mesh_data; // if this is null, it has been freed from application memory. This is the default.
 } Geometry;
@@ -342,10 +369,27 @@ typedef struct /* Resource */ Geometry_s {
 // This is for instancing and file-backed mesh rendering.
 // Really need to think more about "virtual resources" and if any of this makes sense.
 void Geometry_load(void *resource, char *path);
+void Geometry_unload(void *resource);
+size_t Geometry_bytes(void *resource);
+// Asynchronous loading stages.
+void *Geometry_request(char *path);
+void Geometry_prepare(void *job);
+void Geometry_upload(void *resource, void *job);
 Geometry upload_mesh(MeshData *mesh_data);
+// Upload with the attributes interleaved and packed: positions as 16-bit fractions of the bounding box, normals and tangents
+// octahedral-encoded in two 16-bit components, UV coordinates as half floats, and colors as RGBA8. The shaders decode
+// these with the entries of Standard3D (see glsl/shader_blocks/VertexDecoding.glh).
+Geometry upload_mesh_quantized(MeshData *mesh_data);
+// The bytes per vertex in the quantized layout.
+size_t quantized_vertex_size(VertexFormat vertex_format);
 
 #define GM_ATTRIBUTE_BUFFER_SIZE (1024*1024)
 #define GM_INDEX_BUFFER_SIZE (1024*1024)
+// Geometry which lasts for a frame is suballocated from a persistently mapped ring buffer, with one region per frame in flight.
+#define GM_FRAME_RING_FRAMES 3
+#define GM_FRAME_RING_SIZE (GM_FRAME_RING_FRAMES * 8*1024*1024)
+#define GM_FRAME_RING_ALIGNMENT 16
+#define GM_FRAME_RING_MAX_VERTEX_FORMATS 32
 
 uint32_t attribute_1u(AttributeType attribute_type, uint32_t u);
 uint32_t attribute_2f(AttributeType attribute_type, float a, float b);
@@ -355,10 +399,34 @@ void gm_index(uint32_t index);
 void gm_index_buf(uint32_t *indices, int count);
 void gm_triangles(VertexFormat vertex_format);
 Geometry gm_done(void);
+// Complete the specification into the frame ring. The geometry can be drawn until gm_frame_end.
+// gm_free must still be called on it: if the ring is full or the context can't map it, this gives ordinary geometry with
+// buffers of its own. For geometry in the ring, gm_free does nothing.
+Geometry gm_done_frame(void);
+// Called by the engine after each frame's draws, to fence that frame's region of the ring.
+void gm_frame_end(void);
 void gm_draw(Geometry geometry, Material *material);
 void gm_lines(VertexFormat vertex_format);
 void gm_free(Geometry geometry);
 
+// Drawing a run of Geometry+Material pairs (e.g. from a sorted render queue) can skip binding the program, textures,
+// and vertex array when the last draw already bound them. A GMDrawState remembers what the draws made with it have bound,
+// so it must be reset before the run, and is only valid while nothing else touches that GL state.
+#define GM_DRAW_STATE_MAX_TEXTURE_UNITS 32
+typedef struct GMDrawState_s {
+    GLuint program;
+    GLuint vao;
+    Material *material; // The material whose properties are in the MaterialProperties block.
+    GLuint textures[GM_DRAW_STATE_MAX_TEXTURE_UNITS];
+} GMDrawState;
+void gm_draw_state_reset(GMDrawState *state);
+void gm_draw_state(Geometry geometry, Material *material, GMDrawState *state);
+// Instanced drawing. The instance buffer holds a mat4x4 model matrix per instance, and num_instances of these
+// starting at base_instance are fed to the instanced variant of the material type's program at INSTANCE_MATRIX_ATTRIBUTE_LOCATION.
+// The matrix takes four attribute locations, one per column.
+#define INSTANCE_MATRIX_ATTRIBUTE_LOCATION 8
+void gm_draw_instanced_state(Geometry geometry, Material *material, GLuint instance_buffer, int base_instance, int num_instances, GMDrawState *state);
+
 /*--------------------------------------------------------------------------------
 Loading stuff. Possibly should be outside of this module, but since a mesh loading
 function explicitly accounts for possible ways to compile a mesh asset, these
@@ -381,12 +449,71 @@ typedef struct ImageData_s {
 extern ResourceType Texture_RTID;
 typedef struct /* Resource */ Texture_s {
     GLuint texture_id;
+    uint32_t width;
+    uint32_t height;
 } Texture;
 void Texture_load(void *resource, char *path);
+void Texture_unload(void *resource);
+size_t Texture_bytes(void *resource);
+// Asynchronous loading stages.
+void *Texture_request(char *path);
+void Texture_prepare(void *job);
+void Texture_upload(void *resource, void *job);
+Texture *placeholder_texture(void);
 
 //---May be better somewhere else.
 bool load_image_png(ImageData *image_data, FILE *file);
 
+/*--------------------------------------------------------------------------------
+    Conditioned asset blobs
+--------------------------------------------------------------------------------
+Geometry and Texture resources can be "conditioned" offline (with tools/condition_assets) into binary blobs
+which are very close to what the loaders make before vram upload, so loading one is just an mmap.
+The blob is stored next to the source asset, e.g.
+    Meshes/models/bunny.ply.Geometry.bin
+    Images/dirt.png.Texture.image
+The header records a hash of the source file's size and modification time and of the manifest entries
+which affect the conditioned data. If the blob is missing, from another version, or the hash is stale, the
+loaders fall back to loading from the source asset.
+All offsets are from the start of the blob, and data is aligned to ASSET_BLOB_ALIGNMENT.
+--------------------------------------------------------------------------------*/
+#define ASSET_BLOB_VERSION 1
+#define ASSET_BLOB_ALIGNMENT 16
+#define GEOMETRY_BLOB_MAGIC "GEOMBLOB"
+#define TEXTURE_BLOB_MAGIC "TEXBLOB"
+typedef struct AssetBlobHeader_s {
+    char magic[8];
+    uint32_t version;
+    uint32_t source_hash;
+    uint64_t size; // Total size of the blob.
+} AssetBlobHeader;
+typedef struct GeometryBlob_s {
+    AssetBlobHeader header;
+    uint32_t vertex_format;
+    uint32_t num_vertices;
+    uint32_t num_triangles;
+    float radius;
+    uint64_t attribute_offsets[NUM_ATTRIBUTE_TYPES]; // 0 if not in the vertex format.
+    uint64_t triangles_offset;
+} GeometryBlob;
+typedef struct TextureBlob_s {
+    AssetBlobHeader header;
+    uint32_t width;
+    uint32_t height;
+    uint32_t external_format;
+    uint32_t external_type;
+    uint64_t data_offset;
+    uint64_t data_size;
+} TextureBlob;
+uint32_t asset_source_hash(const char *source_path, const void *parameters, size_t parameters_size);
+void *asset_blob_map(char *source_path, char *suffix, const char *magic, uint32_t source_hash, size_t *size);
+void asset_blob_unmap(void *blob, size_t size);
+FILE *asset_blob_create(char *source_path, char *suffix);
+void asset_blob_pad(FILE *file);
+// Condition a resource, returning false if its blob was already fresh.
+bool Geometry_condition(char *path);
+bool Texture_condition(char *path);
+
 /*--------------------------------------------------------------------------------
     Fonts (implemented with signed distance fields for vector rendering with low resolution glyph textures).
 --- This may be better separated.
@@ -426,6 +553,11 @@ void material_set_texture(Material *material, char *texture_name, ResourceHandle
 //////////////////////////////////////////////////////////////////////////////////
 // working on
 void material_prepare(Material *material);
+void material_prepare_state(Material *material, GMDrawState *state); // Skips what the state says is already bound. state can be NULL.
+void material_prepare_program_state(Material *material, GLuint program_id, GMDrawState *state); // e.g. for the instanced program.
+// Materials are usually distinct instances (e.g. from Material_create), so these compare what they bind, rather than the pointers.
+bool material_equivalent(Material *a, Material *b);
+uint32_t material_hash(Material *material);
 
 GLenum gl_shader_type(ShaderType shader_type);
 
@@ -37,19 +37,36 @@ typedef struct ResourceID_s {
 /*--------------------------------------------------------------------------------
     The global resource table 
 --------------------------------------------------------------------------------
-Active resource information is stored in a global resource table (implemented as a chaining hash table).
+Active resource information is stored in a global resource table (implemented as a growable
+open-addressing hash table, with Robin Hood insertion).
 The entries contain a magic number ("uuid") for validating resource lookups,
 a type for type-checking, and a pointer to the actual resource.
+
+Each entry is also stamped with a generation number, unique to that load of the resource. A handle
+which has been resolved caches the slot its resource was found in along with this generation, so
+further dereferences only need to check that the slot still holds the same generation. Entries can
+move when the table grows or when Robin Hood insertion displaces them, in which case the check fails
+and the handle falls back to a hash lookup and re-caches.
 --------------------------------------------------------------------------------*/
-#define RESOURCE_TABLE_START_SIZE 1024
+#define RESOURCE_TABLE_START_SIZE 1024 // This must be a power of two.
+typedef enum ResourceState_e {
+    RESOURCE_UNLOADED, // Not in the table.
+    RESOURCE_LOADING,  // In the table, but the resource is still being loaded asynchronously.
+    RESOURCE_READY,
+} ResourceState;
 typedef struct ResourceTableEntry_s {
-    ResourceUUID uuid;
+    ResourceUUID uuid; // 0 if the slot is empty.
     ResourceType type;
-    // char *path;
+    uint32_t probe_length; // Distance from the entry's home slot.
+    uint32_t generation; // 0 if the slot is empty.
+    uint8_t state;
+    uint32_t refcount; // Number of resolved handles to this resource.
+    struct ResourceLRUNode_s *lru; // If not null, the resource is unreferenced and can be evicted.
     void *resource;
-    struct ResourceTableEntry_s *next; //This struct is an entry in a chaining hash table.
 } ResourceTableEntry;
-extern ResourceTableEntry g_resource_table[];
+extern ResourceTableEntry *g_resource_table;
+extern uint32_t g_resource_table_size;
+extern uint32_t g_resource_table_count;
 
 /*--------------------------------------------------------------------------------
     Resource handles and resource "dereferencing"
@@ -60,10 +77,18 @@ something that wants to use a resource holds a ResourceHandle. A collection
 of macros allows the user to "dereference" this resource handle, which behind
 the scenes may get the cached resource from the global table,
 or actually trigger a resource load.
+
+Resources are reference counted. A handle holds a reference from when it is first resolved until it is destroyed
+(handles are not meant to be copied around after being resolved, since they own their path anyway).
+Unreferenced resources stay loaded, but go onto a least-recently-used list for their type, and if the type is
+over its memory budget the least recently used are evicted (unloaded). The table entry stays, so a later reload is counted.
 --------------------------------------------------------------------------------*/
 typedef struct ResourceHandle_s {
     bool path_backed;
     ResourceID _id; //---should remove underscore.
+    // Cached location of the resource in the global resource table. A zero generation means the handle has not been resolved.
+    uint32_t _slot;
+    uint32_t _generation;
     union {
         // note: since path/resource memory is allocated, resource handles must be destroyed when the owner is destroyed/they are swapped.
         char *path; // for path-backed resources, for example ones that use the path to load the resource from a file.
@@ -89,6 +114,32 @@ void *___oneoff_resource(ResourceType resource_type, ResourceHandle *handle);
     ___oneoff_resource(( RESOURCE_TYPE_NAME ## _RTID ),\
                        &( RESOURCE_HANDLE ));
 
+/*--------------------------------------------------------------------------------
+    Asynchronous loading
+--------------------------------------------------------------------------------
+Resource types can opt in to being loaded in the background, by splitting their load function into three stages:
+    request: On the main thread. Read the manifest (the data dictionary system is not thread-safe) and return a "job" describing the load.
+    prepare: On an I/O thread. Do the slow part, reading files and decoding them (PNG decoding, PLY parsing, ...) into the job.
+    upload:  On the main thread. Finish the resource from the job, e.g. uploading to vram, then free the job.
+resource_prefetch(HANDLE) starts loading a resource without waiting for it. If async loading is switched on, then
+any dereference of an unloaded resource also starts an asynchronous load. While a resource is loading, dereferencing it gives
+the type's placeholder resource if it has one, otherwise it waits for the load to finish.
+
+Prepared jobs are queued for upload, and the application calls resource_upload_pending once a frame
+with a time budget. The upload queue is bounded, so the I/O threads will wait if the main thread falls behind.
+--------------------------------------------------------------------------------*/
+#define RESOURCE_NUM_IO_THREADS 2
+#define RESOURCE_UPLOAD_QUEUE_SIZE 32
+extern bool g_resource_async;
+void ___resource_prefetch(ResourceHandle *handle);
+ResourceState ___resource_state(ResourceHandle *handle);
+bool ___resource_ready(ResourceHandle *handle);
+#define resource_prefetch(HANDLE) ___resource_prefetch(&( HANDLE ))
+#define resource_state(HANDLE) ___resource_state(&( HANDLE ))
+// Returns whether the resource is ready to use. An unloaded resource is loaded, asynchronously if possible.
+#define resource_ready(HANDLE) ___resource_ready(&( HANDLE ))
+void resource_upload_pending(double budget_seconds);
+
 
 /*--------------------------------------------------------------------------------
     Resource types and the global resource type information array
@@ -109,6 +160,10 @@ use symbolic type names, because they expand to pass backend functions the globa
 
 typedef void (*ResourceLoadFunction)(void *, char *); // void *resource, char *path
 typedef void (*ResourceUnloadFunction)(void *); // void *resource
+typedef void *(*ResourceRequestFunction)(char *); // char *path, returns the job
+typedef void (*ResourcePrepareFunction)(void *); // void *job
+typedef void (*ResourceUploadFunction)(void *, void *); // void *resource, void *job
+typedef size_t (*ResourceBytesFunction)(void *); // void *resource, returns the number of bytes (including vram) it uses.
 
 typedef struct ResourceTypeInfo_s {
     ResourceType type; // Its type is being used as its index in the global resource type info array.
@@ -116,6 +171,21 @@ typedef struct ResourceTypeInfo_s {
     char name[MAX_RESOURCE_TYPE_NAME_LENGTH + 1];
     ResourceLoadFunction load;
     ResourceUnloadFunction unload;
+    // Optional asynchronous loading stages. If these are null the resource is always loaded synchronously.
+    ResourceRequestFunction request;
+    ResourcePrepareFunction prepare;
+    ResourceUploadFunction upload;
+    void *placeholder; // Optionally, dereferencing a resource which is still loading gives this.
+    // Memory budgeting. If budget is zero, unreferenced resources of this type are never evicted.
+    ResourceBytesFunction bytes; // If this is null, the size of the resource structure is used.
+    size_t budget;
+    size_t bytes_resident;
+    struct ResourceLRUNode_s *lru_first; // least recently used
+    struct ResourceLRUNode_s *lru_last;
+    // Counters.
+    uint32_t num_loads;
+    uint32_t num_evictions;
+    uint32_t num_reloads;
 } ResourceTypeInfo;
 extern ResourceTypeInfo *g_resource_type_info;
 void ___add_resource_type(ResourceType *type_pointer, size_t size, char *name, ResourceLoadFunction load, ResourceUnloadFunction unload);
@@ -136,6 +206,27 @@ void ___add_resource_type(ResourceType *type_pointer, size_t size, char *name, R
                           ( RESOURCE_TYPE_NAME ## _load ),\
                           ( RESOURCE_TYPE_NAME ## _unload ))
 
+// After a resource type is added, it can opt in to asynchronous loading with
+//     resource_type_async(Texture)
+// which expects Texture_request, Texture_prepare, and Texture_upload to be defined.
+void ___resource_type_async(ResourceType type, ResourceRequestFunction request, ResourcePrepareFunction prepare, ResourceUploadFunction upload);
+#define resource_type_async(RESOURCE_TYPE_NAME)\
+    ___resource_type_async(( RESOURCE_TYPE_NAME ## _RTID ),\
+                           ( RESOURCE_TYPE_NAME ## _request ),\
+                           ( RESOURCE_TYPE_NAME ## _prepare ),\
+                           ( RESOURCE_TYPE_NAME ## _upload ))
+#define resource_type_placeholder(RESOURCE_TYPE_NAME,RESOURCE_POINTER)\
+    ( g_resource_type_info[RESOURCE_TYPE_NAME ## _RTID].placeholder = (void *) ( RESOURCE_POINTER ) )
+// resource_type_measure(Texture) expects a function Texture_bytes to measure a loaded resource for memory budgeting.
+#define resource_type_measure(RESOURCE_TYPE_NAME)\
+    ( g_resource_type_info[RESOURCE_TYPE_NAME ## _RTID].bytes = ( RESOURCE_TYPE_NAME ## _bytes ) )
+#define resource_type_budget(RESOURCE_TYPE_NAME,BYTES)\
+    ( g_resource_type_info[RESOURCE_TYPE_NAME ## _RTID].budget = ( BYTES ) )
+// Evict least recently used unreferenced resources of types which are over budget. This should be called
+// at a point where nothing is holding raw pointers to unreferenced resources, e.g. the start of a frame.
+void resource_evict_over_budget(void);
+void print_resource_stats(void);
+
 /*--------------------------------------------------------------------------------
     The "resource path variable" and drives
 --------------------------------------------------------------------------------
@@ -157,6 +248,17 @@ bool resource_file_path(char *path, char *suffix, char *path_buffer, int path_bu
 FILE *resource_file_open(char *path, char *suffix, char *flags);
 void resource_path_add(char *drive_name, char *path);
 
+/*--------------------------------------------------------------------------------
+Resolving a resource path (plus suffix) to the physical file is cached. Directory listings of the
+bound directories are read lazily, once each, so resolving a path is a listing lookup for each binding of
+the drive, instead of an attempted fopen. The resolved physical path (or that there is none) is then cached.
+resource_file_resolve copies the physical path into the given buffer, returning false if no such file exists (or the
+buffer is too small). The copy is made under the cache's lock, since another thread may clear the cache at any time.
+If files are created or removed at runtime, resource_file_cache_clear must be called.
+--------------------------------------------------------------------------------*/
+bool resource_file_resolve(char *path, char *suffix, char *physical_path_buffer, int physical_path_buffer_size);
+void resource_file_cache_clear(void);
+
 // awful hack for help when opening resources ... "fix" for dropping out of path-search too early
 extern int g_resource_path_count;
 
@@ -28,6 +28,11 @@ typedef struct ShaderBlock_Standard3D_s {
     vec3 camera_position;    //offset: 240, alignment: 16, C_type_size: 12
     char ___std140_pad9[4];
     mat4x4 normal_matrix;    //offset: 256, alignment: 16, C_type_size: 64
+    bool quantized_vertices;    //offset: 320, alignment: 1, C_type_size: 1
+    char ___std140_pad11[15];
+    vec3 quantization_offset;    //offset: 336, alignment: 16, C_type_size: 12
+    char ___std140_pad12[4];
+    vec3 quantization_scale;    //offset: 352, alignment: 16, C_type_size: 12
 } ShaderBlock_Standard3D;
 
 #endif // SHADER_BLOCK_HEADER_DEFINED_STANDARD3D
@@ -0,0 +1,61 @@
+#ifndef HEADER_DEFINED_TRIANGLE_BVH
+#define HEADER_DEFINED_TRIANGLE_BVH
+/*================================================================================
+    Triangle bounding volume hierarchy.
+================================================================================*/
+// A 4-wide BVH over the triangles of a mesh, for ray queries. It is built as a binary tree with a binned surface-area
+// heuristic, then collapsed so that each node holds the boxes of up to four children, laid out so that a ray can be
+// tested against all four with SSE.
+// This only depends on the vector types, so that it can be used (e.g. by tools) without linking the rest of the geometry module.
+#include <stdbool.h>
+#include <stdint.h>
+#include "matrix_mathematics.h"
+
+#define TRIANGLE_BVH_WIDTH 4
+#define TRIANGLE_BVH_LEAF_SIZE 4
+#define TRIANGLE_BVH_NUM_BINS 16
+// The cost of a traversal step relative to a triangle test, in the surface-area heuristic.
+#define TRIANGLE_BVH_TRAVERSAL_COST 1.0
+// Children with count = 0 are inner nodes, at index first. Children with count > 0 are leaves, holding the triangles
+// first to first + count - 1. Unused slots have count = -1.
+typedef struct TriangleBVHNode_s {
+    float min_x[4];
+    float min_y[4];
+    float min_z[4];
+    float max_x[4];
+    float max_y[4];
+    float max_z[4];
+    int32_t first[4];
+    int32_t count[4];
+} TriangleBVHNode;
+// Triangles are stored in leaf order, with their edges precomputed for the intersection test.
+typedef struct TriangleBVHTriangle_s {
+    float a[3];
+    float ab[3];
+    float ac[3];
+    uint32_t index; // The index of the triangle in the mesh it was built from.
+} TriangleBVHTriangle;
+typedef struct TriangleBVH_s {
+    int num_nodes;
+    TriangleBVHNode *nodes;
+    int num_triangles;
+    TriangleBVHTriangle *triangles;
+    int depth;
+} TriangleBVH;
+
+// positions holds three floats per vertex, and triangles three vertex indices per triangle.
+void triangle_bvh_build(TriangleBVH *bvh, int num_vertices, float *positions, int num_triangles, uint32_t *triangles);
+void triangle_bvh_destroy(TriangleBVH *bvh);
+
+// The nearest intersection along the ray, at distances from 0 up to max_t in units of the direction vector.
+// Triangles are hit from both sides. The barycentric weights are those of the triangle's vertices in order.
+typedef struct TriangleRayHit_s {
+    uint32_t triangle;
+    float t;
+    vec3 barycentric;
+} TriangleRayHit;
+bool triangle_bvh_raycast(TriangleBVH *bvh, vec3 origin, vec3 direction, float max_t, TriangleRayHit *hit);
+// Any intersection closer than max_t, which can stop at the first found (e.g. for shadow rays).
+bool triangle_bvh_occluded(TriangleBVH *bvh, vec3 origin, vec3 direction, float max_t);
+
+#endif // HEADER_DEFINED_TRIANGLE_BVH
@@ -20,6 +20,11 @@ The application must provide:
     void mouse_move_event(double dx, double dy);
     void mouse_button_event(MouseButton button, bool click, float x, float y);
 
+Command-line options (see usage()) allow running headless, with a fixed simulated clock, and recording GL call counts.
+For example, to benchmark 1000 frames with no GPU:
+    ./run <app_name> -H -r -n 1000
+scripts/gl_check.sh runs some of the demos like this with -e, as a regression check of the renderer's GL call counts.
+
 project_libs:
     + glad
     + helper_definitions
@@ -39,10 +44,15 @@ project_libs:
 --------------------------------------------------------------------------------*/
 #define BASE_DIRECTORY "/home/lucas/collision/lib/Engine/"
 #define PROJECT_DIRECTORY "/home/lucas/collision/"
+#include <sys/time.h>
 #include "Engine.h"
 
 static GLFWwindow *window;
 
+// Headless mode: no window or context, the null GL backend, and a fixed simulated clock. This is for running
+// simulation and renderer CPU-cost benchmarks on machines with no GPU.
+bool g_headless = false;
+
 // A "main camera" is used to simplify some things. This is by default the last camera created.
 Camera *g_main_camera = NULL;
 
@@ -113,6 +123,17 @@ static int g_time_speed_down_key = GLFW_KEY_F3;
 static int g_time_speed_up_key = GLFW_KEY_F4;
 static int g_time_speed_reset_key = GLFW_KEY_F5;
 static float g_time_multiplier = 1.0;
+static float g_resource_upload_budget = 0.002; // seconds
+static unsigned int g_geometry_budget_mb = 0;
+static unsigned int g_texture_budget_mb = 0;
+// Command-line options.
+static bool g_record_gl = false;    // Count GL calls through the dispatch layer, and print the counts on exit.
+static int g_max_frames = 0;        // 0 for no limit.
+static float g_fixed_dt = 0;        // 0 to use the real clock.
+static int g_headless_width = 1280; // Headless framebuffer size.
+static int g_headless_height = 720;
+static char *g_expected_gl_stats = NULL; // Compare the recorded GL stats with this file on exit,
+static bool g_write_gl_stats = false;    // or write them to it.
 
 static void toggle_raw_mouse(void)
 {
@@ -339,6 +360,8 @@ static void init_base(void)
     init_aspects_gameobjects();
 
     init_resources_rendering();
+    resource_type_budget(Geometry, (size_t) g_geometry_budget_mb * 1024 * 1024);
+    resource_type_budget(Texture, (size_t) g_texture_budget_mb * 1024 * 1024);
 
     glsl_include_path_add(PROJECT_DIRECTORY "glsl/shader_blocks");
     
@@ -362,6 +385,11 @@ static void init_base(void)
 
 static void loop_base(void)
 {
+    // Unload unreferenced resources if over budget. This is done first, so nothing is holding pointers to them.
+    resource_evict_over_budget();
+    // Finish resources which have been loaded in the background.
+    resource_upload_pending(g_resource_upload_budget);
+
     // Update entity logic
     for_aspect(Logic, logic)
         if (logic->updating) logic->update(logic);
@@ -415,11 +443,65 @@ static void loop_base(void)
 }
 
 
+static void usage(char *name)
+{
+    fprintf(stderr, "usage: %s [-H] [-r] [-Q] [-I] [-C] [-B] [-S] [-n frames] [-d dt] [-s WIDTHxHEIGHT] [-e|-E expected_stats]\n", name);
+    fprintf(stderr, "    -H: Headless. No window is created and GL calls go nowhere. Runs for 600 frames of 1/60 s unless -n and -d are given.\n");
+    fprintf(stderr, "    -r: Record GL calls, and print counts of draw calls, state changes, bytes uploaded, etc. on exit.\n");
+    fprintf(stderr, "    -Q: Draw bodies in storage order instead of through the sorted render queue (for comparing state-change counts).\n");
+    fprintf(stderr, "    -I: Don't draw runs of bodies with the same geometry and material as instances.\n");
+    fprintf(stderr, "    -C: Don't frustum cull bodies against the cameras and shadow-map segments.\n");
+    fprintf(stderr, "    -B: Frustum cull by testing every bounding sphere, instead of traversing the scene BVH.\n");
+    fprintf(stderr, "    -S: Redraw every shadow-map segment for every camera, without caching static depth or sharing between cameras.\n");
+    fprintf(stderr, "    -n: Exit after this many frames.\n");
+    fprintf(stderr, "    -d: Advance the clock by this many seconds each frame, instead of using the real time.\n");
+    fprintf(stderr, "    -s: Headless framebuffer size (default 1280x720).\n");
+    fprintf(stderr, "    -e: Record GL calls, and exit with failure if the frames, draw calls, state changes or objects created differ from those in\n"
+                    "        this file, or it doesn't exist. Resources are loaded synchronously, so that the counts don't depend on timing.\n");
+    fprintf(stderr, "    -E: As -e, but write the counts to this file instead, to be kept as the expected values.\n");
+    exit(EXIT_FAILURE);
+}
+
+// (<time.h> and <unistd.h> can't be included, since the globals time and pause() clash with them.)
+static double wall_time(void)
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec + t.tv_usec * 1e-6;
+}
+
 #define config_error(str)\
     { fprintf(stderr, ERROR_ALERT "Application configuration error: non-existent or malformed \"" str "\" entry.\n");\
       exit(EXIT_FAILURE); }
-int main(void)
+int main(int argc, char *argv[])
 {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-H") == 0) g_headless = true;
+        else if (strcmp(argv[i], "-r") == 0) g_record_gl = true;
+        else if (strcmp(argv[i], "-Q") == 0) g_render_queue = false;
+        else if (strcmp(argv[i], "-I") == 0) g_render_instancing = false;
+        else if (strcmp(argv[i], "-C") == 0) g_frustum_culling = false;
+        else if (strcmp(argv[i], "-B") == 0) g_scene_bvh_culling = false;
+        else if (strcmp(argv[i], "-S") == 0) g_shadow_caching = false;
+        else if (i + 1 == argc) usage(argv[0]); // The rest take an argument.
+        else if (strcmp(argv[i], "-n") == 0) g_max_frames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-d") == 0) g_fixed_dt = atof(argv[++i]);
+        else if (strcmp(argv[i], "-e") == 0 || strcmp(argv[i], "-E") == 0) {
+            g_write_gl_stats = argv[i][1] == 'E';
+            g_expected_gl_stats = argv[++i];
+            g_record_gl = true;
+        }
+        else if (strcmp(argv[i], "-s") == 0) {
+            if (sscanf(argv[++i], "%dx%d", &g_headless_width, &g_headless_height) != 2) usage(argv[0]);
+        }
+        else usage(argv[0]);
+    }
+    if (g_max_frames < 0 || g_fixed_dt < 0 || g_headless_width < 1 || g_headless_height < 1) usage(argv[0]);
+    if (g_headless) {
+        if (g_max_frames == 0) g_max_frames = 600;
+        if (g_fixed_dt == 0) g_fixed_dt = 1.0 / 60.0;
+    }
+
     DD *base_config = dd_fopen(BASE_DIRECTORY "Engine.dd");
     if (base_config == NULL) {
         printf("Base directory: " BASE_DIRECTORY "\n");
@@ -450,39 +532,44 @@ int main(void)
         exit(EXIT_FAILURE);
     }
 
-    if (!glfwInit()) {
-        fprintf(stderr, "GLFW error: something went wrong initializing GLFW\n");
-        exit(EXIT_FAILURE);
-    }
     int gl_version[2];
     if (!dd_get(app_config, "gl_version", "ivec2", gl_version)) config_error("gl_version");
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, gl_version[0]);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, gl_version[1]);
-    // GLFW_OPENGL_PROFILE:     GLFW_OPENGL_ANY_PROFILE, GLFW_OPENGL_COMPAT_PROFILE or GLFW_OPENGL_CORE_PROFILE
     bool core_profile;
     if (!dd_get(app_config, "core_profile", "bool", &core_profile)) config_error("core_profile");
-    if (core_profile) glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    else              glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_COMPAT_PROFILE);
-
-    char *name = "Window";
-    // Window hints.
-    // Create multisampling buffers.
-    glfwWindowHint(GLFW_SAMPLES, 4);
-    window = glfwCreateWindow(1, 1, name, NULL, NULL);
-    if (window == NULL) {
-        fprintf(stderr, ERROR_ALERT "GLFW error: failed to create a window properly.\n");
-        glfwTerminate();
-        exit(EXIT_FAILURE);
+    if (g_headless) {
+        gl_dispatch_load(GL_DISPATCH_NULL);
+    } else {
+        if (!glfwInit()) {
+            fprintf(stderr, "GLFW error: something went wrong initializing GLFW\n");
+            exit(EXIT_FAILURE);
+        }
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, gl_version[0]);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, gl_version[1]);
+        // GLFW_OPENGL_PROFILE:     GLFW_OPENGL_ANY_PROFILE, GLFW_OPENGL_COMPAT_PROFILE or GLFW_OPENGL_CORE_PROFILE
+        if (core_profile) glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        else              glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_COMPAT_PROFILE);
+
+        char *name = "Window";
+        // Window hints.
+        // Create multisampling buffers.
+        glfwWindowHint(GLFW_SAMPLES, 4);
+        window = glfwCreateWindow(1, 1, name, NULL, NULL);
+        if (window == NULL) {
+            fprintf(stderr, ERROR_ALERT "GLFW error: failed to create a window properly.\n");
+            glfwTerminate();
+            exit(EXIT_FAILURE);
+        }
+        glfwMakeContextCurrent(window);
+        gl_dispatch_load(GL_DISPATCH_NATIVE);
+        glfwSwapInterval(1);
+        glfwSetFramebufferSizeCallback(window, reshape);
+        // GLFW input callbacks
+        glfwSetKeyCallback(window, key_callback);
+        glfwSetMouseButtonCallback(window, mouse_button_callback);
+        glfwSetCursorPosCallback(window, cursor_position_callback);
+        glfwSetScrollCallback(window, scroll_callback);
     }
-    glfwMakeContextCurrent(window);
-    gladLoadGL();
-    glfwSwapInterval(1);
-    glfwSetFramebufferSizeCallback(window, reshape);
-    // GLFW input callbacks
-    glfwSetKeyCallback(window, key_callback);
-    glfwSetMouseButtonCallback(window, mouse_button_callback);
-    glfwSetCursorPosCallback(window, cursor_position_callback);
-    glfwSetScrollCallback(window, scroll_callback);
+    if (g_record_gl) gl_dispatch_record();
 
     GLbitfield clear_mask = GL_COLOR_BUFFER_BIT; // To be |='d if another buffer is being used.
     float fg_color[4]; // Clear color in the rectangle being rendered onto.
@@ -493,6 +580,8 @@ int main(void)
     memcpy(g_bg_color, bg_color, sizeof(bg_color));
 
     if (!dd_get(app_config, "aspect_ratio", "float", &ASPECT_RATIO)) config_error("aspect_ratio");
+    // There is no framebuffer size callback when headless, so set the size here.
+    if (g_headless) reshape(NULL, g_headless_width, g_headless_height);
 
     char *cull_mode;
     if (!dd_get(app_config, "cull_mode", "string", &cull_mode)) config_error("cull_mode");
@@ -527,7 +616,7 @@ int main(void)
     // g_raw_mouse is a global variable so that it may be toggled with a meta-key.
     bool raw_mouse;
     if (!dd_get(app_config, "raw_mouse", "bool", &raw_mouse)) config_error("raw_mouse");
-    if (raw_mouse) {
+    if (raw_mouse && !g_headless) {
         // details: https://www.glfw.org/docs/latest/input_guide.html#input_mouse
         if (glfwRawMouseMotionSupported()) {
             g_raw_mouse = false; // make sure its switched off.
@@ -540,6 +629,15 @@ int main(void)
         g_raw_mouse = false;
     } 
 
+    // Asynchronous resource loading.
+    if (!dd_get(app_config, "async_resources", "bool", &g_resource_async)) config_error("async_resources");
+    if (g_expected_gl_stats != NULL) g_resource_async = false;
+    float resource_upload_budget_ms;
+    if (!dd_get(app_config, "resource_upload_budget_ms", "float", &resource_upload_budget_ms)) config_error("resource_upload_budget_ms");
+    g_resource_upload_budget = resource_upload_budget_ms * 0.001;
+    if (!dd_get(app_config, "geometry_budget_mb", "uint", &g_geometry_budget_mb)) config_error("geometry_budget_mb");
+    if (!dd_get(app_config, "texture_budget_mb", "uint", &g_texture_budget_mb)) config_error("texture_budget_mb");
+
     // Multi-sample antialiasing. GLFW must have been hinted to create multisampling buffers before the window was created.
     glEnable(GL_MULTISAMPLE);
     glEnable(GL_SAMPLE_COVERAGE);
@@ -548,12 +646,16 @@ int main(void)
     init_base();
     init_program();
     double last_time = time;
-    while (!glfwWindowShouldClose(window))
+    int frame = 0;
+    double start_time = wall_time();
+    while (g_headless || !glfwWindowShouldClose(window))
     {
-        glfwPollEvents();
+        if (g_max_frames > 0 && frame == g_max_frames) break;
+        if (!g_headless) glfwPollEvents();
 
         last_time = time;
-        time = glfwGetTime();
+        if (g_fixed_dt > 0) time += g_fixed_dt;
+        else time = glfwGetTime();
         dt = g_time_multiplier * (time - last_time);
 
         if (g_paused) continue;
@@ -576,19 +678,40 @@ int main(void)
 
         glDisable(GL_SCISSOR_TEST);
         loop_base();
+        gm_frame_end();
 
         glFlush();
-        glfwSwapBuffers(window);
+        if (!g_headless) glfwSwapBuffers(window);
+        gl_dispatch_end_frame();
+        frame ++;
 
         // Pausing after rendering is helpful for visual debugging.
+        // (Headless, nothing could unpause it.)
         if (g_pause_after_rendering) {
-            g_paused = true;
+            if (!g_headless) g_paused = true;
             g_pause_after_rendering = false;
         }
         g_y_scroll = 0; // Make sure global-access-to-scroll-wheel doesn't think the scroll wheel keeps going.
     }
+    double elapsed = wall_time() - start_time;
+    if (g_headless || g_record_gl) {
+        printf("%d frames in %.3f s, %.3f ms per frame\n", frame, elapsed, frame > 0 ? 1000 * elapsed / frame : 0);
+    }
+    if (g_record_gl) {
+        gl_dispatch_print_stats(stdout);
+        cull_print_stats(stdout);
+        shadow_print_stats(stdout);
+    }
+    bool stats_match = true;
+    if (g_expected_gl_stats != NULL) {
+        if (g_write_gl_stats) gl_dispatch_write_stats(g_expected_gl_stats);
+        else stats_match = gl_dispatch_check_stats(g_expected_gl_stats);
+    }
     // Cleanup
     close_program();
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    if (!g_headless) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
+    if (!stats_match) exit(EXIT_FAILURE);
 }
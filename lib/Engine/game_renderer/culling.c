@@ -0,0 +1,210 @@
+/*--------------------------------------------------------------------------------
+    Frustum culling
+    ---------------
+Each frame the bodies' world-space bounding spheres are gathered once into flat arrays. A view (a camera, or a segment
+of a directional light's cascaded shadow map) extracts its six frustum planes from its view-projection matrix, and tests
+the spheres against them four at a time with SSE, giving a list of the bodies it can see.
+Views are looked up by name, and keep counts of what they tested and culled, for printing with the GL stats.
+--------------------------------------------------------------------------------*/
+#include "Engine.h"
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+bool g_frustum_culling = true;
+CullSpheres g_cull_spheres = {0};
+
+static int g_num_cull_views = 0;
+static CullView g_cull_views[MAX_NUM_CULL_VIEWS];
+
+void cull_gather_bodies(CullSpheres *spheres)
+{
+    spheres->length = 0;
+    spheres->static_signature = 0;
+    for_aspect(Body, body)
+        // Bodies with geometry still being loaded (asynchronously) are skipped.
+        if (!resource_ready(body->geometry)) continue;
+        if (spheres->length == spheres->capacity) {
+            // The capacity stays a multiple of four, so the tests can load whole vectors.
+            spheres->capacity = spheres->capacity == 0 ? 256 : 2 * spheres->capacity;
+            spheres->x = realloc(spheres->x, spheres->capacity * sizeof(float));
+            mem_check(spheres->x);
+            spheres->y = realloc(spheres->y, spheres->capacity * sizeof(float));
+            mem_check(spheres->y);
+            spheres->z = realloc(spheres->z, spheres->capacity * sizeof(float));
+            mem_check(spheres->z);
+            spheres->r = realloc(spheres->r, spheres->capacity * sizeof(float));
+            mem_check(spheres->r);
+            spheres->bodies = realloc(spheres->bodies, spheres->capacity * sizeof(Body *));
+            mem_check(spheres->bodies);
+        }
+        int i = spheres->length ++;
+        vec3 position = Transform_position(get_sibling_aspect(body, Transform));
+        spheres->x[i] = position.vals[0];
+        spheres->y[i] = position.vals[1];
+        spheres->z[i] = position.vals[2];
+        spheres->r[i] = Body_radius(body);
+        spheres->bodies[i] = body;
+        if (body->is_static) {
+            // Summed, so that the signature doesn't depend on the order of the bodies.
+            uint32_t hash = hash_mix32((uint32_t) (uintptr_t) body);
+            float vals[4] = { spheres->x[i], spheres->y[i], spheres->z[i], spheres->r[i] };
+            for (int k = 0; k < 4; k++) {
+                uint32_t bits;
+                memcpy(&bits, &vals[k], sizeof(uint32_t));
+                hash = hash_mix32(hash ^ bits);
+            }
+            spheres->static_signature += hash;
+        }
+    end_for_aspect()
+    // Pad up to the next multiple of four, so whole vectors can be loaded. Lanes past the end are ignored.
+    for (int i = spheres->length; i < spheres->capacity && (i % 4) != 0; i++) {
+        spheres->x[i] = spheres->y[i] = spheres->z[i] = 0;
+        spheres->r[i] = -1;
+        spheres->bodies[i] = NULL;
+    }
+}
+
+Frustum frustum_from_matrix(mat4x4 matrix)
+{
+    // Gribb-Hartmann: in clip space, -w <= x, y, z <= w, so each plane is the fourth row of the matrix plus or minus
+    // one of the others. The matrices are column-major.
+    Frustum frustum;
+    float *m = matrix.vals;
+    for (int i = 0; i < 6; i++) {
+        int row = i / 2;
+        float sign = (i % 2 == 0) ? 1 : -1;
+        float a = m[3]  + sign * m[row];
+        float b = m[7]  + sign * m[4 + row];
+        float c = m[11] + sign * m[8 + row];
+        float d = m[15] + sign * m[12 + row];
+        // Normalize, so that the plane equation gives a signed distance to compare with a radius.
+        float inv_length = 1.0 / sqrt(a*a + b*b + c*c);
+        frustum.nx[i] = a * inv_length;
+        frustum.ny[i] = b * inv_length;
+        frustum.nz[i] = c * inv_length;
+        frustum.d[i] = d * inv_length;
+    }
+    return frustum;
+}
+
+bool frustum_sphere_visible(Frustum *frustum, vec3 center, float radius)
+{
+    for (int i = 0; i < 6; i++) {
+        float dist = frustum->nx[i] * center.vals[0] + frustum->ny[i] * center.vals[1] + frustum->nz[i] * center.vals[2] + frustum->d[i];
+        if (dist < -radius) return false;
+    }
+    return true;
+}
+
+CullView *cull_view(char *name)
+{
+    for (int i = 0; i < g_num_cull_views; i++) {
+        if (strcmp(g_cull_views[i].name, name) == 0) return &g_cull_views[i];
+    }
+    if (g_num_cull_views == MAX_NUM_CULL_VIEWS) {
+        fprintf(stderr, ERROR_ALERT "Too many cull views. The maximum is set to %d, but this can be changed.\n", MAX_NUM_CULL_VIEWS);
+        exit(EXIT_FAILURE);
+    }
+    CullView *view = &g_cull_views[g_num_cull_views ++];
+    memset(view, 0, sizeof(CullView));
+    strncpy(view->name, name, CULL_VIEW_NAME_LENGTH);
+    return view;
+}
+
+static void add_visible(CullView *view, Body *body)
+{
+    if (view->num_visible == view->visible_capacity) {
+        view->visible_capacity = view->visible_capacity == 0 ? 256 : 2 * view->visible_capacity;
+        view->visible = realloc(view->visible, view->visible_capacity * sizeof(Body *));
+        mem_check(view->visible);
+    }
+    view->visible[view->num_visible ++] = body;
+}
+
+typedef struct BVHVisitData_s {
+    CullView *view;
+    bool visible_only;
+} BVHVisitData;
+static void bvh_visit(Body *body, int query_index, void *data)
+{
+    BVHVisitData *visit_data = (BVHVisitData *) data;
+    if (visit_data->visible_only && !body->visible) return;
+    add_visible(visit_data->view, body);
+}
+
+void cull_view_run(CullView *view, mat4x4 vp_matrix, CullSpheres *spheres, bool visible_only)
+{
+    view->frustum = frustum_from_matrix(vp_matrix);
+    view->num_visible = 0;
+    view->runs ++;
+    view->tested += spheres->length;
+    if (!g_frustum_culling) {
+        for (int i = 0; i < spheres->length; i++) {
+            if (visible_only && !spheres->bodies[i]->visible) continue;
+            add_visible(view, spheres->bodies[i]);
+        }
+        view->passed += view->num_visible;
+        return;
+    }
+    Frustum *f = &view->frustum;
+    if (g_scene_bvh_culling && g_scene_bvh.num_nodes > 0) {
+        // Traverse the scene BVH (brought up to date at the start of the frame) instead of testing every sphere.
+        BVHVisitData data = { view, visible_only };
+        scene_bvh_query_frustums(&g_scene_bvh, 1, f, bvh_visit, &data);
+        view->passed += view->num_visible;
+        return;
+    }
+#if defined(__SSE__)
+    // Four spheres at a time. A lane is culled if its center is further than its radius behind any plane.
+    __m128 nx[6], ny[6], nz[6], d[6];
+    for (int j = 0; j < 6; j++) {
+        nx[j] = _mm_set1_ps(f->nx[j]);
+        ny[j] = _mm_set1_ps(f->ny[j]);
+        nz[j] = _mm_set1_ps(f->nz[j]);
+        d[j] = _mm_set1_ps(f->d[j]);
+    }
+    for (int i = 0; i < spheres->length; i += 4) {
+        __m128 x = _mm_loadu_ps(&spheres->x[i]);
+        __m128 y = _mm_loadu_ps(&spheres->y[i]);
+        __m128 z = _mm_loadu_ps(&spheres->z[i]);
+        __m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&spheres->r[i]));
+        __m128 outside = _mm_setzero_ps();
+        for (int j = 0; j < 6; j++) {
+            __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[j], x), _mm_mul_ps(ny[j], y)), _mm_add_ps(_mm_mul_ps(nz[j], z), d[j]));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(dist, neg_r));
+        }
+        int mask = _mm_movemask_ps(outside);
+        if (mask == 0xF) continue;
+        for (int k = 0; k < 4 && i + k < spheres->length; k++) {
+            if (mask & (1 << k)) continue;
+            Body *body = spheres->bodies[i + k];
+            if (visible_only && !body->visible) continue;
+            add_visible(view, body);
+        }
+    }
+#else
+    for (int i = 0; i < spheres->length; i++) {
+        Body *body = spheres->bodies[i];
+        if (visible_only && !body->visible) continue;
+        vec3 center = new_vec3(spheres->x[i], spheres->y[i], spheres->z[i]);
+        if (frustum_sphere_visible(f, center, spheres->r[i])) add_visible(view, body);
+    }
+#endif
+    view->passed += view->num_visible;
+}
+
+void cull_print_stats(FILE *file)
+{
+    fprintf(file, "Frustum culling%s:\n", g_frustum_culling ? "" : " (off)");
+    for (int i = 0; i < g_num_cull_views; i++) {
+        CullView *view = &g_cull_views[i];
+        double per_run = view->runs > 0 ? 1.0 / view->runs : 0;
+        fprintf(file, "    %-32s %8.1f tested, %8.1f drawn, %8.1f culled per run (%.1f%%)\n",
+                view->name,
+                view->tested * per_run,
+                view->passed * per_run,
+                (view->tested - view->passed) * per_run,
+                view->tested > 0 ? 100.0 * (view->tested - view->passed) / view->tested : 0);
+    }
+}
@@ -11,7 +11,20 @@ void init_game_renderer(void)
     init_shadows();
 }
 
+// Quantized geometry is decoded by the shaders with these entries (see glsl/shader_blocks/VertexDecoding.glh), which pass
+// other geometry through unchanged.
+void set_geometry_uniforms(Geometry *geometry)
+{
+    set_uniform_bool(Standard3D, quantized_vertices, geometry->quantized);
+    set_uniform_vec3(Standard3D, quantization_offset, geometry->quantized ? geometry->quantization_offset : vec3_zero());
+    set_uniform_vec3(Standard3D, quantization_scale, geometry->quantized ? geometry->quantization_scale : new_vec3(1, 1, 1));
+}
+
 void render_body_with_material(mat4x4 vp_matrix, Body *body, Material *material)
+{
+    render_body_with_material_state(vp_matrix, body, material, NULL);
+}
+void render_body_with_material_state(mat4x4 vp_matrix, Body *body, Material *material, GMDrawState *state)
 {
     Transform *transform = get_sibling_aspect(body, Transform);
     Geometry *mesh = resource_data(Geometry, body->geometry);
@@ -32,7 +45,8 @@ void render_body_with_material(mat4x4 vp_matrix, Body *body, Material *material)
     set_uniform_mat4x4(Standard3D, normal_matrix.vals, normal_matrix.vals); // assuming only rigid transformations.
     set_uniform_mat4x4(Standard3D, mvp_matrix.vals, mvp_matrix.vals);
     set_uniform_mat4x4(Standard3D, vp_matrix.vals, vp_matrix.vals);
-    gm_draw(*mesh, material);
+    set_geometry_uniforms(mesh);
+    gm_draw_state(*mesh, material, state);
 }
 void render_body(mat4x4 vp_matrix, Body *body)
 {
@@ -88,20 +102,44 @@ mat4x4 Camera_prepare(Camera *camera)
     return vp_matrix;
 }
 
+uint64_t g_render_frame = 0;
 void render(void)
 {
+    g_render_frame ++;
     set_uniform_float(StandardLoopWindow, time, time);
     set_uniform_float(StandardLoopWindow, aspect_ratio, ASPECT_RATIO);
 
+    // Gather the bounding spheres once, for every camera and shadow-map segment to cull against.
+    cull_gather_bodies(&g_cull_spheres);
+    if (g_scene_bvh_culling) scene_bvh_update(&g_scene_bvh, &g_cull_spheres);
 // int index = 0; ////////testing
+    int camera_index = 0;
     for_aspect(Camera, camera)
         do_shadows(camera);
         // if (index++ == 0) do_shadows(camera); ////////testing
         mat4x4 vp_matrix = Camera_prepare(camera);
-        // Render each body.
-        for_aspect(Body, body)
-            if (body->visible) render_body(vp_matrix, body);
-        end_for_aspect()
+        char view_name[CULL_VIEW_NAME_LENGTH + 1];
+        snprintf(view_name, sizeof(view_name), "camera %d", camera_index ++);
+        CullView *view = cull_view(view_name);
+        cull_view_run(view, vp_matrix, &g_cull_spheres, true);
+        // Render each body in view.
+        if (g_render_queue) {
+            static RenderQueue queue = {0};
+            render_queue_clear(&queue);
+            vec3 camera_position = Transform_position(get_sibling_aspect(camera, Transform));
+            for (int i = 0; i < view->num_visible; i++) {
+                Body *body = view->visible[i];
+                Material *material = resource_data(Material, body->material);
+                Geometry *geometry = resource_data(Geometry, body->geometry);
+                float depth = vec3_length(vec3_sub(Transform_position(get_sibling_aspect(body, Transform)), camera_position)) / camera->plane_f;
+                render_queue_add(&queue, render_key(RenderPassOpaque, material, geometry, depth), body, material);
+            }
+            render_queue_sort(&queue);
+            render_queue_batch(&queue);
+            render_queue_submit(&queue, vp_matrix);
+        } else {
+            for (int i = 0; i < view->num_visible; i++) render_body(vp_matrix, view->visible[i]);
+        }
         // Draw the buffered paint (in global coordinates).
         set_uniform_mat4x4(Standard3D, mvp_matrix.vals, vp_matrix.vals);
         glCullFace(GL_NONE);
@@ -0,0 +1,186 @@
+/*--------------------------------------------------------------------------------
+    Render queue
+    ------------
+Instead of drawing bodies in aspect-storage order, each visible body is added to a queue with a 64-bit sort key.
+The queue is radix sorted, so bodies sharing a program, then a material, then a geometry are drawn in runs,
+and is submitted through a GMDrawState so that only what changes between consecutive draws is rebound.
+Key layout, from the most significant bits:
+    pass:      4 bits
+    program:  16 bits
+    material: 16 bits
+    geometry: 16 bits (the vertex array)
+    depth:    12 bits (front to back)
+GL names and material hashes are folded into their fields, so two of them may share a key field. This can only
+split runs, since the submission compares the actual bindings.
+The material field is a hash of what the material binds rather than its pointer, since bodies usually have their own
+equivalent material instances. After sorting, batching finds runs of the same geometry with equivalent materials,
+and if the material type has an instanced program, each run is drawn with one instanced draw call, taking the model
+matrices from an instance buffer instead of Standard3D.
+--------------------------------------------------------------------------------*/
+#include "Engine.h"
+
+#define KEY_PASS_SHIFT 60
+#define KEY_PROGRAM_SHIFT 44
+#define KEY_MATERIAL_SHIFT 28
+#define KEY_GEOMETRY_SHIFT 12
+#define KEY_DEPTH_BITS 12
+
+bool g_render_queue = true;
+bool g_render_instancing = true;
+
+uint64_t render_key(RenderPass pass, Material *material, Geometry *geometry, float depth)
+{
+    MaterialType *mt = resource_data(MaterialType, material->material_type);
+    uint32_t material_bits = material_hash(material);
+    material_bits ^= material_bits >> 16;
+    if (depth < 0) depth = 0;
+    if (depth > 1) depth = 1;
+    uint64_t depth_bits = (uint64_t) (depth * ((1 << KEY_DEPTH_BITS) - 1));
+    return  (((uint64_t) pass) << KEY_PASS_SHIFT)
+          | (((uint64_t) (mt->program_id & 0xFFFF)) << KEY_PROGRAM_SHIFT)
+          | (((uint64_t) (material_bits & 0xFFFF)) << KEY_MATERIAL_SHIFT)
+          | (((uint64_t) (geometry->vao_id & 0xFFFF)) << KEY_GEOMETRY_SHIFT)
+          | depth_bits;
+}
+
+void render_queue_clear(RenderQueue *queue)
+{
+    queue->length = 0;
+}
+
+void render_queue_destroy(RenderQueue *queue)
+{
+    free(queue->items);
+    free(queue->keys);
+    free(queue->order);
+    free(queue->scratch_keys);
+    free(queue->scratch_order);
+    free(queue->instance_matrices);
+    if (queue->instance_buffer != 0) glDeleteBuffers(1, &queue->instance_buffer);
+    memset(queue, 0, sizeof(RenderQueue));
+}
+
+void render_queue_add(RenderQueue *queue, uint64_t key, Body *body, Material *material)
+{
+    if (queue->length == queue->capacity) {
+        queue->capacity = queue->capacity == 0 ? 256 : 2 * queue->capacity;
+        queue->items = realloc(queue->items, queue->capacity * sizeof(RenderItem));
+        mem_check(queue->items);
+        queue->keys = realloc(queue->keys, queue->capacity * sizeof(uint64_t));
+        mem_check(queue->keys);
+        queue->order = realloc(queue->order, queue->capacity * sizeof(uint32_t));
+        mem_check(queue->order);
+        queue->scratch_keys = realloc(queue->scratch_keys, queue->capacity * sizeof(uint64_t));
+        mem_check(queue->scratch_keys);
+        queue->scratch_order = realloc(queue->scratch_order, queue->capacity * sizeof(uint32_t));
+        mem_check(queue->scratch_order);
+    }
+    RenderItem *item = &queue->items[queue->length];
+    item->body = body;
+    item->material = material;
+    item->instances = 1;
+    item->base_instance = 0;
+    queue->keys[queue->length] = key;
+    queue->order[queue->length] = queue->length;
+    queue->length ++;
+}
+
+void render_queue_sort(RenderQueue *queue)
+{
+    // Least-significant-digit radix sort of the keys, 8 bits at a time, carrying the item indices along.
+    // Most of a key's bytes are the same for every item (e.g. the pass, and the top bytes of small GL names), and these passes are skipped.
+    int n = queue->length;
+    uint64_t *keys = queue->keys;
+    uint32_t *order = queue->order;
+    uint64_t *out_keys = queue->scratch_keys;
+    uint32_t *out_order = queue->scratch_order;
+    for (int shift = 0; shift < 64; shift += 8) {
+        uint32_t counts[256] = {0};
+        for (int i = 0; i < n; i++) counts[(keys[i] >> shift) & 0xFF] ++;
+        if (n == 0 || counts[(keys[0] >> shift) & 0xFF] == n) continue;
+        uint32_t offset = 0;
+        for (int i = 0; i < 256; i++) {
+            uint32_t count = counts[i];
+            counts[i] = offset;
+            offset += count;
+        }
+        for (int i = 0; i < n; i++) {
+            uint32_t to = counts[(keys[i] >> shift) & 0xFF] ++;
+            out_keys[to] = keys[i];
+            out_order[to] = order[i];
+        }
+        uint64_t *tmp_keys = keys; keys = out_keys; out_keys = tmp_keys;
+        uint32_t *tmp_order = order; order = out_order; out_order = tmp_order;
+    }
+    // After an odd number of passes the sorted arrays are the ones which were scratch, so swap the pointers.
+    queue->keys = keys;
+    queue->order = order;
+    queue->scratch_keys = out_keys;
+    queue->scratch_order = out_order;
+}
+
+void render_queue_batch(RenderQueue *queue)
+{
+    queue->num_instances = 0;
+    int n = queue->length;
+    int i = 0;
+    while (i < n) {
+        RenderItem *first = &queue->items[queue->order[i]];
+        Geometry *geometry = resource_data(Geometry, first->body->geometry);
+        MaterialType *mt = resource_data(MaterialType, first->material->material_type);
+        // Find the run of items which can be drawn with the first. These are contiguous after sorting.
+        int end = i + 1;
+        if (g_render_instancing && mt->instanced_program_id != 0) {
+            while (end < n) {
+                RenderItem *item = &queue->items[queue->order[end]];
+                if (resource_data(Geometry, item->body->geometry)->vao_id != geometry->vao_id) break;
+                if (!material_equivalent(first->material, item->material)) break;
+                end ++;
+            }
+        }
+        if (end - i < RENDER_INSTANCING_MIN_RUN) {
+            for (int j = i; j < end; j++) queue->items[queue->order[j]].instances = 1;
+            i = end;
+            continue;
+        }
+        if (queue->num_instances + (end - i) > queue->instances_capacity) {
+            while (queue->num_instances + (end - i) > queue->instances_capacity) {
+                queue->instances_capacity = queue->instances_capacity == 0 ? 256 : 2 * queue->instances_capacity;
+            }
+            queue->instance_matrices = realloc(queue->instance_matrices, queue->instances_capacity * sizeof(mat4x4));
+            mem_check(queue->instance_matrices);
+        }
+        first->base_instance = queue->num_instances;
+        first->instances = end - i;
+        for (int j = i; j < end; j++) {
+            RenderItem *item = &queue->items[queue->order[j]];
+            if (j != i) item->instances = 0;
+            queue->instance_matrices[queue->num_instances ++] = Transform_matrix(get_sibling_aspect(item->body, Transform));
+        }
+        i = end;
+    }
+    if (queue->num_instances == 0) return;
+    // Respecify the whole buffer, so the driver can orphan the storage a previous frame may still be drawing from.
+    if (queue->instance_buffer == 0) glGenBuffers(1, &queue->instance_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, queue->instance_buffer);
+    glBufferData(GL_ARRAY_BUFFER, queue->num_instances * sizeof(mat4x4), queue->instance_matrices, GL_STREAM_DRAW);
+}
+
+void render_queue_submit(RenderQueue *queue, mat4x4 vp_matrix)
+{
+    GMDrawState state;
+    gm_draw_state_reset(&state);
+    // The instanced programs only take the view-projection matrix from Standard3D.
+    set_uniform_mat4x4(Standard3D, vp_matrix.vals, vp_matrix.vals);
+    for (int i = 0; i < queue->length; i++) {
+        RenderItem *item = &queue->items[queue->order[i]];
+        if (item->instances == 0) continue; // Drawn in an earlier item's instanced run.
+        if (item->instances == 1) {
+            render_body_with_material_state(vp_matrix, item->body, item->material, &state);
+        } else {
+            Geometry *geometry = resource_data(Geometry, item->body->geometry);
+            set_geometry_uniforms(geometry);
+            gm_draw_instanced_state(*geometry, item->material, queue->instance_buffer, item->base_instance, item->instances, &state);
+        }
+    }
+}
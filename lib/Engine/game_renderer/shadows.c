@@ -8,6 +8,35 @@
 
 static Material *g_shadow_map_material = NULL;
 ShadowMap g_directional_light_shadow_maps[MAX_NUM_DIRECTIONAL_LIGHTS];
+bool g_shadow_caching = true;
+ShadowStats g_shadow_stats = {0};
+
+enum CasterFilters {
+    CastersAll,
+    CastersStatic,
+    CastersDynamic,
+};
+// Draw the casters which passed a segment's culling, queued sorted by geometry.
+static void draw_casters(CullView *view, mat4x4 shadow_matrix, int filter)
+{
+    static RenderQueue queue = {0};
+    render_queue_clear(&queue);
+    for (int i = 0; i < view->num_visible; i++) {
+        Body *body = view->visible[i];
+        if ((filter == CastersStatic && !body->is_static) || (filter == CastersDynamic && body->is_static)) continue;
+        if (g_render_queue) {
+            Geometry *geometry = resource_data(Geometry, body->geometry);
+            render_queue_add(&queue, render_key(RenderPassShadow, g_shadow_map_material, geometry, 0), body, g_shadow_map_material);
+        } else {
+            render_body_with_material(shadow_matrix, body, g_shadow_map_material);
+        }
+    }
+    if (g_render_queue) {
+        render_queue_sort(&queue);
+        render_queue_batch(&queue);
+        render_queue_submit(&queue, shadow_matrix);
+    }
+}
 
 void init_shadows(void)
 {
@@ -50,12 +79,38 @@ void init_shadows(void)
             fprintf(stderr, ERROR_ALERT "Incomplete framebuffer when initializing shadow maps.\n");
             exit(EXIT_FAILURE);
         }
+        // The static casters of distant segments are drawn into a depth-only framebuffer, and copied from there.
+        glGenTextures(1, &shadow_map->static_depth_texture);
+        glBindTexture(GL_TEXTURE_2D, shadow_map->static_depth_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_MAP_TEXTURE_WIDTH, SHADOW_MAP_TEXTURE_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glGenFramebuffers(1, &shadow_map->static_framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, shadow_map->static_framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, shadow_map->static_depth_texture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            fprintf(stderr, ERROR_ALERT "Incomplete framebuffer when initializing static shadow-map caches.\n");
+            exit(EXIT_FAILURE);
+        }
         // Bind the depth texture to its reserved texture unit. --------------------------------
         set_uniform_texture(Lights, directional_light_shadow_maps[i], shadow_map->depth_texture);
         // --------------------------------------------------------------------------------------
     }
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
+void shadow_print_stats(FILE *file)
+{
+    fprintf(file, "Shadow-map segments%s: %llu drawn, %llu shared between cameras, static depth redrawn %llu times and reused %llu times\n",
+            g_shadow_caching ? "" : " (caching off)",
+            (unsigned long long) g_shadow_stats.segments_drawn,
+            (unsigned long long) g_shadow_stats.segments_shared,
+            (unsigned long long) g_shadow_stats.static_refreshes,
+            (unsigned long long) g_shadow_stats.static_reuses);
+}
+
 void do_shadows(Camera *camera)
 {
     // Render to the cascaded shadow maps.
@@ -137,39 +192,78 @@ void do_shadows(Camera *camera)
                 light_frustum[i + 4] = mat4x4_vec3(light_matrix, far_quad[i]);
             }
             //--------------------------------------------------------------------------------
-            // Find the axis-aligned bounding box of the frustum segment in light coordinates.
-            // Find the minimum and maximum corners.
+            // Distant segments can keep the depth of static casters drawn on an earlier frame. Their box is then kept
+            // until the camera has moved or turned past a threshold, the light has changed, or the static casters have.
+            // The cache is kept for one camera, which can be taken over if that camera hasn't drawn the segment since last frame.
             //--------------------------------------------------------------------------------
-            // Scene awareness: winnow the box down so that it more tightly (but not perfectly) encloses the shadow-casting models in the scene.
-            // This uses the radius of each body, being the maximal distance from the model-origin of a vertex, to create a bounding box aligned to light space.
-            //--------------------------------------------------------------------------------
-            vec3 scene_corners[2] = { light_frustum[0], light_frustum[0] };
-            for_aspect(Body, body)
-                if (body->is_ground) continue; // The is_ground flag can be set on a body so that shadow maps can be made higher resolution,
-                                               // since the ground is large but probably won't cast shadows.
-                float radius = Body_radius(body);
-                vec3 position = mat4x4_vec3(light_matrix, Transform_position(get_sibling_aspect(body, Transform)));
-                for (int i = 0; i < 3; i++) {
-		    float min_val = position.vals[i] - radius;
-		    float max_val = position.vals[i] + radius;
-                    if (min_val < scene_corners[0].vals[i]) scene_corners[0].vals[i] = min_val;
-                    if (max_val > scene_corners[1].vals[i]) scene_corners[1].vals[i] = max_val;
+            ShadowSegmentCache *cache = &shadow_map->segments[segment];
+            bool light_unchanged = cache->valid && memcmp(&cache->light_matrix, &light_matrix, sizeof(mat4x4)) == 0;
+            bool owns_static = !cache->static_valid || cache->static_camera == camera || cache->static_frame + 1 < g_render_frame;
+            bool caches_static = g_shadow_caching && segment >= SHADOW_CACHE_FIRST_SEGMENT && owns_static;
+            float segment_length = along - along_to;
+            float move_threshold = SHADOW_CACHE_MOVE_FRACTION * segment_length;
+            vec3 forward = Transform_forward(transform);
+            bool refresh_static = caches_static && (!cache->static_valid || cache->static_camera != camera || !light_unchanged
+                                                    || cache->static_signature != g_cull_spheres.static_signature
+                                                    || vec3_length(vec3_sub(pos, cache->camera_position)) > move_threshold
+                                                    || vec3_dot(forward, cache->camera_forward) < cos(SHADOW_CACHE_TURN_ANGLE));
+            vec3 box_corners[2];
+            if (caches_static && !refresh_static) {
+                box_corners[0] = cache->box_corners[0];
+                box_corners[1] = cache->box_corners[1];
+            } else {
+                //--------------------------------------------------------------------------------
+                // Find the axis-aligned bounding box of the frustum segment in light coordinates.
+                // Find the minimum and maximum corners.
+                //--------------------------------------------------------------------------------
+                box_corners[0] = light_frustum[0];
+                box_corners[1] = light_frustum[0];
+                for (int i = 0; i < 8; i++) {
+                    for (int j = 0; j < 3; j++) {
+                        if (light_frustum[i].vals[j] < box_corners[0].vals[j]) box_corners[0].vals[j] = light_frustum[i].vals[j];
+                        if (light_frustum[i].vals[j] > box_corners[1].vals[j]) box_corners[1].vals[j] = light_frustum[i].vals[j];
+                    }
                 }
-            end_for_aspect()
-
-            // Now if this box is larger than the frustum-segment, winnow it down to the frustum-segment, since shadow-casters outside of it do not matter.
-            vec3 box_corners[2] = { light_frustum[0], light_frustum[0] };
-            for (int i = 0; i < 8; i++) {
-                for (int j = 0; j < 3; j++) {
-                    if (light_frustum[i].vals[j] < box_corners[0].vals[j]) box_corners[0].vals[j] = light_frustum[i].vals[j];
-                    if (light_frustum[i].vals[j] > box_corners[1].vals[j]) box_corners[1].vals[j] = light_frustum[i].vals[j];
+                if (caches_static) {
+                    // Pad the box so that it still contains the segment until the camera moves or turns past the threshold.
+                    // Turning by an angle moves a point by at most its distance from the camera times the angle.
+                    float max_distance = 0;
+                    for (int i = 0; i < 8; i++) max_distance = MAX(max_distance, vec3_length(vec3_sub(frustum_points[i], pos)));
+                    float pad = move_threshold + max_distance * SHADOW_CACHE_TURN_ANGLE;
+                    for (int i = 0; i < 3; i++) {
+                        box_corners[0].vals[i] -= pad;
+                        box_corners[1].vals[i] += pad;
+                    }
+                    cache->box_corners[0] = box_corners[0];
+                    cache->box_corners[1] = box_corners[1];
+                } else {
+                    //--------------------------------------------------------------------------------
+                    // Scene awareness: winnow the box down so that it more tightly (but not perfectly) encloses the shadow-casting models in the scene.
+                    // This uses the radius of each body, being the maximal distance from the model-origin of a vertex, to create a bounding box aligned to light space.
+                    // (This isn't done for cached segments, since the dynamic bodies would move out of the kept box.)
+                    //--------------------------------------------------------------------------------
+                    vec3 scene_corners[2] = { light_frustum[0], light_frustum[0] };
+                    for (int k = 0; k < g_cull_spheres.length; k++) {
+                        Body *body = g_cull_spheres.bodies[k];
+                        if (body->is_ground) continue; // The is_ground flag can be set on a body so that shadow maps can be made higher resolution,
+                                                       // since the ground is large but probably won't cast shadows.
+                        float radius = g_cull_spheres.r[k];
+                        vec3 position = mat4x4_vec3(light_matrix, new_vec3(g_cull_spheres.x[k], g_cull_spheres.y[k], g_cull_spheres.z[k]));
+                        for (int i = 0; i < 3; i++) {
+                            float min_val = position.vals[i] - radius;
+                            float max_val = position.vals[i] + radius;
+                            if (min_val < scene_corners[0].vals[i]) scene_corners[0].vals[i] = min_val;
+                            if (max_val > scene_corners[1].vals[i]) scene_corners[1].vals[i] = max_val;
+                        }
+                    }
+                    // Now if the scene box is smaller than the frustum-segment box, winnow it down, since shadow-casters outside of it do not matter.
+                    // Take the minimum-extent (so, minimum maximums) of each of these pairs of corners.
+                    for (int i = 0; i < 3; i++) {
+                        box_corners[0].vals[i] = MAX(box_corners[0].vals[i], scene_corners[0].vals[i]);
+                        box_corners[1].vals[i] = MIN(box_corners[1].vals[i], scene_corners[1].vals[i]);
+                    }
                 }
             }
-            // Now take the minimum-extent (so, minimum maximums) of each of these pairs of corners.
-            for (int i = 0; i < 3; i++) {
-                box_corners[0].vals[i] = MAX(box_corners[0].vals[i], scene_corners[0].vals[i]);
-                box_corners[1].vals[i] = MIN(box_corners[1].vals[i], scene_corners[1].vals[i]);
-            }
             //--------------------------------------------------------------------------------
 
             // light_to_box:
@@ -299,8 +393,28 @@ light to uvd 3
             print_vec3(c2);
 }
 #endif
+            // If another camera has already drawn this segment this frame, with the same matrix, it is still in the quadrant.
+            bool shared = g_shadow_caching && cache->valid && cache->frame == g_render_frame && light_unchanged
+                          && memcmp(&cache->shadow_matrix, &shadow_matrix, sizeof(mat4x4)) == 0;
+            cache->valid = true;
+            cache->frame = g_render_frame;
+            cache->shadow_matrix = shadow_matrix;
+            cache->light_matrix = light_matrix;
+            if (shared) {
+                g_shadow_stats.segments_shared ++;
+                continue;
+            }
+
+            // The segment's box in light space, before it is moved to its quadrant, is what is drawn into the quadrant,
+            // so it is what the casters are culled against.
+            mat4x4 box_matrix = light_to_box;
+            right_multiply_mat4x4(&box_matrix, &light_matrix);
+            char view_name[CULL_VIEW_NAME_LENGTH + 1];
+            snprintf(view_name, sizeof(view_name), "light %d segment %d", index, segment);
+            CullView *view = cull_view(view_name);
+            cull_view_run(view, box_matrix, &g_cull_spheres, false);
+
             // Render to this frustum-segment's quadrant of the shadow map.
-            glBindFramebuffer(GL_FRAMEBUFFER, shadow_map->framebuffer);
             glClearDepth(1.0);
             glEnable(GL_SCISSOR_TEST);
             float quadrant[4] = {
@@ -310,15 +424,39 @@ light to uvd 3
                 SHADOW_MAP_TEXTURE_HEIGHT * 0.5,
             };
             glScissor(quadrant[0], quadrant[1], quadrant[2], quadrant[3]);
-            // Clear the shadow texture.
-            glClear(GL_DEPTH_BUFFER_BIT);
-
             // static int frame_number = 0; //visualize order
             // if (((frame_number ++ / 20) % 4) != segment) continue;
-            for_aspect(Body, body)
-                render_body_with_material(shadow_matrix, body, g_shadow_map_material);
-                // render_body(shadow_matrix, body);
-            end_for_aspect()
+            if (caches_static) {
+                if (refresh_static) {
+                    // Redraw the static casters into the cache.
+                    glBindFramebuffer(GL_FRAMEBUFFER, shadow_map->static_framebuffer);
+                    glClear(GL_DEPTH_BUFFER_BIT);
+                    draw_casters(view, shadow_matrix, CastersStatic);
+                    cache->static_valid = true;
+                    cache->static_camera = camera;
+                    cache->static_signature = g_cull_spheres.static_signature;
+                    cache->camera_position = pos;
+                    cache->camera_forward = forward;
+                    g_shadow_stats.static_refreshes ++;
+                } else {
+                    g_shadow_stats.static_reuses ++;
+                }
+                cache->static_frame = g_render_frame;
+                // Start the quadrant from the cached static depth, then add the dynamic casters.
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, shadow_map->static_framebuffer);
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadow_map->framebuffer);
+                glBlitFramebuffer(quadrant[0], quadrant[1], quadrant[0] + quadrant[2], quadrant[1] + quadrant[3],
+                                  quadrant[0], quadrant[1], quadrant[0] + quadrant[2], quadrant[1] + quadrant[3],
+                                  GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+                glBindFramebuffer(GL_FRAMEBUFFER, shadow_map->framebuffer);
+                draw_casters(view, shadow_matrix, CastersDynamic);
+            } else {
+                glBindFramebuffer(GL_FRAMEBUFFER, shadow_map->framebuffer);
+                // Clear the shadow texture.
+                glClear(GL_DEPTH_BUFFER_BIT);
+                draw_casters(view, shadow_matrix, CastersAll);
+            }
+            g_shadow_stats.segments_drawn ++;
 
 #if 0
             // Draw the frustum-segment bounding box.
@@ -32,10 +32,9 @@ typedef struct Glyph_s {
 } Glyph;
 void print_glyph(Glyph *glyph);
 --------------------------------------------------------------------------------*/
-void Text_bake(Text *text)
+// Specify the glyph quads of the text, to be completed with gm_done or gm_done_frame.
+static void Text_specify(Text *text)
 {
-    gm_free(text->geometry);
-
     float global_offset_x = 0;
     float global_offset_y = -40;
 
@@ -73,8 +72,24 @@ void Text_bake(Text *text)
         // Advance.
         cur_x += glyph->advance >> 6;
     }
+}
+void Text_bake(Text *text)
+{
+    gm_free(text->geometry);
+    Text_specify(text);
     text->geometry = gm_done();
 }
+void Text_set_frame(Text *text, char *string)
+{
+    // The string buffer is reused, so that text changing every frame doesn't allocate.
+    text->string = (char *) realloc(text->string, sizeof(char) * (strlen(string) + 1));
+    mem_check(text->string);
+    strcpy(text->string, string);
+    // The last geometry is freed even if it came from gm_done_frame, since that falls back to ordinary geometry when the ring is full.
+    gm_free(text->geometry);
+    Text_specify(text);
+    text->geometry = gm_done_frame();
+}
 
 void Text_init(Text *text, TextType type, char *font_path, char *string, float scale)
 {
@@ -0,0 +1,423 @@
+/*--------------------------------------------------------------------------------
+    Scene bounding volume hierarchy
+    -------------------------------
+The tree is built top-down. Each split bins the bodies' sphere centers into SCENE_BVH_NUM_BINS along the axis they
+are most spread over, and takes the bin boundary minimizing the surface-area heuristic,
+    cost = (bodies on left) * (area of left box) + (bodies on right) * (area of right box),
+unless keeping the node as a leaf is cheaper.
+Children are always allocated after their parent, so refitting is one reverse pass over the nodes.
+--------------------------------------------------------------------------------*/
+#include "Engine.h"
+
+#define MIN(X,Y) ((X) < (Y) ? (X) : (Y))
+#define MAX(X,Y) ((X) < (Y) ? (Y) : (X))
+
+bool g_scene_bvh_culling = true;
+SceneBVH g_scene_bvh = {0};
+
+static float box_area(float min[3], float max[3])
+{
+    float dx = max[0] - min[0];
+    float dy = max[1] - min[1];
+    float dz = max[2] - min[2];
+    return 2 * (dx*dy + dy*dz + dz*dx);
+}
+static void box_empty(float min[3], float max[3])
+{
+    for (int i = 0; i < 3; i++) {
+        min[i] = INFINITY;
+        max[i] = -INFINITY;
+    }
+}
+static void box_add_sphere(float min[3], float max[3], vec3 center, float radius)
+{
+    for (int i = 0; i < 3; i++) {
+        if (center.vals[i] - radius < min[i]) min[i] = center.vals[i] - radius;
+        if (center.vals[i] + radius > max[i]) max[i] = center.vals[i] + radius;
+    }
+}
+static void box_add_box(float min[3], float max[3], float other_min[3], float other_max[3])
+{
+    for (int i = 0; i < 3; i++) {
+        if (other_min[i] < min[i]) min[i] = other_min[i];
+        if (other_max[i] > max[i]) max[i] = other_max[i];
+    }
+}
+
+static void swap_items(SceneBVH *bvh, int i, int j)
+{
+    Body *body = bvh->bodies[i]; bvh->bodies[i] = bvh->bodies[j]; bvh->bodies[j] = body;
+    int index = bvh->sphere_indices[i]; bvh->sphere_indices[i] = bvh->sphere_indices[j]; bvh->sphere_indices[j] = index;
+    vec3 center = bvh->centers[i]; bvh->centers[i] = bvh->centers[j]; bvh->centers[j] = center;
+    float radius = bvh->radii[i]; bvh->radii[i] = bvh->radii[j]; bvh->radii[j] = radius;
+}
+
+static void leaf_bounds(SceneBVH *bvh, SceneBVHNode *node)
+{
+    box_empty(node->min, node->max);
+    for (int i = node->first; i < node->first + node->count; i++) {
+        box_add_sphere(node->min, node->max, bvh->centers[i], bvh->radii[i]);
+    }
+}
+
+static void subdivide(SceneBVH *bvh, int node_index, int depth)
+{
+    if (depth > bvh->depth) bvh->depth = depth;
+    // (The nodes array has been allocated for the largest possible tree, so this pointer stays valid.)
+    SceneBVHNode *node = &bvh->nodes[node_index];
+    if (node->count <= SCENE_BVH_LEAF_SIZE) return;
+    int first = node->first;
+    int count = node->count;
+
+    // Split along the axis the centers are most spread over.
+    float centers_min[3], centers_max[3];
+    box_empty(centers_min, centers_max);
+    for (int i = first; i < first + count; i++) box_add_sphere(centers_min, centers_max, bvh->centers[i], 0);
+    int axis = 0;
+    for (int i = 1; i < 3; i++) {
+        if (centers_max[i] - centers_min[i] > centers_max[axis] - centers_min[axis]) axis = i;
+    }
+    float extent = centers_max[axis] - centers_min[axis];
+    if (extent <= 0) return; // All at the same point, so keep them together.
+
+    struct { int count; float min[3]; float max[3]; } bins[SCENE_BVH_NUM_BINS];
+    for (int i = 0; i < SCENE_BVH_NUM_BINS; i++) {
+        bins[i].count = 0;
+        box_empty(bins[i].min, bins[i].max);
+    }
+    float scale = SCENE_BVH_NUM_BINS / extent;
+#define bin_of(ITEM) MIN(SCENE_BVH_NUM_BINS - 1, (int) ((bvh->centers[(ITEM)].vals[axis] - centers_min[axis]) * scale))
+    for (int i = first; i < first + count; i++) {
+        int bin = bin_of(i);
+        bins[bin].count ++;
+        box_add_sphere(bins[bin].min, bins[bin].max, bvh->centers[i], bvh->radii[i]);
+    }
+    // Sweep from the right to get the cost of each right side, then from the left, finding the cheapest split.
+    // Splitting after bin i puts bins 0..i on the left.
+    float right_cost[SCENE_BVH_NUM_BINS];
+    float min[3], max[3];
+    box_empty(min, max);
+    int right_count = 0;
+    for (int i = SCENE_BVH_NUM_BINS - 1; i > 0; i--) {
+        right_count += bins[i].count;
+        box_add_box(min, max, bins[i].min, bins[i].max);
+        right_cost[i - 1] = right_count == 0 ? 0 : right_count * box_area(min, max);
+    }
+    box_empty(min, max);
+    int left_count = 0;
+    int best_split = -1;
+    float best_cost = INFINITY;
+    for (int i = 0; i < SCENE_BVH_NUM_BINS - 1; i++) {
+        left_count += bins[i].count;
+        box_add_box(min, max, bins[i].min, bins[i].max);
+        if (left_count == 0 || left_count == count) continue;
+        float cost = left_count * box_area(min, max) + right_cost[i];
+        if (cost < best_cost) {
+            best_cost = cost;
+            best_split = i;
+        }
+    }
+    if (best_split < 0) return;
+    // A leaf costs testing every body. Leaves are still split past a limit, so that a leaf is never very large.
+    if (best_cost >= count * box_area(node->min, node->max) && count <= 4 * SCENE_BVH_LEAF_SIZE) return;
+
+    // Partition the range.
+    int i = first;
+    int j = first + count - 1;
+    while (i <= j) {
+        if (bin_of(i) <= best_split) i ++;
+        else swap_items(bvh, i, j--);
+    }
+#undef bin_of
+    int left = bvh->num_nodes;
+    bvh->num_nodes += 2;
+    bvh->nodes[left].first = first;
+    bvh->nodes[left].count = i - first;
+    leaf_bounds(bvh, &bvh->nodes[left]);
+    bvh->nodes[left + 1].first = i;
+    bvh->nodes[left + 1].count = first + count - i;
+    leaf_bounds(bvh, &bvh->nodes[left + 1]);
+    node->first = left;
+    node->count = 0;
+    subdivide(bvh, left, depth + 1);
+    subdivide(bvh, left + 1, depth + 1);
+}
+
+void scene_bvh_build(SceneBVH *bvh, CullSpheres *spheres)
+{
+    int n = spheres->length;
+    if (n > bvh->bodies_capacity) {
+        bvh->bodies_capacity = n;
+        bvh->bodies = realloc(bvh->bodies, n * sizeof(Body *));
+        mem_check(bvh->bodies);
+        bvh->sphere_indices = realloc(bvh->sphere_indices, n * sizeof(int));
+        mem_check(bvh->sphere_indices);
+        bvh->centers = realloc(bvh->centers, n * sizeof(vec3));
+        mem_check(bvh->centers);
+        bvh->radii = realloc(bvh->radii, n * sizeof(float));
+        mem_check(bvh->radii);
+    }
+    // A binary tree with n leaves has 2n - 1 nodes.
+    if (2 * n > bvh->nodes_capacity) {
+        bvh->nodes_capacity = 2 * n;
+        bvh->nodes = realloc(bvh->nodes, bvh->nodes_capacity * sizeof(SceneBVHNode));
+        mem_check(bvh->nodes);
+    }
+    bvh->num_bodies = n;
+    for (int i = 0; i < n; i++) {
+        bvh->bodies[i] = spheres->bodies[i];
+        bvh->sphere_indices[i] = i;
+        bvh->centers[i] = new_vec3(spheres->x[i], spheres->y[i], spheres->z[i]);
+        bvh->radii[i] = spheres->r[i];
+    }
+    bvh->num_nodes = 0;
+    bvh->depth = 0;
+    bvh->built_area = 0;
+    if (n == 0) return;
+    bvh->num_nodes = 1;
+    bvh->nodes[0].first = 0;
+    bvh->nodes[0].count = n;
+    leaf_bounds(bvh, &bvh->nodes[0]);
+    subdivide(bvh, 0, 0);
+    bvh->built_area = box_area(bvh->nodes[0].min, bvh->nodes[0].max);
+}
+
+bool scene_bvh_refit(SceneBVH *bvh, CullSpheres *spheres)
+{
+    if (spheres->length != bvh->num_bodies) return false;
+    for (int i = 0; i < bvh->num_bodies; i++) {
+        int index = bvh->sphere_indices[i];
+        if (spheres->bodies[index] != bvh->bodies[i]) return false;
+        bvh->centers[i] = new_vec3(spheres->x[index], spheres->y[index], spheres->z[index]);
+        bvh->radii[i] = spheres->r[index];
+    }
+    for (int i = bvh->num_nodes - 1; i >= 0; i--) {
+        SceneBVHNode *node = &bvh->nodes[i];
+        if (node->count > 0) {
+            leaf_bounds(bvh, node);
+        } else {
+            SceneBVHNode *left = &bvh->nodes[node->first];
+            SceneBVHNode *right = &bvh->nodes[node->first + 1];
+            for (int j = 0; j < 3; j++) {
+                node->min[j] = MIN(left->min[j], right->min[j]);
+                node->max[j] = MAX(left->max[j], right->max[j]);
+            }
+        }
+    }
+    return true;
+}
+
+bool scene_bvh_update(SceneBVH *bvh, CullSpheres *spheres)
+{
+    if (scene_bvh_refit(bvh, spheres)
+            && (bvh->num_nodes == 0 || box_area(bvh->nodes[0].min, bvh->nodes[0].max) <= SCENE_BVH_REBUILD_GROWTH * bvh->built_area)) {
+        return false;
+    }
+    scene_bvh_build(bvh, spheres);
+    return true;
+}
+
+void scene_bvh_destroy(SceneBVH *bvh)
+{
+    free(bvh->nodes);
+    free(bvh->bodies);
+    free(bvh->sphere_indices);
+    free(bvh->centers);
+    free(bvh->radii);
+    memset(bvh, 0, sizeof(SceneBVH));
+}
+
+/*--------------------------------------------------------------------------------
+    Batched box and frustum queries.
+For each query, a node is either outside (the query is dropped from the mask for its subtree), fully inside (every body
+in the subtree passes without further tests), or neither (the query stays active).
+--------------------------------------------------------------------------------*/
+#define MAX_BATCH 32
+typedef struct QueryEntry_s {
+    int node;
+    uint32_t active;
+    uint32_t inside;
+} QueryEntry;
+
+// Classify a node against a frustum: -1 outside, 1 inside, 0 intersecting.
+static int frustum_box_classify(Frustum *f, float min[3], float max[3])
+{
+    int result = 1;
+    for (int i = 0; i < 6; i++) {
+        // The box corner furthest along the plane normal, and the one furthest against it.
+        float far = f->nx[i] * (f->nx[i] > 0 ? max[0] : min[0]) + f->ny[i] * (f->ny[i] > 0 ? max[1] : min[1]) + f->nz[i] * (f->nz[i] > 0 ? max[2] : min[2]) + f->d[i];
+        if (far < 0) return -1;
+        float near = f->nx[i] * (f->nx[i] > 0 ? min[0] : max[0]) + f->ny[i] * (f->ny[i] > 0 ? min[1] : max[1]) + f->nz[i] * (f->nz[i] > 0 ? min[2] : max[2]) + f->d[i];
+        if (near < 0) result = 0;
+    }
+    return result;
+}
+static int box_box_classify(vec3 query_min, vec3 query_max, float min[3], float max[3])
+{
+    int result = 1;
+    for (int i = 0; i < 3; i++) {
+        if (max[i] < query_min.vals[i] || min[i] > query_max.vals[i]) return -1;
+        if (min[i] < query_min.vals[i] || max[i] > query_max.vals[i]) result = 0;
+    }
+    return result;
+}
+static bool sphere_box_overlap(vec3 query_min, vec3 query_max, vec3 center, float radius)
+{
+    float dist_squared = 0;
+    for (int i = 0; i < 3; i++) {
+        float c = center.vals[i];
+        if (c < query_min.vals[i]) dist_squared += (query_min.vals[i] - c) * (query_min.vals[i] - c);
+        else if (c > query_max.vals[i]) dist_squared += (c - query_max.vals[i]) * (c - query_max.vals[i]);
+    }
+    return dist_squared <= radius * radius;
+}
+
+// The frustum and box queries only differ in their tests, so share the traversal.
+// (frustums is NULL for box queries.) The visit function is given query indices offset by the batch's start.
+static void query_batch(SceneBVH *bvh, int start, int num_queries, Frustum *frustums, vec3 *box_mins, vec3 *box_maxs, SceneBVHVisit visit, void *data)
+{
+    if (bvh->num_nodes == 0 || num_queries == 0) return;
+    // Depth-first, each level pops one entry and pushes two.
+    QueryEntry stack[bvh->depth + 2];
+    int stack_size = 0;
+    stack[stack_size ++] = (QueryEntry) { 0, num_queries == 32 ? 0xFFFFFFFF : (1u << num_queries) - 1, 0 };
+    while (stack_size > 0) {
+        QueryEntry entry = stack[-- stack_size];
+        SceneBVHNode *node = &bvh->nodes[entry.node];
+        uint32_t active = 0;
+        uint32_t inside = entry.inside;
+        for (int q = 0; q < num_queries; q++) {
+            if ((entry.active & (1u << q)) == 0) continue;
+            int c = frustums != NULL ? frustum_box_classify(&frustums[q], node->min, node->max)
+                                     : box_box_classify(box_mins[q], box_maxs[q], node->min, node->max);
+            if (c > 0) inside |= 1u << q;
+            else if (c == 0) active |= 1u << q;
+        }
+        if ((active | inside) == 0) continue;
+        if (node->count == 0) {
+            stack[stack_size ++] = (QueryEntry) { node->first + 1, active, inside };
+            stack[stack_size ++] = (QueryEntry) { node->first, active, inside };
+            continue;
+        }
+        for (int i = node->first; i < node->first + node->count; i++) {
+            for (int q = 0; q < num_queries; q++) {
+                if (inside & (1u << q)) {
+                    visit(bvh->bodies[i], start + q, data);
+                } else if (active & (1u << q)) {
+                    bool passes = frustums != NULL ? frustum_sphere_visible(&frustums[q], bvh->centers[i], bvh->radii[i])
+                                                   : sphere_box_overlap(box_mins[q], box_maxs[q], bvh->centers[i], bvh->radii[i]);
+                    if (passes) visit(bvh->bodies[i], start + q, data);
+                }
+            }
+        }
+    }
+}
+
+void scene_bvh_query_frustums(SceneBVH *bvh, int num_frustums, Frustum *frustums, SceneBVHVisit visit, void *data)
+{
+    for (int start = 0; start < num_frustums; start += MAX_BATCH) {
+        query_batch(bvh, start, MIN(MAX_BATCH, num_frustums - start), frustums + start, NULL, NULL, visit, data);
+    }
+}
+void scene_bvh_query_aabbs(SceneBVH *bvh, int num_boxes, vec3 *box_mins, vec3 *box_maxs, SceneBVHVisit visit, void *data)
+{
+    for (int start = 0; start < num_boxes; start += MAX_BATCH) {
+        query_batch(bvh, start, MIN(MAX_BATCH, num_boxes - start), NULL, box_mins + start, box_maxs + start, visit, data);
+    }
+}
+
+/*--------------------------------------------------------------------------------
+    Ray queries.
+Each ray traverses the tree front to back, visiting the nearer child first, and skipping nodes which begin past
+the nearest hit so far.
+--------------------------------------------------------------------------------*/
+// Slab test. Gives the distance the ray enters the box, or returns false if it misses it or enters past max_t.
+static bool ray_box(vec3 origin, vec3 inverse_direction, float min[3], float max[3], float max_t, float *t)
+{
+    float t_enter = 0;
+    float t_exit = max_t;
+    for (int i = 0; i < 3; i++) {
+        float t1 = (min[i] - origin.vals[i]) * inverse_direction.vals[i];
+        float t2 = (max[i] - origin.vals[i]) * inverse_direction.vals[i];
+        t_enter = MAX(t_enter, MIN(t1, t2));
+        t_exit = MIN(t_exit, MAX(t1, t2));
+    }
+    *t = t_enter;
+    return t_enter <= t_exit;
+}
+// The distance along the ray it enters the sphere (0 if the origin is inside).
+static bool ray_sphere(vec3 origin, vec3 direction, vec3 center, float radius, float *t)
+{
+    vec3 to_center = vec3_sub(center, origin);
+    float a = vec3_dot(direction, direction);
+    float b = vec3_dot(to_center, direction);
+    float c = vec3_dot(to_center, to_center) - radius * radius;
+    if (c <= 0) {
+        *t = 0;
+        return true;
+    }
+    float discriminant = b*b - a*c;
+    if (b <= 0 || discriminant < 0) return false;
+    *t = (b - sqrt(discriminant)) / a;
+    return true;
+}
+
+static SceneRayHit raycast(SceneBVH *bvh, vec3 origin, vec3 direction, SceneBVHHitTest hit_test, void *data)
+{
+    SceneRayHit hit = { NULL, INFINITY };
+    if (bvh->num_nodes == 0) return hit;
+    // (Division by a zero component gives an infinity, which the slab test handles.)
+    vec3 inverse_direction = new_vec3(1.0 / direction.vals[0], 1.0 / direction.vals[1], 1.0 / direction.vals[2]);
+    int stack[bvh->depth + 2];
+    int stack_size = 0;
+    float t;
+    if (!ray_box(origin, inverse_direction, bvh->nodes[0].min, bvh->nodes[0].max, INFINITY, &t)) return hit;
+    stack[stack_size ++] = 0;
+    while (stack_size > 0) {
+        SceneBVHNode *node = &bvh->nodes[stack[-- stack_size]];
+        if (!ray_box(origin, inverse_direction, node->min, node->max, hit.t, &t)) continue;
+        if (node->count == 0) {
+            float t_left, t_right;
+            bool left = ray_box(origin, inverse_direction, bvh->nodes[node->first].min, bvh->nodes[node->first].max, hit.t, &t_left);
+            bool right = ray_box(origin, inverse_direction, bvh->nodes[node->first + 1].min, bvh->nodes[node->first + 1].max, hit.t, &t_right);
+            // Push the further child first, so the nearer one is popped first.
+            if (left && right) {
+                stack[stack_size ++] = t_left <= t_right ? node->first + 1 : node->first;
+                stack[stack_size ++] = t_left <= t_right ? node->first : node->first + 1;
+            }
+            else if (left) stack[stack_size ++] = node->first;
+            else if (right) stack[stack_size ++] = node->first + 1;
+            continue;
+        }
+        for (int i = node->first; i < node->first + node->count; i++) {
+            if (!ray_sphere(origin, direction, bvh->centers[i], bvh->radii[i], &t) || t >= hit.t) continue;
+            if (hit_test != NULL && !hit_test(bvh->bodies[i], origin, direction, &t, data)) continue;
+            if (t < hit.t) {
+                hit.t = t;
+                hit.body = bvh->bodies[i];
+            }
+        }
+    }
+    return hit;
+}
+
+void scene_bvh_raycast(SceneBVH *bvh, int num_rays, vec3 *origins, vec3 *directions, SceneRayHit *hits, SceneBVHHitTest hit_test, void *data)
+{
+    for (int i = 0; i < num_rays; i++) {
+        hits[i] = raycast(bvh, origins[i], directions[i], hit_test, data);
+    }
+}
+
+Body *Camera_pick(Camera *camera, float x, float y, SceneBVHHitTest hit_test, void *data)
+{
+    // Picking can happen outside of rendering, so bring the tree up to date with the bodies first.
+    // The spheres are gathered separately, so g_cull_spheres is left as render gathered it.
+    static CullSpheres spheres = {0};
+    cull_gather_bodies(&spheres);
+    scene_bvh_update(&g_scene_bvh, &spheres);
+    vec3 origin, direction;
+    Camera_ray(camera, x, y, &origin, &direction);
+    SceneRayHit hit;
+    scene_bvh_raycast(&g_scene_bvh, 1, &origin, &direction, &hit, hit_test, data);
+    return hit.body;
+}
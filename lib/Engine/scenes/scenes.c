@@ -36,6 +36,8 @@ new_reader(Body) {
     bool is_ground; // "ground" doesn't cast shadows, so shadow maps can have increased resolution up to the non-ground scene.
     if (!dd_get(aspect_dd, "is_ground", "bool", &is_ground)) return false;
     body->is_ground = is_ground;
+    bool is_static; // Optional. Static bodies' shadows can be cached.
+    if (dd_get(aspect_dd, "is_static", "bool", &is_static)) body->is_static = is_static;
     
     //----dummy for now
     // Material *mat = oneoff_resource(Material, body->material);
@@ -86,12 +88,13 @@ void open_scene(DD *dict, char *path)
                 printf("Succeeded in reading a \"%s\" aspect.\n", aspect_readers[j].aspect_name);
                 if (aspect_type == Transform_TYPE_ID) { printf("%f %f %f\n", ((Transform *) data)->x, ((Transform *) data)->y, ((Transform *) data)->z); }
             }
-
-            ////////////////////////////////////////////////////////////////////////////////
-            ////// close the dictionaries
-            
+            for (int k = 0; k < num_aspects; k++) dd_close(aspect_dictionaries[k]);
+            free(aspect_dictionaries);
         }
+        dd_close(gameobject_dictionaries[i]);
     }
+    free(gameobject_dictionaries);
+    dd_close(scene_dictionary);
 }
 
 
@@ -5,17 +5,38 @@ just a separate header. But this may be nicer for editing the module.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include "helper_definitions.h"
 #include "data_dictionary.h"
 #include "data_dictionary_implementation.h"
 
 DataDictionary *dd_fopen(char *path)
+{
+    size_t len = strlen(path);
+    if (len >= 4 && strcmp(path + len - 4, ".ddb") == 0) {
+        DataDictionary *dict = dd_map_compiled(path, false);
+        if (dict == NULL) printf("Could not open compiled data-dictionary \"%s\".\n", path);
+        return dict;
+    }
+    // Use the compiled image if there is one and none of its source files have changed.
+    const int n = 4096;
+    char compiled_path[n];
+    if (snprintf(compiled_path, n, "%sb", path) < n) {
+        DataDictionary *dict = dd_map_compiled(compiled_path, true);
+        if (dict != NULL) return dict;
+    }
+    return dd_fopen_text(path);
+}
+
+DataDictionary *dd_fopen_text(char *path)
 {
     FILE *file = fopen(path, "r");
     if (file == NULL) {
         printf("Could not find data-dictionary file \"%s\".\n", path);
         return NULL;
     }
+    dd_clear_source_files();
+    dd_note_source_file(path);
     dd_push_file(file);
     dd_yyparse();
     
@@ -28,27 +49,23 @@ DataDictionary *dd_fopen(char *path)
         printf("Something went wrong when trying to open data-dictionary file \"%s\".\n", path);
         return NULL;
     }
+    dict->refcount = 1;
     return dict;
 }
 
 static DataDictionary *___dd_open(DataDictionary *dict, char *name)
 {
-    // Non-recursive opening.
-    DictExpression *expression = lookup_dict_expression(dict, name, NULL);
-    if (expression == NULL) return NULL;
-    DataDictionary *found_dict = resolve_dictionary_expression(dict, expression);
-    // Give it a pointer to the queried dictionary, for scoping purposes. This means that queried-for dictionaries
-    // form a tree of dictionary tables.
-    found_dict->parent_dictionary = dict;
-    return found_dict;
+    // Non-recursive opening. If the dictionary is already open, it is shared.
+    DictionaryTableCell *cell = lookup_dict_cell(dict, name, NULL);
+    if (cell == NULL || cell->contents.dict.dict_expression == NULL) return NULL;
+    return open_dictionary_cell(dict, cell);
 }
 DataDictionary *dd_open(DataDictionary *dict, char *path)
 {
     // Recursive opening. Follow the /-separated path. Each scope is checked, starting with the deepest.
     DD *scope_dict = dict;
-    printf("Opening \"%s\"\n", path);
+    /* printf("Opening \"%s\"\n", path); */
 
-    int c = 0;
     while (scope_dict != NULL) {
         char *p = path;
         DataDictionary *cur_dict = scope_dict;
@@ -67,7 +84,10 @@ DataDictionary *dd_open(DataDictionary *dict, char *path)
             }
             strncpy(buf, p, sep - p);
             buf[sep - p] = '\0';
-            cur_dict = ___dd_open(cur_dict, buf);
+            DataDictionary *next_dict = ___dd_open(cur_dict, buf);
+            // Intermediate dictionaries on the path are kept open by their children, so their own reference can be released.
+            if (cur_dict != scope_dict) dd_close(cur_dict);
+            cur_dict = next_dict;
             if (cur_dict != NULL && finish) {
                 return cur_dict;
             }
@@ -75,41 +95,80 @@ DataDictionary *dd_open(DataDictionary *dict, char *path)
             p = sep + 1;
         }
         scope_dict = scope_dict->parent_dictionary;
-        ///////not closing dictionaries.
     }
     // Failed to find in any scope.
     return NULL;
 }    
 
+void dd_close(DataDictionary *dict)
+{
+    if (dict == NULL) return;
+    if (dict->refcount <= 0) {
+        fprintf(stderr, ERROR_ALERT "dd_close: Attempted to close a dictionary which is not open.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (-- dict->refcount > 0) return;
+
+    // Free the table. Open subdictionaries hold a reference to this one, so there are none.
+    for (int i = 0; i < dict->table_size && !dict->mapped; i++) {
+        DictionaryTableCell *cell = &dict->table[i];
+        if (cell->name == -1 || !cell->is_dict) continue;
+        free(cell->contents.dict.types);
+        // The expression was copied into this table when masked. Literal operands point into the IR, which is kept.
+        DictExpression *expression = cell->contents.dict.dict_expression;
+        while (expression != NULL) {
+            DictExpression *next = expression->next;
+            free(expression);
+            expression = next;
+        }
+    }
+    if (!dict->mapped) free(dict->table);
+    for (int i = 0; i < dict->num_bases; i++) dd_close(dict->bases[i]);
+    free(dict->bases);
+    // Remove this from the cache in the parent, and release the reference on the parent.
+    DataDictionary *parent = dict->parent_dictionary;
+    bool opened_from_parent = dict->parent_cell != NULL;
+    if (opened_from_parent) dict->parent_cell->contents.dict.opened = NULL;
+    // Only the root of a compiled image holds the mapping, and it is closed last.
+    if (dict->image != NULL) munmap(dict->image, dict->image_size);
+    free(dict);
+    if (opened_from_parent) dd_close(parent);
+}
+
 
 // Lookup a value in a dictionary.
 bool dd_get(DataDictionary *dict, char *name, char *type, void *data)
 {
-    uint32_t hash = hash_crc32(name);
-    int index = hash % dict->table_size;
-    while (dict->table[index].name != -1) {
-        if (strcmp(name, symbol(dict->table[index].name)) == 0) {
-            if (dict->table[index].is_dict) {
-                printf("ERROR dd_get: Attempted to extract dictionary-entry \"%s\" from dictionary as a value.\n", name);
-                return false;
-            }
-            if (strcmp(symbol(dict->table[index].contents.value.type), type) != 0) {
-                printf("ERROR dd_get: Unexpected type, attempted to extract \"%s %s\" when \"%s\"'s type is \"%s\".\n", type, name, name, symbol(dict->table[index].contents.value.type));
-                return false;
-            }
-            DDTypeReader reader = dd_get_reader(type);
-            if (reader == NULL) {
-                printf("ERROR dd_get: No type reader for type \"%s\".\n", type);
-                return false;
-            }
-            // Use the type-reader to parse the value-text.
-            return reader(symbol(dict->table[index].contents.value.value_text), data);
-        }
-        //note: Make sure this mirrors the hashing and indexing done when the table is created.
-        index = (index + 1) % dict->table_size;
+    // Names which have not been interned can't be in any table.
+    int name_symbol = find_symbol(name);
+    DictionaryTableCell *cell = name_symbol == -1 ? NULL : dictionary_table_find(dict, name_symbol);
+    if (cell == NULL || cell->name == -1) {
+        printf("ERROR dd_get: Entry \"%s\" not found in dictionary.\n", name);
+        return false;
     }
-    printf("ERROR dd_get: Entry \"%s\" not found in dictionary.\n", name);
-    return false;
+    if (cell->is_dict) {
+        printf("ERROR dd_get: Attempted to extract dictionary-entry \"%s\" from dictionary as a value.\n", name);
+        return false;
+    }
+    if (cell->contents.value.type == -1) {
+        printf("ERROR dd_get: Attempted to extract \"%s %s\" when \"%s\" has no type.\n", type, name, name);
+        return false;
+    }
+    if (cell->contents.value.type != find_symbol(type)) {
+        printf("ERROR dd_get: Unexpected type, attempted to extract \"%s %s\" when \"%s\"'s type is \"%s\".\n", type, name, name, symbol(cell->contents.value.type));
+        return false;
+    }
+    int type_id = cell->contents.value.type_id;
+    if (type_id == -1) {
+        printf("ERROR dd_get: No type reader for type \"%s\".\n", type);
+        return false;
+    }
+    if (cell->contents.value.parsed) {
+        memcpy(data, cell->contents.value.data, dd_type_readers[type_id].size);
+        return true;
+    }
+    // Not pre-parsed, so use the type-reader to parse the value-text.
+    return dd_type_readers[type_id].reader(symbol(cell->contents.value.value_text), data);
 }
 
 void dd_print_table(DataDictionary *dict_table)
@@ -211,33 +270,45 @@ DD_TYPE_READER(ivec2) { return read_comma_separated_C_type(text, data, "d", size
 DD_TYPE_READER(ivec3) { return read_comma_separated_C_type(text, data, "d", sizeof(int), 3); }
 DD_TYPE_READER(ivec4) { return read_comma_separated_C_type(text, data, "d", sizeof(int), 4); }
 
-#define type(TYPE) { dd_type_reader_ ## TYPE, #TYPE }
-const struct { DDTypeReader reader; const char *type_name; } dd_type_readers[] = {
-    type(bool),
-    type(int),
-    type(float),
-    type(uint),
-    type(vec2),
-    type(vec3),
-    type(vec4),
-    type(ivec2),
-    type(ivec3),
-    type(ivec4),
-    type(string),
-    { NULL, NULL }
+// Strings are not pre-parsed, since a new string is given to the retriever of each query.
+#define type(TYPE,SIZE) { dd_type_reader_ ## TYPE, #TYPE, ( SIZE ) }
+const DDType dd_type_readers[] = {
+    type(bool, sizeof(bool)),
+    type(int, sizeof(int)),
+    type(float, sizeof(float)),
+    type(uint, sizeof(unsigned int)),
+    type(vec2, 2*sizeof(float)),
+    type(vec3, 3*sizeof(float)),
+    type(vec4, 4*sizeof(float)),
+    type(ivec2, 2*sizeof(int)),
+    type(ivec3, 3*sizeof(int)),
+    type(ivec4, 4*sizeof(int)),
+    type(string, 0),
+    { NULL, NULL, 0 }
 };
 #undef type
 
-DDTypeReader dd_get_reader(const char *type)
+int dd_type_id(int type_symbol)
 {
-    int i = 0;
-    while (dd_type_readers[i].reader != NULL && dd_type_readers[i].type_name != NULL) {
-        if (strcmp(type, dd_type_readers[i].type_name) == 0) {
-            return dd_type_readers[i].reader;
-        }
-        i++;
+    // The type names are interned the first time, so types can be found by symbol.
+    static int type_symbols[sizeof(dd_type_readers) / sizeof(dd_type_readers[0])];
+    static bool interned_type_names = false;
+    if (!interned_type_names) {
+        for (int i = 0; dd_type_readers[i].type_name != NULL; i++) type_symbols[i] = new_symbol((char *) dd_type_readers[i].type_name);
+        interned_type_names = true;
     }
-    return NULL;
+    for (int i = 0; dd_type_readers[i].type_name != NULL; i++) {
+        if (type_symbols[i] == type_symbol) return i;
+    }
+    return -1;
+}
+DDTypeReader dd_get_reader(const char *type)
+{
+    int type_symbol = find_symbol(type);
+    if (type_symbol == -1) return NULL;
+    int type_id = dd_type_id(type_symbol);
+    if (type_id == -1) return NULL;
+    return dd_type_readers[type_id].reader;
 }
 
 int dd_scan(DataDictionary *dd, DataDictionary ***scanned, const char *type_string)
@@ -251,12 +322,13 @@ int dd_scan(DataDictionary *dd, DataDictionary ***scanned, const char *type_stri
     const int max_num_scanned = 1024;
     int count = 0;
     int to_open[max_num_scanned];
+    int type_symbol = find_symbol(type_string); // if not interned, nothing has this type.
 
     for (int i = 0; i < dd->table_size; i++) {
         if (dd->table[i].name != -1 && dd->table[i].is_dict) {
             // Try to match the type.
             for (int j = 0; j < dd->table[i].contents.dict.num_types; j++) {
-                if (strcmp(type_string, symbol(dd->table[i].contents.dict.types[j])) == 0) {
+                if (type_symbol != -1 && dd->table[i].contents.dict.types[j] == type_symbol) {
                     if (count >= max_num_scanned) {
                         fprintf(stderr, ERROR_ALERT "dd_scan: Encountered too many dictionaries. The maximum is set to %d, and this can be increased.\n", max_num_scanned);
                         exit(EXIT_FAILURE);
@@ -270,10 +342,8 @@ int dd_scan(DataDictionary *dd, DataDictionary ***scanned, const char *type_stri
     DataDictionary **opened_dds = (DataDictionary **) calloc(1, sizeof(DataDictionary *) * count);
     mem_check(opened_dds);
     for (int i = 0; i < count; i++) {
-        // Go through the scanned indices, and open each dictionary by resolving the expression at that index.
-        DictExpression *expression = dd->table[to_open[i]].contents.dict.dict_expression;
-        opened_dds[i] = resolve_dictionary_expression(dd, expression);
-        opened_dds[i]->parent_dictionary = dd;
+        // Go through the scanned indices, and open each dictionary at that index.
+        opened_dds[i] = open_dictionary_cell(dd, &dd->table[to_open[i]]);
     }
     *scanned = opened_dds;
     return count;
@@ -314,3 +384,30 @@ void dd_print(DataDictionary *dd)
     printf("--------------------------------------------------------------------------------\n");
 }
 
+void dd_stats(DataDictionary *dd)
+{
+    // The probe length of an entry is its distance from the cell its hash maps to.
+    int mask = dd->table_size - 1;
+    int total_probe_length = 0;
+    int max_probe_length = 0;
+    const int num_buckets = 8;
+    int histogram[num_buckets];
+    memset(histogram, 0, sizeof(histogram));
+    for (int i = 0; i < dd->table_size; i++) {
+        if (dd->table[i].name == -1) continue;
+        int probe_length = (i - (int) (dd->table[i].hash & mask)) & mask;
+        total_probe_length += probe_length;
+        if (probe_length > max_probe_length) max_probe_length = probe_length;
+        histogram[probe_length < num_buckets - 1 ? probe_length : num_buckets - 1] ++;
+    }
+    printf("---dictionary stats-------------------------------------------------------------\n");
+    printf("entries: %d\n", dd->num_entries);
+    printf("table size: %d\n", dd->table_size);
+    printf("load factor: %.3f\n", dd->num_entries / (float) dd->table_size);
+    printf("mean probe length: %.3f\n", dd->num_entries == 0 ? 0.0 : total_probe_length / (float) dd->num_entries);
+    printf("max probe length: %d\n", max_probe_length);
+    printf("probe lengths:");
+    for (int i = 0; i < num_buckets; i++) printf(" %d%s:%d", i, i == num_buckets - 1 ? "+" : "", histogram[i]);
+    printf("\n");
+    printf("--------------------------------------------------------------------------------\n");
+}
@@ -0,0 +1,405 @@
+/*--------------------------------------------------------------------------------
+Compiled data-dictionary images
+-------------------------------
+Text .dd files are the authoring format. dd_compile parses a .dd file and its includes, resolves
+the tables of its subdictionaries, and writes everything out as an image:
+    - header
+    - source files (path, size and modification time), to tell if the image is out of date.
+    - the symbol table.
+    - the AST (EntryNodes and DictExpressions) and the resolved tables, in the same layout as
+      they are in memory, with pointers stored as offsets into the image.
+    - relocations: the positions of every pointer and every symbol in the image.
+
+Loading maps the image privately and applies the relocations (adding the mapping address to pointers,
+and replacing symbols with the symbols they were interned as). There is no parsing or masking, and the
+root table and prebuilt subdictionary tables are queried in place.
+
+The layout is that of this build, so the image records the struct sizes and is rejected if they change.
+--------------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "helper_definitions.h"
+#include "data_dictionary_implementation.h"
+
+#define DDB_MAGIC "DDB1"
+#define DDB_VERSION 2
+#define DDB_MAX_PATH_LENGTH 256
+
+typedef struct DDBHeader_s {
+    char magic[4];
+    uint32_t version;
+    // Layout checks.
+    uint32_t cell_size;
+    uint32_t entry_size;
+    uint32_t expression_size;
+    uint32_t num_source_files;
+    uint64_t source_files_offset;
+    uint64_t symbols_offset;
+    uint64_t symbols_size;
+    uint64_t pointer_relocations_offset;
+    uint64_t num_pointer_relocations;
+    uint64_t symbol_relocations_offset;
+    uint64_t num_symbol_relocations;
+    uint64_t root_table_offset;
+    uint32_t root_table_size;
+    uint32_t root_num_entries;
+} DDBHeader;
+
+typedef struct DDBSourceFile_s {
+    char path[DDB_MAX_PATH_LENGTH];
+    int64_t size;
+    int64_t modification_time;
+} DDBSourceFile;
+
+/*--------------------------------------------------------------------------------
+    Source files. These are noted while parsing, for the image to be able to check if it is up to date.
+--------------------------------------------------------------------------------*/
+static DDBSourceFile *g_source_files = NULL;
+static int g_num_source_files = 0;
+static int g_source_files_size = 0;
+
+void dd_clear_source_files(void)
+{
+    g_num_source_files = 0;
+}
+void dd_note_source_file(char *path)
+{
+    if (strlen(path) >= DDB_MAX_PATH_LENGTH) {
+        fprintf(stderr, ERROR_ALERT "Data-dictionary source path \"%s\" is too long to be noted for compilation.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    if (g_num_source_files == g_source_files_size) {
+        g_source_files_size = g_source_files_size == 0 ? 16 : g_source_files_size * 2;
+        g_source_files = (DDBSourceFile *) realloc(g_source_files, sizeof(DDBSourceFile) * g_source_files_size);
+        mem_check(g_source_files);
+    }
+    DDBSourceFile *source = &g_source_files[g_num_source_files ++];
+    memset(source, 0, sizeof(DDBSourceFile));
+    strcpy(source->path, path);
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        source->size = st.st_size;
+        source->modification_time = st.st_mtime;
+    }
+}
+
+/*--------------------------------------------------------------------------------
+    Writing images.
+--------------------------------------------------------------------------------*/
+typedef struct DDBWritten_s {
+    const void *object;
+    uint64_t offset;
+} DDBWritten;
+typedef struct DDBWriter_s {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    uint64_t *pointer_relocations;
+    size_t num_pointer_relocations;
+    size_t pointer_relocations_capacity;
+    uint64_t *symbol_relocations;
+    size_t num_symbol_relocations;
+    size_t symbol_relocations_capacity;
+    // Map from written objects to their offsets, so that shared AST nodes are written once.
+    DDBWritten *written;
+    size_t written_size;
+    size_t num_written;
+} DDBWriter;
+
+static uint64_t ddb_alloc(DDBWriter *w, size_t size)
+{
+    // Allocate zeroed space in the image, aligned for any of the structs. Offsets are used instead of pointers, since the image can move.
+    size_t offset = (w->size + 7) & ~((size_t) 7);
+    if (offset + size > w->capacity) {
+        while (offset + size > w->capacity) w->capacity = w->capacity == 0 ? 4096 : w->capacity * 2;
+        w->data = (uint8_t *) realloc(w->data, w->capacity);
+        mem_check(w->data);
+    }
+    memset(w->data + w->size, 0, offset + size - w->size);
+    w->size = offset + size;
+    return offset;
+}
+static void ddb_add_relocation(uint64_t **relocations, size_t *num, size_t *capacity, uint64_t position)
+{
+    if (*num == *capacity) {
+        *capacity = *capacity == 0 ? 1024 : *capacity * 2;
+        *relocations = (uint64_t *) realloc(*relocations, sizeof(uint64_t) * *capacity);
+        mem_check(*relocations);
+    }
+    (*relocations)[(*num) ++] = position;
+}
+static void ddb_pointer(DDBWriter *w, uint64_t position, uint64_t target)
+{
+    // Write a pointer field as an offset. Offset 0 is the header, so it stands for NULL.
+    memcpy(w->data + position, &target, sizeof(uint64_t));
+    if (target != 0) ddb_add_relocation(&w->pointer_relocations, &w->num_pointer_relocations, &w->pointer_relocations_capacity, position);
+}
+static void ddb_symbol(DDBWriter *w, uint64_t position)
+{
+    // The symbol is already there, it just needs to be offset when loaded.
+    ddb_add_relocation(&w->symbol_relocations, &w->num_symbol_relocations, &w->symbol_relocations_capacity, position);
+}
+
+static uint64_t *ddb_written(DDBWriter *w, const void *object, bool *found)
+{
+    // Find the offset an object was written to, or add an entry for it.
+    if (2*(w->num_written + 1) > w->written_size) {
+        size_t old_size = w->written_size;
+        DDBWritten *old = w->written;
+        w->written_size = w->written_size == 0 ? 1024 : w->written_size * 2;
+        w->written = (DDBWritten *) calloc(w->written_size, sizeof(DDBWritten));
+        mem_check(w->written);
+        w->num_written = 0;
+        for (size_t i = 0; i < old_size; i++) {
+            bool rehashed_found;
+            if (old[i].object != NULL) *ddb_written(w, old[i].object, &rehashed_found) = old[i].offset;
+        }
+        free(old);
+    }
+    size_t mask = w->written_size - 1;
+    size_t index = ((((uintptr_t) object) >> 3) * 0x9e3779b97f4a7c15ULL >> 20) & mask;
+    while (w->written[index].object != NULL) {
+        if (w->written[index].object == object) {
+            *found = true;
+            return &w->written[index].offset;
+        }
+        index = (index + 1) & mask;
+    }
+    *found = false;
+    w->written[index].object = object;
+    w->num_written ++;
+    return &w->written[index].offset;
+}
+
+static uint64_t ddb_write_entries(DDBWriter *w, EntryNode *node);
+static uint64_t ddb_write_expression(DDBWriter *w, DictExpression *expression)
+{
+    // Write a linked list of operands, stopping if it joins a list which has already been written.
+    uint64_t first = 0;
+    uint64_t prev = 0;
+    while (expression != NULL) {
+        bool found;
+        uint64_t *written = ddb_written(w, expression, &found);
+        uint64_t offset = *written;
+        if (!found) {
+            // Note the offset before writing what this points to, which can grow the map.
+            offset = *written = ddb_alloc(w, sizeof(DictExpression));
+            DictExpression *out = (DictExpression *) (w->data + offset);
+            out->is_name = expression->is_name;
+            out->name = expression->is_name ? expression->name : -1;
+            if (out->is_name) ddb_symbol(w, offset + offsetof(DictExpression, name));
+            uint64_t dict = ddb_write_entries(w, expression->dict);
+            ddb_pointer(w, offset + offsetof(DictExpression, dict), dict);
+        }
+        if (prev == 0) first = offset;
+        else ddb_pointer(w, prev + offsetof(DictExpression, next), offset);
+        if (found) break;
+        prev = offset;
+        expression = expression->next;
+    }
+    return first;
+}
+static uint64_t ddb_write_entries(DDBWriter *w, EntryNode *node)
+{
+    uint64_t first = 0;
+    uint64_t prev = 0;
+    while (node != NULL) {
+        bool found;
+        uint64_t *written = ddb_written(w, node, &found);
+        uint64_t offset = *written;
+        if (!found) {
+            // Note the offset before writing what this points to, which can grow the map.
+            offset = *written = ddb_alloc(w, sizeof(EntryNode));
+            EntryNode *out = (EntryNode *) (w->data + offset);
+            out->is_dict = node->is_dict;
+            out->name = node->name;
+            // Dictionary nodes don't have a type or value-text, so make sure these aren't relocated as symbols.
+            out->type = node->is_dict ? -1 : node->type;
+            out->value_text = node->is_dict ? -1 : node->value_text;
+            ddb_symbol(w, offset + offsetof(EntryNode, name));
+            ddb_symbol(w, offset + offsetof(EntryNode, type));
+            ddb_symbol(w, offset + offsetof(EntryNode, value_text));
+            uint64_t expression = ddb_write_expression(w, node->dict_expression);
+            ddb_pointer(w, offset + offsetof(EntryNode, dict_expression), expression);
+        }
+        if (prev == 0) first = offset;
+        else ddb_pointer(w, prev + offsetof(EntryNode, next), offset);
+        if (found) break;
+        prev = offset;
+        node = node->next;
+    }
+    return first;
+}
+
+static uint64_t ddb_write_table(DDBWriter *w, DataDictionary *dd, int prebuilt_depth)
+{
+    // Write a resolved table. Subdictionaries are opened (resolved) and written as well, down to the given depth.
+    uint64_t table = ddb_alloc(w, sizeof(DictionaryTableCell) * dd->table_size);
+    for (int i = 0; i < dd->table_size; i++) {
+        DictionaryTableCell *cell = &dd->table[i];
+        uint64_t position = table + i * sizeof(DictionaryTableCell);
+        #define out ((DictionaryTableCell *) (w->data + position))
+        out->name = cell->name;
+        if (cell->name == -1) continue;
+        ddb_symbol(w, position + offsetof(DictionaryTableCell, name));
+        out->hash = cell->hash;
+        out->is_dict = cell->is_dict;
+        if (!cell->is_dict) {
+            memcpy(&out->contents.value, &cell->contents.value, sizeof(cell->contents.value));
+            ddb_symbol(w, position + offsetof(DictionaryTableCell, contents.value.type));
+            ddb_symbol(w, position + offsetof(DictionaryTableCell, contents.value.value_text));
+            continue;
+        }
+        uint64_t expression = ddb_write_expression(w, cell->contents.dict.dict_expression);
+        ddb_pointer(w, position + offsetof(DictionaryTableCell, contents.dict.dict_expression), expression);
+
+        int num_types = cell->contents.dict.num_types;
+        uint64_t types = ddb_alloc(w, sizeof(int) * num_types);
+        memcpy(w->data + types, cell->contents.dict.types, sizeof(int) * num_types);
+        for (int j = 0; j < num_types; j++) ddb_symbol(w, types + sizeof(int) * j);
+        out->contents.dict.num_types = num_types;
+        ddb_pointer(w, position + offsetof(DictionaryTableCell, contents.dict.types), num_types == 0 ? 0 : types);
+
+        if (prebuilt_depth > 0 && cell->contents.dict.dict_expression != NULL) {
+            DataDictionary *opened = open_dictionary_cell(dd, cell);
+            uint64_t prebuilt_table = ddb_write_table(w, opened, prebuilt_depth - 1);
+            out->contents.dict.prebuilt_table_size = opened->table_size;
+            out->contents.dict.prebuilt_num_entries = opened->num_entries;
+            ddb_pointer(w, position + offsetof(DictionaryTableCell, contents.dict.prebuilt_table), prebuilt_table);
+            dd_close(opened);
+        }
+        #undef out
+    }
+    return table;
+}
+
+bool dd_compile(char *path, char *ddb_path, int prebuilt_depth)
+{
+    DataDictionary *dd = dd_fopen_text(path);
+    if (dd == NULL) return false;
+    // Resolving subdictionaries can't add source files, since includes are flattened when parsing.
+    int num_source_files = g_num_source_files;
+
+    DDBWriter writer = {0};
+    DDBWriter *w = &writer;
+    uint64_t header = ddb_alloc(w, sizeof(DDBHeader));
+    uint64_t source_files = ddb_alloc(w, sizeof(DDBSourceFile) * num_source_files);
+    memcpy(w->data + source_files, g_source_files, sizeof(DDBSourceFile) * num_source_files);
+    uint64_t root_table = ddb_write_table(w, dd, prebuilt_depth);
+
+    // The symbol table is written after the tables, since resolving subdictionaries can create symbols.
+    size_t symbols_size;
+    char *symbols_data = symbol_table_data(&symbols_size);
+    uint64_t symbols = ddb_alloc(w, symbols_size);
+    memcpy(w->data + symbols, symbols_data, symbols_size);
+    uint64_t pointer_relocations = ddb_alloc(w, sizeof(uint64_t) * w->num_pointer_relocations);
+    memcpy(w->data + pointer_relocations, w->pointer_relocations, sizeof(uint64_t) * w->num_pointer_relocations);
+    uint64_t symbol_relocations = ddb_alloc(w, sizeof(uint64_t) * w->num_symbol_relocations);
+    memcpy(w->data + symbol_relocations, w->symbol_relocations, sizeof(uint64_t) * w->num_symbol_relocations);
+
+    DDBHeader *h = (DDBHeader *) (w->data + header);
+    memcpy(h->magic, DDB_MAGIC, 4);
+    h->version = DDB_VERSION;
+    h->cell_size = sizeof(DictionaryTableCell);
+    h->entry_size = sizeof(EntryNode);
+    h->expression_size = sizeof(DictExpression);
+    h->num_source_files = num_source_files;
+    h->source_files_offset = source_files;
+    h->symbols_offset = symbols;
+    h->symbols_size = symbols_size;
+    h->pointer_relocations_offset = pointer_relocations;
+    h->num_pointer_relocations = w->num_pointer_relocations;
+    h->symbol_relocations_offset = symbol_relocations;
+    h->num_symbol_relocations = w->num_symbol_relocations;
+    h->root_table_offset = root_table;
+    h->root_table_size = dd->table_size;
+    h->root_num_entries = dd->num_entries;
+
+    bool success = false;
+    FILE *file = fopen(ddb_path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, ERROR_ALERT "Could not open \"%s\" to write compiled data-dictionary.\n", ddb_path);
+    } else {
+        success = fwrite(w->data, 1, w->size, file) == w->size;
+        if (fclose(file) != 0) success = false;
+        if (!success) fprintf(stderr, ERROR_ALERT "Failed to write compiled data-dictionary \"%s\".\n", ddb_path);
+    }
+    free(w->data);
+    free(w->pointer_relocations);
+    free(w->symbol_relocations);
+    free(w->written);
+    dd_close(dd);
+    return success;
+}
+
+/*--------------------------------------------------------------------------------
+    Loading images.
+--------------------------------------------------------------------------------*/
+DataDictionary *dd_map_compiled(char *ddb_path, bool check_sources)
+{
+    // Returns NULL if there is no valid image, or, if checking sources, if any of its source files have changed.
+    int fd = open(ddb_path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(DDBHeader)) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = st.st_size;
+    // Private, so relocating and caching opened dictionaries in the cells doesn't touch the file.
+    uint8_t *image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) return NULL;
+    #define reject(STRING) { printf("Not using compiled data-dictionary \"%s\": " STRING "\n", ddb_path); munmap(image, size); return NULL; }
+    DDBHeader *h = (DDBHeader *) image;
+    if (memcmp(h->magic, DDB_MAGIC, 4) != 0 || h->version != DDB_VERSION) reject("invalid or old version.");
+    if (h->cell_size != sizeof(DictionaryTableCell) || h->entry_size != sizeof(EntryNode) || h->expression_size != sizeof(DictExpression)) {
+        reject("compiled with a different layout.");
+    }
+    if (h->symbol_relocations_offset + sizeof(uint64_t) * h->num_symbol_relocations > size) reject("truncated.");
+    if (check_sources) {
+        DDBSourceFile *source_files = (DDBSourceFile *) (image + h->source_files_offset);
+        for (int i = 0; i < h->num_source_files; i++) {
+            struct stat source_st;
+            if (stat(source_files[i].path, &source_st) != 0
+                    || source_st.st_size != source_files[i].size
+                    || source_st.st_mtime != source_files[i].modification_time) {
+                munmap(image, size);
+                return NULL;
+            }
+        }
+    }
+    #undef reject
+
+    // Relocate.
+    int *symbol_remap = intern_symbol_block((char *) image + h->symbols_offset, h->symbols_size);
+    uint64_t *pointer_relocations = (uint64_t *) (image + h->pointer_relocations_offset);
+    for (uint64_t i = 0; i < h->num_pointer_relocations; i++) {
+        uint64_t *pointer = (uint64_t *) (image + pointer_relocations[i]);
+        *pointer = (uint64_t) (uintptr_t) (image + *pointer);
+    }
+    uint64_t *symbol_relocations = (uint64_t *) (image + h->symbol_relocations_offset);
+    for (uint64_t i = 0; i < h->num_symbol_relocations; i++) {
+        int *symbol = (int *) (image + symbol_relocations[i]);
+        if (*symbol != -1) *symbol = symbol_remap[*symbol];
+    }
+    free(symbol_remap);
+
+    DataDictionary *dd = (DataDictionary *) calloc(1, sizeof(DataDictionary));
+    mem_check(dd);
+    dd->table = (DictionaryTableCell *) (image + h->root_table_offset);
+    dd->table_size = h->root_table_size;
+    dd->num_entries = h->root_num_entries;
+    dd->mapped = true;
+    dd->image = image;
+    dd->image_size = size;
+    dd->refcount = 1;
+    return dd;
+}
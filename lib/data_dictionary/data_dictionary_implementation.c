@@ -1,7 +1,7 @@
 /*--------------------------------------------------------------------------------
     bugs and problems:
-        The IR is being changed when expressions are concatenated. If the IR form is still used,
-        copy it when it is being appended to an expression.
+        Dictionary-expressions are copied into table cells when masked, so that the IR is not changed when
+        expressions are concatenated. The copies are owned by the table.
 --------------------------------------------------------------------------------*/
 #include <stdio.h>
 #include <string.h>
@@ -12,27 +12,78 @@
 #include "data_dictionary_implementation.h"
 //- Symbol table -----------------------------------------------------------------
 // Taken from the gen_shader_blocks code.
+// Symbols are interned, so each distinct string is stored once and names can be compared by their symbol.
+// Each string is preceded by its hash (dd_name_hash), and a symbol is the position of its string.
 static char *symbol_table = NULL;
 static size_t symbol_table_size;
 static int symbol_table_position = 0;
 #define SYMBOL_TABLE_START_SIZE 3000
+// Open-addressed table of symbols, for interning.
+static int *symbol_lookup = NULL;
+static int symbol_lookup_size = 0;
+static int num_symbols = 0;
+#define SYMBOL_LOOKUP_START_SIZE 256
 
+uint32_t symbol_hash(int entry)
+{
+    uint32_t hash;
+    memcpy(&hash, symbol_table + entry - sizeof(uint32_t), sizeof(uint32_t));
+    return hash;
+}
+static int *symbol_lookup_find(const char *string, uint32_t hash)
+{
+    // Gives the slot with this string's symbol, or the empty slot (-1) where it would go.
+    int mask = symbol_lookup_size - 1;
+    int index = hash & mask;
+    while (symbol_lookup[index] != -1) {
+        int entry = symbol_lookup[index];
+        if (symbol_hash(entry) == hash && strcmp(symbol_table + entry, string) == 0) break;
+        index = (index + 1) & mask;
+    }
+    return &symbol_lookup[index];
+}
+static void grow_symbol_lookup(void)
+{
+    int *old_lookup = symbol_lookup;
+    int old_size = symbol_lookup_size;
+    symbol_lookup_size = symbol_lookup_size == 0 ? SYMBOL_LOOKUP_START_SIZE : symbol_lookup_size * 2;
+    symbol_lookup = (int *) malloc(sizeof(int) * symbol_lookup_size);
+    mem_check(symbol_lookup);
+    for (int i = 0; i < symbol_lookup_size; i++) symbol_lookup[i] = -1;
+    for (int i = 0; i < old_size; i++) {
+        if (old_lookup[i] == -1) continue;
+        *symbol_lookup_find(symbol_table + old_lookup[i], symbol_hash(old_lookup[i])) = old_lookup[i];
+    }
+    free(old_lookup);
+}
+
+int find_symbol(const char *string)
+{
+    // Returns -1 if the string has not been interned, in which case nothing can have it as a name.
+    if (symbol_lookup == NULL) return -1;
+    return *symbol_lookup_find(string, dd_name_hash((char *) string));
+}
 int new_symbol(char *string)
 {
-    #define table_check() if (symbol_table == NULL) { fprintf(stderr, "ERROR: Could not allocate memory for symbol table.\n"); exit(EXIT_FAILURE); }
-    if (symbol_table == NULL) {
-        symbol_table_size = SYMBOL_TABLE_START_SIZE;
-        symbol_table_position = 0;
-        symbol_table = (char *) calloc(1, symbol_table_size * sizeof(char));
-        table_check();
-    } else if (symbol_table_position + strlen(string) >= symbol_table_size) {
-        symbol_table_size *= 2;
+    if (2*(num_symbols + 1) > symbol_lookup_size) grow_symbol_lookup();
+    uint32_t hash = dd_name_hash(string);
+    int *slot = symbol_lookup_find(string, hash);
+    if (*slot != -1) return *slot;
+
+    size_t length = strlen(string);
+    size_t needed = symbol_table_position + sizeof(uint32_t) + length + 1;
+    if (symbol_table == NULL || needed > symbol_table_size) {
+        if (symbol_table == NULL) symbol_table_size = SYMBOL_TABLE_START_SIZE;
+        while (needed > symbol_table_size) symbol_table_size *= 2;
         symbol_table = (char *) realloc(symbol_table, symbol_table_size * sizeof(char));
-        table_check();
+        if (symbol_table == NULL) { fprintf(stderr, "ERROR: Could not allocate memory for symbol table.\n"); exit(EXIT_FAILURE); }
     }
-    int entry = symbol_table_position;
-    strcpy(symbol_table + symbol_table_position, string);
-    symbol_table_position += strlen(string) + 1;
+    memcpy(symbol_table + symbol_table_position, &hash, sizeof(uint32_t));
+    int entry = symbol_table_position + sizeof(uint32_t);
+    memcpy(symbol_table + entry, string, length + 1);
+    symbol_table_position = needed;
+    *slot = entry;
+    num_symbols ++;
     /* print_symbol_table(); */
     return entry;
 }
@@ -41,9 +92,11 @@ void print_symbol_table(void)
     printf("------------\n");
     printf("SYMBOL TABLE\n");
     printf("------------\n");
-    for (int i = 0; i < symbol_table_position; i++) {
-        if (symbol_table[i] == '\0') putchar('\n');
-        else putchar(symbol_table[i]);
+    int position = 0;
+    while (position < symbol_table_position) {
+        char *string = symbol_table + position + sizeof(uint32_t);
+        printf("%s\n", string);
+        position += sizeof(uint32_t) + strlen(string) + 1;
     }
     printf("------------\n");
 }
@@ -51,6 +104,25 @@ char *symbol(int entry)
 {
     return symbol_table + entry;
 }
+char *symbol_table_data(size_t *size)
+{
+    *size = symbol_table_position;
+    return symbol_table;
+}
+int *intern_symbol_block(const char *symbols, size_t size)
+{
+    // Intern a block of symbols in the same format as the symbol table (e.g. from a compiled image).
+    // This returns an array mapping positions of symbols in the block to their symbols, to be freed by the caller.
+    int *remap = (int *) malloc(sizeof(int) * (size + 1));
+    mem_check(remap);
+    size_t position = 0;
+    while (position < size) {
+        char *string = (char *) symbols + position + sizeof(uint32_t);
+        remap[position + sizeof(uint32_t)] = new_symbol(string);
+        position += sizeof(uint32_t) + strlen(string) + 1;
+    }
+    return remap;
+}
 //--------------------------------------------------------------------------------
 // AST
 #define ast_mem_check(THING)\
@@ -143,41 +215,85 @@ void dd_yyerror(char *errmsg)
     exit(EXIT_FAILURE);
 }
 
+static DictionaryTableCell *new_dictionary_table(int size)
+{
+    DictionaryTableCell *table = (DictionaryTableCell *) calloc(1, sizeof(DictionaryTableCell) * size);
+    mem_check(table);
+    for (int i = 0; i < size; i++) {
+        table[i].name = -1; // a -1 name symbol-index denotes an empty cell.
+    }
+    return table;
+}
 DataDictionary *new_data_dictionary(void)
 {
-    const int start_size = 28; // size must be >= 1. ---Currently, if the table is not big enough, probing will cause an infinite loop.
-    // Be careful allocating for this "variable-sized struct". See Dictionary struct definition.
-    DataDictionary *dict = (DataDictionary *) calloc(1, sizeof(DataDictionary) + sizeof(DictionaryTableCell)*(start_size - 1));
+    DataDictionary *dict = (DataDictionary *) calloc(1, sizeof(DataDictionary));
     ast_mem_check(dict); //use mem_check when this is a project library.
-    dict->table_size = start_size;
-    dict->table = &dict->___table; //---- This could be done just by ensuring the allocated memory is contiguous with the metadata struct...
-    for (int i = 0; i < dict->table_size; i++) {
-        dict->table[i].name = -1; // a -1 name symbol-index denotes an empty cell.
-    }
+    dict->table_size = DD_TABLE_START_SIZE;
+    dict->table = new_dictionary_table(dict->table_size);
     return dict;
 }
 
-DictExpression *scoped_dictionary_expression(DataDictionary *dict, char *name, DataDictionary **new_parent_dict)
+uint32_t dd_name_hash(char *name)
+{
+    // The table index takes the low bits, so mix in the high bits of hash_crc32 first.
+    return hash_mix32(hash_crc32(name));
+}
+
+DictionaryTableCell *dictionary_table_find(DataDictionary *dict, int name)
+{
+    // Linear probing. Gives the cell with this name, or the empty cell where it would be added.
+    // The table is never full, so this terminates. Symbols are interned, so names are compared as symbols.
+    int mask = dict->table_size - 1;
+    int index = symbol_hash(name) & mask;
+    while (dict->table[index].name != -1) {
+        if (dict->table[index].name == name) break;
+        index = (index + 1) & mask;
+    }
+    return &dict->table[index];
+}
+
+static void grow_dictionary_table(DataDictionary *dict)
+{
+    // Rehash into a table twice the size. The cells are moved, so this must not be done after the dictionary is resolved.
+    DictionaryTableCell *old_table = dict->table;
+    int old_size = dict->table_size;
+    dict->table_size *= 2;
+    dict->table = new_dictionary_table(dict->table_size);
+    int mask = dict->table_size - 1;
+    for (int i = 0; i < old_size; i++) {
+        if (old_table[i].name == -1) continue;
+        int index = old_table[i].hash & mask;
+        while (dict->table[index].name != -1) index = (index + 1) & mask;
+        dict->table[index] = old_table[i];
+    }
+    free(old_table);
+}
+
+DictionaryTableCell *scoped_dictionary_cell(DataDictionary *dict, int name, DataDictionary **new_parent_dict)
 {
     /* Scoping of dictionary names (as they appear in dictionary-expressions) works by having each dictionary hold a pointer
      * to the dictionary it was queried from. When a name appears in a dict-expression of this dictionary, it first searches for a dictionary of that name
      * in itself, then in its parent, then, ..., etc.
      *
-     * If NULL is not passed as the last argument, this also gives the parent dictionary of the found expression, for scoping purpouses.
+     * If NULL is not passed as the last argument, this also gives the parent dictionary of the found cell, for scoping purpouses.
      */
     /* printf("Searching for \"%s\"\n", name); */
     // printf("\"%s\" appeared in expression, searching for ...\n", name);
 
     DataDictionary *searching_dict = dict;
     while (searching_dict != NULL) {
-        DictExpression *found = lookup_dict_expression(searching_dict, name, new_parent_dict);
+        DictionaryTableCell *found = lookup_dict_cell_symbol(searching_dict, name, new_parent_dict);
         if (found != NULL) return found;
         searching_dict = searching_dict->parent_dictionary;
     }
-    printf("Could not find dictionary with name \"%s\" in the current scope.\n", name);
+    printf("Could not find dictionary with name \"%s\" in the current scope.\n", symbol(name));
     exit(EXIT_FAILURE);
     /* return NULL; */
 }
+DictExpression *scoped_dictionary_expression(DataDictionary *dict, int name, DataDictionary **new_parent_dict)
+{
+    return scoped_dictionary_cell(dict, name, new_parent_dict)->contents.dict.dict_expression;
+}
 
 
 // Recursive function and "header" function for evaluating the types of a dictionary. This is done by expanding the expression and building up
@@ -192,7 +308,7 @@ static int ___compute_dictionary_expression_types(DataDictionary *dd, int types[
         if (expression->is_name) {
             // add this operand's name as a type.
             types[index] = expression->name;
-            DictExpression *expanding_expression = scoped_dictionary_expression(dd, symbol(expression->name), NULL); //??
+            DictExpression *expanding_expression = scoped_dictionary_expression(dd, expression->name, NULL); //??
             // Recur.
             index = ___compute_dictionary_expression_types(dd, types, index + 1, max_num_types, expanding_expression);
         }
@@ -216,25 +332,38 @@ static void compute_dictionary_expression_types(DataDictionary *dd, DictionaryTa
     memcpy(cell->contents.dict.types, types, sizeof(int) * num_types);
 }
 
+static void add_base_dictionary(DataDictionary *dd, DataDictionary *base)
+{
+    // The base is already referenced by the open, this just keeps track of it so it can be released when dd is closed.
+    if (dd->num_bases == dd->bases_size) {
+        dd->bases_size = dd->bases_size == 0 ? 4 : dd->bases_size * 2;
+        dd->bases = (DataDictionary **) realloc(dd->bases, sizeof(DataDictionary *) * dd->bases_size);
+        mem_check(dd->bases);
+    }
+    dd->bases[dd->num_bases ++] = base;
+}
+
 static void ___resolve_dictionary_expression(DataDictionary *dict_table, DataDictionary *dict, DictExpression *expression)
 {
     // dict: The dictionary the expression is an entry in. This is used for scoping names in the expression.
     //
-    // This is the recurred part of the expression resolution. Named operands expand and resolve their named operands and so on, logically leaving
-    // the evaluated table as the table evaluated from the expression fully expanded to just a concatenation ( ... ) ( ... ) ( ... ) ... ,
-    // although here it is done progressively instead of expanding the expression first.
+    // Logically, named operands expand into their expressions, leaving the evaluated table as the table evaluated from the expression
+    // fully expanded to just a concatenation ( ... ) ( ... ) ( ... ) ... .
+    // Masking is associative, so instead of expanding, a named operand is opened (resolved once and cached in the cell it was found in, with
+    // the scope it was found in), and its table is masked in. So a prefab that many instances derive from is only resolved once.
     while (expression != NULL) {
         if (expression->is_name) {
-            // A name references an expression in the current scope. This expands into the expression.
+            // A name references a dictionary in the current scope.
             // For example,
-            // ( ... ) Name ( ... ) ===> ( ... ) [expanded Name: ( ... ) AnotherName ( ... ) ( ... )] ( ... )
+            // ( ... ) Name ( ... ) ===> ( ... ) [resolved Name] ( ... )
             DataDictionary *new_scope_dict;
-            DictExpression *expanding_expression = scoped_dictionary_expression(dict, symbol(expression->name), &new_scope_dict);
-            // Recur.
-            ___resolve_dictionary_expression(dict_table, new_scope_dict, expanding_expression); // Same dict_table (table that is being filled).
-            // ___resolve_dictionary_expression(dict_table, dict, expanding_expression); // Same dict_table (table that is being filled).
-                            //------------------------Does dict have to be changed to where the expression was found? Then scoped_dictionary_expression must return this,
-                            //                        so that the expanded expression can evaluate with the correct scope.
+            DictionaryTableCell *cell = scoped_dictionary_cell(dict, expression->name, &new_scope_dict);
+            DataDictionary *base = open_dictionary_cell(new_scope_dict, cell);
+            add_base_dictionary(dict_table, base);
+            if (!mask_table_to_table(dict_table, base)) {
+                fprintf(stderr, "ERROR: Something went wrong when masking a dictionary.\n");
+                exit(EXIT_FAILURE);
+            }
         } else {
             // Mask a literal dictionary into the table.
             // note: For an expression to be correctly formed it must terminate to literal dictionaries. If it doesn't, currently infinite loops may be entered.
@@ -257,13 +386,41 @@ DataDictionary *resolve_dictionary_expression(DataDictionary *parent_dd, DictExp
     // dictionaries, as the dictionary "types".
     // This prepares this data-dictionary for querying by type.
     for (int i = 0; i < dd->table_size; i++) {
-        if (dd->table[i].is_dict) {
+        if (dd->table[i].name != -1 && dd->table[i].is_dict) {
             compute_dictionary_expression_types(dd, &dd->table[i]);
         }
     }
     return dd;
 }
 
+DataDictionary *open_dictionary_cell(DataDictionary *dict, DictionaryTableCell *cell)
+{
+    // Open the dictionary-entry in a cell of dict, resolving it if it is not already open.
+    // This takes a reference, to be released with dd_close.
+    if (cell->contents.dict.opened == NULL) {
+        DataDictionary *opened;
+        if (cell->contents.dict.prebuilt_table != NULL) {
+            // This table was resolved when the image was compiled.
+            opened = (DataDictionary *) calloc(1, sizeof(DataDictionary));
+            mem_check(opened);
+            opened->table = cell->contents.dict.prebuilt_table;
+            opened->table_size = cell->contents.dict.prebuilt_table_size;
+            opened->num_entries = cell->contents.dict.prebuilt_num_entries;
+            opened->mapped = true;
+        } else {
+            opened = resolve_dictionary_expression(dict, cell->contents.dict.dict_expression);
+        }
+        // Give it a pointer to the queried dictionary, for scoping purposes. This means that queried-for dictionaries
+        // form a tree of dictionary tables. The child keeps its scope open.
+        opened->parent_dictionary = dict;
+        opened->parent_cell = cell;
+        dict->refcount ++;
+        cell->contents.dict.opened = opened;
+    }
+    cell->contents.dict.opened->refcount ++;
+    return cell->contents.dict.opened;
+}
+
 
 /*--------------------------------------------------------------------------------
 Hash tree A's entries into the table (storing all info about each value-entry and dict-entry).
@@ -281,138 +438,163 @@ dict-entries:
     If an entry with the same name is there, concatenate B_i's dict-expression onto one in the table.
     Otherwise, add this as a new dict-entry.
 --------------------------------------------------------------------------------*/
-bool mask_dictionary_to_table(DataDictionary *dict_table, EntryNode *dict)
+static DictExpression *copy_dict_expression(DictExpression *expression)
+{
+    // Copy the linked list of operands. Literal operands still point into the IR.
+    DictExpression *copy = NULL;
+    DictExpression **next = &copy;
+    while (expression != NULL) {
+        *next = (DictExpression *) calloc(1, sizeof(DictExpression));
+        mem_check(*next);
+        memcpy(*next, expression, sizeof(DictExpression));
+        (*next)->next = NULL;
+        next = &(*next)->next;
+        expression = expression->next;
+    }
+    return copy;
+}
+
+static void parse_value_cell(DictionaryTableCell *cell, DictionaryTableCell *parsed_from)
+{
+    // Parse the value-text into the cell, so that queries don't need to. If the value came from an already resolved
+    // table, the parsed data can just be copied.
+    cell->contents.value.parsed = false;
+    int type_id = cell->contents.value.type_id;
+    if (type_id == -1 || dd_type_readers[type_id].size == 0) return;
+    if (parsed_from != NULL && parsed_from->contents.value.parsed && parsed_from->contents.value.type_id == type_id) {
+        memcpy(cell->contents.value.data, parsed_from->contents.value.data, dd_type_readers[type_id].size);
+        cell->contents.value.parsed = true;
+        return;
+    }
+    if (cell->contents.value.value_text == -1) return;
+    // If this fails, the value-text is left to fail again when it is queried.
+    cell->contents.value.parsed = dd_type_readers[type_id].reader(symbol(cell->contents.value.value_text), cell->contents.value.data);
+}
+
+static bool mask_entry_to_table(DataDictionary *dict_table, int name, bool is_dict, int type, int value_text, DictExpression *dict_expression, DictionaryTableCell *parsed_from)
 {
-    // A EntryNode is the IR, linked-list representation of a dictionary. This is what it is kept as in memory until
-    // a dictionary is needed as part of a dict-expression (or when the file is read, the root dictionary is treated as a 1-operand dict-expression),
-    // where it is read into a table, to do the masking operation and type-checking.
     #define mask_error(STRING)\
     {\
         printf("Error when masking dictionary to table: " STRING "\n");\
         return false;\
     }
-    EntryNode *entry = dict;
-    // Successively add entries to the table.
-    while (entry != NULL) {
-        uint32_t hash = hash_crc32(symbol(entry->name));
-        int index = hash % dict_table->table_size;
-        bool appended_expression = false; // This is set to true in the loop if the dict-entry has masked by appending its expression onto the other expression.
-                                          // At the end of the loop, if this is false, a new dict-entry is created at the index instead.
-        // Probe until an empty cell or a name-match is found.
-        while (dict_table->table[index].name != -1) { // Closed addressing.
-            if (strcmp(symbol(entry->name), symbol(dict_table->table[index].name)) == 0) { // could store and compare crc32 hashes, but this works.
-                // A name match has been found. Proceed to do type-checking and then masking.
-                DictionaryTableCell *other_entry = &dict_table->table[index];
-                if (entry->is_dict) {
-                    if (!other_entry->is_dict) mask_error("Attempted to override a value-entry with a dictionary-entry.");
-                    if (other_entry->contents.dict.dict_expression == NULL) {
-                        //   Old entry has an empty expression. Just copy it the new expression.
-                        // Copy the head of the linked list.
-                        other_entry->contents.dict.dict_expression = (DictExpression *) calloc(1, sizeof(DictExpression));
-                        mem_check(other_entry->contents.dict.dict_expression);
-                        DictExpression *new_expression = other_entry->contents.dict.dict_expression;
-                        memcpy(new_expression, entry->dict_expression, sizeof(DictExpression));
-                        // Now follow the linked list and copy each entry.
-                        while (new_expression->next != NULL) {
-                            DictExpression *next_copy = (DictExpression *) calloc(1, sizeof(DictExpression));
-                            mem_check(next_copy);
-                            memcpy(next_copy, new_expression->next, sizeof(DictExpression));
-                            new_expression->next = next_copy;
-                            new_expression = next_copy;
-                        }
-                    } else {
-                        // Concatenate their expressions.
-                        // First, go to the end, then copy the expression.
-                        DictExpression *end = other_entry->contents.dict.dict_expression;
-                        while (end->next != NULL) end = end->next;
-                        // First copy the head of the linked list.
-                        end->next = (DictExpression *) calloc(1, sizeof(DictExpression));
-                        mem_check(end->next);
-                        memcpy(end->next, entry->dict_expression, sizeof(DictExpression));
-                        // Now follow the linked list and copy each entry.
-                        while (end->next != NULL) {
-                            DictExpression *next_copy = (DictExpression *) calloc(1, sizeof(DictExpression));
-                            mem_check(next_copy);
-                            memcpy(next_copy, end->next, sizeof(DictExpression));
-                            end->next = next_copy;
-                            end = next_copy;
-                        }
-                    }
-                    // Break out of the loop, but first set this flag, to signify that a successful dict-entry mask has taken place.
-                    appended_expression = true;
-                    break;
-                } else {
-                    if (other_entry->is_dict) mask_error("Attempted to override a dictionary-entry with a value-entry.");
-                    // Type check. Invalid cases:
-                    //                      A typed value is written into a non-typed value.
-                    //                      A typed value is written into a typed-value with a different type.
-                    if (other_entry->contents.value.type == -1 && entry->type != -1) mask_error("Attempted to overwrite a non-typed value with a typed value.");
-                    if (entry->type != -1 && other_entry->contents.value.type != -1 && strcmp(symbol(entry->type), symbol(other_entry->contents.value.type)) != 0) {
-                        printf("Error: Attempted to overwrite a typed value with a typed value of a different type. %s <-/- %s.\n", symbol(other_entry->contents.value.type), symbol(entry->type));
-                        return false;
-                    }
-                    // Break out of the loop. The value will be overwritten at the cell at this index in the same way that
-                    // a new value is added at an empty cell.
-                    break;
-                }
+    // Make sure there is room for a new entry before probing, so that the found cell stays valid.
+    if ((dict_table->num_entries + 1) > DD_TABLE_MAX_LOAD * dict_table->table_size) grow_dictionary_table(dict_table);
+    DictionaryTableCell *cell = dictionary_table_find(dict_table, name);
+    bool appended_expression = false; // This is set to true if the dict-entry has masked by appending its expression onto the other expression.
+                                      // If this is false, a new dict-entry is created at the cell instead.
+    if (cell->name != -1) {
+        // A name match has been found. Proceed to do type-checking and then masking.
+        DictionaryTableCell *other_entry = cell;
+        if (is_dict) {
+            if (!other_entry->is_dict) mask_error("Attempted to override a value-entry with a dictionary-entry.");
+            if (other_entry->contents.dict.dict_expression == NULL) {
+                // Old entry has an empty expression. Just copy it the new expression.
+                other_entry->contents.dict.dict_expression = copy_dict_expression(dict_expression);
+            } else {
+                // Concatenate their expressions.
+                DictExpression *end = other_entry->contents.dict.dict_expression;
+                while (end->next != NULL) end = end->next;
+                end->next = copy_dict_expression(dict_expression);
             }
-            index = (index + 1) % dict_table->table_size; // Linear probing.
-        }
-        if (entry->is_dict && !appended_expression) {
-            // A new dict-entry has been added, but it has not masked onto a previous one. So, add it.
-            dict_table->table[index].name = entry->name;
-            dict_table->table[index].is_dict = true;
-            dict_table->table[index].contents.dict.dict_expression = entry->dict_expression;
+            // Set this flag, to signify that a successful dict-entry mask has taken place.
+            appended_expression = true;
+        } else {
+            if (other_entry->is_dict) mask_error("Attempted to override a dictionary-entry with a value-entry.");
+            // Type check. Invalid cases:
+            //                      A typed value is written into a non-typed value.
+            //                      A typed value is written into a typed-value with a different type.
+            if (other_entry->contents.value.type == -1 && type != -1) mask_error("Attempted to overwrite a non-typed value with a typed value.");
+            if (type != -1 && other_entry->contents.value.type != -1 && type != other_entry->contents.value.type) {
+                printf("Error: Attempted to overwrite a typed value with a typed value of a different type. %s <-/- %s.\n", symbol(other_entry->contents.value.type), symbol(type));
+                return false;
+            }
+            // The value will be overwritten at the cell in the same way that a new value is added at an empty cell.
         }
-        if (!entry->is_dict) {
-            // note: The type is not being overwritten, as it was type-checked before, and doing this would either be redundant or remove the type.
-            // However, if the cell is empty, do initialize the type.
-            if (dict_table->table[index].name == -1 && entry->type != -1) dict_table->table[index].contents.value.type = entry->type;
-            // add a new value-entry, or overwrite a previous one.
-            dict_table->table[index].name = entry->name;
-            dict_table->table[index].is_dict = false;
-            dict_table->table[index].contents.value.value_text = entry->value_text;
+    } else {
+        dict_table->num_entries ++;
+        cell->hash = symbol_hash(name);
+    }
+    if (is_dict && !appended_expression) {
+        // A new dict-entry has been added, but it has not masked onto a previous one. So, add it.
+        // The expression is copied, since it may be concatenated onto later.
+        cell->name = name;
+        cell->is_dict = true;
+        cell->contents.dict.dict_expression = copy_dict_expression(dict_expression);
+    }
+    if (!is_dict) {
+        // note: The type is not being overwritten, as it was type-checked before, and doing this would either be redundant or remove the type.
+        // However, if the cell is empty, do initialize the type (-1 if this is an untyped value).
+        if (cell->name == -1) {
+            cell->contents.value.type = type;
+            cell->contents.value.type_id = type == -1 ? -1 : dd_type_id(type);
         }
-        entry = entry->next;
+        // add a new value-entry, or overwrite a previous one.
+        cell->name = name;
+        cell->is_dict = false;
+        cell->contents.value.value_text = value_text;
+        parse_value_cell(cell, parsed_from);
     }
     return true;
     #undef mask_error
 }
 
-// Lookup a dictionary-expression in a dictionary.
+bool mask_dictionary_to_table(DataDictionary *dict_table, EntryNode *dict)
+{
+    // A EntryNode is the IR, linked-list representation of a dictionary. This is what it is kept as in memory until
+    // a dictionary is needed as part of a dict-expression (or when the file is read, the root dictionary is treated as a 1-operand dict-expression),
+    // where it is read into a table, to do the masking operation and type-checking.
+    EntryNode *entry = dict;
+    // Successively add entries to the table.
+    while (entry != NULL) {
+        if (!mask_entry_to_table(dict_table, entry->name, entry->is_dict, entry->type, entry->value_text, entry->dict_expression, NULL)) return false;
+        entry = entry->next;
+    }
+    return true;
+}
 
-static DictExpression *___lookup_dict_expression(DataDictionary *dict, char *name)
+bool mask_table_to_table(DataDictionary *dict_table, DataDictionary *dict)
 {
-    uint32_t hash = hash_crc32(name);
-    int index = hash % dict->table_size;
-    while (dict->table[index].name != -1) {
-        if (strcmp(name, symbol(dict->table[index].name)) == 0) {
-            if (!dict->table[index].is_dict) {
-                /* printf("ERROR lookup_dict: Attempted to extract value-entry \"%s\" from dictionary as a dictionary.\n", name); */
-                return NULL;
-            }
-            return dict->table[index].contents.dict.dict_expression;
-        }
-        //note: Make sure this mirrors the hashing and indexing done when the table is created.
-        index = (index + 1) % dict->table_size;
+    // Mask an already resolved dictionary. Names are unique in a table, so this is the same as masking each of the literal
+    // dictionaries it was resolved from in turn.
+    for (int i = 0; i < dict->table_size; i++) {
+        DictionaryTableCell *cell = &dict->table[i];
+        if (cell->name == -1) continue;
+        bool masked;
+        if (cell->is_dict) masked = mask_entry_to_table(dict_table, cell->name, true, -1, -1, cell->contents.dict.dict_expression, NULL);
+        else masked = mask_entry_to_table(dict_table, cell->name, false, cell->contents.value.type, cell->contents.value.value_text, NULL, cell);
+        if (!masked) return false;
     }
-    /* printf("ERROR lookup_dict_expression: Entry \"%s\" not found in dictionary.\n", name); */
-    return NULL;
+    return true;
 }
 
-DictExpression *lookup_dict_expression(DataDictionary *dict, char *path, DataDictionary **new_parent_dict)
+// Lookup a dictionary-entry cell in a dictionary.
+
+static DictionaryTableCell *___lookup_dict_cell(DataDictionary *dict, int name)
+{
+    DictionaryTableCell *cell = dictionary_table_find(dict, name);
+    if (cell->name == -1) {
+        /* printf("ERROR lookup_dict_cell: Entry \"%s\" not found in dictionary.\n", symbol(name)); */
+        return NULL;
+    }
+    if (!cell->is_dict) {
+        /* printf("ERROR lookup_dict: Attempted to extract value-entry \"%s\" from dictionary as a dictionary.\n", symbol(name)); */
+        return NULL;
+    }
+    return cell;
+}
+
+DictionaryTableCell *lookup_dict_cell(DataDictionary *dict, char *path, DataDictionary **new_parent_dict)
 {
     //------
     //note:
-    //    This is the same as the recursive open of a dictionary, through a path, except here the expression for the dictionary is returned instead of an opened dictionary.
-    //    The scoped version of this is "scoped_dict_expression", which should be used.
-    // Get a dict-expression from a dictionary. This is to be used by lookup_dict, which resolves this expression into a table,
-    // and for the semantics of dict-expressions, e.g. looking up dictionary names and concatenating their expressions.
+    //    This is the same as the recursive open of a dictionary, through a path, except here the cell for the dictionary (holding its expression) is returned instead of an opened dictionary.
+    //    The scoped version of this is "scoped_dictionary_cell", which should be used.
+    // Get a dict-entry from a dictionary. This is used for the semantics of dict-expressions, e.g. looking up dictionary names and concatenating their expressions.
     //
     // note: Should not print errors here, since this is allowed to fail when the scope stack is being searched.
-    /* printf("Looking up dictionary expression \"%s\" ...\n", name); */
     
-    // To get the dict-expression instead of the dictionary, open the dictionary which contains the final dictionary, then get the expression
+    // To get the cell instead of the dictionary, open the dictionary which contains the final dictionary, then get the cell
     // from the table.
     
     //////////////////////////////////////////
@@ -421,32 +603,54 @@ DictExpression *lookup_dict_expression(DataDictionary *dict, char *path, DataDic
     //////////////////////////////////////////
     
     DD *parent_dict;
-    const int buf_size = 4096;
-    char head[buf_size];
-    char tail[buf_size];
+    char *tail;
     char *last_sep = strrchr(path, '/');
     if (last_sep == NULL) {
         // No need to open more dictionaries.
-        head[0] = '\0';
-        strncpy(tail, path, buf_size);
+        tail = path;
         parent_dict = dict;
     } else {
         // Open the wanted expression's parent dictionary.
+        // note: This is never closed, as the returned cell and scope live in it.
+        const int buf_size = 4096;
+        char head[buf_size];
+        if (last_sep - path >= buf_size) {
+            fprintf(stderr, ERROR_ALERT "Data-dictionary path \"%s\" is too long.\n", path);
+            exit(EXIT_FAILURE);
+        }
         strncpy(head, path, last_sep - path);
-						    ////////not checking path sizes
         head[last_sep - path] = '\0';
-        strncpy(tail, last_sep + 1, buf_size);
+        tail = last_sep + 1;
         parent_dict = dd_open(dict, head);
     }
     if (parent_dict == NULL) {
         fprintf(stderr, ERROR_ALERT "Could not look up dictionary expression.\n");
         exit(EXIT_FAILURE);
     }
-    DictExpression *expression = ___lookup_dict_expression(parent_dict, tail);
-    if (new_parent_dict != NULL && expression != NULL) {
+    // Names which have not been interned can't be in any table.
+    int name = find_symbol(tail);
+    if (name == -1) return NULL;
+    DictionaryTableCell *cell = ___lookup_dict_cell(parent_dict, name);
+    if (new_parent_dict != NULL && cell != NULL) {
         // printf("Updating parent dictionary, for purpouses of scoping.\n");
         /////////////////////////////////////////////////////////////////////
          *new_parent_dict = parent_dict;
     }
-    return expression;
+    return cell;
+}
+DictionaryTableCell *lookup_dict_cell_symbol(DataDictionary *dict, int name, DataDictionary **new_parent_dict)
+{
+    // Names in dictionary-expressions are usually just names, which can be looked up directly by symbol.
+    if (strchr(symbol(name), '/') != NULL) return lookup_dict_cell(dict, symbol(name), new_parent_dict);
+    DictionaryTableCell *cell = ___lookup_dict_cell(dict, name);
+    if (new_parent_dict != NULL && cell != NULL) *new_parent_dict = dict;
+    return cell;
+}
+
+// Lookup a dictionary-expression in a dictionary.
+DictExpression *lookup_dict_expression(DataDictionary *dict, char *path, DataDictionary **new_parent_dict)
+{
+    DictionaryTableCell *cell = lookup_dict_cell(dict, path, new_parent_dict);
+    if (cell == NULL) return NULL;
+    return cell->contents.dict.dict_expression;
 }
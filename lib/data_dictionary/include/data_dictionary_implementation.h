@@ -14,12 +14,21 @@ extern void dd_push_file(FILE *file);
 extern void dd_pop_file(void);
 
 DataDictionary *new_data_dictionary(void);
+#define DD_TABLE_START_SIZE 16
+#define DD_TABLE_MAX_LOAD 0.75
+uint32_t dd_name_hash(char *name);
+DictionaryTableCell *dictionary_table_find(DataDictionary *dict, int name);
 DataDictionary *resolve_dictionary_expression(DataDictionary *dict, DictExpression *expression);
 uint32_t hash_crc32(char *string);
 bool mask_dictionary_to_table(DataDictionary *dict_table, EntryNode *dict);
+bool mask_table_to_table(DataDictionary *dict_table, DataDictionary *dict);
+DataDictionary *open_dictionary_cell(DataDictionary *dict, DictionaryTableCell *cell);
 
 DictExpression *lookup_dict_expression(DataDictionary *dict, char *path, DataDictionary **new_parent_dict);
-DictExpression *scoped_dictionary_expression(DataDictionary *dict, char *name, DataDictionary **new_parent_dict);
+DictExpression *scoped_dictionary_expression(DataDictionary *dict, int name, DataDictionary **new_parent_dict);
+DictionaryTableCell *lookup_dict_cell(DataDictionary *dict, char *path, DataDictionary **new_parent_dict);
+DictionaryTableCell *lookup_dict_cell_symbol(DataDictionary *dict, int name, DataDictionary **new_parent_dict);
+DictionaryTableCell *scoped_dictionary_cell(DataDictionary *dict, int name, DataDictionary **new_parent_dict);
 
 EntryNode *new_entry_node(int name_symbol, int type_symbol, int value_text_symbol);
 EntryNode *new_dict_node(int name_symbol, DictExpression *dict_expression);
@@ -30,8 +39,27 @@ extern EntryNode *g_dict; // for accessing the root of the AST after calling yyp
 void print_ast(EntryNode *dict);
 void print_dict_expression(DictExpression *expression);
 
+// Type readers. Types with a size are parsed into the table cells when masked, the others (strings) are read on query.
+typedef struct DDType_s {
+    DDTypeReader reader;
+    const char *type_name;
+    size_t size;
+} DDType;
+extern const DDType dd_type_readers[];
+int dd_type_id(int type_symbol);
+
+// Compiled images.
+DataDictionary *dd_fopen_text(char *path);
+DataDictionary *dd_map_compiled(char *ddb_path, bool check_sources);
+void dd_clear_source_files(void);
+void dd_note_source_file(char *path); // The scanner notes each #include'd file, so an image can tell if it is out of date.
+
 // symbol table
 int new_symbol(char *string);
+int find_symbol(const char *string);
+uint32_t symbol_hash(int entry);
+char *symbol_table_data(size_t *size);
+int *intern_symbol_block(const char *symbols, size_t size);
 void print_symbol_table(void);
 char *symbol(int entry);
 
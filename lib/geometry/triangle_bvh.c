@@ -0,0 +1,436 @@
+/*--------------------------------------------------------------------------------
+    Triangle BVH
+    ------------
+The binary tree is built top-down over the triangles' bounding boxes. Each split bins the centroids into
+TRIANGLE_BVH_NUM_BINS along the axis they are most spread over, and takes the bin boundary minimizing the surface-area heuristic,
+    cost = (triangles on left) * (area of left box) + (triangles on right) * (area of right box).
+Nodes of up to TRIANGLE_BVH_LEAF_SIZE triangles are kept as leaves when that is cheaper.
+The binary tree is then collapsed into the 4-wide tree: starting with a node's two children, the child with the largest
+box is repeatedly replaced by its own two children, until there are four or only leaves remain.
+Traversal tests a ray against the four boxes of a node at once, and visits the children nearest first.
+--------------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "helper_definitions.h"
+#include "triangle_bvh.h"
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#define MIN(X,Y) ((X) < (Y) ? (X) : (Y))
+#define MAX(X,Y) ((X) < (Y) ? (Y) : (X))
+
+/*--------------------------------------------------------------------------------
+    Building.
+--------------------------------------------------------------------------------*/
+// Binary nodes. Internal nodes have count = 0, and their children are at first and first + 1.
+typedef struct BuildNode_s {
+    float min[3];
+    float max[3];
+    int first;
+    int count;
+} BuildNode;
+typedef struct Builder_s {
+    int num_nodes;
+    BuildNode *nodes;
+    // These are indexed by the triangle's index in the mesh. Only the order is permuted.
+    float *centroids;
+    float *box_mins;
+    float *box_maxs;
+    uint32_t *order;
+} Builder;
+
+static float box_area(float min[3], float max[3])
+{
+    float dx = max[0] - min[0];
+    float dy = max[1] - min[1];
+    float dz = max[2] - min[2];
+    return 2 * (dx*dy + dy*dz + dz*dx);
+}
+static void box_empty(float min[3], float max[3])
+{
+    for (int i = 0; i < 3; i++) {
+        min[i] = INFINITY;
+        max[i] = -INFINITY;
+    }
+}
+static void box_add_box(float min[3], float max[3], float other_min[3], float other_max[3])
+{
+    for (int i = 0; i < 3; i++) {
+        if (other_min[i] < min[i]) min[i] = other_min[i];
+        if (other_max[i] > max[i]) max[i] = other_max[i];
+    }
+}
+
+static void node_bounds(Builder *b, BuildNode *node)
+{
+    box_empty(node->min, node->max);
+    for (int i = node->first; i < node->first + node->count; i++) {
+        uint32_t t = b->order[i];
+        box_add_box(node->min, node->max, &b->box_mins[3*t], &b->box_maxs[3*t]);
+    }
+}
+
+static void subdivide(Builder *b, int node_index)
+{
+    // (The nodes array has been allocated for the largest possible tree, so this pointer stays valid.)
+    BuildNode *node = &b->nodes[node_index];
+    int first = node->first;
+    int count = node->count;
+    if (count <= 1) return;
+
+    float centroids_min[3], centroids_max[3];
+    box_empty(centroids_min, centroids_max);
+    for (int i = first; i < first + count; i++) {
+        float *c = &b->centroids[3*b->order[i]];
+        box_add_box(centroids_min, centroids_max, c, c);
+    }
+    int axis = 0;
+    for (int i = 1; i < 3; i++) {
+        if (centroids_max[i] - centroids_min[i] > centroids_max[axis] - centroids_min[axis]) axis = i;
+    }
+    float extent = centroids_max[axis] - centroids_min[axis];
+
+    int mid = -1;
+    if (extent > 0) {
+        struct { int count; float min[3]; float max[3]; } bins[TRIANGLE_BVH_NUM_BINS];
+        for (int i = 0; i < TRIANGLE_BVH_NUM_BINS; i++) {
+            bins[i].count = 0;
+            box_empty(bins[i].min, bins[i].max);
+        }
+        float scale = TRIANGLE_BVH_NUM_BINS / extent;
+#define bin_of(ITEM) MIN(TRIANGLE_BVH_NUM_BINS - 1, (int) ((b->centroids[3*b->order[(ITEM)] + axis] - centroids_min[axis]) * scale))
+        for (int i = first; i < first + count; i++) {
+            int bin = bin_of(i);
+            uint32_t t = b->order[i];
+            bins[bin].count ++;
+            box_add_box(bins[bin].min, bins[bin].max, &b->box_mins[3*t], &b->box_maxs[3*t]);
+        }
+        // Sweep from the right to get the cost of each right side, then from the left, finding the cheapest split.
+        // Splitting after bin i puts bins 0..i on the left.
+        float right_cost[TRIANGLE_BVH_NUM_BINS];
+        float min[3], max[3];
+        box_empty(min, max);
+        int right_count = 0;
+        for (int i = TRIANGLE_BVH_NUM_BINS - 1; i > 0; i--) {
+            right_count += bins[i].count;
+            box_add_box(min, max, bins[i].min, bins[i].max);
+            right_cost[i - 1] = right_count == 0 ? 0 : right_count * box_area(min, max);
+        }
+        box_empty(min, max);
+        int left_count = 0;
+        int best_split = -1;
+        float best_cost = INFINITY;
+        for (int i = 0; i < TRIANGLE_BVH_NUM_BINS - 1; i++) {
+            left_count += bins[i].count;
+            box_add_box(min, max, bins[i].min, bins[i].max);
+            if (left_count == 0 || left_count == count) continue;
+            float cost = left_count * box_area(min, max) + right_cost[i];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_split = i;
+            }
+        }
+        // A split costs a traversal step (relative to intersecting a triangle) on top of the children's costs.
+        float node_area = box_area(node->min, node->max);
+        if (count <= TRIANGLE_BVH_LEAF_SIZE && (best_split < 0 || TRIANGLE_BVH_TRAVERSAL_COST * node_area + best_cost >= count * node_area)) return;
+        if (best_split >= 0) {
+            int i = first;
+            int j = first + count - 1;
+            while (i <= j) {
+                if (bin_of(i) <= best_split) i ++;
+                else {
+                    uint32_t t = b->order[i]; b->order[i] = b->order[j]; b->order[j] = t;
+                    j --;
+                }
+            }
+            mid = i;
+        }
+#undef bin_of
+    }
+    if (mid < 0) {
+        // The centroids can't be separated (e.g. duplicated triangles), so only split if the leaf would be too large.
+        if (count <= TRIANGLE_BVH_LEAF_SIZE) return;
+        mid = first + count / 2;
+    }
+    int left = b->num_nodes;
+    b->num_nodes += 2;
+    b->nodes[left].first = first;
+    b->nodes[left].count = mid - first;
+    node_bounds(b, &b->nodes[left]);
+    b->nodes[left + 1].first = mid;
+    b->nodes[left + 1].count = first + count - mid;
+    node_bounds(b, &b->nodes[left + 1]);
+    node->first = left;
+    node->count = 0;
+    subdivide(b, left);
+    subdivide(b, left + 1);
+}
+
+static int collapse(Builder *b, TriangleBVH *bvh, int binary_index, int depth)
+{
+    if (depth > bvh->depth) bvh->depth = depth;
+    int children[TRIANGLE_BVH_WIDTH];
+    int n;
+    BuildNode *binary = &b->nodes[binary_index];
+    if (binary->count > 0) {
+        // Only the root can be a leaf here, when the whole mesh fits in one.
+        children[0] = binary_index;
+        n = 1;
+    } else {
+        children[0] = binary->first;
+        children[1] = binary->first + 1;
+        n = 2;
+        while (n < TRIANGLE_BVH_WIDTH) {
+            int largest = -1;
+            float largest_area = -1;
+            for (int i = 0; i < n; i++) {
+                BuildNode *child = &b->nodes[children[i]];
+                if (child->count > 0) continue;
+                float area = box_area(child->min, child->max);
+                if (area > largest_area) {
+                    largest_area = area;
+                    largest = i;
+                }
+            }
+            if (largest < 0) break;
+            int opened = children[largest];
+            children[largest] = b->nodes[opened].first;
+            children[n ++] = b->nodes[opened].first + 1;
+        }
+    }
+    // (The nodes array has been allocated for the largest possible tree, so this index is written to after the recursion.)
+    int index = bvh->num_nodes ++;
+    for (int i = 0; i < TRIANGLE_BVH_WIDTH; i++) {
+        TriangleBVHNode *node = &bvh->nodes[index];
+        if (i >= n) {
+            node->min_x[i] = node->min_y[i] = node->min_z[i] = 0;
+            node->max_x[i] = node->max_y[i] = node->max_z[i] = 0;
+            node->first[i] = 0;
+            node->count[i] = -1;
+            continue;
+        }
+        BuildNode *child = &b->nodes[children[i]];
+        node->min_x[i] = child->min[0];
+        node->min_y[i] = child->min[1];
+        node->min_z[i] = child->min[2];
+        node->max_x[i] = child->max[0];
+        node->max_y[i] = child->max[1];
+        node->max_z[i] = child->max[2];
+        if (child->count > 0) {
+            node->first[i] = child->first;
+            node->count[i] = child->count;
+        } else {
+            int first = collapse(b, bvh, children[i], depth + 1);
+            bvh->nodes[index].first[i] = first;
+            bvh->nodes[index].count[i] = 0;
+        }
+    }
+    return index;
+}
+
+void triangle_bvh_build(TriangleBVH *bvh, int num_vertices, float *positions, int num_triangles, uint32_t *triangles)
+{
+    memset(bvh, 0, sizeof(TriangleBVH));
+    if (num_triangles == 0) return;
+    Builder b;
+    b.nodes = malloc(2 * num_triangles * sizeof(BuildNode));
+    mem_check(b.nodes);
+    b.centroids = malloc(3 * num_triangles * sizeof(float));
+    mem_check(b.centroids);
+    b.box_mins = malloc(3 * num_triangles * sizeof(float));
+    mem_check(b.box_mins);
+    b.box_maxs = malloc(3 * num_triangles * sizeof(float));
+    mem_check(b.box_maxs);
+    b.order = malloc(num_triangles * sizeof(uint32_t));
+    mem_check(b.order);
+    for (int i = 0; i < num_triangles; i++) {
+        float *min = &b.box_mins[3*i];
+        float *max = &b.box_maxs[3*i];
+        box_empty(min, max);
+        for (int j = 0; j < 3; j++) {
+            uint32_t vertex = triangles[3*i + j];
+            if (vertex >= num_vertices) {
+                fprintf(stderr, ERROR_ALERT "triangle_bvh_build: Triangle %d has out-of-range vertex index %u.\n", i, vertex);
+                exit(EXIT_FAILURE);
+            }
+            box_add_box(min, max, &positions[3*vertex], &positions[3*vertex]);
+        }
+        for (int j = 0; j < 3; j++) b.centroids[3*i + j] = 0.5 * (min[j] + max[j]);
+        b.order[i] = i;
+    }
+    b.num_nodes = 1;
+    b.nodes[0].first = 0;
+    b.nodes[0].count = num_triangles;
+    node_bounds(&b, &b.nodes[0]);
+    subdivide(&b, 0);
+
+    // Each wide node replaces at least one binary internal node (or is the root leaf).
+    bvh->nodes = malloc(MAX(1, b.num_nodes / 2) * sizeof(TriangleBVHNode));
+    mem_check(bvh->nodes);
+    collapse(&b, bvh, 0, 0);
+
+    bvh->num_triangles = num_triangles;
+    bvh->triangles = malloc(num_triangles * sizeof(TriangleBVHTriangle));
+    mem_check(bvh->triangles);
+    for (int i = 0; i < num_triangles; i++) {
+        TriangleBVHTriangle *tri = &bvh->triangles[i];
+        uint32_t t = b.order[i];
+        float *a = &positions[3*triangles[3*t]];
+        float *pb = &positions[3*triangles[3*t + 1]];
+        float *pc = &positions[3*triangles[3*t + 2]];
+        for (int j = 0; j < 3; j++) {
+            tri->a[j] = a[j];
+            tri->ab[j] = pb[j] - a[j];
+            tri->ac[j] = pc[j] - a[j];
+        }
+        tri->index = t;
+    }
+    free(b.nodes);
+    free(b.centroids);
+    free(b.box_mins);
+    free(b.box_maxs);
+    free(b.order);
+}
+
+void triangle_bvh_destroy(TriangleBVH *bvh)
+{
+    free(bvh->nodes);
+    free(bvh->triangles);
+    memset(bvh, 0, sizeof(TriangleBVH));
+}
+
+/*--------------------------------------------------------------------------------
+    Traversal.
+--------------------------------------------------------------------------------*/
+// Moller-Trumbore, giving the distance and the weights of the second and third vertices.
+static bool intersect_triangle(TriangleBVHTriangle *tri, float o[3], float d[3], float max_t, float *t, float *u, float *v)
+{
+    float p[3] = { d[1]*tri->ac[2] - d[2]*tri->ac[1], d[2]*tri->ac[0] - d[0]*tri->ac[2], d[0]*tri->ac[1] - d[1]*tri->ac[0] };
+    float det = tri->ab[0]*p[0] + tri->ab[1]*p[1] + tri->ab[2]*p[2];
+    if (det == 0) return false; // Parallel to the triangle.
+    float inv_det = 1.0 / det;
+    float s[3] = { o[0] - tri->a[0], o[1] - tri->a[1], o[2] - tri->a[2] };
+    float uu = (s[0]*p[0] + s[1]*p[1] + s[2]*p[2]) * inv_det;
+    if (uu < 0 || uu > 1) return false;
+    float q[3] = { s[1]*tri->ab[2] - s[2]*tri->ab[1], s[2]*tri->ab[0] - s[0]*tri->ab[2], s[0]*tri->ab[1] - s[1]*tri->ab[0] };
+    float vv = (d[0]*q[0] + d[1]*q[1] + d[2]*q[2]) * inv_det;
+    if (vv < 0 || uu + vv > 1) return false;
+    float tt = (tri->ac[0]*q[0] + tri->ac[1]*q[1] + tri->ac[2]*q[2]) * inv_det;
+    if (tt < 0 || tt >= max_t) return false;
+    *t = tt;
+    *u = uu;
+    *v = vv;
+    return true;
+}
+
+typedef struct StackEntry_s {
+    int node;
+    float t; // Where the ray enters the node's box, so it can be skipped if a nearer hit has been found since it was pushed.
+} StackEntry;
+
+static bool traverse(TriangleBVH *bvh, vec3 origin, vec3 direction, float max_t, bool any_hit, TriangleRayHit *hit)
+{
+    if (bvh->num_nodes == 0) return false;
+    float o[3], d[3], inv[3];
+    for (int i = 0; i < 3; i++) {
+        o[i] = origin.vals[i];
+        d[i] = direction.vals[i];
+        // Avoid infinities, since 0 * infinity in the slab test is NaN.
+        float di = fabs(d[i]) < 1e-20 ? (d[i] < 0 ? -1e-20 : 1e-20) : d[i];
+        inv[i] = 1.0 / di;
+    }
+    float best_t = max_t;
+    bool found = false;
+    uint32_t best_triangle = 0;
+    float best_u = 0, best_v = 0;
+
+    // Each level pops one entry and pushes at most four.
+    StackEntry stack[3 * bvh->depth + 4];
+    int stack_size = 0;
+    stack[stack_size ++] = (StackEntry) { 0, 0 };
+#if defined(__SSE__)
+    __m128 ox = _mm_set1_ps(o[0]), oy = _mm_set1_ps(o[1]), oz = _mm_set1_ps(o[2]);
+    __m128 ix = _mm_set1_ps(inv[0]), iy = _mm_set1_ps(inv[1]), iz = _mm_set1_ps(inv[2]);
+#endif
+    while (stack_size > 0) {
+        StackEntry entry = stack[-- stack_size];
+        if (entry.t > best_t) continue;
+        TriangleBVHNode *node = &bvh->nodes[entry.node];
+        float t_enter[4];
+        int mask = 0;
+#if defined(__SSE__)
+        __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node->min_x), ox), ix);
+        __m128 tx2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node->max_x), ox), ix);
+        __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node->min_y), oy), iy);
+        __m128 ty2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node->max_y), oy), iy);
+        __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node->min_z), oz), iz);
+        __m128 tz2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node->max_z), oz), iz);
+        __m128 t_enters = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2)), _mm_max_ps(_mm_min_ps(tz1, tz2), _mm_setzero_ps()));
+        __m128 t_exits = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2)), _mm_min_ps(_mm_max_ps(tz1, tz2), _mm_set1_ps(best_t)));
+        mask = _mm_movemask_ps(_mm_cmple_ps(t_enters, t_exits));
+        _mm_storeu_ps(t_enter, t_enters);
+#else
+        for (int i = 0; i < 4; i++) {
+            float tx1 = (node->min_x[i] - o[0]) * inv[0], tx2 = (node->max_x[i] - o[0]) * inv[0];
+            float ty1 = (node->min_y[i] - o[1]) * inv[1], ty2 = (node->max_y[i] - o[1]) * inv[1];
+            float tz1 = (node->min_z[i] - o[2]) * inv[2], tz2 = (node->max_z[i] - o[2]) * inv[2];
+            float enter = MAX(MAX(MIN(tx1, tx2), MIN(ty1, ty2)), MAX(MIN(tz1, tz2), 0));
+            float t_exit = MIN(MIN(MAX(tx1, tx2), MAX(ty1, ty2)), MIN(MAX(tz1, tz2), best_t));
+            t_enter[i] = enter;
+            if (enter <= t_exit) mask |= 1 << i;
+        }
+#endif
+        // Sort the children hit, nearest first.
+        int hits[4];
+        int num_hits = 0;
+        for (int i = 0; i < 4; i++) {
+            if ((mask & (1 << i)) == 0 || node->count[i] < 0) continue;
+            int j = num_hits ++;
+            while (j > 0 && t_enter[hits[j - 1]] > t_enter[i]) {
+                hits[j] = hits[j - 1];
+                j --;
+            }
+            hits[j] = i;
+        }
+        // Leaves are tested now, nearest first. Inner nodes are pushed furthest first, so the nearest is popped next.
+        for (int k = 0; k < num_hits; k++) {
+            int i = hits[k];
+            if (node->count[i] == 0 || t_enter[i] > best_t) continue;
+            for (int j = node->first[i]; j < node->first[i] + node->count[i]; j++) {
+                float t, u, v;
+                if (intersect_triangle(&bvh->triangles[j], o, d, best_t, &t, &u, &v)) {
+                    found = true;
+                    best_t = t;
+                    best_triangle = bvh->triangles[j].index;
+                    best_u = u;
+                    best_v = v;
+                    if (any_hit) return true;
+                }
+            }
+        }
+        for (int k = num_hits - 1; k >= 0; k--) {
+            int i = hits[k];
+            if (node->count[i] != 0 || t_enter[i] > best_t) continue;
+            stack[stack_size ++] = (StackEntry) { node->first[i], t_enter[i] };
+        }
+    }
+    if (found && hit != NULL) {
+        hit->triangle = best_triangle;
+        hit->t = best_t;
+        hit->barycentric = new_vec3(1 - best_u - best_v, best_u, best_v);
+    }
+    return found;
+}
+
+bool triangle_bvh_raycast(TriangleBVH *bvh, vec3 origin, vec3 direction, float max_t, TriangleRayHit *hit)
+{
+    return traverse(bvh, origin, direction, max_t, false, hit);
+}
+
+bool triangle_bvh_occluded(TriangleBVH *bvh, vec3 origin, vec3 direction, float max_t)
+{
+    return traverse(bvh, origin, direction, max_t, true, NULL);
+}
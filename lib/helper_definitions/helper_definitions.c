@@ -19,3 +19,14 @@ uint32_t hash_crc32(char *string)
     }
     return hash;
 }
+// Mix all of the bits of a hash into the low bits, for indexing power-of-two sized tables.
+// This is the finalizer of Chris Wellons' "lowbias32" integer hash.
+uint32_t hash_mix32(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x7feb352d;
+    h ^= h >> 15;
+    h *= 0x846ca68b;
+    h ^= h >> 16;
+    return h;
+}
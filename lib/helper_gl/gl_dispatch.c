@@ -0,0 +1,760 @@
+/*--------------------------------------------------------------------------------
+    GL dispatch
+    -----------
+Every gl* call in the project already goes through glad's table of function pointers (glDrawElements is a macro
+for the pointer glad_glDrawElements). This module decides what is in that table:
+    GL_DISPATCH_NATIVE: The driver's functions, loaded by glad. This needs a current context.
+    GL_DISPATCH_NULL:   No-op functions, so the engine can run with no window, context, or GPU. Queries give
+                        answers which keep the rendering module happy (shaders compile, framebuffers are complete,
+                        gen'd names are unique).
+On top of either, gl_dispatch_record() swaps in wrappers for the functions that matter for renderer cost, which
+count draw calls, state changes, and bytes uploaded, then call through to whatever was there before.
+So render(), gm_done(), material_prepare(), painting_draw(), etc. need no changes to be run headless or measured.
+--------------------------------------------------------------------------------*/
+#include <glad/glad.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "helper_definitions.h"
+#include "helper_gl.h"
+
+static GLDispatchBackend g_backend = GL_DISPATCH_NATIVE;
+static bool g_recording = false;
+static GLDispatchStats g_stats = {0};
+
+/*--------------------------------------------------------------------------------
+    Null backend
+--------------------------------------------------------------------------------*/
+// Anything not given below goes to this. Calling it through a pointer of a different type is fine with the
+// caller-cleans-up calling conventions of the platforms this runs on, and the zero return value gives
+// NULL pointers, zero names, and GL_NO_ERROR.
+static GLuint APIENTRY null_noop(void)
+{
+    return 0;
+}
+
+static GLuint g_null_next_name = 1;
+static GLint g_null_viewport[4] = {0, 0, 1, 1};
+static void *g_null_mapping = NULL;
+static size_t g_null_mapping_size = 0;
+
+static const GLubyte * APIENTRY null_GetString(GLenum name)
+{
+    switch (name) {
+    case GL_VENDOR: return (const GLubyte *) "collision";
+    case GL_RENDERER: return (const GLubyte *) "null";
+    case GL_VERSION: return (const GLubyte *) "4.6.0 null";
+    case GL_SHADING_LANGUAGE_VERSION: return (const GLubyte *) "4.60 null";
+    default: return (const GLubyte *) "";
+    }
+}
+static const GLubyte * APIENTRY null_GetStringi(GLenum name, GLuint index)
+{
+    // glad fails to load if a 3.0+ context has no extensions, so there is one.
+    return (const GLubyte *) "GL_collision_null";
+}
+static void APIENTRY null_GetIntegerv(GLenum pname, GLint *data)
+{
+    switch (pname) {
+    case GL_NUM_EXTENSIONS: data[0] = 1; break;
+    case GL_VIEWPORT: memcpy(data, g_null_viewport, sizeof(g_null_viewport)); break;
+    default: data[0] = 0;
+    }
+}
+static void APIENTRY null_GetFloatv(GLenum pname, GLfloat *data)
+{
+    data[0] = 0;
+}
+static void APIENTRY null_Viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    // Remembered since the engine reads the viewport back to find the subwindow.
+    g_null_viewport[0] = x;
+    g_null_viewport[1] = y;
+    g_null_viewport[2] = width;
+    g_null_viewport[3] = height;
+}
+static void APIENTRY null_GetShaderiv(GLuint shader, GLenum pname, GLint *params)
+{
+    params[0] = pname == GL_COMPILE_STATUS ? GL_TRUE : 0;
+}
+static void APIENTRY null_GetProgramiv(GLuint program, GLenum pname, GLint *params)
+{
+    params[0] = pname == GL_LINK_STATUS ? GL_TRUE : 0;
+}
+static void APIENTRY null_GetInfoLog(GLuint object, GLsizei bufSize, GLsizei *length, GLchar *infoLog)
+{
+    if (length != NULL) *length = 0;
+    if (bufSize > 0) infoLog[0] = '\0';
+}
+static void APIENTRY null_GetActiveUniformBlockiv(GLuint program, GLuint uniformBlockIndex, GLenum pname, GLint *params)
+{
+    // No active uniforms, and a zero size, so the indices query writes nothing.
+    if (pname != GL_UNIFORM_BLOCK_ACTIVE_UNIFORM_INDICES) params[0] = 0;
+}
+static void APIENTRY null_GetActiveUniformsiv(GLuint program, GLsizei uniformCount, const GLuint *uniformIndices, GLenum pname, GLint *params)
+{
+    for (int i = 0; i < uniformCount; i++) params[i] = 0;
+}
+static void APIENTRY null_GetActiveUniformName(GLuint program, GLuint uniformIndex, GLsizei bufSize, GLsizei *length, GLchar *uniformName)
+{
+    null_GetInfoLog(program, bufSize, length, uniformName);
+}
+static GLenum APIENTRY null_CheckFramebufferStatus(GLenum target)
+{
+    return GL_FRAMEBUFFER_COMPLETE;
+}
+static void APIENTRY null_GenNames(GLsizei n, GLuint *names)
+{
+    for (int i = 0; i < n; i++) names[i] = g_null_next_name ++;
+}
+static GLuint APIENTRY null_CreateName(void)
+{
+    return g_null_next_name ++;
+}
+static void * APIENTRY null_MapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access)
+{
+    // Writes to a mapping go nowhere, so every mapping shares one scratch allocation. It is never freed, rather than
+    // reallocated, since a persistent mapping (e.g. the frame ring) stays in use while later mappings are made.
+    if (length > g_null_mapping_size) {
+        g_null_mapping = malloc(length);
+        mem_check(g_null_mapping);
+        g_null_mapping_size = length;
+    }
+    return g_null_mapping;
+}
+static GLboolean APIENTRY null_UnmapBuffer(GLenum target)
+{
+    return GL_TRUE;
+}
+static GLsync APIENTRY null_FenceSync(GLenum condition, GLbitfield flags)
+{
+    return (GLsync) (uintptr_t) g_null_next_name ++;
+}
+static GLenum APIENTRY null_ClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout)
+{
+    return GL_ALREADY_SIGNALED;
+}
+
+static const struct {
+    const char *name;
+    void *proc;
+} g_null_procs[] = {
+    { "glGetString", (void *) null_GetString },
+    { "glGetStringi", (void *) null_GetStringi },
+    { "glGetIntegerv", (void *) null_GetIntegerv },
+    { "glGetFloatv", (void *) null_GetFloatv },
+    { "glViewport", (void *) null_Viewport },
+    { "glGetShaderiv", (void *) null_GetShaderiv },
+    { "glGetProgramiv", (void *) null_GetProgramiv },
+    { "glGetShaderInfoLog", (void *) null_GetInfoLog },
+    { "glGetProgramInfoLog", (void *) null_GetInfoLog },
+    { "glGetActiveUniformBlockiv", (void *) null_GetActiveUniformBlockiv },
+    { "glGetActiveUniformsiv", (void *) null_GetActiveUniformsiv },
+    { "glGetActiveUniformName", (void *) null_GetActiveUniformName },
+    { "glCheckFramebufferStatus", (void *) null_CheckFramebufferStatus },
+    { "glGenBuffers", (void *) null_GenNames },
+    { "glGenVertexArrays", (void *) null_GenNames },
+    { "glGenTextures", (void *) null_GenNames },
+    { "glGenFramebuffers", (void *) null_GenNames },
+    { "glGenRenderbuffers", (void *) null_GenNames },
+    { "glGenSamplers", (void *) null_GenNames },
+    { "glGenQueries", (void *) null_GenNames },
+    { "glCreateShader", (void *) null_CreateName },
+    { "glCreateProgram", (void *) null_CreateName },
+    { "glMapBufferRange", (void *) null_MapBufferRange },
+    { "glUnmapBuffer", (void *) null_UnmapBuffer },
+    { "glFenceSync", (void *) null_FenceSync },
+    { "glClientWaitSync", (void *) null_ClientWaitSync },
+};
+
+static void *null_loader(const char *name)
+{
+    for (int i = 0; i < sizeof(g_null_procs)/sizeof(g_null_procs[0]); i++) {
+        if (strcmp(g_null_procs[i].name, name) == 0) return g_null_procs[i].proc;
+    }
+    return (void *) null_noop;
+}
+
+/*--------------------------------------------------------------------------------
+    Recording
+--------------------------------------------------------------------------------*/
+// The last known binding of things which are cheap to track, so rebinding what is already bound can be counted.
+// (GLuint) -1 means unknown, e.g. before the first bind.
+#define UNKNOWN ((GLuint) -1)
+#define MAX_TRACKED_UNITS 32
+#define MAX_TRACKED_CAPS 32
+enum { TRACK_TEXTURE_2D, TRACK_TEXTURE_CUBE_MAP, TRACK_TEXTURE_2D_ARRAY, NUM_TRACKED_TEXTURE_TARGETS };
+enum { TRACK_ARRAY_BUFFER, TRACK_ELEMENT_ARRAY_BUFFER, TRACK_UNIFORM_BUFFER, NUM_TRACKED_BUFFER_TARGETS };
+static struct {
+    GLuint program;
+    GLuint vao;
+    GLuint framebuffer;
+    GLuint unit;
+    GLuint textures[MAX_TRACKED_UNITS][NUM_TRACKED_TEXTURE_TARGETS];
+    GLuint buffers[NUM_TRACKED_BUFFER_TARGETS];
+    struct {
+        GLenum cap;
+        bool enabled;
+    } caps[MAX_TRACKED_CAPS];
+    int num_caps;
+} g_bound;
+
+static void forget_bindings(void)
+{
+    g_bound.program = UNKNOWN;
+    g_bound.vao = UNKNOWN;
+    g_bound.framebuffer = UNKNOWN;
+    g_bound.unit = UNKNOWN;
+    for (int i = 0; i < MAX_TRACKED_UNITS; i++) {
+        for (int j = 0; j < NUM_TRACKED_TEXTURE_TARGETS; j++) g_bound.textures[i][j] = UNKNOWN;
+    }
+    for (int i = 0; i < NUM_TRACKED_BUFFER_TARGETS; i++) g_bound.buffers[i] = UNKNOWN;
+    g_bound.num_caps = 0;
+}
+
+static GLuint *tracked_texture(GLenum target)
+{
+    if (g_bound.unit >= MAX_TRACKED_UNITS) return NULL;
+    switch (target) {
+    case GL_TEXTURE_2D: return &g_bound.textures[g_bound.unit][TRACK_TEXTURE_2D];
+    case GL_TEXTURE_CUBE_MAP: return &g_bound.textures[g_bound.unit][TRACK_TEXTURE_CUBE_MAP];
+    case GL_TEXTURE_2D_ARRAY: return &g_bound.textures[g_bound.unit][TRACK_TEXTURE_2D_ARRAY];
+    default: return NULL;
+    }
+}
+static GLuint *tracked_buffer(GLenum target)
+{
+    switch (target) {
+    case GL_ARRAY_BUFFER: return &g_bound.buffers[TRACK_ARRAY_BUFFER];
+    case GL_ELEMENT_ARRAY_BUFFER: return &g_bound.buffers[TRACK_ELEMENT_ARRAY_BUFFER];
+    case GL_UNIFORM_BUFFER: return &g_bound.buffers[TRACK_UNIFORM_BUFFER];
+    default: return NULL;
+    }
+}
+
+// Count a state change which sets the tracked value (if there is one) to the new value.
+static void state_change(GLuint *tracked, GLuint value)
+{
+    g_stats.state_changes ++;
+    if (tracked == NULL) return;
+    if (*tracked == value) g_stats.redundant_state_changes ++;
+    *tracked = value;
+}
+static void cap_change(GLenum cap, bool enabled)
+{
+    g_stats.state_changes ++;
+    for (int i = 0; i < g_bound.num_caps; i++) {
+        if (g_bound.caps[i].cap == cap) {
+            if (g_bound.caps[i].enabled == enabled) g_stats.redundant_state_changes ++;
+            g_bound.caps[i].enabled = enabled;
+            return;
+        }
+    }
+    if (g_bound.num_caps == MAX_TRACKED_CAPS) return;
+    g_bound.caps[g_bound.num_caps].cap = cap;
+    g_bound.caps[g_bound.num_caps].enabled = enabled;
+    g_bound.num_caps ++;
+}
+// Deleting a bound object reverts the binding to zero.
+static void forget_deleted(GLuint *tracked, int n, GLsizei num_names, const GLuint *names)
+{
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < num_names; j++) {
+            if (tracked[i] == names[j]) tracked[i] = 0;
+        }
+    }
+}
+
+static size_t texel_size(GLenum format, GLenum type)
+{
+    switch (type) {
+    case GL_UNSIGNED_INT_24_8:
+    case GL_UNSIGNED_INT_8_8_8_8:
+    case GL_UNSIGNED_INT_8_8_8_8_REV:
+    case GL_UNSIGNED_INT_2_10_10_10_REV:
+        return 4; // packed, the whole texel is one value.
+    }
+    size_t components;
+    switch (format) {
+    case GL_RG: case GL_RG_INTEGER: components = 2; break;
+    case GL_RGB: case GL_BGR: case GL_RGB_INTEGER: components = 3; break;
+    case GL_RGBA: case GL_BGRA: case GL_RGBA_INTEGER: components = 4; break;
+    default: components = 1;
+    }
+    switch (type) {
+    case GL_SHORT: case GL_UNSIGNED_SHORT: case GL_HALF_FLOAT: return components * 2;
+    case GL_INT: case GL_UNSIGNED_INT: case GL_FLOAT: return components * 4;
+    default: return components;
+    }
+}
+
+// The functions which were in the table before recording was switched on.
+static PFNGLDRAWARRAYSPROC lower_DrawArrays;
+static PFNGLDRAWELEMENTSPROC lower_DrawElements;
+static PFNGLDRAWARRAYSINSTANCEDPROC lower_DrawArraysInstanced;
+static PFNGLDRAWELEMENTSINSTANCEDPROC lower_DrawElementsInstanced;
+static PFNGLDRAWARRAYSINSTANCEDBASEINSTANCEPROC lower_DrawArraysInstancedBaseInstance;
+static PFNGLDRAWELEMENTSINSTANCEDBASEINSTANCEPROC lower_DrawElementsInstancedBaseInstance;
+static PFNGLCLEARPROC lower_Clear;
+static PFNGLUSEPROGRAMPROC lower_UseProgram;
+static PFNGLBINDVERTEXARRAYPROC lower_BindVertexArray;
+static PFNGLACTIVETEXTUREPROC lower_ActiveTexture;
+static PFNGLBINDTEXTUREPROC lower_BindTexture;
+static PFNGLBINDBUFFERPROC lower_BindBuffer;
+static PFNGLBINDBUFFERBASEPROC lower_BindBufferBase;
+static PFNGLBINDFRAMEBUFFERPROC lower_BindFramebuffer;
+static PFNGLBINDSAMPLERPROC lower_BindSampler;
+static PFNGLENABLEPROC lower_Enable;
+static PFNGLDISABLEPROC lower_Disable;
+static PFNGLBLENDFUNCPROC lower_BlendFunc;
+static PFNGLBLENDEQUATIONPROC lower_BlendEquation;
+static PFNGLCULLFACEPROC lower_CullFace;
+static PFNGLDEPTHFUNCPROC lower_DepthFunc;
+static PFNGLVIEWPORTPROC lower_Viewport;
+static PFNGLSCISSORPROC lower_Scissor;
+static PFNGLUNIFORM1FPROC lower_Uniform1f;
+static PFNGLUNIFORM1IPROC lower_Uniform1i;
+static PFNGLUNIFORM3FPROC lower_Uniform3f;
+static PFNGLUNIFORM4FPROC lower_Uniform4f;
+static PFNGLUNIFORMMATRIX4FVPROC lower_UniformMatrix4fv;
+static PFNGLBUFFERDATAPROC lower_BufferData;
+static PFNGLBUFFERSUBDATAPROC lower_BufferSubData;
+static PFNGLBUFFERSTORAGEPROC lower_BufferStorage;
+static PFNGLTEXIMAGE2DPROC lower_TexImage2D;
+static PFNGLTEXSUBIMAGE2DPROC lower_TexSubImage2D;
+static PFNGLGENBUFFERSPROC lower_GenBuffers;
+static PFNGLGENVERTEXARRAYSPROC lower_GenVertexArrays;
+static PFNGLGENTEXTURESPROC lower_GenTextures;
+static PFNGLGENFRAMEBUFFERSPROC lower_GenFramebuffers;
+static PFNGLDELETEBUFFERSPROC lower_DeleteBuffers;
+static PFNGLDELETEVERTEXARRAYSPROC lower_DeleteVertexArrays;
+static PFNGLDELETETEXTURESPROC lower_DeleteTextures;
+
+//---Draws
+static void APIENTRY record_DrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+    g_stats.draw_calls ++;
+    g_stats.instances ++;
+    g_stats.vertices += count;
+    lower_DrawArrays(mode, first, count);
+}
+static void APIENTRY record_DrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices)
+{
+    g_stats.draw_calls ++;
+    g_stats.instances ++;
+    g_stats.vertices += count;
+    lower_DrawElements(mode, count, type, indices);
+}
+static void APIENTRY record_DrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instancecount)
+{
+    g_stats.draw_calls ++;
+    g_stats.instances += instancecount;
+    g_stats.vertices += ((uint64_t) count) * instancecount;
+    lower_DrawArraysInstanced(mode, first, count, instancecount);
+}
+static void APIENTRY record_DrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei instancecount)
+{
+    g_stats.draw_calls ++;
+    g_stats.instances += instancecount;
+    g_stats.vertices += ((uint64_t) count) * instancecount;
+    lower_DrawElementsInstanced(mode, count, type, indices, instancecount);
+}
+static void APIENTRY record_DrawArraysInstancedBaseInstance(GLenum mode, GLint first, GLsizei count, GLsizei instancecount, GLuint baseinstance)
+{
+    g_stats.draw_calls ++;
+    g_stats.instances += instancecount;
+    g_stats.vertices += ((uint64_t) count) * instancecount;
+    lower_DrawArraysInstancedBaseInstance(mode, first, count, instancecount, baseinstance);
+}
+static void APIENTRY record_DrawElementsInstancedBaseInstance(GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei instancecount, GLuint baseinstance)
+{
+    g_stats.draw_calls ++;
+    g_stats.instances += instancecount;
+    g_stats.vertices += ((uint64_t) count) * instancecount;
+    lower_DrawElementsInstancedBaseInstance(mode, count, type, indices, instancecount, baseinstance);
+}
+static void APIENTRY record_Clear(GLbitfield mask)
+{
+    g_stats.clears ++;
+    lower_Clear(mask);
+}
+//---State
+static void APIENTRY record_UseProgram(GLuint program)
+{
+    g_stats.program_changes ++;
+    state_change(&g_bound.program, program);
+    lower_UseProgram(program);
+}
+static void APIENTRY record_BindVertexArray(GLuint array)
+{
+    g_stats.vao_changes ++;
+    if (array != g_bound.vao) g_bound.buffers[TRACK_ELEMENT_ARRAY_BUFFER] = UNKNOWN; // The element buffer binding is part of the VAO.
+    state_change(&g_bound.vao, array);
+    lower_BindVertexArray(array);
+}
+static void APIENTRY record_ActiveTexture(GLenum texture)
+{
+    state_change(&g_bound.unit, texture - GL_TEXTURE0);
+    lower_ActiveTexture(texture);
+}
+static void APIENTRY record_BindTexture(GLenum target, GLuint texture)
+{
+    g_stats.texture_changes ++;
+    state_change(tracked_texture(target), texture);
+    lower_BindTexture(target, texture);
+}
+static void APIENTRY record_BindBuffer(GLenum target, GLuint buffer)
+{
+    g_stats.buffer_changes ++;
+    state_change(tracked_buffer(target), buffer);
+    lower_BindBuffer(target, buffer);
+}
+static void APIENTRY record_BindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+    // This also binds the generic binding point.
+    g_stats.buffer_changes ++;
+    state_change(tracked_buffer(target), buffer);
+    lower_BindBufferBase(target, index, buffer);
+}
+static void APIENTRY record_BindFramebuffer(GLenum target, GLuint framebuffer)
+{
+    state_change(&g_bound.framebuffer, framebuffer);
+    lower_BindFramebuffer(target, framebuffer);
+}
+static void APIENTRY record_BindSampler(GLuint unit, GLuint sampler)
+{
+    state_change(NULL, 0);
+    lower_BindSampler(unit, sampler);
+}
+static void APIENTRY record_Enable(GLenum cap)
+{
+    cap_change(cap, true);
+    lower_Enable(cap);
+}
+static void APIENTRY record_Disable(GLenum cap)
+{
+    cap_change(cap, false);
+    lower_Disable(cap);
+}
+static void APIENTRY record_BlendFunc(GLenum sfactor, GLenum dfactor)
+{
+    state_change(NULL, 0);
+    lower_BlendFunc(sfactor, dfactor);
+}
+static void APIENTRY record_BlendEquation(GLenum mode)
+{
+    state_change(NULL, 0);
+    lower_BlendEquation(mode);
+}
+static void APIENTRY record_CullFace(GLenum mode)
+{
+    state_change(NULL, 0);
+    lower_CullFace(mode);
+}
+static void APIENTRY record_DepthFunc(GLenum func)
+{
+    state_change(NULL, 0);
+    lower_DepthFunc(func);
+}
+static void APIENTRY record_Viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    state_change(NULL, 0);
+    lower_Viewport(x, y, width, height);
+}
+static void APIENTRY record_Scissor(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    state_change(NULL, 0);
+    lower_Scissor(x, y, width, height);
+}
+//---Uniforms
+static void APIENTRY record_Uniform1f(GLint location, GLfloat v0)
+{
+    g_stats.uniform_uploads ++;
+    g_stats.bytes_uploaded += sizeof(GLfloat);
+    lower_Uniform1f(location, v0);
+}
+static void APIENTRY record_Uniform1i(GLint location, GLint v0)
+{
+    g_stats.uniform_uploads ++;
+    g_stats.bytes_uploaded += sizeof(GLint);
+    lower_Uniform1i(location, v0);
+}
+static void APIENTRY record_Uniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2)
+{
+    g_stats.uniform_uploads ++;
+    g_stats.bytes_uploaded += 3 * sizeof(GLfloat);
+    lower_Uniform3f(location, v0, v1, v2);
+}
+static void APIENTRY record_Uniform4f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3)
+{
+    g_stats.uniform_uploads ++;
+    g_stats.bytes_uploaded += 4 * sizeof(GLfloat);
+    lower_Uniform4f(location, v0, v1, v2, v3);
+}
+static void APIENTRY record_UniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value)
+{
+    g_stats.uniform_uploads ++;
+    g_stats.bytes_uploaded += ((uint64_t) count) * 16 * sizeof(GLfloat);
+    lower_UniformMatrix4fv(location, count, transpose, value);
+}
+//---Uploads
+static void APIENTRY record_BufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage)
+{
+    g_stats.bytes_allocated += size;
+    if (data != NULL) g_stats.bytes_uploaded += size;
+    lower_BufferData(target, size, data, usage);
+}
+static void APIENTRY record_BufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data)
+{
+    g_stats.bytes_uploaded += size;
+    lower_BufferSubData(target, offset, size, data);
+}
+static void APIENTRY record_BufferStorage(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags)
+{
+    g_stats.bytes_allocated += size;
+    if (data != NULL) g_stats.bytes_uploaded += size;
+    lower_BufferStorage(target, size, data, flags);
+}
+static void APIENTRY record_TexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *pixels)
+{
+    size_t size = ((size_t) width) * height * texel_size(format, type);
+    g_stats.bytes_allocated += size;
+    if (pixels != NULL) g_stats.bytes_uploaded += size;
+    lower_TexImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+}
+static void APIENTRY record_TexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *pixels)
+{
+    g_stats.bytes_uploaded += ((size_t) width) * height * texel_size(format, type);
+    lower_TexSubImage2D(target, level, xoffset, yoffset, width, height, format, type, pixels);
+}
+//---Objects
+static void APIENTRY record_GenBuffers(GLsizei n, GLuint *buffers)
+{
+    g_stats.objects_created += n;
+    lower_GenBuffers(n, buffers);
+}
+static void APIENTRY record_GenVertexArrays(GLsizei n, GLuint *arrays)
+{
+    g_stats.objects_created += n;
+    lower_GenVertexArrays(n, arrays);
+}
+static void APIENTRY record_GenTextures(GLsizei n, GLuint *textures)
+{
+    g_stats.objects_created += n;
+    lower_GenTextures(n, textures);
+}
+static void APIENTRY record_GenFramebuffers(GLsizei n, GLuint *framebuffers)
+{
+    g_stats.objects_created += n;
+    lower_GenFramebuffers(n, framebuffers);
+}
+static void APIENTRY record_DeleteBuffers(GLsizei n, const GLuint *buffers)
+{
+    g_stats.objects_deleted += n;
+    forget_deleted(g_bound.buffers, NUM_TRACKED_BUFFER_TARGETS, n, buffers);
+    lower_DeleteBuffers(n, buffers);
+}
+static void APIENTRY record_DeleteVertexArrays(GLsizei n, const GLuint *arrays)
+{
+    g_stats.objects_deleted += n;
+    forget_deleted(&g_bound.vao, 1, n, arrays);
+    lower_DeleteVertexArrays(n, arrays);
+}
+static void APIENTRY record_DeleteTextures(GLsizei n, const GLuint *textures)
+{
+    g_stats.objects_deleted += n;
+    forget_deleted(&g_bound.textures[0][0], MAX_TRACKED_UNITS * NUM_TRACKED_TEXTURE_TARGETS, n, textures);
+    lower_DeleteTextures(n, textures);
+}
+
+/*--------------------------------------------------------------------------------
+    Interface
+--------------------------------------------------------------------------------*/
+void gl_dispatch_load(GLDispatchBackend backend)
+{
+    int status;
+    switch (backend) {
+    case GL_DISPATCH_NATIVE:
+        status = gladLoadGL();
+        break;
+    case GL_DISPATCH_NULL:
+        status = gladLoadGLLoader(null_loader);
+        break;
+    default:
+        fprintf(stderr, ERROR_ALERT "Invalid GL dispatch backend given.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!status) {
+        fprintf(stderr, ERROR_ALERT "Failed to load the %s GL functions.\n", backend == GL_DISPATCH_NATIVE ? "native" : "null");
+        exit(EXIT_FAILURE);
+    }
+    g_backend = backend;
+    // Loading replaces the whole table, so recording has to be switched back on.
+    g_recording = false;
+}
+
+GLDispatchBackend gl_dispatch_backend(void)
+{
+    return g_backend;
+}
+
+void gl_dispatch_record(void)
+{
+    if (g_recording) return;
+    g_recording = true;
+    forget_bindings();
+#define hook(NAME)\
+    lower_ ## NAME = glad_gl ## NAME;\
+    glad_gl ## NAME = record_ ## NAME;
+    hook(DrawArrays);
+    hook(DrawElements);
+    hook(DrawArraysInstanced);
+    hook(DrawElementsInstanced);
+    hook(DrawArraysInstancedBaseInstance);
+    hook(DrawElementsInstancedBaseInstance);
+    hook(Clear);
+    hook(UseProgram);
+    hook(BindVertexArray);
+    hook(ActiveTexture);
+    hook(BindTexture);
+    hook(BindBuffer);
+    hook(BindBufferBase);
+    hook(BindFramebuffer);
+    hook(BindSampler);
+    hook(Enable);
+    hook(Disable);
+    hook(BlendFunc);
+    hook(BlendEquation);
+    hook(CullFace);
+    hook(DepthFunc);
+    hook(Viewport);
+    hook(Scissor);
+    hook(Uniform1f);
+    hook(Uniform1i);
+    hook(Uniform3f);
+    hook(Uniform4f);
+    hook(UniformMatrix4fv);
+    hook(BufferData);
+    hook(BufferSubData);
+    hook(BufferStorage);
+    hook(TexImage2D);
+    hook(TexSubImage2D);
+    hook(GenBuffers);
+    hook(GenVertexArrays);
+    hook(GenTextures);
+    hook(GenFramebuffers);
+    hook(DeleteBuffers);
+    hook(DeleteVertexArrays);
+    hook(DeleteTextures);
+#undef hook
+}
+
+bool gl_dispatch_recording(void)
+{
+    return g_recording;
+}
+
+void gl_dispatch_end_frame(void)
+{
+    g_stats.frames ++;
+}
+
+GLDispatchStats gl_dispatch_stats(void)
+{
+    return g_stats;
+}
+
+void gl_dispatch_reset_stats(void)
+{
+    memset(&g_stats, 0, sizeof(GLDispatchStats));
+}
+
+void gl_dispatch_print_stats(FILE *file)
+{
+    // Totals, and per-frame averages if any frames were finished.
+    double f = g_stats.frames > 0 ? g_stats.frames : 1;
+#define stat(NAME) fprintf(file, "%-24s %14llu %16.2f\n", #NAME, (unsigned long long) g_stats.NAME, g_stats.NAME / f)
+    fprintf(file, "%-24s %14s %16s\n", "gl_stat", "total", "per_frame");
+    fprintf(file, "%-24s %14llu\n", "frames", (unsigned long long) g_stats.frames);
+    stat(draw_calls);
+    stat(instances);
+    stat(vertices);
+    stat(clears);
+    stat(state_changes);
+    stat(redundant_state_changes);
+    stat(program_changes);
+    stat(texture_changes);
+    stat(vao_changes);
+    stat(buffer_changes);
+    stat(uniform_uploads);
+    stat(bytes_uploaded);
+    stat(bytes_allocated);
+    stat(objects_created);
+    stat(objects_deleted);
+#undef stat
+}
+
+/*--------------------------------------------------------------------------------
+    Regression check
+--------------------------------------------------------------------------------*/
+// The totals which are compared. These should be the same on every run of a fixed scene, frame count and timestep.
+#define NUM_CHECKED_STATS 4
+static const char *g_checked_stat_names[NUM_CHECKED_STATS] = { "frames", "draw_calls", "state_changes", "objects_created" };
+static void checked_stats(uint64_t values[])
+{
+    values[0] = g_stats.frames;
+    values[1] = g_stats.draw_calls;
+    values[2] = g_stats.state_changes;
+    values[3] = g_stats.objects_created;
+}
+
+void gl_dispatch_write_stats(char *path)
+{
+    uint64_t values[NUM_CHECKED_STATS];
+    checked_stats(values);
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, ERROR_ALERT "Could not open \"%s\" to write the expected GL stats.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < NUM_CHECKED_STATS; i++) fprintf(file, "%s %llu\n", g_checked_stat_names[i], (unsigned long long) values[i]);
+    fclose(file);
+    printf("Wrote the expected GL stats to \"%s\".\n", path);
+}
+
+bool gl_dispatch_check_stats(char *path)
+{
+    uint64_t values[NUM_CHECKED_STATS];
+    checked_stats(values);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        // A missing expectation is a failure, not a pass, so that the check can't silently record whatever it is given.
+        fprintf(stderr, ERROR_ALERT "Could not open the expected GL stats \"%s\". They are recorded with -E.\n", path);
+        return false;
+    }
+    bool same = true;
+    bool found[NUM_CHECKED_STATS] = {0};
+    char name[64];
+    unsigned long long expected;
+    while (fscanf(file, "%63s %llu", name, &expected) == 2) {
+        for (int i = 0; i < NUM_CHECKED_STATS; i++) {
+            if (strcmp(name, g_checked_stat_names[i]) != 0) continue;
+            found[i] = true;
+            if (values[i] != expected) {
+                fprintf(stderr, ERROR_ALERT "GL stat %s is %llu, expected %llu.\n", name, (unsigned long long) values[i], expected);
+                same = false;
+            }
+        }
+    }
+    fclose(file);
+    for (int i = 0; i < NUM_CHECKED_STATS; i++) {
+        if (!found[i]) {
+            fprintf(stderr, ERROR_ALERT "The expected GL stats \"%s\" have no %s.\n", path, g_checked_stat_names[i]);
+            same = false;
+        }
+    }
+    if (same) printf("GL stats match \"%s\".\n", path);
+    return same;
+}
@@ -0,0 +1,482 @@
+/*--------------------------------------------------------------------------------
+    CPU path tracer
+    ---------------
+Surfaces are Lambertian, with an optional emission, and light comes from the emitters and the sky. Each sample traces a
+path from the camera through a jittered point in its pixel, bouncing in cosine-weighted directions about the normal.
+Rays are intersected against each instance whose world box they pass through, by moving the ray into the mesh's own
+coordinates and querying its triangle BVH. The direction is transformed without normalizing, so distances along the ray
+are the same in both.
+Random numbers are seeded from the pixel and sample index, so a render is the same however the tiles are shared out.
+
+project_libs:
+    + helper_definitions
+    + matrix_mathematics
+    + geometry
+--------------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <png.h>
+#include "helper_definitions.h"
+#include "path_tracer.h"
+
+#define MIN(X,Y) ((X) < (Y) ? (X) : (Y))
+#define MAX(X,Y) ((X) < (Y) ? (Y) : (X))
+
+static double time_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Column-major affine transformations of points and vectors.
+static vec3 transform_point(mat4x4 *m, vec3 v)
+{
+    float *a = m->vals;
+    return new_vec3(a[0]*v.vals[0] + a[4]*v.vals[1] + a[8]*v.vals[2] + a[12],
+                    a[1]*v.vals[0] + a[5]*v.vals[1] + a[9]*v.vals[2] + a[13],
+                    a[2]*v.vals[0] + a[6]*v.vals[1] + a[10]*v.vals[2] + a[14]);
+}
+static vec3 transform_vector(mat4x4 *m, vec3 v)
+{
+    float *a = m->vals;
+    return new_vec3(a[0]*v.vals[0] + a[4]*v.vals[1] + a[8]*v.vals[2],
+                    a[1]*v.vals[0] + a[5]*v.vals[1] + a[9]*v.vals[2],
+                    a[2]*v.vals[0] + a[6]*v.vals[1] + a[10]*v.vals[2]);
+}
+// Normals transform by the inverse transpose.
+static vec3 transform_normal(mat4x4 *inverse, vec3 n)
+{
+    float *a = inverse->vals;
+    return new_vec3(a[0]*n.vals[0] + a[1]*n.vals[1] + a[2]*n.vals[2],
+                    a[4]*n.vals[0] + a[5]*n.vals[1] + a[6]*n.vals[2],
+                    a[8]*n.vals[0] + a[9]*n.vals[1] + a[10]*n.vals[2]);
+}
+
+/*--------------------------------------------------------------------------------
+    Meshes and scenes.
+--------------------------------------------------------------------------------*/
+PTMesh *pt_mesh_create(int num_vertices, float *positions, float *normals, int num_triangles, uint32_t *triangles)
+{
+    PTMesh *mesh = malloc(sizeof(PTMesh));
+    mem_check(mesh);
+    mesh->num_vertices = num_vertices;
+    mesh->positions = malloc(3 * num_vertices * sizeof(float));
+    mem_check(mesh->positions);
+    memcpy(mesh->positions, positions, 3 * num_vertices * sizeof(float));
+    mesh->normals = NULL;
+    if (normals != NULL) {
+        mesh->normals = malloc(3 * num_vertices * sizeof(float));
+        mem_check(mesh->normals);
+        memcpy(mesh->normals, normals, 3 * num_vertices * sizeof(float));
+    }
+    mesh->num_triangles = num_triangles;
+    mesh->triangles = malloc(3 * num_triangles * sizeof(uint32_t));
+    mem_check(mesh->triangles);
+    memcpy(mesh->triangles, triangles, 3 * num_triangles * sizeof(uint32_t));
+    triangle_bvh_build(&mesh->bvh, num_vertices, mesh->positions, num_triangles, mesh->triangles);
+    for (int i = 0; i < 3; i++) {
+        mesh->box_min[i] = INFINITY;
+        mesh->box_max[i] = -INFINITY;
+    }
+    for (int i = 0; i < num_vertices; i++) {
+        for (int j = 0; j < 3; j++) {
+            mesh->box_min[j] = MIN(mesh->box_min[j], positions[3*i + j]);
+            mesh->box_max[j] = MAX(mesh->box_max[j], positions[3*i + j]);
+        }
+    }
+    return mesh;
+}
+
+void pt_mesh_destroy(PTMesh *mesh)
+{
+    triangle_bvh_destroy(&mesh->bvh);
+    free(mesh->positions);
+    free(mesh->normals);
+    free(mesh->triangles);
+    free(mesh);
+}
+
+void pt_scene_init(PTScene *scene)
+{
+    memset(scene, 0, sizeof(PTScene));
+    scene->sky_horizon = new_vec3(0.9, 0.9, 0.95);
+    scene->sky_zenith = new_vec3(0.35, 0.55, 0.9);
+}
+
+void pt_scene_set_matrix(PTScene *scene, int instance_index, mat4x4 matrix)
+{
+    PTInstance *instance = &scene->instances[instance_index];
+    instance->matrix = matrix;
+    instance->inverse_matrix = mat4x4_inverse(matrix);
+    // The world box bounds the transformed corners of the mesh's box.
+    PTMesh *mesh = instance->mesh;
+    for (int i = 0; i < 3; i++) {
+        instance->box_min[i] = INFINITY;
+        instance->box_max[i] = -INFINITY;
+    }
+    for (int corner = 0; corner < 8; corner++) {
+        vec3 p = new_vec3((corner & 1) ? mesh->box_max[0] : mesh->box_min[0],
+                          (corner & 2) ? mesh->box_max[1] : mesh->box_min[1],
+                          (corner & 4) ? mesh->box_max[2] : mesh->box_min[2]);
+        p = transform_point(&instance->matrix, p);
+        for (int i = 0; i < 3; i++) {
+            instance->box_min[i] = MIN(instance->box_min[i], p.vals[i]);
+            instance->box_max[i] = MAX(instance->box_max[i], p.vals[i]);
+        }
+    }
+}
+
+int pt_scene_add(PTScene *scene, PTMesh *mesh, mat4x4 matrix, vec3 albedo, vec3 emission)
+{
+    if (scene->num_instances == scene->instances_capacity) {
+        scene->instances_capacity = scene->instances_capacity == 0 ? 16 : 2 * scene->instances_capacity;
+        scene->instances = realloc(scene->instances, scene->instances_capacity * sizeof(PTInstance));
+        mem_check(scene->instances);
+    }
+    int index = scene->num_instances ++;
+    PTInstance *instance = &scene->instances[index];
+    instance->mesh = mesh;
+    instance->albedo = albedo;
+    instance->emission = emission;
+    pt_scene_set_matrix(scene, index, matrix);
+    return index;
+}
+
+void pt_scene_destroy(PTScene *scene)
+{
+    free(scene->instances);
+    memset(scene, 0, sizeof(PTScene));
+}
+
+/*--------------------------------------------------------------------------------
+    Tracing.
+--------------------------------------------------------------------------------*/
+typedef struct SceneHit_s {
+    int instance;
+    TriangleRayHit triangle_hit;
+} SceneHit;
+
+static bool ray_box(vec3 o, vec3 inv_d, float min[3], float max[3], float max_t)
+{
+    float t_enter = 0;
+    float t_exit = max_t;
+    for (int i = 0; i < 3; i++) {
+        float t1 = (min[i] - o.vals[i]) * inv_d.vals[i];
+        float t2 = (max[i] - o.vals[i]) * inv_d.vals[i];
+        t_enter = MAX(t_enter, MIN(t1, t2));
+        t_exit = MIN(t_exit, MAX(t1, t2));
+    }
+    return t_enter <= t_exit;
+}
+
+static bool scene_intersect(PTScene *scene, vec3 o, vec3 d, SceneHit *hit)
+{
+    vec3 inv_d;
+    for (int i = 0; i < 3; i++) {
+        float di = fabs(d.vals[i]) < 1e-20 ? (d.vals[i] < 0 ? -1e-20 : 1e-20) : d.vals[i];
+        inv_d.vals[i] = 1.0 / di;
+    }
+    float best_t = INFINITY;
+    bool found = false;
+    for (int i = 0; i < scene->num_instances; i++) {
+        PTInstance *instance = &scene->instances[i];
+        if (!ray_box(o, inv_d, instance->box_min, instance->box_max, best_t)) continue;
+        vec3 local_o = transform_point(&instance->inverse_matrix, o);
+        vec3 local_d = transform_vector(&instance->inverse_matrix, d);
+        TriangleRayHit triangle_hit;
+        if (triangle_bvh_raycast(&instance->mesh->bvh, local_o, local_d, best_t, &triangle_hit)) {
+            best_t = triangle_hit.t;
+            hit->instance = i;
+            hit->triangle_hit = triangle_hit;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// The world-space normal at a hit, facing against the ray.
+static vec3 hit_normal(PTScene *scene, SceneHit *hit, vec3 d)
+{
+    PTInstance *instance = &scene->instances[hit->instance];
+    PTMesh *mesh = instance->mesh;
+    uint32_t *tri = &mesh->triangles[3*hit->triangle_hit.triangle];
+    vec3 n = vec3_zero();
+    if (mesh->normals != NULL) {
+        for (int i = 0; i < 3; i++) {
+            float w = hit->triangle_hit.barycentric.vals[i];
+            for (int j = 0; j < 3; j++) n.vals[j] += w * mesh->normals[3*tri[i] + j];
+        }
+    }
+    if (mesh->normals == NULL || vec3_dot(n, n) < 1e-12) {
+        vec3 a, b, c;
+        memcpy(&a, &mesh->positions[3*tri[0]], sizeof(vec3));
+        memcpy(&b, &mesh->positions[3*tri[1]], sizeof(vec3));
+        memcpy(&c, &mesh->positions[3*tri[2]], sizeof(vec3));
+        n = vec3_cross(vec3_sub(b, a), vec3_sub(c, a));
+    }
+    // (Not vec3_normalize, since that gives zero for short vectors, and small meshes have short cross products.)
+    n = transform_normal(&instance->inverse_matrix, n);
+    n = vec3_mul(n, 1.0 / sqrt(vec3_dot(n, n)));
+    if (vec3_dot(n, d) > 0) n = vec3_neg(n);
+    return n;
+}
+
+static uint32_t hash32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+// xorshift32, giving a float in [0, 1).
+static float random_float(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+static vec3 cosine_direction(vec3 n, uint32_t *rng)
+{
+    // A point on the unit disk, projected up to the hemisphere, in a basis around the normal.
+    float r = sqrt(random_float(rng));
+    float phi = 2 * M_PI * random_float(rng);
+    float x = r * cos(phi);
+    float y = r * sin(phi);
+    float z = sqrt(MAX(0, 1 - x*x - y*y));
+    vec3 t = fabs(n.vals[0]) > 0.9 ? new_vec3(0, 1, 0) : new_vec3(1, 0, 0);
+    vec3 u = vec3_normalize(vec3_cross(t, n));
+    vec3 v = vec3_cross(n, u);
+    return vec3_add(vec3_add(vec3_mul(u, x), vec3_mul(v, y)), vec3_mul(n, z));
+}
+
+static vec3 sky(PTScene *scene, vec3 d)
+{
+    float up = MAX(0, d.vals[1] / vec3_length(d));
+    return vec3_lerp(scene->sky_zenith, scene->sky_horizon, up);
+}
+
+static vec3 trace_path(PathTracer *pt, vec3 o, vec3 d, uint32_t *rng, uint64_t *num_rays)
+{
+    PTScene *scene = pt->scene;
+    vec3 radiance = vec3_zero();
+    vec3 throughput = new_vec3(1, 1, 1);
+    for (int bounce = 0; bounce <= pt->max_bounces; bounce++) {
+        SceneHit hit;
+        (*num_rays) ++;
+        if (!scene_intersect(scene, o, d, &hit)) {
+            vec3 s = sky(scene, d);
+            for (int i = 0; i < 3; i++) radiance.vals[i] += throughput.vals[i] * s.vals[i];
+            break;
+        }
+        PTInstance *instance = &scene->instances[hit.instance];
+        for (int i = 0; i < 3; i++) {
+            radiance.vals[i] += throughput.vals[i] * instance->emission.vals[i];
+            throughput.vals[i] *= instance->albedo.vals[i];
+        }
+        if (bounce >= PATH_TRACER_ROULETTE_BOUNCES) {
+            float survive = MIN(0.95, MAX(throughput.vals[0], MAX(throughput.vals[1], throughput.vals[2])));
+            if (random_float(rng) >= survive) break;
+            throughput = vec3_mul(throughput, 1.0 / survive);
+        }
+        vec3 n = hit_normal(scene, &hit, d);
+        vec3 p = vec3_add(o, vec3_mul(d, hit.triangle_hit.t));
+        // Start the next ray slightly off the surface, so it doesn't hit the same triangle.
+        float scale = MAX(fabs(p.vals[0]), MAX(fabs(p.vals[1]), fabs(p.vals[2])));
+        o = vec3_add(p, vec3_mul(n, 1e-4 * (1 + scale)));
+        d = cosine_direction(n, rng);
+    }
+    return radiance;
+}
+
+/*--------------------------------------------------------------------------------
+    Rendering.
+--------------------------------------------------------------------------------*/
+void path_tracer_init(PathTracer *pt, PTScene *scene, int width, int height)
+{
+    memset(pt, 0, sizeof(PathTracer));
+    pt->scene = scene;
+    pt->width = width;
+    pt->height = height;
+    pt->max_bounces = PATH_TRACER_MAX_BOUNCES;
+    pt->camera_matrix = identity_mat4x4();
+    pt->half_width = 0.5;
+    pt->accumulation = calloc(3 * width * height, sizeof(float));
+    mem_check(pt->accumulation);
+}
+
+void path_tracer_destroy(PathTracer *pt)
+{
+    free(pt->accumulation);
+    memset(pt, 0, sizeof(PathTracer));
+}
+
+void path_tracer_reset(PathTracer *pt)
+{
+    memset(pt->accumulation, 0, 3 * pt->width * pt->height * sizeof(float));
+    pt->num_samples = 0;
+}
+
+void path_tracer_set_camera(PathTracer *pt, mat4x4 camera_matrix, float half_width)
+{
+    pt->camera_matrix = camera_matrix;
+    pt->half_width = half_width;
+    path_tracer_reset(pt);
+}
+
+typedef struct RenderJob_s {
+    PathTracer *pt;
+    int samples_per_pixel;
+    int tiles_x;
+    int num_tiles;
+    int next_tile;
+    uint64_t num_rays;
+    pthread_mutex_t mutex;
+} RenderJob;
+
+static void render_tile(RenderJob *job, int tile, uint64_t *num_rays)
+{
+    PathTracer *pt = job->pt;
+    int x0 = (tile % job->tiles_x) * PATH_TRACER_TILE_SIZE;
+    int y0 = (tile / job->tiles_x) * PATH_TRACER_TILE_SIZE;
+    int x1 = MIN(x0 + PATH_TRACER_TILE_SIZE, pt->width);
+    int y1 = MIN(y0 + PATH_TRACER_TILE_SIZE, pt->height);
+    vec3 origin = new_vec3(pt->camera_matrix.vals[12], pt->camera_matrix.vals[13], pt->camera_matrix.vals[14]);
+    float half_height = pt->half_width * pt->height / pt->width;
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            float *pixel = &pt->accumulation[3 * (y * pt->width + x)];
+            for (int s = 0; s < job->samples_per_pixel; s++) {
+                uint32_t rng = hash32(hash32(y * pt->width + x) ^ (uint32_t) (pt->num_samples + s) * 0x9e3779b9) | 1;
+                float u = pt->half_width * (2 * (x + random_float(&rng)) / pt->width - 1);
+                float v = half_height * (1 - 2 * (y + random_float(&rng)) / pt->height);
+                vec3 d = transform_vector(&pt->camera_matrix, new_vec3(u, v, -1));
+                vec3 radiance = trace_path(pt, origin, d, &rng, num_rays);
+                for (int i = 0; i < 3; i++) pixel[i] += radiance.vals[i];
+            }
+        }
+    }
+}
+
+static void *render_thread(void *arg)
+{
+    RenderJob *job = (RenderJob *) arg;
+    uint64_t num_rays = 0;
+    while (1) {
+        pthread_mutex_lock(&job->mutex);
+        int tile = job->next_tile ++;
+        pthread_mutex_unlock(&job->mutex);
+        if (tile >= job->num_tiles) break;
+        render_tile(job, tile, &num_rays);
+    }
+    pthread_mutex_lock(&job->mutex);
+    job->num_rays += num_rays;
+    pthread_mutex_unlock(&job->mutex);
+    return NULL;
+}
+
+void path_tracer_render(PathTracer *pt, int samples_per_pixel)
+{
+    double start = time_now();
+    RenderJob job;
+    job.pt = pt;
+    job.samples_per_pixel = samples_per_pixel;
+    job.tiles_x = (pt->width + PATH_TRACER_TILE_SIZE - 1) / PATH_TRACER_TILE_SIZE;
+    job.num_tiles = job.tiles_x * ((pt->height + PATH_TRACER_TILE_SIZE - 1) / PATH_TRACER_TILE_SIZE);
+    job.next_tile = 0;
+    job.num_rays = 0;
+    pthread_mutex_init(&job.mutex, NULL);
+
+    int num_threads = pt->num_threads;
+    if (num_threads <= 0) num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads < 1) num_threads = 1;
+    if (num_threads > PATH_TRACER_MAX_THREADS) num_threads = PATH_TRACER_MAX_THREADS;
+    if (num_threads > job.num_tiles) num_threads = job.num_tiles;
+    pthread_t threads[PATH_TRACER_MAX_THREADS];
+    bool created[PATH_TRACER_MAX_THREADS] = {0};
+    for (int t = 1; t < num_threads; t++) {
+        created[t] = pthread_create(&threads[t], NULL, render_thread, &job) == 0;
+    }
+    // The calling thread takes tiles too. If a thread couldn't be created, the others take its share.
+    render_thread(&job);
+    for (int t = 1; t < num_threads; t++) {
+        if (created[t]) pthread_join(threads[t], NULL);
+    }
+    pthread_mutex_destroy(&job.mutex);
+
+    pt->num_samples += samples_per_pixel;
+    pt->num_rays += job.num_rays;
+    pt->render_time += time_now() - start;
+}
+
+vec3 path_tracer_pixel(PathTracer *pt, int x, int y)
+{
+    if (pt->num_samples == 0) return vec3_zero();
+    float *pixel = &pt->accumulation[3 * (y * pt->width + x)];
+    return vec3_mul(new_vec3(pixel[0], pixel[1], pixel[2]), 1.0 / pt->num_samples);
+}
+
+void path_tracer_resolve(PathTracer *pt, uint8_t *rgb)
+{
+    for (int y = 0; y < pt->height; y++) {
+        for (int x = 0; x < pt->width; x++) {
+            vec3 c = path_tracer_pixel(pt, x, y);
+            for (int i = 0; i < 3; i++) {
+                float v = pow(MIN(1, MAX(0, c.vals[i])), 1 / 2.2);
+                rgb[3 * (y * pt->width + x) + i] = (uint8_t) (255 * v + 0.5);
+            }
+        }
+    }
+}
+
+bool path_tracer_write_png(PathTracer *pt, char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) return false;
+    uint8_t *rgb = malloc(3 * pt->width * pt->height);
+    mem_check(rgb);
+    png_bytep *rows = malloc(pt->height * sizeof(png_bytep));
+    mem_check(rows);
+    path_tracer_resolve(pt, rgb);
+    for (int y = 0; y < pt->height; y++) rows[y] = &rgb[3 * y * pt->width];
+
+    png_structp png_ptr;
+    png_infop info_ptr;
+    if ((png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL)) == NULL) goto failed;
+    if ((info_ptr = png_create_info_struct(png_ptr)) == NULL) {
+        png_destroy_write_struct(&png_ptr, NULL);
+        goto failed;
+    }
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        // An exception was raised in a libpng routine, jump back to here.
+        png_destroy_write_struct(&png_ptr, &info_ptr);
+        goto failed;
+    }
+    png_init_io(png_ptr, file);
+    png_set_IHDR(png_ptr, info_ptr, pt->width, pt->height, 8, PNG_COLOR_TYPE_RGB,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png_ptr, info_ptr);
+    png_write_image(png_ptr, rows);
+    png_write_end(png_ptr, NULL);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    free(rows);
+    free(rgb);
+    fclose(file);
+    return true;
+failed:
+    free(rows);
+    free(rgb);
+    fclose(file);
+    return false;
+}
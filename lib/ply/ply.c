@@ -6,6 +6,10 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "helper_definitions.h"
 #include "ply.h"
 
@@ -27,6 +31,7 @@ static char _ply_type_names[NUM_PLY_TYPES][12] = { // do not shuffle these!
     "double"
 };
 static size_t _ply_type_sizes[NUM_PLY_TYPES] = { // do not shuffle these!
+    0,
     1,
     1,
     2,
@@ -71,113 +76,749 @@ static PLYType match_ply_type(char *string)
 //--------------------------------------------------------------------------------
 // Data extraction
 //--------------------------------------------------------------------------------
+/* The body of the file (everything after the end_header line) is mapped, or read in one go if the file can't be
+ * mapped (a pipe, say), then decoded element-by-element into the internal types.
+ *
+ * Elements without list properties have entries of a fixed size, so these are decoded a property at a time
+ * with strided copies, and only the stride and the offset of each property in an entry are kept instead of
+ * an offset for every property of every entry.
+ */
+typedef struct PLYBody_s {
+    const char *start; // first byte after the end_header line
+    const char *end;
+    void *base; // the whole file, to be unmapped or freed
+    size_t base_size;
+    bool mapped;
+} PLYBody;
+
+static void ply_open_body(FILE *file, PLYBody *body)
+{
+    memset(body, 0, sizeof(PLYBody));
+    struct stat st;
+    int fd = fileno(file);
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base != MAP_FAILED) {
+            madvise(base, st.st_size, MADV_SEQUENTIAL);
+            body->base = base;
+            body->base_size = st.st_size;
+            body->mapped = true;
+        }
+    }
+    if (!body->mapped) {
+        fseek(file, 0, SEEK_SET);
+        size_t capacity = 1 << 16;
+        char *base = (char *) malloc(capacity);
+        mem_check(base);
+        size_t size = 0;
+        size_t n;
+        while ((n = fread(base + size, 1, capacity - size, file)) > 0) {
+            size += n;
+            if (size == capacity) {
+                capacity *= 2;
+                base = (char *) realloc(base, capacity);
+                mem_check(base);
+            }
+        }
+        body->base = base;
+        body->base_size = size;
+    }
+    // Find the end_header line. Lines may end in \n or \r\n.
+    const char *p = (const char *) body->base;
+    const char *end = p + body->base_size;
+    while (p < end) {
+        const char *line_end = memchr(p, '\n', end - p);
+        if (line_end == NULL) break;
+        size_t len = line_end - p;
+        if (len > 0 && p[len - 1] == '\r') len --;
+        if (len == 10 && memcmp(p, "end_header", 10) == 0) {
+            body->start = line_end + 1;
+            body->end = end;
+            return;
+        }
+        p = line_end + 1;
+    }
+    fprintf(stderr, ERROR_ALERT "Could not find the end of the header when reading PLY data.\n");
+    exit(EXIT_FAILURE);
+}
+static void ply_close_body(PLYBody *body)
+{
+    if (body->mapped) munmap(body->base, body->base_size);
+    else free(body->base);
+}
+
+static void ply_truncated_error(PLYElement *element)
+{
+    fprintf(stderr, ERROR_ALERT "PLY data ended early, or is malformed, when reading element \"%s\".\n", element->name);
+    exit(EXIT_FAILURE);
+}
+
+//- Binary -----------------------------------------------------------------------
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define PLY_HOST_BINARY_FORMAT PLY_FORMAT_BINARY_LITTLE_ENDIAN_1
+#else
+#define PLY_HOST_BINARY_FORMAT PLY_FORMAT_BINARY_BIG_ENDIAN_1
+#endif
+// Decode a binary value into its internal 32-bit representation (returned as the bits of the float/uint32_t/int32_t).
+static inline uint32_t ply_decode_binary(const char *p, PLYType type, bool swap)
+{
+    switch (type) {
+    case PLY_CHAR: return (uint32_t) (int32_t) *((int8_t *) p);
+    case PLY_UCHAR: return *((uint8_t *) p);
+    case PLY_SHORT:
+    case PLY_USHORT: {
+        uint16_t v;
+        memcpy(&v, p, sizeof(uint16_t));
+        if (swap) v = __builtin_bswap16(v);
+        return type == PLY_SHORT ? (uint32_t) (int32_t) (int16_t) v : v;
+    }
+    case PLY_INT:
+    case PLY_UINT:
+    case PLY_FLOAT: {
+        uint32_t v;
+        memcpy(&v, p, sizeof(uint32_t));
+        return swap ? __builtin_bswap32(v) : v;
+    }
+    case PLY_DOUBLE: {
+        uint64_t v;
+        memcpy(&v, p, sizeof(uint64_t));
+        if (swap) v = __builtin_bswap64(v);
+        double d;
+        memcpy(&d, &v, sizeof(double));
+        float f = (float) d;
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(float));
+        return bits;
+    }
+    }
+    return 0;
+}
+static void ply_decode_binary_strided(char *out, size_t out_stride, const char *in, size_t in_stride, size_t count, PLYType type, bool swap)
+{
+    if (!swap && _ply_type_sizes[type] == sizeof(uint32_t)) {
+        // 4-byte values in the host byte order are already in their internal representation.
+        for (size_t i = 0; i < count; i++) memcpy(out + i*out_stride, in + i*in_stride, sizeof(uint32_t));
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        uint32_t v = ply_decode_binary(in + i*in_stride, type, swap);
+        memcpy(out + i*out_stride, &v, sizeof(uint32_t));
+    }
+}
+
+//- ASCII ------------------------------------------------------------------------
+static inline bool ply_ascii_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+static const char *ply_parse_ascii_integer(const char *p, const char *end, int64_t *out)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p ++;
+    }
+    const char *digits_start = p;
+    int64_t value = 0;
+    while (p < end && *p >= '0' && *p <= '9' && p - digits_start < 18) {
+        value = value*10 + (*p - '0');
+        p ++;
+    }
+    if (p == digits_start || (p < end && !ply_ascii_space(*p))) return NULL;
+    *out = negative ? -value : value;
+    return p;
+}
+static const double ply_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+static const char *ply_parse_ascii_float(const char *p, const char *end, float *out)
+{
+    // Up to 19 significant digits are collected into an integer mantissa, then scaled by an exact power of ten.
+    // Anything unusual (inf, nan, huge exponents) is given to strtof.
+    const char *start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p ++;
+    }
+    uint64_t mantissa = 0;
+    int significant_digits = 0;
+    int exponent = 0;
+    bool any_digits = false;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (significant_digits < 19) {
+            mantissa = mantissa*10 + (*p - '0');
+            if (mantissa != 0) significant_digits ++;
+        } else exponent ++;
+        any_digits = true;
+        p ++;
+    }
+    if (p < end && *p == '.') {
+        p ++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (significant_digits < 19) {
+                mantissa = mantissa*10 + (*p - '0');
+                if (mantissa != 0) significant_digits ++;
+                exponent --;
+            }
+            any_digits = true;
+            p ++;
+        }
+    }
+    if (!any_digits) goto slow;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p ++;
+        int64_t e;
+        if ((p = ply_parse_ascii_integer(p, end, &e)) == NULL) goto slow;
+        if (e < -1000 || e > 1000) goto slow;
+        exponent += e;
+    }
+    if (p < end && !ply_ascii_space(*p)) goto slow;
+    if (exponent < -22 || exponent > 22) goto slow;
+    double value = (double) mantissa;
+    if (exponent < 0) value /= ply_powers_of_ten[-exponent];
+    else value *= ply_powers_of_ten[exponent];
+    *out = (float) (negative ? -value : value);
+    return p;
+slow:;
+    char buffer[64];
+    size_t n = 0;
+    p = start;
+    while (p < end && !ply_ascii_space(*p) && n < sizeof(buffer) - 1) buffer[n++] = *p++;
+    buffer[n] = '\0';
+    char *parsed_end;
+    float slow_value = strtof(buffer, &parsed_end);
+    if (parsed_end == buffer || *parsed_end != '\0') return NULL;
+    *out = slow_value;
+    return p;
+}
+static const char *ply_read_ascii_value(const char *p, const char *end, PLYType type, void *out)
+{
+    while (p < end && ply_ascii_space(*p)) p++;
+    if (ply_float_type(type)) {
+        float v;
+        if ((p = ply_parse_ascii_float(p, end, &v)) == NULL) return NULL;
+        memcpy(out, &v, sizeof(float));
+    } else {
+        int64_t v;
+        if ((p = ply_parse_ascii_integer(p, end, &v)) == NULL) return NULL;
+        if (ply_unsigned_int_type(type)) {
+            if (v < 0 || v > UINT32_MAX) return NULL;
+            uint32_t u = v;
+            memcpy(out, &u, sizeof(uint32_t));
+        } else {
+            if (v < INT32_MIN || v > INT32_MAX) return NULL;
+            int32_t s = v;
+            memcpy(out, &s, sizeof(int32_t));
+        }
+    }
+    return p;
+}
+
+// Read a single value in either format, for the entries of elements with lists.
+static const char *ply_read_value(const char *p, const char *end, PLYFormat format, PLYType type, void *out)
+{
+    if (format == PLY_FORMAT_ASCII_1) return ply_read_ascii_value(p, end, type, out);
+    if (end - p < _ply_type_sizes[type]) return NULL;
+    uint32_t v = ply_decode_binary(p, type, format != PLY_HOST_BINARY_FORMAT);
+    memcpy(out, &v, sizeof(uint32_t));
+    return p + _ply_type_sizes[type];
+}
+
+// Where ply_get_many puts a queried property of each entry.
+typedef struct PLYSink_s {
+    PLYElement *element;
+    int prop_index;
+    char *out; // where this property goes in the first entry of the request's array
+    size_t stride; // size of an entry of the request's array
+    int list_length; // 0 if the property isn't a list
+} PLYSink;
+
+//- Parallel ASCII ---------------------------------------------------------------
+/* Large ASCII bodies are parsed by several threads. Entries are one to a line, so first the newlines in equal byte
+ * chunks of the body are counted in parallel, which gives where the lines of each element start. Then each thread
+ * parses its share of the lines of every element. Fixed-size entries (and, for ply_get_many, fixed-length lists)
+ * go straight to their place in the output. For ply->data, the entries of elements with lists are parsed into a
+ * buffer per thread, and placed after a prefix sum of the buffer sizes.
+ * If any line doesn't hold exactly one entry, this gives up and the serial parser is used instead.
+ */
+#define PLY_PARALLEL_MIN_BYTES (1 << 22)
+#define PLY_MAX_THREADS 64
+static int g_ply_num_threads = 0;
+void ply_set_num_threads(int num_threads)
+{
+    g_ply_num_threads = num_threads;
+}
+static int ply_num_threads(size_t body_size)
+{
+    if (body_size < PLY_PARALLEL_MIN_BYTES) return 1;
+    int num_threads = g_ply_num_threads;
+    if (num_threads <= 0) num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads < 1) num_threads = 1;
+    if (num_threads > PLY_MAX_THREADS) num_threads = PLY_MAX_THREADS;
+    return num_threads;
+}
+
+typedef struct PLYParallel_s {
+    const char *start;
+    const char *end;
+    int num_threads;
+    size_t chunk_size;
+    size_t chunk_newlines[PLY_MAX_THREADS + 1]; // newlines before each chunk, after the prefix sum
+    bool failed[PLY_MAX_THREADS];
+
+    int num_elements;
+    PLYElement **elements;
+    PLYProperty ***properties; // of each element, in order
+    bool *has_lists;
+    size_t *first_lines; // line of the first entry of each element
+    // Entries go either to sinks (ply_get_many), or into data (ply->data).
+    int num_sinks;
+    PLYSink *sinks;
+    char *data;
+    // Data of elements with lists, [element * num_threads + thread].
+    uint32_t **list_buffers;
+    size_t *list_buffer_sizes; // in words
+    size_t **list_offsets; // word offset in the buffer of each property of each entry
+    size_t *list_bases; // byte offset of the buffer in data
+} PLYParallel;
+typedef struct PLYParallelJob_s {
+    PLYParallel *par;
+    int thread;
+} PLYParallelJob;
+
+static void ply_run_threads(PLYParallel *par, void *(*function)(void *))
+{
+    pthread_t threads[PLY_MAX_THREADS];
+    bool created[PLY_MAX_THREADS] = {0};
+    PLYParallelJob jobs[PLY_MAX_THREADS];
+    for (int t = 0; t < par->num_threads; t++) {
+        jobs[t].par = par;
+        jobs[t].thread = t;
+    }
+    for (int t = 1; t < par->num_threads; t++) {
+        created[t] = pthread_create(&threads[t], NULL, function, &jobs[t]) == 0;
+    }
+    // The calling thread does the first share, and any shares which couldn't be given a thread.
+    function(&jobs[0]);
+    for (int t = 1; t < par->num_threads; t++) {
+        if (created[t]) pthread_join(threads[t], NULL);
+        else function(&jobs[t]);
+    }
+}
+
+static void *ply_count_newlines_thread(void *arg)
+{
+    PLYParallelJob *job = (PLYParallelJob *) arg;
+    PLYParallel *par = job->par;
+    size_t size = par->end - par->start;
+    size_t from = job->thread * par->chunk_size;
+    size_t to = from + par->chunk_size;
+    if (from > size) from = size;
+    if (to > size) to = size;
+    size_t count = 0;
+    for (const char *p = par->start + from; p < par->start + to; p++) count += *p == '\n';
+    par->chunk_newlines[job->thread + 1] = count;
+    return NULL;
+}
+// The start of the given line of the body (counting from 0), or NULL if the body doesn't have that many lines.
+static const char *ply_line_start(PLYParallel *par, size_t line)
+{
+    if (line == 0) return par->start;
+    if (line > par->chunk_newlines[par->num_threads]) return NULL;
+    int c = 0;
+    while (par->chunk_newlines[c + 1] < line) c++;
+    size_t newlines = par->chunk_newlines[c];
+    for (const char *p = par->start + c * par->chunk_size; p < par->end; p++) {
+        if (*p == '\n' && ++newlines == line) return p + 1;
+    }
+    return NULL;
+}
+static const char *ply_line_end(const char *p, const char *end)
+{
+    const char *line_end = memchr(p, '\n', end - p);
+    return line_end == NULL ? end : line_end;
+}
+// Parse an entry which must make up the whole line into out, in the internal layout (a list is its count then its values),
+// giving the word offset of each property. out must have room for a word for each property and each value on the line.
+// Returns the number of words written, or -1 if the line doesn't hold exactly one entry.
+static long ply_parse_ascii_line(const char *p, const char *line_end, PLYProperty **properties, int num_properties, uint32_t *out, size_t *word_offsets)
+{
+    size_t n = 0;
+    for (int k = 0; k < num_properties; k++) {
+        word_offsets[k] = n;
+        uint32_t list_count = 1;
+        if (properties[k]->is_list) {
+            if ((p = ply_read_ascii_value(p, line_end, properties[k]->list_count_type, &list_count)) == NULL) return -1;
+            out[n++] = list_count;
+        }
+        for (uint32_t j = 0; j < list_count; j++) {
+            if ((p = ply_read_ascii_value(p, line_end, properties[k]->type, &out[n++])) == NULL) return -1;
+        }
+    }
+    while (p < line_end && ply_ascii_space(*p)) p++;
+    return p == line_end ? n : -1;
+}
+
+static void *ply_parse_lines_thread(void *arg)
+{
+    PLYParallelJob *job = (PLYParallelJob *) arg;
+    PLYParallel *par = job->par;
+    int t = job->thread;
+    int num_threads = par->num_threads;
+    size_t scratch_size = 0;
+    uint32_t *scratch = NULL;
+    size_t *word_offsets = NULL;
+
+    for (int e = 0; e < par->num_elements; e++) {
+        PLYElement *element = par->elements[e];
+        PLYProperty **properties = par->properties[e];
+        int num_properties = element->num_properties;
+        if (par->sinks != NULL) {
+            // Lines of elements which aren't queried are skipped.
+            bool queried = false;
+            for (int s = 0; s < par->num_sinks; s++) {
+                if (par->sinks[s].element == element) queried = true;
+            }
+            if (!queried) continue;
+        }
+        size_t count = element->count;
+        size_t from = count * t / num_threads;
+        size_t to = count * (t + 1) / num_threads;
+        if (from == to) continue;
+        const char *p = ply_line_start(par, par->first_lines[e] + from);
+        if (p == NULL) goto failed;
+        word_offsets = (size_t *) realloc(word_offsets, num_properties * sizeof(size_t));
+        mem_check(word_offsets);
+
+        bool list_data = par->sinks == NULL && par->has_lists[e];
+        size_t list_size = 0;
+        size_t list_capacity = 0;
+        uint32_t *list_buffer = NULL;
+        size_t *list_offsets = NULL;
+        if (list_data) {
+            list_offsets = (size_t *) malloc((to - from) * num_properties * sizeof(size_t));
+            mem_check(list_offsets);
+            par->list_offsets[e * num_threads + t] = list_offsets;
+        }
+        for (size_t i = from; i < to; i++) {
+            if (p >= par->end) goto failed;
+            const char *line_end = ply_line_end(p, par->end);
+            size_t words = num_properties + (line_end - p + 1) / 2 + 1;
+            uint32_t *out;
+            if (par->sinks == NULL && !list_data) {
+                out = (uint32_t *) (par->data + element->offset + i * element->stride);
+            } else if (list_data) {
+                if (list_size + words > list_capacity) {
+                    list_capacity = list_capacity == 0 ? 4096 : list_capacity;
+                    while (list_size + words > list_capacity) list_capacity *= 2;
+                    list_buffer = (uint32_t *) realloc(list_buffer, list_capacity * sizeof(uint32_t));
+                    mem_check(list_buffer);
+                    par->list_buffers[e * num_threads + t] = list_buffer;
+                }
+                out = list_buffer + list_size;
+            } else {
+                if (words > scratch_size) {
+                    scratch_size = words * 2;
+                    scratch = (uint32_t *) realloc(scratch, scratch_size * sizeof(uint32_t));
+                    mem_check(scratch);
+                }
+                out = scratch;
+            }
+            long n = ply_parse_ascii_line(p, line_end, properties, num_properties, out, word_offsets);
+            if (n < 0) goto failed;
+            if (par->sinks != NULL) {
+                for (int s = 0; s < par->num_sinks; s++) {
+                    PLYSink *sink = &par->sinks[s];
+                    if (sink->element != element) continue;
+                    uint32_t *values = out + word_offsets[sink->prop_index];
+                    if (sink->list_length != 0) {
+                        if (values[0] != sink->list_length) goto failed; // the serial parser gives the error
+                        memcpy(sink->out + i * sink->stride, values + 1, sink->list_length * sizeof(uint32_t));
+                    } else {
+                        memcpy(sink->out + i * sink->stride, values, sizeof(uint32_t));
+                    }
+                }
+            } else if (list_data) {
+                for (int k = 0; k < num_properties; k++) list_offsets[(i - from) * num_properties + k] = list_size + word_offsets[k];
+                list_size += n;
+            }
+            p = line_end < par->end ? line_end + 1 : line_end;
+        }
+        if (list_data) par->list_buffer_sizes[e * num_threads + t] = list_size;
+    }
+    free(scratch);
+    free(word_offsets);
+    return NULL;
+failed:
+    par->failed[t] = true;
+    free(scratch);
+    free(word_offsets);
+    return NULL;
+}
+
+static void *ply_place_lists_thread(void *arg)
+{
+    PLYParallelJob *job = (PLYParallelJob *) arg;
+    PLYParallel *par = job->par;
+    int t = job->thread;
+    int num_threads = par->num_threads;
+    for (int e = 0; e < par->num_elements; e++) {
+        if (!par->has_lists[e]) continue;
+        PLYElement *element = par->elements[e];
+        int b = e * num_threads + t;
+        size_t from = element->count * t / num_threads;
+        size_t to = element->count * (t + 1) / num_threads;
+        if (par->list_buffers[b] != NULL) {
+            memcpy(par->data + par->list_bases[b], par->list_buffers[b], par->list_buffer_sizes[b] * sizeof(uint32_t));
+        }
+        for (size_t i = from; i < to; i++) {
+            for (int k = 0; k < element->num_properties; k++) {
+                element->property_offsets[k][i] = par->list_bases[b] + par->list_offsets[b][(i - from) * element->num_properties + k] * sizeof(uint32_t);
+            }
+        }
+    }
+    return NULL;
+}
+
+// Parse an ASCII body in parallel, either into the sinks, or if sinks is NULL into ply->data (setting up the element offsets).
+// Returns false if the body is too small to bother, or doesn't have one entry to a line, and nothing is changed.
+static bool ply_parse_ascii_parallel(PLYBody *body, PLY *ply, PLYSink *sinks, int num_sinks)
+{
+    PLYParallel par;
+    memset(&par, 0, sizeof(PLYParallel));
+    par.num_threads = ply_num_threads(body->end - body->start);
+    if (par.num_threads <= 1) return false;
+    par.start = body->start;
+    par.end = body->end;
+    par.chunk_size = (par.end - par.start + par.num_threads - 1) / par.num_threads;
+    par.sinks = sinks;
+    par.num_sinks = num_sinks;
+    ply_run_threads(&par, ply_count_newlines_thread);
+    for (int c = 0; c < par.num_threads; c++) par.chunk_newlines[c + 1] += par.chunk_newlines[c];
+
+    int num_elements = ply->num_elements;
+    int num_threads = par.num_threads;
+    par.num_elements = num_elements;
+    par.elements = (PLYElement **) malloc(num_elements * sizeof(PLYElement *));
+    mem_check(par.elements);
+    par.properties = (PLYProperty ***) malloc(num_elements * sizeof(PLYProperty **));
+    mem_check(par.properties);
+    par.has_lists = (bool *) calloc(num_elements, sizeof(bool));
+    mem_check(par.has_lists);
+    par.first_lines = (size_t *) malloc(num_elements * sizeof(size_t));
+    mem_check(par.first_lines);
+    size_t line = 0;
+    int e = 0;
+    for (PLYElement *element = ply->first_element; element != NULL; element = element->next_element, e++) {
+        par.elements[e] = element;
+        par.properties[e] = (PLYProperty **) malloc(element->num_properties * sizeof(PLYProperty *));
+        mem_check(par.properties[e]);
+        int k = 0;
+        for (PLYProperty *property = element->first_property; property != NULL; property = property->next_property) {
+            par.properties[e][k++] = property;
+            if (property->is_list) par.has_lists[e] = true;
+        }
+        par.first_lines[e] = line;
+        line += element->count;
+    }
+    bool failed = line > par.chunk_newlines[num_threads] + 1;
+
+    size_t offset = 0;
+    if (!failed && sinks == NULL) {
+        // Fixed-size elements go first in the data, so their entries can be parsed into place.
+        for (e = 0; e < num_elements; e++) {
+            PLYElement *element = par.elements[e];
+            if (par.has_lists[e]) continue;
+            element->offset = offset;
+            element->stride = element->num_properties * sizeof(uint32_t);
+            element->property_stride_offsets = (size_t *) malloc(element->num_properties * sizeof(size_t));
+            mem_check(element->property_stride_offsets);
+            for (int k = 0; k < element->num_properties; k++) element->property_stride_offsets[k] = k * sizeof(uint32_t);
+            offset += element->count * element->stride;
+        }
+        par.data = (char *) malloc(offset + 1);
+        mem_check(par.data);
+        par.list_buffers = (uint32_t **) calloc(num_elements * num_threads, sizeof(uint32_t *));
+        mem_check(par.list_buffers);
+        par.list_buffer_sizes = (size_t *) calloc(num_elements * num_threads, sizeof(size_t));
+        mem_check(par.list_buffer_sizes);
+        par.list_offsets = (size_t **) calloc(num_elements * num_threads, sizeof(size_t *));
+        mem_check(par.list_offsets);
+        par.list_bases = (size_t *) calloc(num_elements * num_threads, sizeof(size_t));
+        mem_check(par.list_bases);
+    }
+    if (!failed) {
+        ply_run_threads(&par, ply_parse_lines_thread);
+        for (int t = 0; t < num_threads; t++) {
+            if (par.failed[t]) failed = true;
+        }
+    }
+    if (!failed && sinks == NULL) {
+        // Prefix sum of the list buffer sizes to place them after the fixed-size elements.
+        for (e = 0; e < num_elements; e++) {
+            if (!par.has_lists[e]) continue;
+            PLYElement *element = par.elements[e];
+            element->offset = offset;
+            for (int t = 0; t < num_threads; t++) {
+                par.list_bases[e * num_threads + t] = offset;
+                offset += par.list_buffer_sizes[e * num_threads + t] * sizeof(uint32_t);
+            }
+            element->property_offsets = (size_t **) malloc(element->num_properties * sizeof(size_t *));
+            mem_check(element->property_offsets);
+            for (int k = 0; k < element->num_properties; k++) {
+                element->property_offsets[k] = (size_t *) malloc(element->count * sizeof(size_t));
+                mem_check(element->property_offsets[k]);
+            }
+        }
+        par.data = (char *) realloc(par.data, offset + 1);
+        mem_check(par.data);
+        ply_run_threads(&par, ply_place_lists_thread);
+        ply->data = par.data;
+        ply_debug("Parsed ASCII PLY body with %d threads.\n", num_threads);
+    }
+    if (failed && sinks == NULL) {
+        free(par.data);
+        for (e = 0; e < num_elements; e++) {
+            PLYElement *element = par.elements[e];
+            if (element->property_stride_offsets != NULL) free(element->property_stride_offsets);
+            element->property_stride_offsets = NULL;
+            element->stride = 0;
+            element->offset = 0;
+        }
+    }
+    if (par.list_buffers != NULL) {
+        for (int b = 0; b < num_elements * num_threads; b++) {
+            if (par.list_buffers[b] != NULL) free(par.list_buffers[b]);
+            if (par.list_offsets[b] != NULL) free(par.list_offsets[b]);
+        }
+        free(par.list_buffers);
+        free(par.list_buffer_sizes);
+        free(par.list_offsets);
+        free(par.list_bases);
+    }
+    for (e = 0; e < num_elements; e++) free(par.properties[e]);
+    free(par.properties);
+    free(par.elements);
+    free(par.has_lists);
+    free(par.first_lines);
+    return !failed;
+}
+
 #define GROW_DATA(AMOUNT)\
 {\
     size_t to_size = offset + ( AMOUNT );\
-    if (to_size >= data_size) {\
-        while (to_size >= data_size) data_size *= 2;\
+    if (to_size > data_size) {\
+        while (to_size > data_size) data_size *= 2;\
         data = realloc(data, data_size);\
         mem_check(data);\
     }\
 }
 void ply_get_binary_data(FILE *file, PLY *ply)
 {
-    fseek(file, 0, SEEK_SET);
-    printf("Getting PLY binary data ...\n");
-    
-    // read lines until the end of header (need a better way to do this for arbitrary line lengths)
-    // --- line endings
-    char line_buffer[4096];
-    while(fgets(line_buffer, 4096, file) != NULL) {
-        if (strcmp(line_buffer, "end_header\n") == 0) break;
+    ply_debug("Getting PLY binary data ...\n");
+    if (ply->format != PLY_FORMAT_ASCII_1 && ply->format != PLY_FORMAT_BINARY_LITTLE_ENDIAN_1 && ply->format != PLY_FORMAT_BINARY_BIG_ENDIAN_1) {
+        fprintf(stderr, ERROR_ALERT "PLY format given for extraction of binary data is not implemented.\n");
+        exit(EXIT_FAILURE);
     }
-    printf("Eaten past header\n");
-    
-    size_t data_size = 4096;
-    void *data = malloc(data_size);
+    PLYBody body;
+    ply_open_body(file, &body);
+    bool ascii = ply->format == PLY_FORMAT_ASCII_1;
+    bool swap = !ascii && ply->format != PLY_HOST_BINARY_FORMAT;
+    if (ascii && ply_parse_ascii_parallel(&body, ply, NULL, 0)) {
+        ply_close_body(&body);
+        return;
+    }
+
+    // Every property takes at least 4 bytes per entry (a value, or a list count), so most of the data size is known up front.
+    size_t data_size = 64;
+    for (PLYElement *element = ply->first_element; element != NULL; element = element->next_element) {
+        data_size += element->count * element->num_properties * sizeof(uint32_t);
+    }
+    char *data = (char *) malloc(data_size);
     mem_check(data);
     size_t offset = 0;
-    PLYElement *cur_element = ply->first_element;
+    const char *p = body.start;
+    const char *end = body.end;
 
-    printf("Allocated some space for the read data (it can grow later).\n");
-
-    switch(ply->format) {
-    case PLY_FORMAT_ASCII_1:
-        printf("Reading binary data from ASCII formatted PLY file.\n");
-        while (cur_element != NULL) {
-            printf("===============================\n");
-            printf("Reading a new element ...\n");
-            printf("===============================\n");
-            // Set this element region's byte offset from the start.
-            cur_element->offset = offset;
-
-            // Since PLY files can contain lists of variable length, this keeps track of the offsets of properties.
-            // --- why have this tree structure in here? why not just put in the properties?
-            size_t **property_offsets = (size_t **) malloc(cur_element->num_properties * sizeof(size_t *));
-            mem_check(property_offsets);
-            for (int i = 0; i < cur_element->num_properties; i++) {
-                property_offsets[i] = (size_t *) malloc(cur_element->count * sizeof(size_t));
-                mem_check(property_offsets[i]);
-            }
-            printf("Allocated memory for the property offsets (it can grow later).\n");
+    for (PLYElement *element = ply->first_element; element != NULL; element = element->next_element) {
+        ply_debug("Reading element \"%s\" (%d entries) ...\n", element->name, element->count);
+        element->offset = offset;
+        size_t count = element->count;
+        int num_properties = element->num_properties;
 
-            for (int i = 0; i < cur_element->count; i++) {
-                printf("-------------------------------\n");
-                printf("Reading an element entry ...\n");
-                printf("-------------------------------\n");
-                PLYProperty *cur_property = cur_element->first_property;
-                int prop_index = 0;
-                while (cur_property != NULL) {
-
-                    property_offsets[prop_index][i] = offset; //---order
+        PLYProperty **properties = (PLYProperty **) malloc(num_properties * sizeof(PLYProperty *));
+        mem_check(properties);
+        bool has_lists = false;
+        size_t in_stride = 0;
+        {
+            int k = 0;
+            for (PLYProperty *property = element->first_property; property != NULL; property = property->next_property) {
+                properties[k++] = property;
+                if (property->is_list) has_lists = true;
+                in_stride += _ply_type_sizes[property->type];
+            }
+        }
+        if (!has_lists) {
+            element->stride = num_properties * sizeof(uint32_t);
+            element->property_stride_offsets = (size_t *) malloc(num_properties * sizeof(size_t));
+            mem_check(element->property_stride_offsets);
+            for (int k = 0; k < num_properties; k++) element->property_stride_offsets[k] = k * sizeof(uint32_t);
+            GROW_DATA(count * element->stride);
 
+            if (ascii) {
+                char *out = data + offset;
+                for (size_t i = 0; i < count; i++) {
+                    for (int k = 0; k < num_properties; k++) {
+                        if ((p = ply_read_ascii_value(p, end, properties[k]->type, out)) == NULL) ply_truncated_error(element);
+                        out += sizeof(uint32_t);
+                    }
+                }
+            } else {
+                if ((size_t) (end - p) < count * in_stride) ply_truncated_error(element);
+                size_t in_offset = 0;
+                for (int k = 0; k < num_properties; k++) {
+                    ply_decode_binary_strided(data + offset + k*sizeof(uint32_t), element->stride, p + in_offset, in_stride, count, properties[k]->type, swap);
+                    in_offset += _ply_type_sizes[properties[k]->type];
+                }
+                p += count * in_stride;
+            }
+            offset += count * element->stride;
+        } else {
+            // Lists can be of variable length, so the offset of each property of each entry is kept.
+            size_t **property_offsets = (size_t **) malloc(num_properties * sizeof(size_t *));
+            mem_check(property_offsets);
+            for (int k = 0; k < num_properties; k++) {
+                property_offsets[k] = (size_t *) malloc(count * sizeof(size_t));
+                mem_check(property_offsets[k]);
+            }
+            for (size_t i = 0; i < count; i++) {
+                for (int k = 0; k < num_properties; k++) {
+                    PLYProperty *property = properties[k];
+                    property_offsets[k][i] = offset;
                     uint32_t list_count = 1; // leave list count at 1 if it isn't a list property.
-                    if (cur_property->is_list) {
-                        fscanf(file, "%u", &list_count);
-                        GROW_DATA(sizeof(uint32_t));
+                    if (property->is_list) {
+                        if ((p = ply_read_value(p, end, ply->format, property->list_count_type, &list_count)) == NULL) ply_truncated_error(element);
+                        // Every value takes at least a byte, so this bounds the list count before growing the buffer for it.
+                        if (list_count > (size_t) (end - p)) ply_truncated_error(element);
+                        GROW_DATA(sizeof(uint32_t) * (1 + (size_t) list_count));
                         memcpy(data + offset, &list_count, sizeof(uint32_t));
                         offset += sizeof(uint32_t);
+                    } else {
+                        GROW_DATA(sizeof(uint32_t));
                     }
-                    for (int k = 0; k < list_count; k++) {
-                        // Using C's standard ASCII type formats.
-                        if (ply_float_type(cur_property->type)) {
-                            float float_val;
-                            fscanf(file, "%f", &float_val);
-                            GROW_DATA(sizeof(float));
-                            memcpy(data + offset, &float_val, sizeof(float));
-                            offset += sizeof(float);
-                        } else if (ply_unsigned_int_type(cur_property->type)) {
-                            uint32_t unsigned_int_val;
-                            fscanf(file, "%u", &unsigned_int_val);
-                            GROW_DATA(sizeof(uint32_t));
-                            memcpy(data + offset, &unsigned_int_val, sizeof(uint32_t));
-                            offset += sizeof(uint32_t);
-                        } else if (ply_signed_int_type(cur_property->type)) {
-                            int32_t signed_int_val;
-                            fscanf(file, "%d", &signed_int_val);
-                            size_t to_size = offset + sizeof(int32_t);
-                            GROW_DATA(sizeof(int32_t));
-                            memcpy(data + offset, &signed_int_val, sizeof(int32_t));
-                            offset += sizeof(int32_t);
-                        }
-                        printf(" - ");
+                    for (uint32_t j = 0; j < list_count; j++) {
+                        if ((p = ply_read_value(p, end, ply->format, property->type, data + offset)) == NULL) ply_truncated_error(element);
+                        offset += sizeof(uint32_t);
                     }
-                    printf("\n");
-                    cur_property = cur_property->next_property;
-                    // Remember to increment!
-                    prop_index ++;
-                    printf("Done reading a property entry\n");
                 }
             }
-            // Give the element the property offsets.
-            cur_element->property_offsets = property_offsets;
-            cur_element = cur_element->next_element;
+            element->property_offsets = property_offsets;
         }
-    break;
-    default:
-        fprintf(stderr, ERROR_ALERT "PLY format given for extraction of binary data is not implemented.\n");
-        exit(EXIT_FAILURE);
+        free(properties);
     }
+    ply_close_body(&body);
     // Give this data to the PLY object.
     ply->data = data;
 }
@@ -186,6 +827,95 @@ void ply_get_binary_data(FILE *file, PLY *ply)
 //--------------------------------------------------------------------------------
 // Querying
 //--------------------------------------------------------------------------------
+// Byte offset into the PLY data of the given property of the i'th entry of an element.
+static inline size_t ply_entry_offset(PLYElement *element, int prop_index, int i)
+{
+    if (element->property_offsets == NULL) {
+        return element->offset + i * element->stride + element->property_stride_offsets[prop_index];
+    }
+    return element->property_offsets[prop_index][i];
+}
+// Match an element query against the PLY header, giving the matched element, and for each queried property
+// the matched property and its index in the element. The query's pattern strings are split up in place.
+static PLYElement *ply_match_query_element(PLY *ply, PLYQueryElement *query_element, PLYProperty **got_properties, int *prop_indices)
+{
+    if (query_element->pattern_string == NULL) {
+        fprintf(stderr, ERROR_ALERT "Pattern string not set during PLY query\n");
+        exit(EXIT_FAILURE);
+    }
+    ply_debug("Matching new element query \"%s\" ...\n", query_element->pattern_string);
+
+    char *p = query_element->pattern_string;
+
+    PLYElement *got_element = NULL;
+    while (got_element == NULL) {
+        // Splits the string by bars.
+        char *end = strchr(p, '|');
+        if (end != NULL) {
+            *end = '\0';
+        }
+        ply_debug("Checking %s ...\n", p);
+        //- Operate on substring ----------------------
+        got_element = ply_get_element(ply, p);
+        //---------------------------------------------
+        if (end == NULL) break;
+        p = end + 1;
+    }
+    if (got_element == NULL) {
+        fprintf(stderr, ERROR_ALERT "Couldn't find element in PLY query.\n");
+        exit(EXIT_FAILURE);
+    }
+    ply_debug("Matched element %s\n", got_element->name);
+
+    // Got an element, match its properties.
+    PLYQueryProperty *cur_query_property = query_element->first_property;
+    int prop_index = 0;
+    while (cur_query_property != NULL) {
+        ply_debug("Matching new property query \"%s\" ...\n", cur_query_property->pattern_string);
+        if (cur_query_property->pattern_string == NULL) {
+            fprintf(stderr, ERROR_ALERT "Query string not set during PLY query\n");
+            exit(EXIT_FAILURE);
+        }
+        PLYProperty *got_property = NULL;
+        char *p = cur_query_property->pattern_string;
+        while (got_property == NULL) {
+            // Splits the string by bars.
+            char *end = strchr(p, '|');
+            if (end != NULL) {
+                *end = '\0';
+            }
+            //- Operate on substring ----------------------
+            //------------------------------------------------Need to check the type!
+            ply_debug("looking for %s ...\n", p);
+            got_property = ply_get_property(got_element, p);
+            //---------------------------------------------
+            if (end == NULL) break;
+            p = end + 1;
+        }
+        if (got_property == NULL) {
+            fprintf(stderr, ERROR_ALERT "Couldn't find property in PLY query.\n");
+            exit(EXIT_FAILURE);
+        }
+        ply_debug("Matched property query with \"%s\".\n", got_property->name);
+        // Matched a property, add this to the gotten properties for packing later.
+        got_properties[prop_index] = got_property;
+        cur_query_property = cur_query_property->next;
+        // Increment the property index!
+        prop_index++;
+    }
+    // Find the index of each matched property in the element, which its data offsets are kept by.
+    for (int k = 0; k < query_element->num_properties; k++) {
+        int prop_index = 0;
+        PLYProperty *cur_property = got_element->first_property;
+        while (cur_property != NULL && cur_property != got_properties[k]) {
+            prop_index ++;
+            cur_property = cur_property->next_property;
+        }
+        prop_indices[k] = prop_index;
+    }
+    return got_element;
+}
+
 #define GROW_GOT_DATA(AMOUNT)\
 {\
     size_t to_size = got_data_offset + ( AMOUNT );\
@@ -206,24 +936,24 @@ void *ply_get(FILE *file, PLY *ply, char *query_string, int *num_entries)
     
     fseek(file, 0, SEEK_SET);
     if (ply->data == NULL) { // if it is not null, it has already been loaded.
-        printf("Didn't have data, getting now ...\n");
+        ply_debug("Didn't have data, getting now ...\n");
         ply_get_binary_data(file, ply);
         if (ply->data == NULL) {
             fprintf(stderr, ERROR_ALERT "Could not retrieve binary data from PLY file when querying.\n");
         }
-        printf("Got the data.\n");
+        ply_debug("Got the data.\n");
     }
 
-    printf("Querying with \"%s\" ...\n", query_string);
-    printf("started ply_get\n");
+    ply_debug("Querying with \"%s\" ...\n", query_string);
+    ply_debug("started ply_get\n");
 
 
     PLYQuery *query = read_ply_query(query_string);
     PLYQueryElement *cur_query_element = query->first_element;
 
 
-    printf("read the ply query\n");
-    print_ply_query(query);
+    ply_debug("read the ply query\n");
+    if (PLY_DEBUG) print_ply_query(query);
 
     size_t got_data_size = 4096;
     void *got_data = malloc(got_data_size);
@@ -231,106 +961,24 @@ void *ply_get(FILE *file, PLY *ply, char *query_string, int *num_entries)
     size_t got_data_offset = 0;
 
     while (cur_query_element != NULL) {
-        if (cur_query_element->pattern_string == NULL) {
-            fprintf(stderr, ERROR_ALERT "Pattern string not set during PLY query\n");
-            exit(EXIT_FAILURE);
-        }
-        printf("Matching new element query \"%s\" ...\n", cur_query_element->pattern_string);
-
-        char *p = cur_query_element->pattern_string;
-
-        PLYElement *got_element = NULL;
-        while (got_element == NULL) {
-            // Splits the string by bars.
-            char *end = strchr(p, '|');
-            if (end != NULL) {
-                *end = '\0';
-            }
-            printf("Checking %s ...\n", p);
-            //- Operate on substring ----------------------
-            got_element = ply_get_element(ply, p);
-            //---------------------------------------------
-            if (end == NULL) break;
-            p = end + 1;
-        }
-        if (got_element == NULL) {
-            fprintf(stderr, ERROR_ALERT "Couldn't find element in PLY query.\n");
-            exit(EXIT_FAILURE);
-        }
-        printf("Matched element %s\n", got_element->name);
-
-        // Collect the matched properties into this malloc'd space.
+        // Match the element and its properties, then pack these.
         PLYProperty **got_properties = (PLYProperty **) malloc(cur_query_element->num_properties * sizeof(PLYProperty *));
         mem_check(got_properties);
-
-        // Got an element, match its properties.
-        PLYQueryProperty *cur_query_property = cur_query_element->first_property;
-        int prop_index = 0;
-        while (cur_query_property != NULL) {
-            printf("Matching new property query \"%s\" ...\n", cur_query_property->pattern_string);
-            if (cur_query_property->pattern_string == NULL) {
-                fprintf(stderr, ERROR_ALERT "Query string not set during PLY query\n");
-                exit(EXIT_FAILURE);
-            }
-            PLYProperty *got_property = NULL;
-            char *p = cur_query_property->pattern_string;
-            while (got_property == NULL) {
-                // Splits the string by bars.
-                char *end = strchr(p, '|');
-                if (end != NULL) {
-                    *end = '\0';
-                }
-                //- Operate on substring ----------------------
-                //------------------------------------------------Need to check the type!
-                printf("looking for %s ...\n", p);
-                got_property = ply_get_property(got_element, p);
-                //---------------------------------------------
-                if (end == NULL) break;
-                p = end + 1;
-            }
-            if (got_property == NULL) {
-                fprintf(stderr, ERROR_ALERT "Couldn't find property in PLY query.\n");
-                exit(EXIT_FAILURE);
-            }
-            printf("Matched property query with \"%s\".\n", got_property->name);
-            // Matched a property, add this to the gotten properties for packing later.
-            got_properties[prop_index] = got_property;
-            cur_query_property = cur_query_property->next;
-            // Increment the property index!
-            prop_index++;
-        }
-
-        // Now that an element pattern has been matched, and its property patterns have been matched to actual properties,
-        // pack these.
-        printf("Transfering data and packing according to format pattern ...\n");
-        size_t ply_data_offset = 0;
+        int *prop_indices = (int *) malloc(cur_query_element->num_properties * sizeof(int));
+        mem_check(prop_indices);
+        PLYElement *got_element = ply_match_query_element(ply, cur_query_element, got_properties, prop_indices);
+        ply_debug("Transfering data and packing according to format pattern ...\n");
         for (int i = 0; i < got_element->count; i++) {
             // Get this ply element data (all properties in the order of the PLY file).
             for (int k = 0; k < cur_query_element->num_properties; k++) {
-                //////////////////////////////////////////////////////////////////////////////////
-                // ----put the offset info in the property instead. this just gets the index, awfully.
-                //-----------------------------------Seriously awful, change this.
-                int prop_index = 0;
-                {
-                    PLYProperty *cur_property = got_element->first_property;
-                    while (cur_property != NULL) {
-                        if (cur_property == got_properties[k]) break;
-                        prop_index ++;
-                        cur_property = cur_property->next_property;
-                    }
-                    if (prop_index >= got_element->num_properties) { fprintf(stderr, "couldn't find in awful hack\n"); exit(EXIT_FAILURE); }
-                }
-                //////////////////////////////////////////////////////////////////////////////////
-                ///// I don't know if using count_offset is neccessary.
+                size_t entry_offset = ply_entry_offset(got_element, prop_indices[k], i);
                 uint32_t count = 1;
                 size_t count_offset = 0; // shifted up if there needs to be room for a list count
                 if (got_properties[k]->is_list) {
                     // the data stored here should be a 32-bit unsigned int, and denote the number of list entries to read.
-                    count = ((uint32_t *) (ply->data + got_element->property_offsets[prop_index][i]))[0];
-                    /* printf("count: %u\n", count); */
-                    /* getchar(); */
+                    count = ((uint32_t *) (ply->data + entry_offset))[0];
                     GROW_GOT_DATA(sizeof(uint32_t));
-                    memcpy(got_data + got_data_offset, ply->data + got_element->property_offsets[prop_index][i], sizeof(uint32_t));
+                    memcpy(got_data + got_data_offset, ply->data + entry_offset, sizeof(uint32_t));
                     count_offset += sizeof(uint32_t);
                 }
                 size_t sz;
@@ -342,16 +990,17 @@ void *ply_get(FILE *file, PLY *ply, char *query_string, int *num_entries)
                     fprintf(stderr, ERROR_ALERT "Unrecognized property type when extracting binary data from PLY file through query.\n");
                     exit(EXIT_FAILURE);
                 }
-                GROW_GOT_DATA(sz);
+                GROW_GOT_DATA(count_offset + sz);
                 // Store the i'th entry in the PLY data of the k'th matched property. This takes into account variable list property lengths.
-                memcpy(got_data + got_data_offset + count_offset, ply->data + got_element->property_offsets[prop_index][i] + count_offset, sz);
+                memcpy(got_data + got_data_offset + count_offset, ply->data + entry_offset + count_offset, sz);
                 got_data_offset += sz + count_offset;
             }
-            //////////////////////////////////////////////////////////////////////////////////
-            // Here, expecting that there is only one element. Have to remove multiple-elements querying.
-            if (num_entries != NULL) *num_entries = got_element->count;
         }
-        printf("Finished extracting and packing element.\n");
+        //////////////////////////////////////////////////////////////////////////////////
+        // Here, expecting that there is only one element. Have to remove multiple-elements querying.
+        if (num_entries != NULL) *num_entries = got_element->count;
+        free(prop_indices);
+        ply_debug("Finished extracting and packing element.\n");
 
         // Remember to free!
         free(got_properties);
@@ -360,18 +1009,602 @@ void *ply_get(FILE *file, PLY *ply, char *query_string, int *num_entries)
 
     destroy_ply_query(query);
     //---check if forgot to free anything.
-    printf("Completed getting queried data.\n");
+    ply_debug("Completed getting queried data.\n");
     return got_data;
 }
 #undef GROW_GOT_DATA
 
+/* ply_get_many answers several single-element queries with one pass over the file body, decoding each queried
+ * property straight from the file into the arrays of the requests that want it. ply->data is not used.
+ *
+ * Matching the query patterns against the header is done once for each combination of header layout (element names
+ * and property declarations, not counts) and requests, then kept as a query plan. Loading many files with the same
+ * layout then skips the query lexer and the pattern matching entirely. Like the lexers, the plan cache is not thread-safe.
+ */
+typedef struct PLYPlanSink_s {
+    int request_index;
+    int element_index;
+    int prop_index;
+    size_t out_offset; // offset of this property in an entry of the request's array
+    int list_length; // 0 if the property isn't a list
+} PLYPlanSink;
+typedef struct PLYQueryPlan_s {
+    uint64_t hash;
+    char *key; // compared when the hash matches
+    int num_requests;
+    int *element_indices; // for each request
+    size_t *strides; // size of an entry of each request's array
+    int num_sinks;
+    PLYPlanSink *sinks; // the sinks of each request in order of its queried properties
+} PLYQueryPlan;
+static PLYQueryPlan *g_query_plans = NULL;
+static int g_num_query_plans = 0;
+static int g_query_plans_size = 0;
+
+static void ply_key_append(char **key, size_t *length, size_t *size, const char *string)
+{
+    size_t n = strlen(string);
+    if (*length + n + 1 > *size) {
+        while (*length + n + 1 > *size) *size *= 2;
+        *key = (char *) realloc(*key, *size);
+        mem_check(*key);
+    }
+    memcpy(*key + *length, string, n + 1);
+    *length += n;
+}
+// The plan key is the header layout followed by the requests.
+static char *ply_query_plan_key(PLY *ply, int num_requests, PLYRequest *requests)
+{
+    size_t size = 256;
+    size_t length = 0;
+    char *key = (char *) malloc(size);
+    mem_check(key);
+    key[0] = '\0';
+    for (PLYElement *element = ply->first_element; element != NULL; element = element->next_element) {
+        ply_key_append(&key, &length, &size, element->name);
+        ply_key_append(&key, &length, &size, ":");
+        for (PLYProperty *property = element->first_property; property != NULL; property = property->next_property) {
+            if (property->is_list) {
+                ply_key_append(&key, &length, &size, "list ");
+                ply_key_append(&key, &length, &size, _ply_type_names[property->list_count_type]);
+                ply_key_append(&key, &length, &size, " ");
+            }
+            ply_key_append(&key, &length, &size, _ply_type_names[property->type]);
+            ply_key_append(&key, &length, &size, " ");
+            ply_key_append(&key, &length, &size, property->name);
+            ply_key_append(&key, &length, &size, ",");
+        }
+        ply_key_append(&key, &length, &size, ";");
+    }
+    for (int i = 0; i < num_requests; i++) {
+        char list_length[16];
+        snprintf(list_length, 16, "\n%d ", requests[i].list_length);
+        ply_key_append(&key, &length, &size, list_length);
+        ply_key_append(&key, &length, &size, requests[i].query_string);
+    }
+    return key;
+}
+static uint64_t ply_hash_string(const char *string)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *c = string; *c != '\0'; c++) {
+        hash ^= (uint8_t) *c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void ply_compile_query_plan(PLY *ply, int num_requests, PLYRequest *requests, PLYQueryPlan *plan)
+{
+    PLYQuery **queries = (PLYQuery **) malloc(num_requests * sizeof(PLYQuery *));
+    mem_check(queries);
+    plan->num_sinks = 0;
+    for (int i = 0; i < num_requests; i++) {
+        queries[i] = read_ply_query(requests[i].query_string);
+        if (queries[i] == NULL || queries[i]->num_elements != 1) {
+            fprintf(stderr, ERROR_ALERT "PLY requests must query exactly one element, given \"%s\".\n", requests[i].query_string);
+            exit(EXIT_FAILURE);
+        }
+        plan->num_sinks += queries[i]->first_element->num_properties;
+    }
+    plan->num_requests = num_requests;
+    plan->element_indices = (int *) malloc(num_requests * sizeof(int));
+    mem_check(plan->element_indices);
+    plan->strides = (size_t *) malloc(num_requests * sizeof(size_t));
+    mem_check(plan->strides);
+    plan->sinks = (PLYPlanSink *) malloc(plan->num_sinks * sizeof(PLYPlanSink));
+    mem_check(plan->sinks);
+
+    int sink_index = 0;
+    for (int i = 0; i < num_requests; i++) {
+        PLYQueryElement *query_element = queries[i]->first_element;
+        int num_properties = query_element->num_properties;
+        PLYProperty **got_properties = (PLYProperty **) malloc(num_properties * sizeof(PLYProperty *));
+        mem_check(got_properties);
+        int *prop_indices = (int *) malloc(num_properties * sizeof(int));
+        mem_check(prop_indices);
+        PLYElement *got_element = ply_match_query_element(ply, query_element, got_properties, prop_indices);
+        int element_index = 0;
+        for (PLYElement *element = ply->first_element; element != got_element; element = element->next_element) element_index ++;
+
+        size_t stride = 0;
+        for (int k = 0; k < num_properties; k++) {
+            PLYPlanSink *sink = &plan->sinks[sink_index++];
+            sink->request_index = i;
+            sink->element_index = element_index;
+            sink->prop_index = prop_indices[k];
+            sink->out_offset = stride;
+            sink->list_length = 0;
+            if (got_properties[k]->is_list) {
+                if (requests[i].list_length <= 0) {
+                    fprintf(stderr, ERROR_ALERT "PLY request \"%s\" has a list property but no list length.\n", requests[i].query_string);
+                    exit(EXIT_FAILURE);
+                }
+                sink->list_length = requests[i].list_length;
+                stride += requests[i].list_length * sizeof(uint32_t);
+            } else {
+                stride += sizeof(uint32_t);
+            }
+        }
+        plan->element_indices[i] = element_index;
+        plan->strides[i] = stride;
+        free(got_properties);
+        free(prop_indices);
+        destroy_ply_query(queries[i]);
+    }
+    free(queries);
+}
+
+static PLYQueryPlan *ply_query_plan(PLY *ply, int num_requests, PLYRequest *requests)
+{
+    char *key = ply_query_plan_key(ply, num_requests, requests);
+    uint64_t hash = ply_hash_string(key);
+    for (int i = 0; i < g_num_query_plans; i++) {
+        if (g_query_plans[i].hash == hash && strcmp(g_query_plans[i].key, key) == 0) {
+            free(key);
+            return &g_query_plans[i];
+        }
+    }
+    ply_debug("Compiling PLY query plan for \"%s\" ...\n", key);
+    if (g_num_query_plans == g_query_plans_size) {
+        g_query_plans_size = g_query_plans_size == 0 ? 16 : 2 * g_query_plans_size;
+        g_query_plans = (PLYQueryPlan *) realloc(g_query_plans, g_query_plans_size * sizeof(PLYQueryPlan));
+        mem_check(g_query_plans);
+    }
+    PLYQueryPlan *plan = &g_query_plans[g_num_query_plans++];
+    plan->hash = hash;
+    plan->key = key;
+    ply_compile_query_plan(ply, num_requests, requests, plan);
+    return plan;
+}
+
+void ply_clear_query_plans(void)
+{
+    for (int i = 0; i < g_num_query_plans; i++) {
+        free(g_query_plans[i].key);
+        free(g_query_plans[i].element_indices);
+        free(g_query_plans[i].strides);
+        free(g_query_plans[i].sinks);
+    }
+    free(g_query_plans);
+    g_query_plans = NULL;
+    g_num_query_plans = 0;
+    g_query_plans_size = 0;
+}
+
+void ply_get_many(FILE *file, PLY *ply, int num_requests, PLYRequest *requests)
+{
+    PLYQueryPlan *plan = ply_query_plan(ply, num_requests, requests);
+
+    PLYElement **elements = (PLYElement **) malloc(ply->num_elements * sizeof(PLYElement *));
+    mem_check(elements);
+    {
+        int index = 0;
+        for (PLYElement *element = ply->first_element; element != NULL; element = element->next_element) elements[index++] = element;
+    }
+    // Size and allocate the arrays from the element counts, and point the sinks into them.
+    int num_sinks = plan->num_sinks;
+    PLYSink *sinks = (PLYSink *) malloc(num_sinks * sizeof(PLYSink));
+    mem_check(sinks);
+    for (int i = 0; i < num_requests; i++) {
+        PLYElement *element = elements[plan->element_indices[i]];
+        if (requests[i].data == NULL) {
+            requests[i].data = malloc(element->count * plan->strides[i] + 1);
+            mem_check(requests[i].data);
+        }
+        requests[i].num_entries = element->count;
+    }
+    for (int s = 0; s < num_sinks; s++) {
+        PLYPlanSink *plan_sink = &plan->sinks[s];
+        sinks[s].element = elements[plan_sink->element_index];
+        sinks[s].prop_index = plan_sink->prop_index;
+        sinks[s].out = ((char *) requests[plan_sink->request_index].data) + plan_sink->out_offset;
+        sinks[s].stride = plan->strides[plan_sink->request_index];
+        sinks[s].list_length = plan_sink->list_length;
+    }
+    free(elements);
+
+    PLYBody body;
+    ply_open_body(file, &body);
+    bool ascii = ply->format == PLY_FORMAT_ASCII_1;
+    bool swap = !ascii && ply->format != PLY_HOST_BINARY_FORMAT;
+    const char *p = body.start;
+    const char *end = body.end;
+
+    // Values of a property of one entry are read here, then copied to the sinks.
+    size_t values_size = 16;
+    uint32_t *values = (uint32_t *) malloc(values_size * sizeof(uint32_t));
+    mem_check(values);
+
+    bool parsed = ascii && ply_parse_ascii_parallel(&body, ply, sinks, num_sinks);
+    for (PLYElement *element = ply->first_element; element != NULL && !parsed; element = element->next_element) {
+        size_t count = element->count;
+        int num_properties = element->num_properties;
+        PLYProperty **properties = (PLYProperty **) malloc(num_properties * sizeof(PLYProperty *));
+        mem_check(properties);
+        size_t *in_offsets = (size_t *) malloc(num_properties * sizeof(size_t));
+        mem_check(in_offsets);
+        bool has_lists = false;
+        size_t in_stride = 0;
+        {
+            int k = 0;
+            for (PLYProperty *property = element->first_property; property != NULL; property = property->next_property) {
+                properties[k] = property;
+                in_offsets[k++] = in_stride;
+                if (property->is_list) has_lists = true;
+                in_stride += _ply_type_sizes[property->type];
+            }
+        }
+        if (!ascii && !has_lists) {
+            // Fixed-size binary entries: one strided decode for each sink.
+            if ((size_t) (end - p) < count * in_stride) ply_truncated_error(element);
+            for (int s = 0; s < num_sinks; s++) {
+                if (sinks[s].element != element) continue;
+                int k = sinks[s].prop_index;
+                ply_decode_binary_strided(sinks[s].out, sinks[s].stride, p + in_offsets[k], in_stride, count, properties[k]->type, swap);
+            }
+            p += count * in_stride;
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                for (int k = 0; k < num_properties; k++) {
+                    PLYProperty *property = properties[k];
+                    uint32_t list_count = 1;
+                    if (property->is_list) {
+                        if ((p = ply_read_value(p, end, ply->format, property->list_count_type, &list_count)) == NULL) ply_truncated_error(element);
+                        // Every value takes at least a byte, so this bounds the list count before growing the buffer for it.
+                        if (list_count > (size_t) (end - p)) ply_truncated_error(element);
+                        if (list_count > values_size) {
+                            while (list_count > values_size) values_size *= 2;
+                            values = (uint32_t *) realloc(values, values_size * sizeof(uint32_t));
+                            mem_check(values);
+                        }
+                    }
+                    for (uint32_t j = 0; j < list_count; j++) {
+                        if ((p = ply_read_value(p, end, ply->format, property->type, &values[j])) == NULL) ply_truncated_error(element);
+                    }
+                    for (int s = 0; s < num_sinks; s++) {
+                        if (sinks[s].element != element || sinks[s].prop_index != k) continue;
+                        if (property->is_list && list_count != sinks[s].list_length) {
+                            fprintf(stderr, ERROR_ALERT "PLY list property \"%s\" has an entry of length %u, expected %d.\n", property->name, list_count, sinks[s].list_length);
+                            exit(EXIT_FAILURE);
+                        }
+                        memcpy(sinks[s].out + i * sinks[s].stride, values, list_count * sizeof(uint32_t));
+                    }
+                }
+            }
+        }
+        free(properties);
+        free(in_offsets);
+    }
+    ply_close_body(&body);
+    free(values);
+    free(sinks);
+}
+
+//--------------------------------------------------------------------------------
+// Streaming
+//--------------------------------------------------------------------------------
+/* A cursor reads the body through a window buffer which only grows to fit a batch (or one long entry), so memory use
+ * is bounded by the batch size rather than the file size. Each batch is packed as by ply_get_many into a records
+ * array owned by the cursor, which is reused for the next batch. ASCII entries must be one to a line.
+ */
+struct PLYCursor_s {
+    FILE *file;
+    PLYFormat format;
+    bool swap;
+    // The queried element, and where its matched properties go in a record.
+    PLYElement *element;
+    PLYProperty **properties;
+    size_t *in_offsets; // of each property in a binary entry, if there are no lists
+    size_t in_stride;
+    bool has_lists;
+    int num_sinks;
+    PLYPlanSink *sinks;
+    size_t stride;
+    // Batches
+    int batch_size;
+    char *records;
+    size_t next_entry;
+    // Window onto the file
+    char *window;
+    size_t window_size;
+    size_t window_pos;
+    size_t window_end;
+    bool eof;
+    // Values of one entry (in the internal layout, lists with their counts), and the word offset of each property.
+    uint32_t *values;
+    size_t values_size;
+    size_t *word_offsets;
+};
+
+static void ply_cursor_error(PLYCursor *cursor, PLYElement *element)
+{
+    fprintf(stderr, ERROR_ALERT "PLY data ended early, or is malformed, when streaming element \"%s\".\n", element->name);
+    exit(EXIT_FAILURE);
+}
+// Make sure there are at least n bytes in the window from the read position, reading more of the file if needed.
+static bool ply_cursor_ensure(PLYCursor *cursor, size_t n)
+{
+    size_t available = cursor->window_end - cursor->window_pos;
+    if (available >= n) return true;
+    if (cursor->eof) return false;
+    memmove(cursor->window, cursor->window + cursor->window_pos, available);
+    cursor->window_pos = 0;
+    cursor->window_end = available;
+    if (n > cursor->window_size) {
+        while (n > cursor->window_size) cursor->window_size *= 2;
+        cursor->window = (char *) realloc(cursor->window, cursor->window_size);
+        mem_check(cursor->window);
+    }
+    while (cursor->window_end < n) {
+        size_t got = fread(cursor->window + cursor->window_end, 1, cursor->window_size - cursor->window_end, cursor->file);
+        if (got == 0) {
+            cursor->eof = true;
+            break;
+        }
+        cursor->window_end += got;
+    }
+    return cursor->window_end >= n;
+}
+// Get the next line in the window (without its newline), reading more of the file if needed. Returns false at the end of the file.
+static bool ply_cursor_line(PLYCursor *cursor, const char **line, const char **line_end)
+{
+    size_t searched = 0;
+    while (true) {
+        char *start = cursor->window + cursor->window_pos;
+        size_t available = cursor->window_end - cursor->window_pos;
+        char *newline = memchr(start + searched, '\n', available - searched);
+        if (newline != NULL) {
+            *line = start;
+            *line_end = newline;
+            cursor->window_pos += newline - start + 1;
+            return true;
+        }
+        if (cursor->eof || !ply_cursor_ensure(cursor, available + 1)) {
+            // The last line might not end in a newline.
+            if (available == 0) return false;
+            *line = cursor->window + cursor->window_pos;
+            *line_end = *line + available;
+            cursor->window_pos += available;
+            return true;
+        }
+        searched = available;
+    }
+}
+static void ply_cursor_reserve_values(PLYCursor *cursor, size_t words)
+{
+    if (words > cursor->values_size) {
+        while (words > cursor->values_size) cursor->values_size *= 2;
+        cursor->values = (uint32_t *) realloc(cursor->values, cursor->values_size * sizeof(uint32_t));
+        mem_check(cursor->values);
+    }
+}
+// A binary list count is read straight from the file, and the values buffer is grown to hold the list before it is read.
+// A corrupt or truncated file can give a count of up to 2^32, so larger counts than any real mesh would have are rejected
+// as errors instead of reserving gigabytes.
+#define PLY_CURSOR_MAX_LIST_COUNT (1 << 24)
+// Read one entry of an element into the cursor's values.
+static void ply_cursor_read_entry(PLYCursor *cursor, PLYElement *element, PLYProperty **properties)
+{
+    int num_properties = element->num_properties;
+    if (cursor->format == PLY_FORMAT_ASCII_1) {
+        const char *line, *line_end;
+        if (!ply_cursor_line(cursor, &line, &line_end)) ply_cursor_error(cursor, element);
+        ply_cursor_reserve_values(cursor, num_properties + (line_end - line + 1) / 2 + 1);
+        if (ply_parse_ascii_line(line, line_end, properties, num_properties, cursor->values, cursor->word_offsets) < 0) ply_cursor_error(cursor, element);
+        return;
+    }
+    size_t n = 0;
+    for (int k = 0; k < num_properties; k++) {
+        cursor->word_offsets[k] = n;
+        uint32_t list_count = 1;
+        size_t size = _ply_type_sizes[properties[k]->type];
+        if (properties[k]->is_list) {
+            size_t count_size = _ply_type_sizes[properties[k]->list_count_type];
+            if (!ply_cursor_ensure(cursor, count_size)) ply_cursor_error(cursor, element);
+            list_count = ply_decode_binary(cursor->window + cursor->window_pos, properties[k]->list_count_type, cursor->swap);
+            cursor->window_pos += count_size;
+            if (list_count > PLY_CURSOR_MAX_LIST_COUNT) ply_cursor_error(cursor, element);
+            ply_cursor_reserve_values(cursor, n + 1 + list_count);
+            cursor->values[n++] = list_count;
+        } else {
+            ply_cursor_reserve_values(cursor, n + 1);
+        }
+        if (!ply_cursor_ensure(cursor, list_count * size)) ply_cursor_error(cursor, element);
+        for (uint32_t j = 0; j < list_count; j++) {
+            cursor->values[n++] = ply_decode_binary(cursor->window + cursor->window_pos, properties[k]->type, cursor->swap);
+            cursor->window_pos += size;
+        }
+    }
+}
+// Skip over the entries of an element which comes before the queried one.
+static void ply_cursor_skip_element(PLYCursor *cursor, PLYElement *element)
+{
+    PLYProperty **properties = (PLYProperty **) malloc(element->num_properties * sizeof(PLYProperty *));
+    mem_check(properties);
+    bool has_lists = false;
+    size_t in_stride = 0;
+    int k = 0;
+    for (PLYProperty *property = element->first_property; property != NULL; property = property->next_property) {
+        properties[k++] = property;
+        if (property->is_list) has_lists = true;
+        in_stride += _ply_type_sizes[property->type];
+    }
+    cursor->word_offsets = (size_t *) realloc(cursor->word_offsets, element->num_properties * sizeof(size_t));
+    mem_check(cursor->word_offsets);
+    if (cursor->format != PLY_FORMAT_ASCII_1 && !has_lists) {
+        size_t remaining = element->count * in_stride;
+        while (remaining > 0) {
+            size_t n = remaining < cursor->window_size ? remaining : cursor->window_size;
+            if (!ply_cursor_ensure(cursor, n)) ply_cursor_error(cursor, element);
+            cursor->window_pos += n;
+            remaining -= n;
+        }
+    } else if (cursor->format == PLY_FORMAT_ASCII_1) {
+        const char *line, *line_end;
+        for (int i = 0; i < element->count; i++) {
+            if (!ply_cursor_line(cursor, &line, &line_end)) ply_cursor_error(cursor, element);
+        }
+    } else {
+        for (int i = 0; i < element->count; i++) ply_cursor_read_entry(cursor, element, properties);
+    }
+    free(properties);
+}
+
+PLYCursor *ply_cursor_open(FILE *file, PLY *ply, char *query_string, int list_length, int batch_size)
+{
+    if (ply->format != PLY_FORMAT_ASCII_1 && ply->format != PLY_FORMAT_BINARY_LITTLE_ENDIAN_1 && ply->format != PLY_FORMAT_BINARY_BIG_ENDIAN_1) {
+        fprintf(stderr, ERROR_ALERT "PLY format given for streaming is not implemented.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (batch_size <= 0) {
+        fprintf(stderr, ERROR_ALERT "PLY cursors must have a positive batch size.\n");
+        exit(EXIT_FAILURE);
+    }
+    PLYCursor *cursor = (PLYCursor *) calloc(1, sizeof(PLYCursor));
+    mem_check(cursor);
+    cursor->file = file;
+    cursor->format = ply->format;
+    cursor->swap = ply->format != PLY_FORMAT_ASCII_1 && ply->format != PLY_HOST_BINARY_FORMAT;
+    cursor->batch_size = batch_size;
+
+    // Match the query (through the plan cache). The plan is copied since later plans can move it.
+    PLYRequest request = {0};
+    request.query_string = query_string;
+    request.list_length = list_length;
+    PLYQueryPlan *plan = ply_query_plan(ply, 1, &request);
+    cursor->num_sinks = plan->num_sinks;
+    cursor->sinks = (PLYPlanSink *) malloc(plan->num_sinks * sizeof(PLYPlanSink));
+    mem_check(cursor->sinks);
+    memcpy(cursor->sinks, plan->sinks, plan->num_sinks * sizeof(PLYPlanSink));
+    cursor->stride = plan->strides[0];
+    int element_index = plan->element_indices[0];
+
+    cursor->window_size = 1 << 20;
+    cursor->window = (char *) malloc(cursor->window_size);
+    mem_check(cursor->window);
+    cursor->values_size = 64;
+    cursor->values = (uint32_t *) malloc(cursor->values_size * sizeof(uint32_t));
+    mem_check(cursor->values);
+    cursor->records = (char *) malloc(batch_size * cursor->stride + 1);
+    mem_check(cursor->records);
+
+    // Read past the header, and skip the elements before the queried one.
+    fseek(file, 0, SEEK_SET);
+    const char *line, *line_end;
+    while (true) {
+        if (!ply_cursor_line(cursor, &line, &line_end)) {
+            fprintf(stderr, ERROR_ALERT "Could not find the end of the header when streaming PLY data.\n");
+            exit(EXIT_FAILURE);
+        }
+        size_t len = line_end - line;
+        if (len > 0 && line[len - 1] == '\r') len --;
+        if (len == 10 && memcmp(line, "end_header", 10) == 0) break;
+    }
+    PLYElement *element = ply->first_element;
+    for (int e = 0; e < element_index; e++, element = element->next_element) ply_cursor_skip_element(cursor, element);
+
+    cursor->element = element;
+    cursor->properties = (PLYProperty **) malloc(element->num_properties * sizeof(PLYProperty *));
+    mem_check(cursor->properties);
+    cursor->in_offsets = (size_t *) malloc(element->num_properties * sizeof(size_t));
+    mem_check(cursor->in_offsets);
+    cursor->word_offsets = (size_t *) realloc(cursor->word_offsets, element->num_properties * sizeof(size_t));
+    mem_check(cursor->word_offsets);
+    int k = 0;
+    for (PLYProperty *property = element->first_property; property != NULL; property = property->next_property) {
+        cursor->properties[k] = property;
+        cursor->in_offsets[k++] = cursor->in_stride;
+        if (property->is_list) cursor->has_lists = true;
+        cursor->in_stride += _ply_type_sizes[property->type];
+    }
+    return cursor;
+}
+
+void *ply_cursor_next(PLYCursor *cursor, int *num_records)
+{
+    PLYElement *element = cursor->element;
+    size_t count = element->count;
+    size_t n = 0;
+    while (n < cursor->batch_size && cursor->next_entry < count) {
+        if (cursor->format != PLY_FORMAT_ASCII_1 && !cursor->has_lists) {
+            // Fixed-size binary entries are decoded in blocks with strided copies.
+            size_t block = cursor->batch_size - n;
+            if (block > count - cursor->next_entry) block = count - cursor->next_entry;
+            if (!ply_cursor_ensure(cursor, block * cursor->in_stride)) ply_cursor_error(cursor, element);
+            for (int s = 0; s < cursor->num_sinks; s++) {
+                int k = cursor->sinks[s].prop_index;
+                ply_decode_binary_strided(cursor->records + n * cursor->stride + cursor->sinks[s].out_offset, cursor->stride,
+                                          cursor->window + cursor->window_pos + cursor->in_offsets[k], cursor->in_stride,
+                                          block, cursor->properties[k]->type, cursor->swap);
+            }
+            cursor->window_pos += block * cursor->in_stride;
+            n += block;
+            cursor->next_entry += block;
+            continue;
+        }
+        ply_cursor_read_entry(cursor, element, cursor->properties);
+        char *record = cursor->records + n * cursor->stride;
+        for (int s = 0; s < cursor->num_sinks; s++) {
+            PLYPlanSink *sink = &cursor->sinks[s];
+            uint32_t *values = cursor->values + cursor->word_offsets[sink->prop_index];
+            if (sink->list_length != 0) {
+                if (values[0] != sink->list_length) {
+                    fprintf(stderr, ERROR_ALERT "PLY list property \"%s\" has an entry of length %u, expected %d.\n", cursor->properties[sink->prop_index]->name, values[0], sink->list_length);
+                    exit(EXIT_FAILURE);
+                }
+                memcpy(record + sink->out_offset, values + 1, sink->list_length * sizeof(uint32_t));
+            } else {
+                memcpy(record + sink->out_offset, values, sizeof(uint32_t));
+            }
+        }
+        n ++;
+        cursor->next_entry ++;
+    }
+    if (num_records != NULL) *num_records = n;
+    return n == 0 ? NULL : cursor->records;
+}
+
+void ply_cursor_close(PLYCursor *cursor)
+{
+    free(cursor->properties);
+    free(cursor->in_offsets);
+    free(cursor->sinks);
+    free(cursor->records);
+    free(cursor->window);
+    free(cursor->values);
+    free(cursor->word_offsets);
+    free(cursor);
+}
+
 void *ply_get_element(PLY *ply, char *element_name)
 {
     PLYElement *cur_element = ply->first_element;
     while (cur_element != NULL) {
-        printf("\"%s\" = \"%s\"?\n", cur_element->name, element_name);
+        ply_debug("\"%s\" = \"%s\"?\n", cur_element->name, element_name);
         if (cur_element->name != NULL && strcmp(cur_element->name, element_name) == 0) {
-            printf("Got!\n");
+            ply_debug("Got!\n");
             return cur_element;
         }
         cur_element = cur_element->next_element;
@@ -382,7 +1615,7 @@ void *ply_get_property(PLYElement *element, char *property_name)
 {
     PLYProperty *cur_property = element->first_property;
     while (cur_property != NULL) {
-        printf("\"%s\" = \"%s\"?\n", cur_property->name, property_name);
+        ply_debug("\"%s\" = \"%s\"?\n", cur_property->name, property_name);
         if (cur_property->name != NULL && strcmp(cur_property->name, property_name) == 0) {
             return cur_property;
         }
@@ -399,6 +1632,7 @@ void init_ply(PLY *ply)
     ply->format = PLY_FORMAT_NONE;
     ply->num_elements = 0;
     ply->first_element = NULL;
+    ply->data = NULL;
 }
 void destroy_ply(PLY *ply)
 {
@@ -410,6 +1644,7 @@ void destroy_ply(PLY *ply)
             destroy_ply_element(destroy_this);
         } while (cur_element != NULL);
     }
+    if (ply->data != NULL) free(ply->data);
     free(ply);
 }
 void init_ply_element(PLYElement *ply_element)
@@ -419,6 +1654,10 @@ void init_ply_element(PLYElement *ply_element)
     ply_element->num_properties = 0;
     ply_element->next_element = NULL;
     ply_element->first_property = NULL;
+    ply_element->offset = 0;
+    ply_element->property_offsets = NULL;
+    ply_element->stride = 0;
+    ply_element->property_stride_offsets = NULL;
 }
 void destroy_ply_element(PLYElement *ply_element)
 {
@@ -437,7 +1676,9 @@ void destroy_ply_element(PLYElement *ply_element)
                 free(ply_element->property_offsets[i]);
             }
         }
+        free(ply_element->property_offsets);
     }
+    if (ply_element->property_stride_offsets != NULL) free(ply_element->property_stride_offsets);
     free(ply_element);
 }
 void init_ply_property(PLYProperty *ply_property)
@@ -0,0 +1,100 @@
+/*--------------------------------------------------------------------------------
+    Conditioned asset blobs component of the rendering module.
+    Helpers for validating, mapping and writing the binary blobs made by tools/condition_assets.
+    The Geometry and Texture specific parts are with their loaders.
+--------------------------------------------------------------------------------*/
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "helper_definitions.h"
+#include "resources.h"
+#include "rendering.h"
+
+static uint32_t fnv1a(uint32_t h, const void *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        h ^= ((const uint8_t *) data)[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+uint32_t asset_source_hash(const char *source_path, const void *parameters, size_t parameters_size)
+{
+    // source_path is a resource path. The source's size and modification time are used instead of its contents,
+    // so checking freshness doesn't need to read the source.
+    char physical_path[1024];
+    if (!resource_file_resolve((char *) source_path, "", physical_path, 1024)) return 0;
+    struct stat st;
+    if (stat(physical_path, &st) != 0) return 0;
+    uint64_t size = st.st_size;
+    uint64_t mtime = st.st_mtime;
+    uint32_t version = ASSET_BLOB_VERSION;
+    uint32_t h = 2166136261u;
+    h = fnv1a(h, &version, sizeof(version));
+    h = fnv1a(h, &size, sizeof(size));
+    h = fnv1a(h, &mtime, sizeof(mtime));
+    h = fnv1a(h, parameters, parameters_size);
+    return h;
+}
+
+void *asset_blob_map(char *source_path, char *suffix, const char *magic, uint32_t source_hash, size_t *size)
+{
+    // Returns the mapped blob, or NULL if there is no usable blob.
+    if (source_hash == 0) return NULL;
+    char physical_path[1024];
+    if (!resource_file_resolve(source_path, suffix, physical_path, 1024)) return NULL;
+    int fd = open(physical_path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(AssetBlobHeader)) {
+        close(fd);
+        return NULL;
+    }
+    void *blob = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (blob == MAP_FAILED) return NULL;
+    AssetBlobHeader *header = (AssetBlobHeader *) blob;
+    if (strncmp(header->magic, magic, 8) != 0
+            || header->version != ASSET_BLOB_VERSION
+            || header->source_hash != source_hash
+            || header->size != st.st_size) {
+        munmap(blob, st.st_size);
+        return NULL;
+    }
+    *size = st.st_size;
+    return blob;
+}
+void asset_blob_unmap(void *blob, size_t size)
+{
+    munmap(blob, size);
+}
+
+FILE *asset_blob_create(char *source_path, char *suffix)
+{
+    // Blobs are written next to the source asset.
+    char physical_path[1024];
+    if (!resource_file_resolve(source_path, "", physical_path, 1024)) return NULL;
+    char path_buffer[1024];
+    if (snprintf(path_buffer, 1024, "%s%s", physical_path, suffix) >= 1024) return NULL;
+    FILE *file = fopen(path_buffer, "wb");
+    // The resolve cache may have cached that there was no blob.
+    resource_file_cache_clear();
+    return file;
+}
+void asset_blob_pad(FILE *file)
+{
+    // Pad the file to the blob data alignment.
+    static const uint8_t zeros[ASSET_BLOB_ALIGNMENT] = {0};
+    long pos = ftell(file);
+    if (pos % ASSET_BLOB_ALIGNMENT != 0) fwrite(zeros, 1, ASSET_BLOB_ALIGNMENT - pos % ASSET_BLOB_ALIGNMENT, file);
+}
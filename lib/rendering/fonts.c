@@ -44,6 +44,7 @@ void Font_load(void *resource, char *path)
     FILE *sdf_metadata = resource_file_open(sdf_metadata_path, "", "r");
     if (sdf_metadata == NULL) load_error("Could not load glyph map metadata text file.");
     free(sdf_metadata_path);
+    dd_close(dd);
 #define metadata_error() load_error("malformed metadata\n")
 
     font.num_glyphs = 'z' - 'A' + 1; //---preparing for just enough glyphs, since that is what is currently in the sdf data.
@@ -12,6 +12,7 @@ This module is not for geometric math, only the "Geometry" resource.
 #include <stdbool.h>
 #include <ctype.h>
 #include <math.h>
+#include <pthread.h>
 #include "helper_definitions.h"
 #include "resources.h"
 #include "rendering.h"
@@ -44,7 +45,63 @@ enum CalculateUVType {
     UVNone,
     UVOrthographic,
 };
-void Geometry_load(void *resource, char *_path)
+typedef struct GeometryLoadJob_s {
+    bool keep_mesh_data;
+    bool quantize;
+    VertexFormat vertex_format;
+    bool calculate_normals;
+    bool calculate_uv;
+    int calculate_uv_type;
+    float calculate_uv_scale;
+    vec3 calculate_uv_orthographic_direction;
+    char *ply_path;
+    // Filled when prepared.
+    Geometry geometry;
+    MeshData mesh_data;
+    void *blob; // If the geometry was loaded from a conditioned blob, the mesh data points into this mapping.
+    size_t blob_size;
+} GeometryLoadJob;
+
+static uint32_t geometry_blob_hash(GeometryLoadJob *job)
+{
+    // Everything in the manifest which changes the conditioned mesh data.
+    float parameters[8] = {
+        job->vertex_format,
+        job->calculate_normals,
+        job->calculate_uv,
+        job->calculate_uv_type,
+        job->calculate_uv_scale,
+        X(job->calculate_uv_orthographic_direction),
+        Y(job->calculate_uv_orthographic_direction),
+        Z(job->calculate_uv_orthographic_direction),
+    };
+    return asset_source_hash(job->ply_path, parameters, sizeof(parameters));
+}
+static bool geometry_blob_load(GeometryLoadJob *job)
+{
+    job->blob = asset_blob_map(job->ply_path, ".Geometry.bin", GEOMETRY_BLOB_MAGIC, geometry_blob_hash(job), &job->blob_size);
+    if (job->blob == NULL) return false;
+    GeometryBlob *blob = (GeometryBlob *) job->blob;
+    MeshData *mesh_data = &job->mesh_data;
+    mesh_data->vertex_format = blob->vertex_format;
+    mesh_data->num_vertices = blob->num_vertices;
+    mesh_data->num_triangles = blob->num_triangles;
+    for (int i = 0; i < NUM_ATTRIBUTE_TYPES; i++) {
+        if (blob->attribute_offsets[i] == 0) continue;
+        mesh_data->attribute_data[i] = job->blob + blob->attribute_offsets[i];
+        mesh_data->attribute_data_sizes[i] = mesh_data->num_vertices * g_attribute_info[i].gl_size * sizeof(float);
+    }
+    mesh_data->triangles = (uint32_t *) (job->blob + blob->triangles_offset);
+    job->geometry.radius = blob->radius;
+    return true;
+}
+
+// The PLY header and query scanners are flex scanners with global state, so only one thread can be parsing a PLY file at a time.
+static pthread_mutex_t g_ply_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#define load_error(STRING) { fprintf(stderr, ERROR_ALERT "Error loading geometry: %s\n", ( STRING )); exit(EXIT_FAILURE); }
+#define manifest_error(str) load_error("Geometry manifest file has missing or malformed " str " entry.\n")
+void *Geometry_request(char *_path)
 {
     //----Experimenting with flags for resource loading parameters. For example,
     // new_resource_handle(Geometry, "Models/bunny -a") loads the bunny with application data kept. The flags are part of the "path",
@@ -62,16 +119,16 @@ void Geometry_load(void *resource, char *_path)
     //--testing flags.
     // printf("got geometry path: \"%s\"\n", path); getchar();
     // printf("got geometry flags: \"%s\"\n", flags); getchar();
+    GeometryLoadJob *job = (GeometryLoadJob *) calloc(1, sizeof(GeometryLoadJob));
+    mem_check(job);
     //--------------------------------------------------------------------------------
     // Process flags
     //--------------------------------------------------------------------------------
-    bool keep_mesh_data = false;
+    job->keep_mesh_data = false;
     if (strcmp(flags, "-a") == 0) { //--just so it works, only one flag right now anyway.
-        keep_mesh_data = true;
+        job->keep_mesh_data = true;
     }
 
-    #define load_error(STRING) { fprintf(stderr, ERROR_ALERT "Error loading geometry: %s\n", ( STRING )); exit(EXIT_FAILURE); }
-    #define manifest_error(str) load_error("Geometry manifest file has missing or malformed " str " entry.\n")
     DataDictionary *dd = dd_open(g_resource_dictionary, path);
     if (dd == NULL) load_error("Could not open dictionary for geometry.");
     char *vertex_format_string;
@@ -79,106 +136,250 @@ void Geometry_load(void *resource, char *_path)
     VertexFormat vertex_format = string_to_VertexFormat(vertex_format_string);
     free(vertex_format_string);
     if (vertex_format == VERTEX_FORMAT_NONE) load_error("Invalid vertex format given.");
+    job->vertex_format = vertex_format;
     char *type;
     if (!dd_get(dd, "type", "string", &type)) manifest_error("type"); //- if not doing a fatal error, remember to free the queried strings.
     
     // With this option, normals are calculated from the mesh and override whatever normals were loaded (defaults to false).
     // Normals (just a boolean flag, no variation, always calculated as the average of the normals of adjacent triangles.)
-    bool calculate_normals;
-    if (!dd_get(dd, "calculate_normals", "bool", &calculate_normals)) manifest_error("calculate_normals");
+    if (!dd_get(dd, "calculate_normals", "bool", &job->calculate_normals)) manifest_error("calculate_normals");
     // UV, texture coordinates (options for different types of projections, and parameters for those options.)
     char *calculate_uv_string;
     if (!dd_get(dd, "calculate_uv", "string", &calculate_uv_string)) manifest_error("calculate_uv");
-    int calculate_uv_type;
-    bool calculate_uv = true;
+    job->calculate_uv = true;
     if (strcmp(calculate_uv_string, "none") == 0) {
-        calculate_uv = false; // don't calculate any uv coordinates. This is the default.
-        calculate_uv_type = UVNone;
+        job->calculate_uv = false; // don't calculate any uv coordinates. This is the default.
+        job->calculate_uv_type = UVNone;
     } else if (strcmp(calculate_uv_string, "orthographic") == 0) {
-        calculate_uv_type = UVOrthographic;
+        job->calculate_uv_type = UVOrthographic;
     } else {
         fprintf(stderr, ERROR_ALERT "Invalid option for uv coordinate calculation given in geometry resource definition.\n");
         exit(EXIT_FAILURE);
     }
+    free(calculate_uv_string);
+    if (job->calculate_uv && (vertex_format & VERTEX_FORMAT_U) != 0) {
+        if (!dd_get(dd, "calculate_uv_scale", "float", &job->calculate_uv_scale)) manifest_error("calculate_uv_scale");
+        if (job->calculate_uv_type == UVOrthographic) {
+            if (!dd_get(dd, "calculate_uv_orthographic_direction", "vec3", &job->calculate_uv_orthographic_direction)) manifest_error("calculate_uv_orthographic_direction");
+        }
+    }
 
-    Geometry geometry;
-    if (!dd_get(dd, "patch_vertices", "int", &geometry.patch_vertices)) manifest_error("No patch_vertices.");
+    if (!dd_get(dd, "patch_vertices", "int", &job->geometry.patch_vertices)) manifest_error("No patch_vertices.");
+    // With this option, the mesh is uploaded with packed attributes (see upload_mesh_quantized).
+    if (!dd_get(dd, "quantize", "bool", &job->quantize)) manifest_error("quantize");
     if (strcmp(type, "ply") == 0) {
-        // Load geometry from a PLY file.
-        char *ply_path;
-        if (!dd_get(dd, "path", "string", &ply_path)) manifest_error("path");
-        FILE *ply_file = resource_file_open(ply_path, "", "r");
-        if (ply_file == NULL) load_error("Cannot open resource PLY file.");
-        MeshData mesh_data = {0};
-
-        // Optionally calculate vertex attributes.
-        VertexFormat calculating_attributes = VERTEX_FORMAT_NONE;
-        if (calculate_normals) calculating_attributes |= VERTEX_FORMAT_N;
-        if (calculate_uv) calculating_attributes |= VERTEX_FORMAT_U;
-        if ((vertex_format & VERTEX_FORMAT_T) != 0) calculating_attributes |= VERTEX_FORMAT_T; // Tangents are not queried for, even if available, but calculated.
-
-        // Mask the vertex format for the PLY query so that calculated attributes aren't queried for.
-        VertexFormat query_vertex_format = vertex_format & ~calculating_attributes;
-        load_mesh_ply(&mesh_data, query_vertex_format, ply_file);
-        mesh_data.vertex_format = vertex_format;
-
-        // Only compute attributes if they are declared in the vertex format. Otherwise, they will not be freed when the mesh data is destroyed.
-        if (calculate_normals && (vertex_format & VERTEX_FORMAT_N) != 0) {
-            MeshData_calculate_normals(&mesh_data);
-        }
-        if (calculate_uv && (vertex_format & VERTEX_FORMAT_U) != 0) {
-            float scale;
-	    if (!dd_get(dd, "calculate_uv_scale", "float", &scale)) manifest_error("calculate_uv_scale");
-            if (calculate_uv_type == UVOrthographic) {
-                vec3 direction;
-                if (!dd_get(dd, "calculate_uv_orthographic_direction", "vec3", &direction)) manifest_error("calculate_uv_orthographic_direction");
-                MeshData_calculate_uv_orthographic(&mesh_data, direction, scale);
-            } else {
-                fprintf(stderr, ERROR_ALERT "Something went wrong. Attempted to calculate UV coordinates for mesh with invalid projection type.\n");
-                exit(EXIT_FAILURE);
-            }
+        if (!dd_get(dd, "path", "string", &job->ply_path)) manifest_error("path");
+    } else load_error("Invalid geometry-loading type given.");
+    free(type);
+    dd_close(dd);
+    return job;
+}
+
+void Geometry_prepare(void *_job)
+{
+    GeometryLoadJob *job = (GeometryLoadJob *) _job;
+    VertexFormat vertex_format = job->vertex_format;
+    MeshData *mesh_data = &job->mesh_data;
+
+    // Use the conditioned blob if there is a fresh one.
+    if (geometry_blob_load(job)) return;
+
+    // Load geometry from a PLY file.
+    FILE *ply_file = resource_file_open(job->ply_path, "", "r");
+    if (ply_file == NULL) load_error("Cannot open resource PLY file.");
+
+    // Optionally calculate vertex attributes.
+    VertexFormat calculating_attributes = VERTEX_FORMAT_NONE;
+    if (job->calculate_normals) calculating_attributes |= VERTEX_FORMAT_N;
+    if (job->calculate_uv) calculating_attributes |= VERTEX_FORMAT_U;
+    if ((vertex_format & VERTEX_FORMAT_T) != 0) calculating_attributes |= VERTEX_FORMAT_T; // Tangents are not queried for, even if available, but calculated.
+
+    // Mask the vertex format for the PLY query so that calculated attributes aren't queried for.
+    VertexFormat query_vertex_format = vertex_format & ~calculating_attributes;
+    pthread_mutex_lock(&g_ply_mutex);
+    load_mesh_ply(mesh_data, query_vertex_format, ply_file);
+    pthread_mutex_unlock(&g_ply_mutex);
+    fclose(ply_file);
+    mesh_data->vertex_format = vertex_format;
+
+    // Only compute attributes if they are declared in the vertex format. Otherwise, they will not be freed when the mesh data is destroyed.
+    if (job->calculate_normals && (vertex_format & VERTEX_FORMAT_N) != 0) {
+        MeshData_calculate_normals(mesh_data);
+    }
+    if (job->calculate_uv && (vertex_format & VERTEX_FORMAT_U) != 0) {
+        if (job->calculate_uv_type == UVOrthographic) {
+            MeshData_calculate_uv_orthographic(mesh_data, job->calculate_uv_orthographic_direction, job->calculate_uv_scale);
+        } else {
+            fprintf(stderr, ERROR_ALERT "Something went wrong. Attempted to calculate UV coordinates for mesh with invalid projection type.\n");
+            exit(EXIT_FAILURE);
         }
-        // Calculate tangents only after UV coordinates and normals, because they used in the construction.
-        if ((vertex_format & VERTEX_FORMAT_T) != 0) {
-            if ((vertex_format & VERTEX_FORMAT_U) == 0 || (vertex_format & VERTEX_FORMAT_N) == 0) {
-                fprintf(stderr, ERROR_ALERT "geomety error: Tangent vectors cannot be contained in a vertex format without both normals and UV coordinates.");
-                exit(EXIT_FAILURE);
-            }
-            MeshData_calculate_tangents(&mesh_data);
+    }
+    // Calculate tangents only after UV coordinates and normals, because they used in the construction.
+    if ((vertex_format & VERTEX_FORMAT_T) != 0) {
+        if ((vertex_format & VERTEX_FORMAT_U) == 0 || (vertex_format & VERTEX_FORMAT_N) == 0) {
+            fprintf(stderr, ERROR_ALERT "geomety error: Tangent vectors cannot be contained in a vertex format without both normals and UV coordinates.");
+            exit(EXIT_FAILURE);
         }
+        MeshData_calculate_tangents(mesh_data);
+    }
 
-        geometry = upload_mesh(&mesh_data);
-
-        // Calculate the radius, being the maximum distance of a vertex from the model origin.
-        // This is used for a simple bounding sphere.
-        float max_sq_dist = 0;
-        for (int i = 0; i < mesh_data.num_vertices; i++) {
-            vec3 vertex = ((vec3 *) mesh_data.attribute_data[Position])[i];
-            if (vec3_square_length(vertex) > max_sq_dist) max_sq_dist = vec3_square_length(vertex);
-        }
-        geometry.radius = sqrt(max_sq_dist);
-        // printf("calculated %.2f for radius of model %s\n", geometry.radius, path);
-        // getchar();
+    // Calculate the radius, being the maximum distance of a vertex from the model origin.
+    // This is used for a simple bounding sphere.
+    float max_sq_dist = 0;
+    for (int i = 0; i < mesh_data->num_vertices; i++) {
+        vec3 vertex = ((vec3 *) mesh_data->attribute_data[Position])[i];
+        if (vec3_square_length(vertex) > max_sq_dist) max_sq_dist = vec3_square_length(vertex);
+    }
+    job->geometry.radius = sqrt(max_sq_dist);
+}
 
-        // Destroy the mesh data. (mesh data can be kept with the -a flag)
-        if (!keep_mesh_data) {
-            for (int i = 0; i < NUM_ATTRIBUTE_TYPES; i++) {
-                if (mesh_data.attribute_data[i] != NULL) free(mesh_data.attribute_data[i]);
-            }
-            if (mesh_data.triangles != NULL) free(mesh_data.triangles);
-            geometry.mesh_data = NULL; // make sure this pointer is null so the application knows the mesh data isn't there.
-        } else {
+void Geometry_upload(void *resource, void *_job)
+{
+    GeometryLoadJob *job = (GeometryLoadJob *) _job;
+    MeshData mesh_data = job->mesh_data;
+
+    Geometry geometry = job->quantize ? upload_mesh_quantized(&mesh_data) : upload_mesh(&mesh_data);
+    geometry.patch_vertices = job->geometry.patch_vertices;
+    geometry.radius = job->geometry.radius;
+    // printf("calculated %.2f for radius of model %s\n", geometry.radius, path);
+    // getchar();
+
+    // Destroy the mesh data. (mesh data can be kept with the -a flag)
+    if (job->blob != NULL) {
+        // The mesh data is in the mapped blob, so copy it out if it is being kept.
+        geometry.mesh_data = NULL;
+        if (job->keep_mesh_data) {
             MeshData *out_mesh_data = (MeshData *) malloc(sizeof(MeshData));
             mem_check(out_mesh_data);
             memcpy(out_mesh_data, &mesh_data, sizeof(MeshData));
+            for (int i = 0; i < NUM_ATTRIBUTE_TYPES; i++) {
+                if (mesh_data.attribute_data[i] == NULL) continue;
+                out_mesh_data->attribute_data[i] = malloc(mesh_data.attribute_data_sizes[i]);
+                mem_check(out_mesh_data->attribute_data[i]);
+                memcpy(out_mesh_data->attribute_data[i], mesh_data.attribute_data[i], mesh_data.attribute_data_sizes[i]);
+            }
+            out_mesh_data->triangles = (uint32_t *) malloc(3 * mesh_data.num_triangles * sizeof(uint32_t));
+            mem_check(out_mesh_data->triangles);
+            memcpy(out_mesh_data->triangles, mesh_data.triangles, 3 * mesh_data.num_triangles * sizeof(uint32_t));
             geometry.mesh_data = out_mesh_data;
         }
-    } else load_error("Invalid geometry-loading type given.");
-
-    free(type);
+        asset_blob_unmap(job->blob, job->blob_size);
+    } else if (!job->keep_mesh_data) {
+        for (int i = 0; i < NUM_ATTRIBUTE_TYPES; i++) {
+            if (mesh_data.attribute_data[i] != NULL) free(mesh_data.attribute_data[i]);
+        }
+        if (mesh_data.triangles != NULL) free(mesh_data.triangles);
+        geometry.mesh_data = NULL; // make sure this pointer is null so the application knows the mesh data isn't there.
+    } else {
+        MeshData *out_mesh_data = (MeshData *) malloc(sizeof(MeshData));
+        mem_check(out_mesh_data);
+        memcpy(out_mesh_data, &mesh_data, sizeof(MeshData));
+        geometry.mesh_data = out_mesh_data;
+    }
     memcpy(resource, &geometry, sizeof(Geometry));
-    #undef load_error
-    #undef manifest_error
+    free(job->ply_path);
+    free(job);
+}
+
+void Geometry_load(void *resource, char *path)
+{
+    void *job = Geometry_request(path);
+    Geometry_prepare(job);
+    Geometry_upload(resource, job);
+}
+/*--------------------------------------------------------------------------------
+Conditioning: write the prepared mesh data to a blob next to the PLY file, for tools/condition_assets.
+--------------------------------------------------------------------------------*/
+static void free_geometry_job(GeometryLoadJob *job)
+{
+    if (job->blob != NULL) {
+        asset_blob_unmap(job->blob, job->blob_size);
+    } else {
+        for (int i = 0; i < NUM_ATTRIBUTE_TYPES; i++) {
+            if (job->mesh_data.attribute_data[i] != NULL) free(job->mesh_data.attribute_data[i]);
+        }
+        if (job->mesh_data.triangles != NULL) free(job->mesh_data.triangles);
+    }
+    free(job->ply_path);
+    free(job);
+}
+bool Geometry_condition(char *path)
+{
+    GeometryLoadJob *job = (GeometryLoadJob *) Geometry_request(path);
+    Geometry_prepare(job);
+    if (job->blob != NULL) {
+        // Already fresh.
+        free_geometry_job(job);
+        return false;
+    }
+    FILE *file = asset_blob_create(job->ply_path, ".Geometry.bin");
+    if (file == NULL) load_error("Could not create geometry blob.");
+    MeshData *mesh_data = &job->mesh_data;
+    GeometryBlob blob = {0};
+    memcpy(blob.header.magic, GEOMETRY_BLOB_MAGIC, strlen(GEOMETRY_BLOB_MAGIC));
+    blob.header.version = ASSET_BLOB_VERSION;
+    blob.header.source_hash = geometry_blob_hash(job);
+    blob.vertex_format = mesh_data->vertex_format;
+    blob.num_vertices = mesh_data->num_vertices;
+    blob.num_triangles = mesh_data->num_triangles;
+    blob.radius = job->geometry.radius;
+    // Lay out the data after the header, then write the header with the offsets filled in.
+    uint64_t offset = sizeof(GeometryBlob);
+    #define align(OFFSET) ( ((OFFSET) + ASSET_BLOB_ALIGNMENT - 1) & ~((uint64_t) ASSET_BLOB_ALIGNMENT - 1) )
+    for (int i = 0; i < NUM_ATTRIBUTE_TYPES; i++) {
+        if (mesh_data->attribute_data[i] == NULL) continue;
+        offset = align(offset);
+        blob.attribute_offsets[i] = offset;
+        offset += mesh_data->num_vertices * g_attribute_info[i].gl_size * sizeof(float);
+    }
+    offset = align(offset);
+    blob.triangles_offset = offset;
+    offset += 3 * mesh_data->num_triangles * sizeof(uint32_t);
+    blob.header.size = offset;
+    #undef align
+    fwrite(&blob, sizeof(GeometryBlob), 1, file);
+    for (int i = 0; i < NUM_ATTRIBUTE_TYPES; i++) {
+        if (mesh_data->attribute_data[i] == NULL) continue;
+        asset_blob_pad(file);
+        fwrite(mesh_data->attribute_data[i], g_attribute_info[i].gl_size * sizeof(float), mesh_data->num_vertices, file);
+    }
+    asset_blob_pad(file);
+    fwrite(mesh_data->triangles, 3 * sizeof(uint32_t), mesh_data->num_triangles, file);
+    if (ftell(file) != blob.header.size) load_error("Failed to write geometry blob.");
+    fclose(file);
+    free_geometry_job(job);
+    return true;
+}
+#undef load_error
+#undef manifest_error
+
+void Geometry_unload(void *resource)
+{
+    Geometry *geometry = (Geometry *) resource;
+    gm_free(*geometry);
+    if (geometry->mesh_data != NULL) {
+        for (int i = 0; i < NUM_ATTRIBUTE_TYPES; i++) {
+            if (geometry->mesh_data->attribute_data[i] != NULL) free(geometry->mesh_data->attribute_data[i]);
+        }
+        if (geometry->mesh_data->triangles != NULL) free(geometry->mesh_data->triangles);
+        free(geometry->mesh_data);
+    }
+}
+size_t Geometry_bytes(void *resource)
+{
+    // The vram taken up by the attribute and index buffers, and the application memory of the mesh data if it is kept.
+    // The mesh data holds floats, so for quantized geometry it is larger than the buffers.
+    Geometry *geometry = (Geometry *) resource;
+    size_t bytes = sizeof(Geometry);
+    size_t float_bytes = 0;
+    for (int i = 0; i < NUM_ATTRIBUTE_TYPES; i++) {
+        if (geometry->vertex_format & (1 << i)) float_bytes += geometry->num_vertices * g_attribute_info[i].gl_size * sizeof(float);
+    }
+    size_t index_bytes = geometry->is_indexed ? geometry->num_indices * sizeof(uint32_t) : 0;
+    if (geometry->quantized) bytes += geometry->num_vertices * quantized_vertex_size(geometry->vertex_format) + index_bytes;
+    else bytes += float_bytes + index_bytes;
+    if (geometry->mesh_data != NULL) bytes += float_bytes + index_bytes;
+    return bytes;
 }
 
 /*---Usage details----------------------------------------------------------------
@@ -226,6 +427,19 @@ gm_index(a); gm_index(c); gm_index(d);
 Geometry g = gm_done();
 gm_draw(g, some color-interpolating material);
 gm_free(g);
+
+------ Per-frame geometry
+Geometry which is only drawn in the frame it is specified in should be completed with
+Geometry g = gm_done_frame();
+instead. Its vertices and indices are written into the frame ring, a buffer which stays mapped and is reused every
+few frames, and it is drawn with a vertex array shared by all frame geometry of the same vertex format. So no GL
+objects are created or destroyed for it. It must not be drawn after the frame ends.
+!! gm_free(g) must still be called on it when it is done with. If the GL version can't map the ring (before 4.4) or
+   the frame's region is full, gm_done_frame gives ordinary geometry with buffers of its own, which gm_free deletes.
+   For geometry in the ring, gm_free does nothing.
+Geometry g = gm_done_frame();
+gm_draw(g, material);
+gm_free(g);
 --------------------------------------------------------------------------------*/
 
 /*---Implementation details-------------------------------------------------------
@@ -282,6 +496,11 @@ static void gm_reset(void)
         gm_init();\
     }\
 }
+// The width in bytes of one value of the attribute.
+static size_t attribute_width(AttributeType attribute_type)
+{
+    return g_attribute_info[attribute_type].gl_size * gl_type_size(g_attribute_info[attribute_type].gl_type);
+}
 
 // Functions for starting a geometry-specification.
 void gm_triangles(VertexFormat vertex_format)
@@ -352,7 +571,7 @@ void attribute_buf(AttributeType attribute_type, void *buf, int count)
     /* Specify the attribute data from a buffer. This will be faster than streaming through, if you already
      * have the data in the format needed for the attribute.
      */
-    size_t width = g_attribute_info[attribute_type].gl_size * gl_type_size(g_attribute_info[attribute_type].gl_type); // the width of a single one of these attributes.
+    size_t width = attribute_width(attribute_type);
     size_t pos = g_gm_attribute_positions[attribute_type];
     if ((g_geometry.vertex_format & (1 << attribute_type)) == 0) gm_attribute_error();
     if (pos + width * count > GM_ATTRIBUTE_BUFFER_SIZE) gm_size_error();
@@ -375,7 +594,8 @@ void gm_index_buf(uint32_t *indices, int count)
 }
 
 // Completing the geometry specification.
-Geometry gm_done(void)
+// Check that the specification can be completed, returning the number of vertices.
+static int gm_done_check(void)
 {
     if (!g_gm_specifying) {
         fprintf(stderr, ERROR_ALERT "Cannot call gm_done when no geometry is being specified.\n");
@@ -392,6 +612,11 @@ Geometry gm_done(void)
             last_count = g_gm_attribute_counts[i];
         }
     }
+    return last_count;
+}
+Geometry gm_done(void)
+{
+    int last_count = gm_done_check();
 
     glGenVertexArrays(1, &g_geometry.vao_id);
     glBindVertexArray(g_geometry.vao_id);
@@ -425,23 +650,188 @@ Geometry gm_done(void)
     return g_geometry;
 }
 
+/*--------------------------------------------------------------------------------
+    Frame ring
+----------------------------------------------------------------------------------
+One buffer, created with immutable storage and mapped once for good, is split into GM_FRAME_RING_FRAMES regions.
+Each frame's gm_done_frame calls write into the next region in turn, and gm_frame_end puts a fence after that frame's
+draws. Before a region is written again, its fence is waited on, though with a few frames in flight the GPU is
+normally long done with it. The vertex arrays are made with separate attribute formats and bindings (GL 4.3), so one
+per vertex format can serve all frame geometry, with the attribute data pointed to by glBindVertexBuffer on each draw.
+--------------------------------------------------------------------------------*/
+static bool g_ring_initialized = false;
+static bool g_ring_available = false; // Buffer storage needs GL 4.4.
+static GLuint g_ring_buffer;
+static uint8_t *g_ring_mapping;
+static int g_ring_frame;
+static size_t g_ring_position; // Offset into the current frame's region.
+static GLsync g_ring_fences[GM_FRAME_RING_FRAMES];
+static int g_ring_num_vertex_arrays;
+static struct {
+    VertexFormat vertex_format;
+    GLuint vao_id;
+} g_ring_vertex_arrays[GM_FRAME_RING_MAX_VERTEX_FORMATS];
+
+static void ring_init(void)
+{
+    g_ring_initialized = true;
+    if (!GLAD_GL_VERSION_4_4) return;
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &g_ring_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, g_ring_buffer);
+    glBufferStorage(GL_ARRAY_BUFFER, GM_FRAME_RING_SIZE, NULL, flags);
+    g_ring_mapping = glMapBufferRange(GL_ARRAY_BUFFER, 0, GM_FRAME_RING_SIZE, flags);
+    if (g_ring_mapping == NULL) {
+        glDeleteBuffers(1, &g_ring_buffer);
+        return;
+    }
+    g_ring_available = true;
+}
+
+// Wait until the GPU has finished with the current region, if it was used a few frames ago.
+static void ring_wait(void)
+{
+    GLsync fence = g_ring_fences[g_ring_frame];
+    if (fence == NULL) return;
+    GLenum status;
+    do {
+        status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    } while (status == GL_TIMEOUT_EXPIRED);
+    if (status == GL_WAIT_FAILED) {
+        fprintf(stderr, ERROR_ALERT "Failed to wait for the frame ring's fence.\n");
+        exit(EXIT_FAILURE);
+    }
+    glDeleteSync(fence);
+    g_ring_fences[g_ring_frame] = NULL;
+}
+
+// Take size bytes from the current region, giving the offset into the buffer, or return false if the region is full.
+static bool ring_alloc(size_t size, uint32_t *offset)
+{
+    size_t region_size = GM_FRAME_RING_SIZE / GM_FRAME_RING_FRAMES;
+    size_t position = (g_ring_position + GM_FRAME_RING_ALIGNMENT - 1) & ~((size_t) GM_FRAME_RING_ALIGNMENT - 1);
+    if (position + size > region_size) return false;
+    *offset = g_ring_frame * region_size + position;
+    g_ring_position = position + size;
+    return true;
+}
+
+static GLuint ring_vertex_array(VertexFormat vertex_format)
+{
+    for (int i = 0; i < g_ring_num_vertex_arrays; i++) {
+        if (g_ring_vertex_arrays[i].vertex_format == vertex_format) return g_ring_vertex_arrays[i].vao_id;
+    }
+    if (g_ring_num_vertex_arrays == GM_FRAME_RING_MAX_VERTEX_FORMATS) {
+        fprintf(stderr, ERROR_ALERT "Too many vertex formats have been used for frame geometry.\n");
+        exit(EXIT_FAILURE);
+    }
+    GLuint vao_id;
+    glGenVertexArrays(1, &vao_id);
+    glBindVertexArray(vao_id);
+    for (int i = 0; i < NUM_ATTRIBUTE_TYPES; i++) {
+        if (vertex_format & (1 << i)) {
+            // Attribute i is fed from binding i, which is given a buffer range when drawing.
+            glVertexAttribFormat(i, g_attribute_info[i].gl_size, g_attribute_info[i].gl_type, GL_FALSE, 0);
+            glVertexAttribBinding(i, i);
+            glEnableVertexAttribArray(i);
+        }
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_ring_buffer);
+    g_ring_vertex_arrays[g_ring_num_vertex_arrays].vertex_format = vertex_format;
+    g_ring_vertex_arrays[g_ring_num_vertex_arrays].vao_id = vao_id;
+    g_ring_num_vertex_arrays ++;
+    return vao_id;
+}
+
+Geometry gm_done_frame(void)
+{
+    if (!g_ring_initialized) ring_init();
+    if (!g_ring_available) return gm_done();
+    int last_count = gm_done_check();
+    ring_wait();
+
+    size_t start_position = g_ring_position;
+    bool fits = true;
+    for (int i = 0; i < NUM_ATTRIBUTE_TYPES; i++) {
+        if (g_geometry.vertex_format & (1 << i)) {
+            fits = fits && ring_alloc(g_gm_attribute_positions[i], &g_geometry.attribute_offsets[i]);
+        }
+    }
+    if (g_geometry.is_indexed) fits = fits && ring_alloc(sizeof(uint32_t)*g_gm_index_count, &g_geometry.indices_offset);
+    if (!fits) {
+        // This frame has used up its region, so fall back to buffers of its own.
+        g_ring_position = start_position;
+        memset(g_geometry.attribute_offsets, 0, sizeof(g_geometry.attribute_offsets));
+        g_geometry.indices_offset = 0;
+        return gm_done();
+    }
+    for (int i = 0; i < NUM_ATTRIBUTE_TYPES; i++) {
+        if (g_geometry.vertex_format & (1 << i)) {
+            memcpy(g_ring_mapping + g_geometry.attribute_offsets[i], g_gm_attribute_buffers[i], g_gm_attribute_positions[i]);
+        }
+    }
+    if (g_geometry.is_indexed) memcpy(g_ring_mapping + g_geometry.indices_offset, g_gm_index_buffer, sizeof(uint32_t)*g_gm_index_count);
+
+    g_geometry.transient = true;
+    g_geometry.vao_id = ring_vertex_array(g_geometry.vertex_format);
+    g_geometry.indices_id = g_ring_buffer;
+    g_geometry.num_indices = g_gm_index_count;
+    g_geometry.num_vertices = last_count;
+    g_gm_specifying = false;
+
+    return g_geometry;
+}
+
+void gm_frame_end(void)
+{
+    if (!g_ring_available || g_ring_position == 0) return;
+    g_ring_fences[g_ring_frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    g_ring_frame = (g_ring_frame + 1) % GM_FRAME_RING_FRAMES;
+    g_ring_position = 0;
+}
+
 
 //--move to materials
+// Bind a texture to a unit, unless the draw state says it is already there.
+static void bind_texture_unit(int unit, GLuint texture_id, GMDrawState *state)
+{
+    if (state != NULL && unit < GM_DRAW_STATE_MAX_TEXTURE_UNITS) {
+        if (state->textures[unit] == texture_id) return;
+        state->textures[unit] = texture_id;
+    }
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+}
+
 // prepare the material for rendering
 void material_prepare(Material *material)
+{
+    material_prepare_state(material, NULL);
+}
+void material_prepare_state(Material *material, GMDrawState *state)
 {
     MaterialType *mt = resource_data(MaterialType, material->material_type);
-    glUseProgram(mt->program_id);
+    material_prepare_program_state(material, mt->program_id, state);
+}
+// The program is either the material type's program or its instanced variant, which share textures and shader blocks.
+void material_prepare_program_state(Material *material, GLuint program_id, GMDrawState *state)
+{
+    MaterialType *mt = resource_data(MaterialType, material->material_type);
+    if (state == NULL || state->program != program_id) {
+        glUseProgram(program_id);
+        if (state != NULL) state->program = program_id;
+    }
 
     // Bind the textures
     for (int i = 0; i < mt->num_textures; i++) {
-        glActiveTexture(GL_TEXTURE0 + i + g_num_reserved_samplers); // Shift up a certain amount according to the number of shaderblock-defined samplers taking up texture units.
-        glBindTexture(GL_TEXTURE_2D, resource_data(Texture, material->textures[i])->texture_id);
+        // Shift up a certain amount according to the number of shaderblock-defined samplers taking up texture units.
+        bind_texture_unit(i + g_num_reserved_samplers, resource_data(Texture, material->textures[i])->texture_id, state);
     }
-    // Prepare the material properties, if there are any.
-    if (material->properties != NULL) {
+    // Prepare the material properties, if there are any. If this material's properties were the last copied in, they are still there.
+    if (material->properties != NULL && (state == NULL || state->material != material)) {
         memcpy(g_shader_blocks[ShaderBlockID_MaterialProperties].shader_block, material->properties, mt->properties_size);
         g_shader_blocks[ShaderBlockID_MaterialProperties].dirty = true; //setting this explicitly since this is not using the macro syntax for accessing entries of the block.
+        if (state != NULL) state->material = material;
     }
     synchronize_shader_blocks();
 
@@ -452,8 +842,7 @@ void material_prepare(Material *material)
         ShaderBlockInfo *block_info = &g_shader_blocks[mt->shader_blocks[i]];
         for (int j = 0; j < block_info->num_samplers; j++) {
             int sampler_index = block_info->samplers_start_index + j;
-            glActiveTexture(GL_TEXTURE0 + sampler_index);
-            glBindTexture(GL_TEXTURE_2D, block_info->samplers[j]);
+            bind_texture_unit(sampler_index, block_info->samplers[j], state);
         }
     }
 }
@@ -461,14 +850,20 @@ void material_prepare(Material *material)
 // Rendering a Geometry+Material pair.
 void gm_draw(Geometry geometry, Material *material)
 {
-    // Check that the vertex formats are compatible, that is, there are no attributes required by the material that the geometry doesn't have.
-    MaterialType *mt = resource_data(MaterialType, material->material_type);
-    if ((mt->vertex_format & ~geometry.vertex_format) != 0)  {
-        fprintf(stderr, ERROR_ALERT "Attempted to render geometry which does not have enough of the required attributes for the material it is being rendered with.\n");
-        exit(EXIT_FAILURE);
-    }
+    gm_draw_state(geometry, material, NULL);
+}
+
+void gm_draw_state_reset(GMDrawState *state)
+{
+    // Zero is a valid binding, so mark everything as unknown.
+    state->program = (GLuint) -1;
+    state->vao = (GLuint) -1;
+    state->material = NULL;
+    for (int i = 0; i < GM_DRAW_STATE_MAX_TEXTURE_UNITS; i++) state->textures[i] = (GLuint) -1;
+}
 
-    material_prepare(material);
+static GLenum gm_primitive_type(Geometry geometry, MaterialType *mt)
+{
     GLenum gl_primitive_type;
 
     if (mt->force_patches) {
@@ -491,21 +886,86 @@ void gm_draw(Geometry geometry, Material *material)
                 exit(EXIT_FAILURE);
         }
     }
-    glBindVertexArray(geometry.vao_id);
+    return gl_primitive_type;
+}
+
+static void gm_bind_vertex_array(Geometry geometry, GMDrawState *state)
+{
+    // The element buffer binding is part of the vertex array's state, so neither need rebinding for the same geometry.
+    if (state == NULL || state->vao != geometry.vao_id) {
+        glBindVertexArray(geometry.vao_id);
+        if (geometry.is_indexed) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geometry.indices_id);
+        if (state != NULL) state->vao = geometry.vao_id;
+    }
+    // Frame geometry shares its vertex array with the rest of its vertex format, so its data is pointed to on each draw.
+    if (geometry.transient) {
+        for (int i = 0; i < NUM_ATTRIBUTE_TYPES; i++) {
+            if (geometry.vertex_format & (1 << i)) {
+                glBindVertexBuffer(i, g_ring_buffer, geometry.attribute_offsets[i], attribute_width(i));
+            }
+        }
+    }
+}
+
+void gm_draw_state(Geometry geometry, Material *material, GMDrawState *state)
+{
+    // Check that the vertex formats are compatible, that is, there are no attributes required by the material that the geometry doesn't have.
+    MaterialType *mt = resource_data(MaterialType, material->material_type);
+    if ((mt->vertex_format & ~geometry.vertex_format) != 0)  {
+        fprintf(stderr, ERROR_ALERT "Attempted to render geometry which does not have enough of the required attributes for the material it is being rendered with.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    material_prepare_state(material, state);
+    GLenum gl_primitive_type = gm_primitive_type(geometry, mt);
+    gm_bind_vertex_array(geometry, state);
     if (geometry.is_indexed) {
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geometry.indices_id);
-        glDrawElements(gl_primitive_type, geometry.num_indices, GL_UNSIGNED_INT, (void *) 0);
+        glDrawElements(gl_primitive_type, geometry.num_indices, GL_UNSIGNED_INT, (void *) (uintptr_t) geometry.indices_offset);
     } else {
         glDrawArrays(gl_primitive_type, 0, geometry.num_vertices);
     }
 }
 
+void gm_draw_instanced_state(Geometry geometry, Material *material, GLuint instance_buffer, int base_instance, int num_instances, GMDrawState *state)
+{
+    MaterialType *mt = resource_data(MaterialType, material->material_type);
+    if ((mt->vertex_format & ~geometry.vertex_format) != 0)  {
+        fprintf(stderr, ERROR_ALERT "Attempted to render geometry which does not have enough of the required attributes for the material it is being rendered with.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (mt->instanced_program_id == 0) {
+        fprintf(stderr, ERROR_ALERT "Attempted to draw instances with a material type which has no instanced_vertex_shader.\n");
+        exit(EXIT_FAILURE);
+    }
+    material_prepare_program_state(material, mt->instanced_program_id, state);
+    GLenum gl_primitive_type = gm_primitive_type(geometry, mt);
+    gm_bind_vertex_array(geometry, state);
+    // Point the four columns of the per-instance matrix at the instance buffer. The pointers start at the start of the buffer,
+    // and the base instance offsets them, so this is the same for every run of instances in the buffer.
+    glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+    for (int i = 0; i < 4; i++) {
+        glVertexAttribPointer(INSTANCE_MATRIX_ATTRIBUTE_LOCATION + i, 4, GL_FLOAT, GL_FALSE, sizeof(mat4x4), (void *) (i * sizeof(vec4)));
+        glVertexAttribDivisor(INSTANCE_MATRIX_ATTRIBUTE_LOCATION + i, 1);
+        glEnableVertexAttribArray(INSTANCE_MATRIX_ATTRIBUTE_LOCATION + i);
+    }
+    if (geometry.is_indexed) {
+        glDrawElementsInstancedBaseInstance(gl_primitive_type, geometry.num_indices, GL_UNSIGNED_INT, (void *) (uintptr_t) geometry.indices_offset, num_instances, base_instance);
+    } else {
+        glDrawArraysInstancedBaseInstance(gl_primitive_type, 0, geometry.num_vertices, num_instances, base_instance);
+    }
+    // The arrays were enabled on the geometry's own vertex array (shared by all frame geometry of its format), so disable
+    // them again, or later non-instanced draws would carry arrays pointing into an instance buffer which can since have
+    // been reallocated or deleted.
+    for (int i = 0; i < 4; i++) glDisableVertexAttribArray(INSTANCE_MATRIX_ATTRIBUTE_LOCATION + i);
+}
+
 // Destroying the geometry (freeing the vram buffers).
 void gm_free(Geometry geometry)
 {
-    // --- Since this is called for each transient draw, maybe it would be better
-    // --- to just allocate an ID for every attribute type, and free them all at once, to reduce
-    // --- the number of API calls.
+    // Frame geometry is in the frame ring, which is reused rather than freed.
+    if (geometry.transient) return;
+    glDeleteVertexArrays(1, &geometry.vao_id);
+    glDeleteBuffers(1, &geometry.vertex_buffer_id); // Only quantized geometry has an interleaved buffer.
     if (geometry.is_indexed) {
         glDeleteBuffers(1, &geometry.indices_id);
     }
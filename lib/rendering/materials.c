@@ -54,6 +54,62 @@ Text-file format:
      texture{i}: <string>, the name of this texture
          ...
 --------------------------------------------------------------------------------*/
+// Bind a material type's textures and shader blocks to a linked program using it (either the main program or the instanced variant).
+// The program must be in use.
+static bool bind_program_interface(MaterialType *mt, GLuint program_id)
+{
+    for (int i = 0; i < mt->num_textures; i++) {
+        // Bind this texture in the program to the binding point.
+        GLint texture_location = glGetUniformLocation(program_id, mt->texture_names[i]);
+        // if (texture_location < 0) {
+        //     // ----Since a sampler in glsl is a loose uniform variable, maybe it could be optimized out. -1 being passed to texture functions
+        //     // fails silently, so it might be fine to not give a load error here.
+        //     load_error("Could not find sampler in linked program.");
+        // }
+        glUniform1i(texture_location, i + g_num_reserved_samplers); // Offset this to account for reserved texture units, such as for shadow maps.
+    }
+    for (int i = 0; i < mt->num_blocks; i++) {
+        ShaderBlockID block_id = mt->shader_blocks[i];
+        char *block = g_shader_blocks[block_id].name;
+        // Bind the block to the linked program.
+        GLuint block_index = glGetUniformBlockIndex(program_id, block);
+        if (block_index == GL_INVALID_INDEX) {
+            // Hopefully the glsl compiler does not optimize away entire std140 uniform blocks.
+            // (It appears that it doesn't.)
+            return false;
+        }
+        glUniformBlockBinding(program_id, block_index, block_id);
+        // The block id is both index into the global block info array, and the binding point.
+        glBindBufferBase(GL_UNIFORM_BUFFER, block_id, g_shader_blocks[block_id].vram_buffer_id);
+#if 1
+        // Bind the global samplers of this shader block to their reserved binding points.
+        int num_samplers = g_shader_blocks[block_id].num_samplers;
+        char **sampler_names = g_shader_blocks[block_id].sampler_names;
+        for (int j = 0; j < num_samplers; j++) {
+            int sampler_index = g_shader_blocks[block_id].samplers_start_index + j;
+            GLint location = glGetUniformLocation(program_id, sampler_names[j]);
+            //---uncomment for debugging.
+            //printf("In material type %s\n", path);
+            //printf("Looking for sampler %s\n", sampler_names[j]);
+            //printf("Binding to location %d\n", sampler_index);
+            //getchar();
+            // If the sampler isn't found, then it has probably been optimized out since it is unused. Just skip it.
+            // printf("mt: %s\n", path);
+            // if (location < 0) {
+            //     printf("could not find %s\n", sampler_names[j]);
+            //     getchar();
+            // }
+            if (location < 0) continue;
+            // printf("mt: %s\n", path);
+            // printf("setting %s to %d\n", sampler_names[j], sampler_index);
+            // getchar();
+            glUniform1i(location, sampler_index); // Bind this uniform sampler location in the material-type's shader program to this global reserved index.
+        }
+#endif
+    }
+    return true;
+}
+
 void MaterialType_load(void *resource, char *path)
 {
     MaterialType mt = {0};
@@ -120,14 +176,6 @@ void MaterialType_load(void *resource, char *path)
         if (!dd_get(dd, texture_token, "string", &texture)) load_error("Not all declared textures have been given.");
         if (strlen(texture) >= MATERIAL_MAX_TEXTURE_NAME_LENGTH) load_error("Texture name too long.");
         strncpy(mt.texture_names[i], texture, MATERIAL_MAX_TEXTURE_NAME_LENGTH);
-        // Bind this texture in the program to the binding point.
-        GLint texture_location = glGetUniformLocation(mt.program_id, texture);
-        // if (texture_location < 0) {
-        //     // ----Since a sampler in glsl is a loose uniform variable, maybe it could be optimized out. -1 being passed to texture functions
-        //     // fails silently, so it might be fine to not give a load error here.
-        //     load_error("Could not find sampler in linked program.");
-        // }
-        glUniform1i(texture_location, i + g_num_reserved_samplers); // Offset this to account for reserved texture units, such as for shadow maps.
     }
 
     // Collect shader-block information and bind their backing buffers to the linked program.
@@ -144,41 +192,30 @@ void MaterialType_load(void *resource, char *path)
         ShaderBlockID block_id = get_shader_block_id(block);
         if (block_id < 0) load_error("Unsupported shader block.");
         mt.shader_blocks[i] = block_id;
-        // Bind the block to the linked program.
-        GLuint block_index = glGetUniformBlockIndex(mt.program_id, block);
-        if (block_index == GL_INVALID_INDEX) {
-            // Hopefully the glsl compiler does not optimize away entire std140 uniform blocks.
-            // (It appears that it doesn't.)
-            load_error("Could not find uniform block.");
+    }
+    // Bind the textures and shader blocks to the linked program.
+    if (!bind_program_interface(&mt, mt.program_id)) load_error("Could not find uniform block.");
+
+    // A material type can give a vertex shader variant which takes a per-instance model matrix (at INSTANCE_MATRIX_ATTRIBUTE_LOCATION)
+    // instead of the Standard3D model and mvp matrices. Bodies sharing geometry and material can then be drawn with one instanced draw call.
+    char *instanced_vertex_shader;
+    if (dd_get(dd, "instanced_vertex_shader", "string", &instanced_vertex_shader)) {
+        mt.instanced_vertex_shader = new_resource_handle(Shader, instanced_vertex_shader);
+        mt.instanced_program_id = glCreateProgram();
+        glAttachShader(mt.instanced_program_id, resource_data(Shader, mt.instanced_vertex_shader)->shader_id);
+        for (int i = 0; i < NUM_SHADER_TYPES; i++) {
+            if (i == Vertex || (mt.program_type & (1 << i)) == 0) continue;
+            glAttachShader(mt.instanced_program_id, resource_data(Shader, mt.shaders[i])->shader_id);
         }
-        glUniformBlockBinding(mt.program_id, block_index, block_id);
-        // The block id is both index into the global block info array, and the binding point.
-        glBindBufferBase(GL_UNIFORM_BUFFER, block_id, g_shader_blocks[block_id].vram_buffer_id);
-#if 1
-        // Bind the global samplers of this shader block to their reserved binding points.
-        int num_samplers = g_shader_blocks[block_id].num_samplers;
-        char **sampler_names = g_shader_blocks[block_id].sampler_names;
-        for (int i = 0; i < num_samplers; i++) {
-            int sampler_index = g_shader_blocks[block_id].samplers_start_index + i;
-            GLint location = glGetUniformLocation(mt.program_id, sampler_names[i]);
-            //---uncomment for debugging.
-            //printf("In material type %s\n", path);
-            //printf("Looking for sampler %s\n", sampler_names[i]);
-            //printf("Binding to location %d\n", sampler_index);
-            //getchar();
-            // If the sampler isn't found, then it has probably been optimized out since it is unused. Just skip it.
-            // printf("mt: %s\n", path);
-            // if (location < 0) {
-            //     printf("could not find %s\n", sampler_names[i]);
-            //     getchar();
-            // }
-            if (location < 0) continue;
-            // printf("mt: %s\n", path);
-            // printf("setting %s to %d\n", sampler_names[i], sampler_index);
-            // getchar();
-            glUniform1i(location, sampler_index); // Bind this uniform sampler location in the material-type's shader program to this global reserved index.
+        link_shader_program(mt.instanced_program_id);
+        glDetachShader(mt.instanced_program_id, resource_data(Shader, mt.instanced_vertex_shader)->shader_id);
+        for (int i = 0; i < NUM_SHADER_TYPES; i++) {
+            if (i == Vertex || (mt.program_type & (1 << i)) == 0) continue;
+            glDetachShader(mt.instanced_program_id, resource_data(Shader, mt.shaders[i])->shader_id);
         }
-#endif
+        glUseProgram(mt.instanced_program_id);
+        if (!bind_program_interface(&mt, mt.instanced_program_id)) load_error("Could not find uniform block in the instanced program.");
+        glUseProgram(mt.program_id);
     }
 
     // There is a special shader block, MaterialProperties, which is the per-material-instance interface to the parameters
@@ -236,6 +273,7 @@ void MaterialType_load(void *resource, char *path)
     
     // Unbind the program.
     glUseProgram(0);
+    dd_close(dd);
     // Successfully filled the MaterialType.
     MaterialType *out_material_type = (MaterialType *) resource;
     memcpy(out_material_type, &mt, sizeof(MaterialType));
@@ -319,10 +357,12 @@ void Material_load(void *resource, char *path)
             #undef set
             if (!dd_get(properties, info->name, type, material.properties + info->offset)) load_error("Failed to read material proeprty.");
         }
+        dd_close(properties);
     } else {
         // If there is no material properties block, the size is zero. So, do not allocate memory for properties.
         material.properties = NULL;
     }
+    dd_close(dd);
     printf("Finished loading file-backed material instance from path %s\n", path);
 
     Material *out_material = (Material *) resource;
@@ -390,6 +430,36 @@ void material_set_property_vec4(Material *material, char *property_name, vec4 v)
     ___material_set_property(material, property_name, (void *) &v, sizeof(vec4));
 }
 
+// Two materials are equivalent if drawing with one binds the same things as drawing with the other. Bodies usually
+// have their own material instance, so this is what instanced drawing groups by.
+bool material_equivalent(Material *a, Material *b)
+{
+    if (a == b) return true;
+    MaterialType *mt = resource_data(MaterialType, a->material_type);
+    if (mt != resource_data(MaterialType, b->material_type)) return false;
+    for (int i = 0; i < mt->num_textures; i++) {
+        if (resource_data(Texture, a->textures[i])->texture_id != resource_data(Texture, b->textures[i])->texture_id) return false;
+    }
+    if ((a->properties == NULL) != (b->properties == NULL)) return false;
+    return a->properties == NULL || memcmp(a->properties, b->properties, mt->properties_size) == 0;
+}
+// A hash consistent with material_equivalent (FNV-1a over the material type, texture objects, and properties).
+uint32_t material_hash(Material *material)
+{
+    MaterialType *mt = resource_data(MaterialType, material->material_type);
+    uint32_t hash = 2166136261u;
+#define hash_bytes(DATA,SIZE)\
+    for (size_t ___i = 0; ___i < (SIZE); ___i++) hash = (hash ^ ((uint8_t *) (DATA))[___i]) * 16777619u;
+    hash_bytes(&mt, sizeof(mt));
+    for (int i = 0; i < mt->num_textures; i++) {
+        GLuint texture_id = resource_data(Texture, material->textures[i])->texture_id;
+        hash_bytes(&texture_id, sizeof(texture_id));
+    }
+    if (material->properties != NULL) hash_bytes(material->properties, mt->properties_size);
+#undef hash_bytes
+    return hash;
+}
+
 void material_set_texture_path(Material *material, char *texture_name, char *texture_resource_path)
 {
     // Convenience function, because a resource handle need not be backed by a path.
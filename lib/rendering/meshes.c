@@ -5,6 +5,7 @@ This module consists of
     - Functions to load meshes from asset files into a MeshData struct.
     - A function, upload_mesh, to upload the MeshData to vram and return a Geometry object.
       Underyling this are the usual geometry-specification calls.
+    - upload_mesh_quantized, which uploads the MeshData interleaved and packed, for large meshes.
 --------------------------------------------------------------------------------*/
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -163,6 +164,7 @@ void MeshData_calculate_uv_orthographic(MeshData *mesh_data, vec3 direction, flo
 
 void load_mesh_ply(MeshData *mesh, VertexFormat vertex_format, FILE *file)
 {
+    // All of the queries are answered in one pass over the file, decoding straight into the MeshData arrays.
     memset(mesh, 0, sizeof(MeshData));
     mesh->vertex_format = vertex_format;
 
@@ -172,95 +174,79 @@ void load_mesh_ply(MeshData *mesh, VertexFormat vertex_format, FILE *file)
         fprintf(stderr, ERROR_ALERT "Attempted to load PLY mesh with invalid vertex format (no position attribute).\n");
         exit(EXIT_FAILURE);
     }
+    if ((vertex_format & ~VERTEX_FORMAT_3 & ~VERTEX_FORMAT_C & ~VERTEX_FORMAT_U & ~VERTEX_FORMAT_N) != 0) {
+        fprintf(stderr, ERROR_ALERT "Attempted to extract mesh data with unsupported vertex format from PLY file.\n");
+        exit(EXIT_FAILURE);
+    }
 #define BASE_VERTEX_QUERY "VERTEX|VERTICES|vertex|vertices|position|pos|positions|point|points"
+    PLYRequest requests[5] = {0};
+    AttributeType request_attributes[5];
+    int num_requests = 0;
     
     //--------------------------------------------------------------------------------
     // Query for positions
     //--------------------------------------------------------------------------------
-    char *pos_query = "[" BASE_VERTEX_QUERY "]: \
+    request_attributes[num_requests] = ATTRIBUTE_TYPE_POSITION;
+    requests[num_requests++].query_string = "[" BASE_VERTEX_QUERY "]: \
 float X|x|xpos|x_position|posx|position_x|x_coord|coord_x, \
 float Y|y|ypos|y_position|posy|position_y|y_coord|coord_y, \
 float Z|z|zpos|z_position|posz|position_z|z_coord|coord_z";
-    int num_vertices;
-    void *pos_data = ply_get(file, ply, pos_query, &num_vertices);
-    mesh->attribute_data[ATTRIBUTE_TYPE_POSITION] = pos_data;
-    mesh->num_vertices = num_vertices;
 
     //--------------------------------------------------------------------------------
     // Query for colors
     //--------------------------------------------------------------------------------
     if ((vertex_format & VERTEX_FORMAT_C) != 0) {
-        char *color_query = "[" BASE_VERTEX_QUERY "|COLOR|COLORS|COLOUR|COLOURS|color|colors|colour|colours]: \
+        request_attributes[num_requests] = ATTRIBUTE_TYPE_COLOR;
+        requests[num_requests++].query_string = "[" BASE_VERTEX_QUERY "|COLOR|COLORS|COLOUR|COLOURS|color|colors|colour|colours]: \
 float r|red|R|RED, \
 float g|green|G|GREEN, \
 float b|blue|B|BLUE";
-        void *color_data = ply_get(file, ply, color_query, NULL);
-        mesh->attribute_data[ATTRIBUTE_TYPE_COLOR] = color_data;
     }
     
     //--------------------------------------------------------------------------------
     // Query for texture coordinates
     //--------------------------------------------------------------------------------
     if ((vertex_format & VERTEX_FORMAT_U) != 0) {
-        char *texture_coord_query = "[" BASE_VERTEX_QUERY "|TEXTURES|texcoords|TEXCOORD|texture_coordinates|UV|Uv|uv|texcoord|textures]: \
+        request_attributes[num_requests] = ATTRIBUTE_TYPE_UV;
+        requests[num_requests++].query_string = "[" BASE_VERTEX_QUERY "|TEXTURES|texcoords|TEXCOORD|texture_coordinates|UV|Uv|uv|texcoord|textures]: \
 float u|U|textureU|texU|tex_coord_u|tex_coord_U, \
 float v|V|textureV|texV|tex_coord_v|tex_coord_V";
-        void *texture_coord_data = ply_get(file, ply, texture_coord_query, NULL);
-        mesh->attribute_data[ATTRIBUTE_TYPE_UV] = texture_coord_data;
     }
 
     //--------------------------------------------------------------------------------
     // Query for normals
     //--------------------------------------------------------------------------------
     if ((vertex_format & VERTEX_FORMAT_N) != 0) {
-        char *normal_query = "[" BASE_VERTEX_QUERY "]: \
+        request_attributes[num_requests] = ATTRIBUTE_TYPE_NORMAL;
+        requests[num_requests++].query_string = "[" BASE_VERTEX_QUERY "]: \
 float nx|nX|NX|Nx|normal_x|Normal_x|Normal_X|xNormal|XNormal, \
 float ny|nY|NY|Ny|normal_y|Normal_y|Normal_Y|yNormal|YNormal, \
 float nz|nZ|NZ|Nz|normal_z|Normal_z|Normal_Z|zNormal|ZNormal";
-        void *normal_data = ply_get(file, ply, normal_query, NULL);
-        mesh->attribute_data[ATTRIBUTE_TYPE_NORMAL] = normal_data;
     }
     //--------------------------------------------------------------------------------
 
-    if ((vertex_format & ~VERTEX_FORMAT_3 & ~VERTEX_FORMAT_C & ~VERTEX_FORMAT_U & ~VERTEX_FORMAT_N) != 0) {
-        fprintf(stderr, ERROR_ALERT "Attempted to extract mesh data with unsupported vertex format from PLY file.\n");
-        exit(EXIT_FAILURE);
-    }
-    // Triangles and face data. This is queried for, then it is made sure each face has 3 vertex indices,
-    // then packs this data into the format used for meshes, with no counts (just ...|...|... etc.).
-    char *face_query = "[face|faces|triangle|triangles|tris|tri]: \
+    // Triangles and face data. Each face must have 3 vertex indices (not handling triangulation of arbitrary polygon lists),
+    // and these are packed without the counts into the format used for meshes.
+    int face_request = num_requests;
+    requests[num_requests].list_length = 3;
+    requests[num_requests++].query_string = "[face|faces|triangle|triangles|tris|tri]: \
 list int vertex_index|vertex_indices|indices|triangle_indices|tri_indices|index_list|indices_list";
-    printf("Loaded face data.\n");
-    int num_faces;
-    void *face_data = ply_get(file, ply, face_query, &num_faces);
-    size_t face_data_offset = 0;
-    size_t triangles_size = 128;
-    void *triangles = malloc(triangles_size * sizeof(uint32_t));
-    size_t triangles_offset = 0;
-    for (int i = 0; i < num_faces; i++) {
-        if (((uint32_t *) (face_data + face_data_offset))[0] != 3) {
-            // not handling triangulation of arbitrary polygon lists
-            fprintf(stderr, ERROR_ALERT "Attempted to extract face from PLY file as a triangle, it does not have 3 vertex indices.\n");
+
+    ply_get_many(file, ply, num_requests, requests);
+
+    mesh->num_vertices = requests[0].num_entries;
+    for (int i = 0; i < face_request; i++) {
+        if (requests[i].num_entries != mesh->num_vertices) {
+            fprintf(stderr, ERROR_ALERT "Vertex attributes queried from a PLY file have differing counts.\n");
             exit(EXIT_FAILURE);
         }
-        face_data_offset += sizeof(uint32_t);
-        // Now extract the three entries
-        for (int i = 0; i < 3; i++) {
-            size_t to_size = triangles_offset + sizeof(uint32_t);
-            if (to_size >= triangles_size) {
-                while (to_size >= triangles_size) triangles_size += 128;
-                triangles = (uint32_t *) realloc(triangles, triangles_size * sizeof(uint32_t));
-                mem_check(triangles);
-            }
-            memcpy(triangles + triangles_offset, face_data + face_data_offset, sizeof(uint32_t));
-            face_data_offset += sizeof(uint32_t);
-            triangles_offset = to_size;
-        }
+        AttributeType attribute = request_attributes[i];
+        mesh->attribute_data[attribute] = requests[i].data;
+        mesh->attribute_data_sizes[attribute] = mesh->num_vertices * g_attribute_info[attribute].gl_size * sizeof(float);
     }
-
-    mesh->num_triangles = num_faces;
-    mesh->triangles = (uint32_t *) triangles;
-    free(face_data); // this is not stored in the mesh
+    mesh->num_triangles = requests[face_request].num_entries;
+    mesh->triangles = (uint32_t *) requests[face_request].data;
+    destroy_ply(ply);
 #undef BASE_VERTEX_QUERY
 }
 
@@ -280,6 +266,205 @@ Geometry upload_mesh(MeshData *mesh_data)
     return gm_done();
 }
 
+/*--------------------------------------------------------------------------------
+    Quantized upload.
+--------------------------------------------------------------------------------*/
+// The packed encoding of each attribute type, in the interleaved layout.
+static const struct {
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    size_t bytes;
+} g_quantized_attribute_info[NUM_ATTRIBUTE_TYPES] = {
+    { 4, GL_UNSIGNED_SHORT, GL_TRUE, 8 }, // Position. The fourth component is padding, to keep the following attributes aligned.
+    { 4, GL_UNSIGNED_BYTE, GL_TRUE, 4 },  // Color.
+    { 2, GL_SHORT, GL_TRUE, 4 },          // Normal, octahedral.
+    { 2, GL_HALF_FLOAT, GL_FALSE, 4 },    // UV.
+    { 2, GL_SHORT, GL_TRUE, 4 },          // Tangent, octahedral.
+};
+
+size_t quantized_vertex_size(VertexFormat vertex_format)
+{
+    size_t size = 0;
+    for (int i = 0; i < NUM_ATTRIBUTE_TYPES; i++) {
+        if (vertex_format & (1 << i)) size += g_quantized_attribute_info[i].bytes;
+    }
+    return size;
+}
+
+static int16_t snorm16(float x)
+{
+    if (x < -1) x = -1;
+    if (x > 1) x = 1;
+    return (int16_t) roundf(x * 32767);
+}
+// Project a direction onto the octahedron |x|+|y|+|z| = 1, then fold the lower half out over the upper half,
+// so that it is given by the x and y of a point in the square [-1,1]^2.
+static void octahedral_encode(float *v, int16_t *out)
+{
+    float l1 = fabs(v[0]) + fabs(v[1]) + fabs(v[2]);
+    if (l1 == 0) {
+        out[0] = out[1] = 0;
+        return;
+    }
+    float x = v[0] / l1;
+    float y = v[1] / l1;
+    if (v[2] < 0) {
+        float folded_x = (1 - fabs(y)) * (x >= 0 ? 1 : -1);
+        y = (1 - fabs(x)) * (y >= 0 ? 1 : -1);
+        x = folded_x;
+    }
+    out[0] = snorm16(x);
+    out[1] = snorm16(y);
+}
+// Round to the nearest half float. Values too large become infinities.
+static uint16_t float_to_half(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(uint32_t));
+    uint16_t sign = (x >> 16) & 0x8000;
+    int exponent = (int) ((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = x & 0x7fffff;
+    if (exponent >= 31) return sign | 0x7c00;
+    if (exponent <= 0) {
+        // Subnormal, or rounded to zero.
+        if (exponent < -10) return sign;
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint16_t h = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1) h ++;
+        return sign | h;
+    }
+    uint16_t h = sign | (exponent << 10) | (mantissa >> 13);
+    // A carry out of the mantissa correctly increments the exponent.
+    if (mantissa & 0x1000) h ++;
+    return h;
+}
+
+Geometry upload_mesh_quantized(MeshData *mesh_data)
+{
+    VertexFormat vertex_format = mesh_data->vertex_format;
+    if ((vertex_format & VERTEX_FORMAT_3) == 0) {
+        fprintf(stderr, ERROR_ALERT "upload_mesh_quantized: Vertex format must contain positions.\n");
+        exit(EXIT_FAILURE);
+    }
+    Geometry geometry = {0};
+    geometry.vertex_format = vertex_format;
+    geometry.primitive_type = Triangles;
+    geometry.is_indexed = true;
+    geometry.num_vertices = mesh_data->num_vertices;
+    geometry.num_indices = 3 * mesh_data->num_triangles;
+    geometry.quantized = true;
+
+    // Quantize positions relative to the bounding box.
+    float *positions = (float *) mesh_data->attribute_data[Position];
+    vec3 box_min = new_vec3(INFINITY, INFINITY, INFINITY);
+    vec3 box_max = new_vec3(-INFINITY, -INFINITY, -INFINITY);
+    for (int i = 0; i < mesh_data->num_vertices; i++) {
+        for (int j = 0; j < 3; j++) {
+            if (positions[3*i + j] < box_min.vals[j]) box_min.vals[j] = positions[3*i + j];
+            if (positions[3*i + j] > box_max.vals[j]) box_max.vals[j] = positions[3*i + j];
+        }
+    }
+    if (mesh_data->num_vertices == 0) box_min = box_max = vec3_zero();
+    geometry.quantization_offset = box_min;
+    geometry.quantization_scale = vec3_sub(box_max, box_min);
+
+    size_t stride = quantized_vertex_size(vertex_format);
+    size_t offsets[NUM_ATTRIBUTE_TYPES] = {0};
+    size_t offset = 0;
+    for (int i = 0; i < NUM_ATTRIBUTE_TYPES; i++) {
+        if (vertex_format & (1 << i)) {
+            offsets[i] = offset;
+            offset += g_quantized_attribute_info[i].bytes;
+        }
+    }
+    uint8_t *vertices = calloc(mesh_data->num_vertices, stride);
+    mem_check(vertices);
+    for (int i = 0; i < mesh_data->num_vertices; i++) {
+        uint8_t *vertex = vertices + i * stride;
+        uint16_t position[4] = {0};
+        for (int j = 0; j < 3; j++) {
+            float extent = geometry.quantization_scale.vals[j];
+            if (extent > 0) position[j] = (uint16_t) roundf(65535 * (positions[3*i + j] - box_min.vals[j]) / extent);
+        }
+        memcpy(vertex + offsets[Position], position, sizeof(position));
+        if (vertex_format & VERTEX_FORMAT_C) {
+            float *color = &((float *) mesh_data->attribute_data[Color])[3*i];
+            uint8_t rgba[4] = {0, 0, 0, 255};
+            for (int j = 0; j < 3; j++) rgba[j] = (uint8_t) roundf(255 * (color[j] < 0 ? 0 : (color[j] > 1 ? 1 : color[j])));
+            memcpy(vertex + offsets[Color], rgba, sizeof(rgba));
+        }
+        if (vertex_format & VERTEX_FORMAT_N) {
+            int16_t normal[2];
+            octahedral_encode(&((float *) mesh_data->attribute_data[Normal])[3*i], normal);
+            memcpy(vertex + offsets[Normal], normal, sizeof(normal));
+        }
+        if (vertex_format & VERTEX_FORMAT_U) {
+            float *uv = &((float *) mesh_data->attribute_data[TexCoord])[2*i];
+            uint16_t half_uv[2] = { float_to_half(uv[0]), float_to_half(uv[1]) };
+            memcpy(vertex + offsets[TexCoord], half_uv, sizeof(half_uv));
+        }
+        if (vertex_format & VERTEX_FORMAT_T) {
+            int16_t tangent[2];
+            octahedral_encode(&((float *) mesh_data->attribute_data[Tangent])[3*i], tangent);
+            memcpy(vertex + offsets[Tangent], tangent, sizeof(tangent));
+        }
+    }
+
+    glGenVertexArrays(1, &geometry.vao_id);
+    glBindVertexArray(geometry.vao_id);
+    glGenBuffers(1, &geometry.vertex_buffer_id);
+    glBindBuffer(GL_ARRAY_BUFFER, geometry.vertex_buffer_id);
+    glBufferData(GL_ARRAY_BUFFER, mesh_data->num_vertices * stride, vertices, GL_STATIC_DRAW);
+    for (int i = 0; i < NUM_ATTRIBUTE_TYPES; i++) {
+        if (vertex_format & (1 << i)) {
+            glVertexAttribPointer(i,
+                                  g_quantized_attribute_info[i].size,
+                                  g_quantized_attribute_info[i].type,
+                                  g_quantized_attribute_info[i].normalized,
+                                  stride,
+                                  (void *) offsets[i]);
+            glEnableVertexAttribArray(i);
+        }
+    }
+    glGenBuffers(1, &geometry.indices_id);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geometry.indices_id);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, geometry.num_indices * sizeof(uint32_t), mesh_data->triangles, GL_STATIC_DRAW);
+    free(vertices);
+    return geometry;
+}
+
+/*--------------------------------------------------------------------------------
+    Ray queries.
+--------------------------------------------------------------------------------*/
+void MeshData_build_bvh(MeshData *mesh_data, TriangleBVH *bvh)
+{
+    triangle_bvh_build(bvh, mesh_data->num_vertices, (float *) mesh_data->attribute_data[Position], mesh_data->num_triangles, mesh_data->triangles);
+}
+
+bool MeshData_raycast(MeshData *mesh_data, TriangleBVH *bvh, vec3 origin, vec3 direction, MeshRayHit *hit)
+{
+    TriangleRayHit tri_hit;
+    if (!triangle_bvh_raycast(bvh, origin, direction, INFINITY, &tri_hit)) return false;
+    uint32_t *tri = &mesh_data->triangles[3*tri_hit.triangle];
+    vec3 *positions = (vec3 *) mesh_data->attribute_data[Position];
+    vec3 weights = tri_hit.barycentric;
+    hit->triangle = tri_hit.triangle;
+    hit->t = tri_hit.t;
+    hit->barycentric = weights;
+    hit->position = vec3_add(origin, vec3_mul(direction, tri_hit.t));
+    if (mesh_data->attribute_data[Normal] != NULL) {
+        vec3 *normals = (vec3 *) mesh_data->attribute_data[Normal];
+        hit->normal = vec3_normalize(vec3_add(vec3_add(vec3_mul(normals[tri[0]], X(weights)),
+                                                       vec3_mul(normals[tri[1]], Y(weights))),
+                                                       vec3_mul(normals[tri[2]], Z(weights))));
+    } else {
+        hit->normal = vec3_normalize(vec3_cross(vec3_sub(positions[tri[1]], positions[tri[0]]), vec3_sub(positions[tri[2]], positions[tri[0]])));
+    }
+    return true;
+}
+
 /*--------------------------------------------------------------------------------
     Debugging and visualization.
 --------------------------------------------------------------------------------*/
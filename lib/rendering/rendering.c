@@ -56,10 +56,18 @@ VertexFormat string_to_VertexFormat(char *string)
 void init_resources_rendering(void)
 {
     add_resource_type_no_unload(Shader);
-    add_resource_type_no_unload(Geometry);
-    add_resource_type_no_unload(Texture);
+    add_resource_type(Geometry);
+    add_resource_type(Texture);
     add_resource_type_no_unload(Font);
     add_resource_type_no_unload(MaterialType);
     add_resource_type(Material);
+
+    // Geometry and textures can be loaded in the background. While a texture is loading, a plain white one is used.
+    resource_type_async(Geometry);
+    resource_type_async(Texture);
+    resource_type_placeholder(Texture, placeholder_texture());
+    // Geometry and textures are measured by their vram usage, for memory budgets.
+    resource_type_measure(Geometry);
+    resource_type_measure(Texture);
 }
 
@@ -49,19 +49,7 @@ void Shader_load(void *resource, char *path)
     printf("created id: %d\n", shader_id);
     // Load the shader source from the physical path, and attempt to compile it.
     char shader_path_buffer[1024];
-    int i;
-    //////////////////////////////////////////////////////////////////////////////////
-    // Awful hack for looking up a resource.
-    for (i = 0; i < g_resource_path_count; i++) {
-        if (resource_file_path(path, "", shader_path_buffer, 1024, i)) {
-            FILE *fd = fopen(shader_path_buffer, "r");
-            if (fd != NULL) {
-                fclose(fd);
-                break;
-            }
-        }
-    }
-    if (i == g_resource_path_count) {
+    if (!resource_file_resolve(path, "", shader_path_buffer, 1024)) {
         fprintf(stderr, ERROR_ALERT "Failed to get shader from path \"%s\".\n", path);
         exit(EXIT_FAILURE);
         return NULL;
@@ -30,49 +30,88 @@ ResourceType Texture_RTID;
     
   =notes=
   Currently the only texture-resource support is for 2D textures with some options in RGB/RGBA/grayscale.
+  Loading is split into stages so that textures can be loaded asynchronously (see resources.h):
+    Texture_request: read the manifest.
+    Texture_prepare: decode the image (on an I/O thread).
+    Texture_upload:  upload to vram.
 --------------------------------------------------------------------------------*/
-void Texture_load(void *resource, char *path)
-{
-    #define load_error(str) { fprintf(stderr, "Texture load error: " str "\n"); exit(EXIT_FAILURE); }
+typedef struct TextureLoadJob_s {
+    char *type;
+    char *filename;
+    bool cutout;
+    bool nearest;
+    ImageData image_data;
+    void *blob; // If the image was loaded from a conditioned blob, the image data points into this mapping.
+    size_t blob_size;
+} TextureLoadJob;
 
+#define load_error(str) { fprintf(stderr, "Texture load error: " str "\n"); exit(EXIT_FAILURE); }
+void *Texture_request(char *path)
+{
     DD *dd = dd_open(g_resource_dictionary, path);
     if (dd == NULL) {
-        fprintf(ERROR_ALERT "Could not find texture \"%s\".\n", path);
+        fprintf(stderr, ERROR_ALERT "Could not find texture \"%s\".\n", path);
         exit(EXIT_FAILURE);
     }
-    ImageData image_data;
+    TextureLoadJob *job = (TextureLoadJob *) calloc(1, sizeof(TextureLoadJob));
+    mem_check(job);
+    if (!dd_get(dd, "type", "string", &job->type)) load_error("No type.");
+    if (!dd_get(dd, "path", "string", &job->filename)) load_error("No file.");
+    if (strcmp(job->type, "png") != 0) load_error("Invalid texture type.");
+    if (!dd_get(dd, "cutout", "bool", &job->cutout)) load_error("No cutout.");
+    if (!dd_get(dd, "nearest", "bool", &job->nearest)) load_error("No nearest.");
+    dd_close(dd);
+    return job;
+}
+
+static bool texture_blob_load(TextureLoadJob *job)
+{
+    // The filtering options are applied at upload, so the only thing the blob depends on is the image file.
+    job->blob = asset_blob_map(job->filename, ".Texture.image", TEXTURE_BLOB_MAGIC, asset_source_hash(job->filename, NULL, 0), &job->blob_size);
+    if (job->blob == NULL) return false;
+    TextureBlob *blob = (TextureBlob *) job->blob;
+    job->image_data.width = blob->width;
+    job->image_data.height = blob->height;
+    job->image_data.external_format = blob->external_format;
+    job->image_data.external_type = blob->external_type;
+    job->image_data.data = job->blob + blob->data_offset;
+    return true;
+}
+
+void Texture_prepare(void *_job)
+{
+    TextureLoadJob *job = (TextureLoadJob *) _job;
+    // Use the conditioned blob if there is a fresh one.
+    if (texture_blob_load(job)) return;
     // Try for a PNG file.
-    char *type;
-    char *filename;
-    if (!dd_get(dd, "type", "string", &type)) load_error("No type.");
-    if (!dd_get(dd, "path", "string", &filename)) load_error("No file.");
-    if (strcmp(type, "png") == 0) {
-        FILE *file = resource_file_open(filename, "", "rb");
+    if (strcmp(job->type, "png") == 0) {
+        FILE *file = resource_file_open(job->filename, "", "rb");
         if (file == NULL) load_error("Could not open png file.");
-        if (!load_image_png(&image_data, file)) load_error("Failed to decode png.");
+        if (!load_image_png(&job->image_data, file)) load_error("Failed to decode png.");
+        fclose(file);
     }
+}
+
+void Texture_upload(void *resource, void *_job)
+{
+    TextureLoadJob *job = (TextureLoadJob *) _job;
+    ImageData image_data = job->image_data;
+
     GLenum mag_filter = GL_LINEAR;
     GLenum min_filter = GL_LINEAR;
     GLenum texture_wrap_s = GL_REPEAT;
     GLenum texture_wrap_t = GL_REPEAT;
-    bool cutout;
-    if (!dd_get(dd, "cutout", "bool", &cutout)) load_error("No cutout.");
-    if (cutout) {
+    if (job->cutout) {
         // Removes visual artifacts when repeating a texture combined with linear interpolation, which makes opaqueness wrap around where it shouldn't.
         texture_wrap_s = GL_CLAMP_TO_EDGE;
         texture_wrap_t = GL_CLAMP_TO_EDGE;
     }
-    bool nearest;
-    if (!dd_get(dd, "nearest", "bool", &nearest)) load_error("No nearest.");
-    if (nearest) {
+    if (job->nearest) {
         // For example, low-resolution minecraft-block textures should use this flag.
         mag_filter = GL_NEAREST;
         min_filter = GL_NEAREST;
     }
 
-    // free(type);
-    // free(filename);
-
     Texture *texture = (Texture *) resource;
 
     // All texture images are being stored in internal format rgba:8,8,8,8-bit unsigned integers.
@@ -90,7 +129,8 @@ void Texture_load(void *resource, char *path)
                     image_data.data);
     // Destroy the image data.
     //-------------Organize actual destruction/tear-down functions. On-heap (destruction?) versus properties on heap (teardown, terminology?)
-    free(image_data.data);
+    if (job->blob != NULL) asset_blob_unmap(job->blob, job->blob_size);
+    else free(image_data.data);
 
     // printf("GETTING DEPTH DATA\n");
     // getchar();getchar();getchar();
@@ -107,6 +147,91 @@ void Texture_load(void *resource, char *path)
     glBindTexture(GL_TEXTURE_2D, 0);
 
     texture->texture_id = texture_id;
+    texture->width = image_data.width;
+    texture->height = image_data.height;
+
+    free(job->type);
+    free(job->filename);
+    free(job);
+}
+
+void Texture_load(void *resource, char *path)
+{
+    void *job = Texture_request(path);
+    Texture_prepare(job);
+    Texture_upload(resource, job);
+}
+
+/*--------------------------------------------------------------------------------
+Conditioning: write the decoded image to a blob next to the image file, for tools/condition_assets.
+--------------------------------------------------------------------------------*/
+bool Texture_condition(char *path)
+{
+    TextureLoadJob *job = (TextureLoadJob *) Texture_request(path);
+    Texture_prepare(job);
+    bool conditioned = false;
+    if (job->blob == NULL) {
+        ImageData *image_data = &job->image_data;
+        int num_channels = image_data->external_format == GL_RGBA ? 4 : 3; // load_image_png only gives 8-bit RGB or RGBA.
+        FILE *file = asset_blob_create(job->filename, ".Texture.image");
+        if (file == NULL) load_error("Could not create texture blob.");
+        TextureBlob blob = {0};
+        memcpy(blob.header.magic, TEXTURE_BLOB_MAGIC, strlen(TEXTURE_BLOB_MAGIC));
+        blob.header.version = ASSET_BLOB_VERSION;
+        blob.header.source_hash = asset_source_hash(job->filename, NULL, 0);
+        blob.width = image_data->width;
+        blob.height = image_data->height;
+        blob.external_format = image_data->external_format;
+        blob.external_type = image_data->external_type;
+        blob.data_offset = (sizeof(TextureBlob) + ASSET_BLOB_ALIGNMENT - 1) & ~(ASSET_BLOB_ALIGNMENT - 1);
+        blob.data_size = num_channels * image_data->width * image_data->height;
+        blob.header.size = blob.data_offset + blob.data_size;
+        fwrite(&blob, sizeof(TextureBlob), 1, file);
+        asset_blob_pad(file);
+        fwrite(image_data->data, 1, blob.data_size, file);
+        if (ftell(file) != blob.header.size) load_error("Failed to write texture blob.");
+        fclose(file);
+        free(image_data->data);
+        conditioned = true;
+    } else {
+        asset_blob_unmap(job->blob, job->blob_size);
+    }
+    free(job->type);
+    free(job->filename);
+    free(job);
+    return conditioned;
+}
+#undef load_error
+
+void Texture_unload(void *resource)
+{
+    Texture *texture = (Texture *) resource;
+    glDeleteTextures(1, &texture->texture_id);
+}
+size_t Texture_bytes(void *resource)
+{
+    // rgba8, plus about a third more for the mipmaps.
+    Texture *texture = (Texture *) resource;
+    return (4 * (size_t) texture->width * texture->height * 4) / 3;
+}
+
+// A 1x1 white texture, given in place of textures which are still loading asynchronously.
+static Texture g_placeholder_texture;
+Texture *placeholder_texture(void)
+{
+    if (g_placeholder_texture.texture_id == 0) {
+        uint8_t white[4] = { 255, 255, 255, 255 };
+        g_placeholder_texture.width = 1;
+        g_placeholder_texture.height = 1;
+        glGenTextures(1, &g_placeholder_texture.texture_id);
+        glBindTexture(GL_TEXTURE_2D, g_placeholder_texture.texture_id);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, 1, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, white);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    return &g_placeholder_texture;
 }
 
 
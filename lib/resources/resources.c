@@ -13,6 +13,9 @@ notes:
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include <dirent.h>
 #include "helper_definitions.h"
 #include "resources.h"
 #include "data_dictionary.h"
@@ -22,8 +25,10 @@ notes:
 // note: This is up to the load function for a resource. For example, a resource path may be interpreted as a physical path mapped as an asset/source file.
 //        ---unsure if this is a good idea. Maybe rather everything should be in a .dd file, which would be less annoying with .dd generation.
 DataDictionary *g_resource_dictionary = NULL;
-#define RESOURCE_TABLE_SIZE 1024
-ResourceTableEntry g_resource_table[RESOURCE_TABLE_SIZE];
+ResourceTableEntry *g_resource_table = NULL;
+uint32_t g_resource_table_size = 0;
+uint32_t g_resource_table_count = 0;
+static uint32_t g_resource_generation = 0;
 
 // Static helper functions
 // -----------------------
@@ -79,13 +84,374 @@ void ___add_resource_type(ResourceType *type_pointer, size_t size, char *name, R
     new_info->size = size;
     new_info->load = load;
     new_info->unload = unload;
+    new_info->request = NULL;
+    new_info->prepare = NULL;
+    new_info->upload = NULL;
+    new_info->placeholder = NULL;
+    new_info->bytes = NULL;
+    new_info->budget = 0;
+    new_info->bytes_resident = 0;
+    new_info->lru_first = NULL;
+    new_info->lru_last = NULL;
+    new_info->num_loads = 0;
+    new_info->num_evictions = 0;
+    new_info->num_reloads = 0;
     strncpy(new_info->name, name, MAX_RESOURCE_TYPE_NAME_LENGTH);
 }
+void ___resource_type_async(ResourceType type, ResourceRequestFunction request, ResourcePrepareFunction prepare, ResourceUploadFunction upload)
+{
+    ResourceTypeInfo *info = &g_resource_type_info[type];
+    info->request = request;
+    info->prepare = prepare;
+    info->upload = upload;
+}
 
 /*================================================================================
     Resource handles, loading, and caching.
 ================================================================================*/
 
+/*--------------------------------------------------------------------------------
+The global resource table is open-addressed, with Robin Hood insertion: an entry being inserted
+takes the slot of any entry it passes which is closer to its home slot, which then continues being
+inserted. This keeps probe lengths short and even, and lookups can stop as soon as they reach an entry
+closer to home than the probe so far.
+--------------------------------------------------------------------------------*/
+static uint32_t resource_table_home(ResourceUUID uuid)
+{
+    // The uuid is hash_crc32 of the path, which is a sum of per-character terms, so mix it before taking the low bits.
+    return hash_mix32(uuid) & (g_resource_table_size - 1);
+}
+static void resource_table_place(ResourceTableEntry entry)
+{
+    // Place an entry (with probe length already set, probably zero) in the table, displacing richer entries.
+    uint32_t index = resource_table_home(entry.uuid);
+    entry.probe_length = 0;
+    while (1) {
+        ResourceTableEntry *slot = &g_resource_table[index];
+        if (slot->uuid == 0) {
+            *slot = entry;
+            return;
+        }
+        if (slot->probe_length < entry.probe_length) {
+            ResourceTableEntry displaced = *slot;
+            *slot = entry;
+            entry = displaced;
+        }
+        entry.probe_length ++;
+        index = (index + 1) & (g_resource_table_size - 1);
+    }
+}
+static void resource_table_grow(void)
+{
+    ResourceTableEntry *old_table = g_resource_table;
+    uint32_t old_size = g_resource_table_size;
+    g_resource_table_size = old_size == 0 ? RESOURCE_TABLE_START_SIZE : 2 * old_size;
+    g_resource_table = (ResourceTableEntry *) calloc(g_resource_table_size, sizeof(ResourceTableEntry));
+    mem_check(g_resource_table);
+    // Entries keep their generations when rehashed, so handles caching their old slots will just miss and look them up again.
+    for (int i = 0; i < old_size; i++) {
+        if (old_table[i].uuid != 0) resource_table_place(old_table[i]);
+    }
+    if (old_table != NULL) free(old_table);
+}
+static int32_t resource_table_find(ResourceID id)
+{
+    // Returns the slot of the entry for this resource, or -1 if it is not in the table.
+    if (g_resource_table_size == 0) return -1;
+    uint32_t index = resource_table_home(id.uuid);
+    uint32_t probe_length = 0;
+    while (1) {
+        ResourceTableEntry *slot = &g_resource_table[index];
+        if (slot->uuid == 0 || slot->probe_length < probe_length) return -1;
+        if (slot->uuid == id.uuid && slot->type == id.type) return index;
+        probe_length ++;
+        index = (index + 1) & (g_resource_table_size - 1);
+    }
+}
+static int32_t resource_table_insert(ResourceID id, void *resource, ResourceState state)
+{
+    // Insert a new entry and return the slot it ended up in.
+    if (4 * (g_resource_table_count + 1) > 3 * g_resource_table_size) resource_table_grow();
+    ResourceTableEntry entry;
+    entry.uuid = id.uuid;
+    entry.type = id.type;
+    entry.probe_length = 0;
+    entry.generation = ++g_resource_generation;
+    entry.state = state;
+    entry.refcount = 0;
+    entry.lru = NULL;
+    entry.resource = resource;
+    resource_table_place(entry);
+    g_resource_table_count ++;
+    return resource_table_find(id);
+}
+
+static int32_t resource_table_claim(ResourceID id, ResourceState state)
+{
+    // Get an entry for a resource which is about to be loaded. If the resource has been evicted, its entry and resource structure are reused
+    // (the small memory allocator can't free anyway). The generation is renewed so that anything still caching the old slot will miss.
+    ResourceTypeInfo *resource_type = &g_resource_type_info[id.type];
+    int32_t slot = resource_table_find(id);
+    if (slot >= 0) {
+        g_resource_table[slot].generation = ++g_resource_generation;
+        g_resource_table[slot].state = state;
+        resource_type->num_reloads ++;
+        return slot;
+    }
+    return resource_table_insert(id, sma_alloc(resource_type->size), state);
+}
+
+/*--------------------------------------------------------------------------------
+Reference counting and eviction.
+Each resource type has a least-recently-used list of its unreferenced resources. A resource goes on the end of this
+list when its reference count drops to zero (or when it finishes loading with no references), and comes off it when
+a handle resolves to it again.
+--------------------------------------------------------------------------------*/
+typedef struct ResourceLRUNode_s {
+    ResourceID id;
+    struct ResourceLRUNode_s *prev;
+    struct ResourceLRUNode_s *next;
+} ResourceLRUNode;
+
+static void resource_lru_push(int32_t slot)
+{
+    ResourceTableEntry *entry = &g_resource_table[slot];
+    ResourceTypeInfo *resource_type = &g_resource_type_info[entry->type];
+    ResourceLRUNode *node = (ResourceLRUNode *) malloc(sizeof(ResourceLRUNode));
+    mem_check(node);
+    node->id.uuid = entry->uuid;
+    node->id.type = entry->type;
+    node->next = NULL;
+    node->prev = resource_type->lru_last;
+    if (resource_type->lru_last == NULL) resource_type->lru_first = node;
+    else resource_type->lru_last->next = node;
+    resource_type->lru_last = node;
+    entry->lru = node;
+}
+static void resource_lru_remove(int32_t slot)
+{
+    ResourceTableEntry *entry = &g_resource_table[slot];
+    ResourceTypeInfo *resource_type = &g_resource_type_info[entry->type];
+    ResourceLRUNode *node = entry->lru;
+    if (node->prev == NULL) resource_type->lru_first = node->next;
+    else node->prev->next = node->next;
+    if (node->next == NULL) resource_type->lru_last = node->prev;
+    else node->next->prev = node->prev;
+    free(node);
+    entry->lru = NULL;
+}
+
+static size_t resource_bytes(int32_t slot)
+{
+    ResourceTypeInfo *resource_type = &g_resource_type_info[g_resource_table[slot].type];
+    if (resource_type->bytes == NULL) return resource_type->size;
+    return resource_type->bytes(g_resource_table[slot].resource);
+}
+static void resource_loaded(int32_t slot)
+{
+    // Called when a resource has become ready.
+    ResourceTableEntry *entry = &g_resource_table[slot];
+    ResourceTypeInfo *resource_type = &g_resource_type_info[entry->type];
+    entry->state = RESOURCE_READY;
+    resource_type->num_loads ++;
+    resource_type->bytes_resident += resource_bytes(slot);
+    if (entry->refcount == 0) resource_lru_push(slot);
+}
+static void resource_handle_bind(ResourceHandle *handle, int32_t slot)
+{
+    // Cache the slot on the handle. If the handle is new to this resource, it now holds a reference.
+    ResourceTableEntry *entry = &g_resource_table[slot];
+    if (handle->_generation != entry->generation) {
+        entry->refcount ++;
+        if (entry->lru != NULL) resource_lru_remove(slot);
+    }
+    handle->_slot = slot;
+    handle->_generation = entry->generation;
+}
+static void resource_handle_release(ResourceHandle *handle)
+{
+    if (handle->_generation == 0) return; // This handle never resolved, so it holds no reference.
+    int32_t slot = resource_table_find(handle->_id);
+    if (slot < 0) return;
+    ResourceTableEntry *entry = &g_resource_table[slot];
+    if (entry->generation != handle->_generation || entry->refcount == 0) return; // (e.g. a copy of a handle that was already destroyed.)
+    entry->refcount --;
+    if (entry->refcount == 0 && entry->state == RESOURCE_READY) resource_lru_push(slot);
+}
+
+static void resource_evict(int32_t slot)
+{
+    ResourceTableEntry *entry = &g_resource_table[slot];
+    ResourceTypeInfo *resource_type = &g_resource_type_info[entry->type];
+    resource_type->bytes_resident -= resource_bytes(slot);
+    resource_lru_remove(slot);
+    // Unloading may destroy handles to other resources (e.g. a Material's textures), which may push them onto their LRU lists,
+    // but doesn't touch the table layout.
+    if (resource_type->unload != NULL) resource_type->unload(entry->resource);
+    memset(entry->resource, 0, resource_type->size);
+    entry->state = RESOURCE_UNLOADED;
+    entry->generation = ++g_resource_generation;
+    resource_type->num_evictions ++;
+}
+void resource_evict_over_budget(void)
+{
+    for (int i = 0; i < g_num_resource_types; i++) {
+        ResourceTypeInfo *resource_type = &g_resource_type_info[i];
+        if (resource_type->budget == 0) continue;
+        while (resource_type->bytes_resident > resource_type->budget && resource_type->lru_first != NULL) {
+            resource_evict(resource_table_find(resource_type->lru_first->id));
+        }
+    }
+}
+void print_resource_stats(void)
+{
+    printf("Resource table: %u/%u slots used\n", g_resource_table_count, g_resource_table_size);
+    for (int i = 0; i < g_num_resource_types; i++) {
+        ResourceTypeInfo *resource_type = &g_resource_type_info[i];
+        printf("    %s: %zu bytes resident", resource_type->name, resource_type->bytes_resident);
+        if (resource_type->budget != 0) printf(" (budget %zu)", resource_type->budget);
+        printf(", %u loads, %u evictions, %u reloads\n", resource_type->num_loads, resource_type->num_evictions, resource_type->num_reloads);
+    }
+}
+
+/*--------------------------------------------------------------------------------
+Asynchronous loading.
+A load job is created on the main thread by the resource type's request function, which can read the manifest. The job is
+pushed onto the load queue, and an I/O thread takes it and calls the prepare function, then pushes it onto the upload queue.
+The main thread pops from the upload queue in resource_upload_pending (or when it needs to wait for a resource), and
+calls the upload function, which finishes the resource and frees the type-specific job.
+The I/O threads never touch the resource table or the resource itself, only the job.
+--------------------------------------------------------------------------------*/
+bool g_resource_async = false;
+typedef struct ResourceLoadJob_s {
+    ResourceID id;
+    void *job;
+    struct ResourceLoadJob_s *next;
+} ResourceLoadJob;
+static pthread_mutex_t g_resource_load_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_resource_load_cond = PTHREAD_COND_INITIALIZER;   // Signalled when a job is put on the load queue.
+static pthread_cond_t g_resource_room_cond = PTHREAD_COND_INITIALIZER;   // Signalled when the upload queue has room.
+static pthread_cond_t g_resource_upload_cond = PTHREAD_COND_INITIALIZER; // Signalled when a job is put on the upload queue.
+static ResourceLoadJob *g_resource_load_queue = NULL;
+static ResourceLoadJob *g_resource_load_queue_last = NULL;
+static ResourceLoadJob *g_resource_upload_queue = NULL;
+static ResourceLoadJob *g_resource_upload_queue_last = NULL;
+static int g_resource_upload_queue_length = 0;
+static bool g_resource_io_threads_started = false;
+static pthread_t g_resource_io_threads[RESOURCE_NUM_IO_THREADS];
+
+static void *resource_io_thread(void *arg)
+{
+    while (1) {
+        pthread_mutex_lock(&g_resource_load_mutex);
+        while (g_resource_load_queue == NULL) pthread_cond_wait(&g_resource_load_cond, &g_resource_load_mutex);
+        ResourceLoadJob *load_job = g_resource_load_queue;
+        g_resource_load_queue = load_job->next;
+        if (g_resource_load_queue == NULL) g_resource_load_queue_last = NULL;
+        pthread_mutex_unlock(&g_resource_load_mutex);
+
+        g_resource_type_info[load_job->id.type].prepare(load_job->job);
+
+        pthread_mutex_lock(&g_resource_load_mutex);
+        while (g_resource_upload_queue_length >= RESOURCE_UPLOAD_QUEUE_SIZE) pthread_cond_wait(&g_resource_room_cond, &g_resource_load_mutex);
+        load_job->next = NULL;
+        if (g_resource_upload_queue_last == NULL) g_resource_upload_queue = load_job;
+        else g_resource_upload_queue_last->next = load_job;
+        g_resource_upload_queue_last = load_job;
+        g_resource_upload_queue_length ++;
+        pthread_cond_signal(&g_resource_upload_cond);
+        pthread_mutex_unlock(&g_resource_load_mutex);
+    }
+    return NULL;
+}
+
+static void resource_load_async(ResourceHandle *handle)
+{
+    // Start loading a resource which is not in the table (or has been evicted).
+    ResourceTypeInfo *resource_type = &g_resource_type_info[handle->_id.type];
+    if (!g_resource_io_threads_started) {
+        for (int i = 0; i < RESOURCE_NUM_IO_THREADS; i++) {
+            if (pthread_create(&g_resource_io_threads[i], NULL, resource_io_thread, NULL) != 0) {
+                fprintf(stderr, ERROR_ALERT "Failed to create resource I/O thread.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        g_resource_io_threads_started = true;
+    }
+    ResourceLoadJob *load_job = (ResourceLoadJob *) malloc(sizeof(ResourceLoadJob));
+    mem_check(load_job);
+    load_job->id = handle->_id;
+    load_job->job = resource_type->request(handle->data.path);
+    load_job->next = NULL;
+    // The resource structure is allocated now, but it is not filled until the upload. The entry is marked as loading,
+    // so nothing gets the resource until then.
+    resource_table_claim(handle->_id, RESOURCE_LOADING);
+
+    pthread_mutex_lock(&g_resource_load_mutex);
+    if (g_resource_load_queue_last == NULL) g_resource_load_queue = load_job;
+    else g_resource_load_queue_last->next = load_job;
+    g_resource_load_queue_last = load_job;
+    pthread_cond_signal(&g_resource_load_cond);
+    pthread_mutex_unlock(&g_resource_load_mutex);
+}
+
+static ResourceLoadJob *resource_pop_upload(bool wait)
+{
+    pthread_mutex_lock(&g_resource_load_mutex);
+    if (wait) {
+        while (g_resource_upload_queue == NULL) pthread_cond_wait(&g_resource_upload_cond, &g_resource_load_mutex);
+    }
+    ResourceLoadJob *load_job = g_resource_upload_queue;
+    if (load_job != NULL) {
+        g_resource_upload_queue = load_job->next;
+        if (g_resource_upload_queue == NULL) g_resource_upload_queue_last = NULL;
+        g_resource_upload_queue_length --;
+        pthread_cond_signal(&g_resource_room_cond);
+    }
+    pthread_mutex_unlock(&g_resource_load_mutex);
+    return load_job;
+}
+static void resource_finish_load(ResourceLoadJob *load_job)
+{
+    int32_t slot = resource_table_find(load_job->id);
+    if (slot < 0) {
+        fprintf(stderr, ERROR_ALERT "Finished loading a resource which is not in the resource table.\n");
+        exit(EXIT_FAILURE);
+    }
+    // The upload may dereference other resources, so the entry may move. Find it again afterward.
+    g_resource_type_info[load_job->id.type].upload(g_resource_table[slot].resource, load_job->job);
+    resource_loaded(resource_table_find(load_job->id));
+    free(load_job);
+}
+
+static double resource_clock(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+void resource_upload_pending(double budget_seconds)
+{
+    // Called once a frame on the main thread. At least one upload is done if there are any, so loading always progresses.
+    double start = resource_clock();
+    ResourceLoadJob *load_job;
+    while ((load_job = resource_pop_upload(false)) != NULL) {
+        resource_finish_load(load_job);
+        if (resource_clock() - start >= budget_seconds) break;
+    }
+}
+
+static int32_t resource_wait(ResourceID id)
+{
+    // Block until a loading resource is ready, doing uploads (for whatever resources) in the meantime. Returns the resource's slot.
+    // The main thread keeps draining the upload queue, so the I/O threads can't get stuck waiting for room.
+    while (1) {
+        int32_t slot = resource_table_find(id);
+        if (g_resource_table[slot].state == RESOURCE_READY) return slot;
+        resource_finish_load(resource_pop_upload(true));
+    }
+}
+
 ResourceHandle ___new_resource_handle(ResourceType resource_type, char *path)
 {
     // path-backed resource
@@ -93,6 +459,8 @@ ResourceHandle ___new_resource_handle(ResourceType resource_type, char *path)
     resource_handle.path_backed = true;
     resource_handle._id = null_resource_id();
     resource_handle._id.type = resource_type;
+    resource_handle._slot = 0;
+    resource_handle._generation = 0;
     resource_handle.data.path = (char *) malloc((strlen(path) + 1) * sizeof(char));
     mem_check(resource_handle.data.path);
     strcpy(resource_handle.data.path, path);
@@ -102,6 +470,7 @@ ResourceHandle ___new_resource_handle(ResourceType resource_type, char *path)
 void destroy_resource_handle(ResourceHandle *handle)
 {
     if (handle->path_backed) {
+        resource_handle_release(handle);
         // Free the path string from the heap.
         if (handle->data.path != NULL) free(handle->data.path);
     } else {
@@ -122,6 +491,8 @@ void *___oneoff_resource(ResourceType resource_type, ResourceHandle *handle)
     handle->path_backed = false;
     handle->_id = null_resource_id();
     handle->_id.type = resource_type;
+    handle->_slot = 0;
+    handle->_generation = 0;
     handle->data.resource = calloc(1, g_resource_type_info[resource_type].size);
     mem_check(handle->data.resource);
     return handle->data.resource;
@@ -129,45 +500,80 @@ void *___oneoff_resource(ResourceType resource_type, ResourceHandle *handle)
 void *___resource_data(ResourceHandle *handle)
 {
     if (!handle->path_backed) return handle->data.resource;
+    // The common case. The handle has been resolved before, and its resource has not moved since.
+    // The generation is unique to a load, so if the slot holds the same generation it holds the same resource.
+    // (Handles only cache their slot once the resource is ready.)
+    if (handle->_generation != 0 && g_resource_table[handle->_slot].generation == handle->_generation) {
+        return g_resource_table[handle->_slot].resource;
+    }
     // printf("Getting resource data from path %s...\n", handle->data.path);
     // printf("Handle:\n\tuuid: %u\n\ttype: %d\n", handle->_id.uuid, handle->_id.type);
-
-    // note: Really this is "checking_entry" while the loop is running.
-    ResourceTableEntry *new_entry = &g_resource_table[handle->_id.uuid % RESOURCE_TABLE_SIZE];
-                                                    // At the end of search, if the resource wasn't found cached, this will be left as a pointer to fill with the new loaded entry.
-                                                    // This complication is here since a new entry can be added either straight in the table, or at the end of one of the chains.
+    ResourceTypeInfo *resource_type = &g_resource_type_info[handle->_id.type];
 
     #if 1 // set to 0  to force reload (and probably crash).
-    if (new_entry->uuid != 0) {
-        while (1) {
-            if (new_entry->uuid == handle->_id.uuid) {
-                // The point of this. Resource loading and unloading should be very rare compared to references to the resource,
-                // so that should be a constant (-except chaining) fast lookup, yet still trigger a resource load if needed, unknown to the caller.
-                // printf("Resource found cached.\n");
-                return new_entry->resource;
-            }
-            if (new_entry->next == NULL) {
-                // The end of the chain was reached, and no cached resource was found. Allocate a new entry and attach it to the end of the chain.
-                new_entry->next = (ResourceTableEntry *) sma_alloc(sizeof(ResourceTableEntry)); // Using the small memory allocator here as well, to store the chains of the hash table.
-                new_entry = new_entry->next;
-                break;
-            }
-            new_entry = new_entry->next;
-        }
+    int32_t slot = resource_table_find(handle->_id);
+    if (slot >= 0 && g_resource_table[slot].state == RESOURCE_READY) {
+        // The point of this. Resource loading and unloading should be very rare compared to references to the resource,
+        // so that should be a constant fast lookup, yet still trigger a resource load if needed, unknown to the caller.
+        // printf("Resource found cached.\n");
+        resource_handle_bind(handle, slot);
+        return g_resource_table[slot].resource;
+    }
+    if (slot >= 0 && g_resource_table[slot].state == RESOURCE_LOADING) {
+        if (resource_type->placeholder != NULL) return resource_type->placeholder;
+        slot = resource_wait(handle->_id);
+        resource_handle_bind(handle, slot);
+        return g_resource_table[slot].resource;
     }
     #endif
+    // The resource is not loaded (it may never have been, or it may have been evicted).
+    if (g_resource_async && resource_type->request != NULL) {
+        resource_load_async(handle);
+        if (resource_type->placeholder != NULL) return resource_type->placeholder;
+        slot = resource_wait(handle->_id);
+        resource_handle_bind(handle, slot);
+        return g_resource_table[slot].resource;
+    }
     // printf("Resource not cached, loading ...\n");
-    // The resource is not cached. Load it and cache it.
-    ResourceTypeInfo *resource_type = &g_resource_type_info[handle->_id.type];
-    void *resource = sma_alloc(resource_type->size); // Allocate it a block of an appropriate size using the small memory allocator.
+    // Load it and cache it.
+    // note: Loading may dereference other resource handles (e.g. a Material loading its Textures),
+    //       which may grow the table and move entries around, so the entry is found again after the load.
+    slot = resource_table_claim(handle->_id, RESOURCE_LOADING);
+    void *resource = g_resource_table[slot].resource;
     resource_type->load(resource, handle->data.path); // Use the relevant load function to fill the new resource data.
-    new_entry->uuid = handle->_id.uuid;
-    new_entry->type = handle->_id.type;
-    new_entry->resource = resource;
-    new_entry->next = NULL;
+    slot = resource_table_find(handle->_id);
+    resource_loaded(slot);
+    resource_handle_bind(handle, slot);
     return resource;
 }
 
+ResourceState ___resource_state(ResourceHandle *handle)
+{
+    if (!handle->path_backed) return RESOURCE_READY;
+    if (handle->_generation != 0 && g_resource_table[handle->_slot].generation == handle->_generation) return RESOURCE_READY;
+    int32_t slot = resource_table_find(handle->_id);
+    if (slot < 0) return RESOURCE_UNLOADED;
+    return g_resource_table[slot].state; // (An evicted resource's entry is marked unloaded.)
+}
+bool ___resource_ready(ResourceHandle *handle)
+{
+    ResourceState state = ___resource_state(handle);
+    if (state == RESOURCE_READY) return true;
+    if (state == RESOURCE_LOADING) return false;
+    if (g_resource_async && g_resource_type_info[handle->_id.type].request != NULL) {
+        resource_load_async(handle);
+        return false;
+    }
+    // This type can't be loaded in the background, so just load it now.
+    ___resource_data(handle);
+    return true;
+}
+void ___resource_prefetch(ResourceHandle *handle)
+{
+    if (___resource_state(handle) != RESOURCE_UNLOADED) return;
+    if (g_resource_type_info[handle->_id.type].request != NULL) resource_load_async(handle);
+    else ___resource_data(handle);
+}
 
 /*================================================================================
     Asset/source paths.
@@ -213,10 +619,26 @@ before running the application), it might save the image file or it might not.
 static uint32_t g_resource_path_length = 0;
 static char *g_resource_path = NULL;
 int g_resource_path_count = 0;
+// The drive-directory pairs are also kept split up, for resolving paths without reparsing the path variable.
+typedef struct ResourceDrive_s {
+    char *drive;
+    char *directory;
+} ResourceDrive;
+static ResourceDrive *g_resource_drives = NULL;
 
 void resource_path_add(char *drive_name, char *path)
 {
     g_resource_path_count ++;
+    g_resource_drives = (ResourceDrive *) realloc(g_resource_drives, g_resource_path_count * sizeof(ResourceDrive));
+    mem_check(g_resource_drives);
+    g_resource_drives[g_resource_path_count - 1].drive = (char *) malloc((strlen(drive_name) + 1) * sizeof(char));
+    mem_check(g_resource_drives[g_resource_path_count - 1].drive);
+    strcpy(g_resource_drives[g_resource_path_count - 1].drive, drive_name);
+    g_resource_drives[g_resource_path_count - 1].directory = (char *) malloc((strlen(path) + 1) * sizeof(char));
+    mem_check(g_resource_drives[g_resource_path_count - 1].directory);
+    strcpy(g_resource_drives[g_resource_path_count - 1].directory, path);
+    // A new binding can change what paths resolve to.
+    resource_file_cache_clear();
 
     // Append ":drive_name:path" to the resource path variable, and initialize/relocate if neccessary.
     size_t len = strlen(path) + 1 + strlen(drive_name);
@@ -249,14 +671,186 @@ will attempt to open, with a pair in the global path variable of TextureLibrary:
 */
 FILE *resource_file_open(char *path, char *suffix, char *flags)
 {
-    char path_buffer[1024];
-    for (int i = 0; i < g_resource_path_count; i++) {
-        if (resource_file_path(path, suffix, path_buffer, 1024, i)) {
-            FILE *file = fopen(path_buffer, flags);
-            if (file != NULL) return file;
+    if (strchr(flags, 'w') != NULL || strchr(flags, 'a') != NULL) {
+        // Opening for writing may create the file, so this can't go through the cache. Just try each binding.
+        char path_buffer[1024];
+        for (int i = 0; i < g_resource_path_count; i++) {
+            if (resource_file_path(path, suffix, path_buffer, 1024, i)) {
+                FILE *file = fopen(path_buffer, flags);
+                if (file != NULL) {
+                    resource_file_cache_clear();
+                    return file;
+                }
+            }
         }
+        return NULL;
     }
-    return NULL;
+    char physical_path[1024];
+    if (!resource_file_resolve(path, suffix, physical_path, 1024)) return NULL;
+    return fopen(physical_path, flags);
+}
+
+/*--------------------------------------------------------------------------------
+Resolved path cache and directory listings.
+Both are string-keyed open-addressing tables. The listings table maps a physical directory to a table of the names in it,
+and the resolved path table maps a resource path plus suffix to a physical path (or to g_resource_no_file).
+This is used from the I/O threads as well, so it is behind a mutex.
+--------------------------------------------------------------------------------*/
+typedef struct ResourceStringTable_s {
+    uint32_t size; // a power of two, or zero if not yet allocated.
+    uint32_t count;
+    char **keys;
+    void **values;
+} ResourceStringTable;
+static ResourceStringTable g_resource_resolved_paths = {0};
+static ResourceStringTable g_resource_directory_listings = {0};
+static char g_resource_no_file; // Its address marks a cached failed resolve.
+static pthread_mutex_t g_resource_file_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t resource_string_hash(const char *string)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (; *string != '\0'; string++) {
+        h ^= (uint8_t) *string;
+        h *= 16777619u;
+    }
+    return h;
+}
+static void **resource_string_table_get(ResourceStringTable *table, const char *key)
+{
+    // Returns a pointer to the value for the key, adding the key (with a null value) if it isn't there.
+    if (2 * (table->count + 1) > table->size) {
+        uint32_t old_size = table->size;
+        char **old_keys = table->keys;
+        void **old_values = table->values;
+        table->size = old_size == 0 ? 64 : 2 * old_size;
+        table->keys = (char **) calloc(table->size, sizeof(char *));
+        mem_check(table->keys);
+        table->values = (void **) calloc(table->size, sizeof(void *));
+        mem_check(table->values);
+        for (int i = 0; i < old_size; i++) {
+            if (old_keys[i] == NULL) continue;
+            uint32_t index = resource_string_hash(old_keys[i]) & (table->size - 1);
+            while (table->keys[index] != NULL) index = (index + 1) & (table->size - 1);
+            table->keys[index] = old_keys[i];
+            table->values[index] = old_values[i];
+        }
+        if (old_keys != NULL) free(old_keys);
+        if (old_values != NULL) free(old_values);
+    }
+    uint32_t index = resource_string_hash(key) & (table->size - 1);
+    while (table->keys[index] != NULL) {
+        if (strcmp(table->keys[index], key) == 0) return &table->values[index];
+        index = (index + 1) & (table->size - 1);
+    }
+    table->keys[index] = (char *) malloc((strlen(key) + 1) * sizeof(char));
+    mem_check(table->keys[index]);
+    strcpy(table->keys[index], key);
+    table->values[index] = NULL;
+    table->count ++;
+    return &table->values[index];
+}
+static void resource_string_table_clear(ResourceStringTable *table, void (*free_value)(void *))
+{
+    for (int i = 0; i < table->size; i++) {
+        if (table->keys[i] == NULL) continue;
+        free(table->keys[i]);
+        if (table->values[i] != NULL && free_value != NULL) free_value(table->values[i]);
+    }
+    if (table->keys != NULL) free(table->keys);
+    if (table->values != NULL) free(table->values);
+    memset(table, 0, sizeof(ResourceStringTable));
+}
+static void free_resolved_path(void *value)
+{
+    if (value != &g_resource_no_file) free(value);
+}
+static void free_directory_listing(void *value)
+{
+    resource_string_table_clear((ResourceStringTable *) value, NULL);
+    free(value);
+}
+void resource_file_cache_clear(void)
+{
+    pthread_mutex_lock(&g_resource_file_mutex);
+    resource_string_table_clear(&g_resource_resolved_paths, free_resolved_path);
+    resource_string_table_clear(&g_resource_directory_listings, free_directory_listing);
+    pthread_mutex_unlock(&g_resource_file_mutex);
+}
+
+static ResourceStringTable *resource_directory_listing(const char *directory)
+{
+    // Read the names in a directory, once. A directory which doesn't exist has an empty listing.
+    void **listing = resource_string_table_get(&g_resource_directory_listings, directory);
+    if (*listing != NULL) return (ResourceStringTable *) *listing;
+    ResourceStringTable *names = (ResourceStringTable *) calloc(1, sizeof(ResourceStringTable));
+    mem_check(names);
+    DIR *dir = opendir(directory);
+    if (dir != NULL) {
+        struct dirent *dirent;
+        while ((dirent = readdir(dir)) != NULL) {
+            *resource_string_table_get(names, dirent->d_name) = (void *) names; // any non-null value
+        }
+        closedir(dir);
+    }
+    *listing = (void *) names;
+    return names;
+}
+static bool resource_directory_contains(ResourceStringTable *names, const char *name)
+{
+    if (names->size == 0) return false;
+    uint32_t index = resource_string_hash(name) & (names->size - 1);
+    while (names->keys[index] != NULL) {
+        if (strcmp(names->keys[index], name) == 0) return true;
+        index = (index + 1) & (names->size - 1);
+    }
+    return false;
+}
+
+bool resource_file_resolve(char *path, char *suffix, char *physical_path_buffer, int physical_path_buffer_size)
+{
+    char key[1024];
+    if (strlen(path) + strlen(suffix) >= 1024) {
+        fprintf(stderr, ERROR_ALERT "Resource path too large for given buffer.\n");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(key, path);
+    strcat(key, suffix);
+    char *first_slash = strchr(key, '/');
+    if (first_slash == NULL) {
+        fprintf(stderr, "Bad path given.\n");
+        exit(EXIT_FAILURE);
+    }
+    int drive_length = first_slash - key;
+    // The physical directory is the bound directory followed by the subdirectories in the path (including the leading slash),
+    // and then the name is looked for in that directory.
+    char *last_slash = strrchr(key, '/');
+    int subdirectory_length = last_slash - first_slash;
+    char *name = last_slash + 1;
+
+    pthread_mutex_lock(&g_resource_file_mutex);
+    void **resolved = resource_string_table_get(&g_resource_resolved_paths, key);
+    if (*resolved == NULL) {
+        *resolved = (void *) &g_resource_no_file;
+        for (int i = 0; i < g_resource_path_count; i++) {
+            if (strlen(g_resource_drives[i].drive) != drive_length || strncmp(g_resource_drives[i].drive, key, drive_length) != 0) continue;
+            char directory[1024];
+            if (snprintf(directory, 1024, "%s%.*s", g_resource_drives[i].directory, subdirectory_length, first_slash) >= 1024) continue;
+            if (resource_directory_contains(resource_directory_listing(directory), name)) {
+                char *physical_path = (char *) malloc((strlen(directory) + 1 + strlen(name) + 1) * sizeof(char));
+                mem_check(physical_path);
+                sprintf(physical_path, "%s/%s", directory, name);
+                *resolved = (void *) physical_path;
+                break;
+            }
+        }
+    }
+    // The cached string is freed if the cache is cleared, so it is copied out before unlocking.
+    bool found = *resolved != (void *) &g_resource_no_file && strlen((char *) *resolved) < physical_path_buffer_size;
+    if (found) strcpy(physical_path_buffer, (char *) *resolved);
+    pthread_mutex_unlock(&g_resource_file_mutex);
+    return found;
 }
 
 bool resource_file_path(char *path, char *suffix, char *path_buffer, int path_buffer_size, int start_index)
@@ -4,10 +4,11 @@
 #version 420
 
 #block Standard3D
+#block VertexDecoding
 
 layout (location = 0) in vec4 vPosition;
 
 void main(void)
 {
-    gl_Position = mvp_matrix * vPosition;
+    gl_Position = mvp_matrix * decode_position(vPosition);
 }
@@ -0,0 +1,16 @@
+/*--------------------------------------------------------------------------------
+    Vertex shader for instanced shadow passes. Each instance gives its own model matrix,
+    and the view-projection comes from Standard3D.
+--------------------------------------------------------------------------------*/
+#version 420
+
+#block Standard3D
+#block VertexDecoding
+
+layout (location = 0) in vec4 vPosition;
+layout (location = 8) in mat4x4 instance_model_matrix; // INSTANCE_MATRIX_ATTRIBUTE_LOCATION
+
+void main(void)
+{
+    gl_Position = vp_matrix * instance_model_matrix * decode_position(vPosition);
+}
@@ -1,6 +1,7 @@
 #version 420
 
 #block Standard3D
+#block VertexDecoding
 #block Lights
 
 out vOut {
@@ -22,15 +23,16 @@ layout (location = 3) in vec2 vTexCoord;
 
 void main(void)
 {
-    gl_Position = mvp_matrix * vPosition;
-    fPosition = model_matrix * vPosition;
+    vec4 position = decode_position(vPosition);
+    gl_Position = mvp_matrix * position;
+    fPosition = model_matrix * position;
     fTexCoord = vTexCoord;
-    fNormal = (normal_matrix * vec4(vNormal, 1)).xyz;
+    fNormal = (normal_matrix * vec4(decode_direction(vNormal), 1)).xyz;
 
     for (int i = 0; i < num_directional_lights; i++) {
         for (int j = 0; j < NUM_FRUSTUM_SEGMENTS; j++) {
             mat4x4 model_shadow_matrix = directional_lights[i].shadow_matrices[j] * model_matrix;
-            fDirectionalLightShadowCoord[4*i + j] = model_shadow_matrix * vPosition;
+            fDirectionalLightShadowCoord[4*i + j] = model_shadow_matrix * position;
         }
     }
 }
@@ -0,0 +1,35 @@
+#version 420
+
+#block Standard3D
+#block VertexDecoding
+#block Lights
+
+// The instanced variant of textured_phong_shadows.vert. Each instance gives its own model matrix,
+// instead of the model, normal, and mvp matrices in Standard3D.
+out vOut {
+    vec2 fTexCoord;
+    vec4 fPosition;
+    vec3 fNormal;
+    vec4 fDirectionalLightShadowCoord[MAX_NUM_DIRECTIONAL_LIGHTS * NUM_FRUSTUM_SEGMENTS];
+};
+
+// #vertex_format 3NU
+layout (location = 0) in vec4 vPosition;
+layout (location = 2) in vec3 vNormal;
+layout (location = 3) in vec2 vTexCoord;
+layout (location = 8) in mat4x4 instance_model_matrix; // INSTANCE_MATRIX_ATTRIBUTE_LOCATION
+
+void main(void)
+{
+    fPosition = instance_model_matrix * decode_position(vPosition);
+    gl_Position = vp_matrix * fPosition;
+    fTexCoord = vTexCoord;
+    // Assuming only rigid transformations (and uniform scaling), so the rotation part of the model matrix can transform normals.
+    fNormal = normalize(mat3(instance_model_matrix) * decode_direction(vNormal));
+
+    for (int i = 0; i < num_directional_lights; i++) {
+        for (int j = 0; j < NUM_FRUSTUM_SEGMENTS; j++) {
+            fDirectionalLightShadowCoord[4*i + j] = directional_lights[i].shadow_matrices[j] * fPosition;
+        }
+    }
+}
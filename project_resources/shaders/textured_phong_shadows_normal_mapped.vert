@@ -1,5 +1,6 @@
 #version 420
 #block Standard3D
+#block VertexDecoding
 #block StandardLoopWindow
 #block Lights
 
@@ -18,31 +19,34 @@ out vOut {
 
 void main(void)
 {
+    vec4 position = decode_position(vPosition);
+    vec3 normal = decode_direction(vNormal);
+    vec3 tangent = decode_direction(vTangent);
     // fPosition = model_matrix * vPosition;
     // fPosition *= 1.0 / fPosition.w;
     // gl_Position = vp_matrix * fPosition;
-    gl_Position = mvp_matrix * vPosition;
+    gl_Position = mvp_matrix * position;
 
     // fPosition = model_matrix * vPosition;
     fTexCoord = vTexCoord;
-    fNormal = (normal_matrix * vec4(vNormal, 1)).xyz;
+    fNormal = (normal_matrix * vec4(normal, 1)).xyz;
 
     for (int i = 0; i < num_directional_lights; i++) {
         // Use the shadow matrices for each frustum-segment to create shadow coordinates to
         // interpolate.
         for (int j = 0; j < NUM_FRUSTUM_SEGMENTS; j++) {
             mat4x4 model_shadow_matrix = directional_lights[i].shadow_matrices[j] * model_matrix;
-            fDirectionalLightShadowCoord[4*i + j] = model_shadow_matrix * vPosition;
+            fDirectionalLightShadowCoord[4*i + j] = model_shadow_matrix * position;
         }
         // Interpolate the tangent-space directions of each directional light. This is used for
         // normal mapping, since the normal map is given in tangent-space.
-        vec3 vBinormal = cross(vNormal, vTangent);
+        vec3 vBinormal = cross(normal, tangent);
         vec3 light_dir = directional_lights[i].direction;
         vec3 tangent_space_direction;
         // [ T B N ]^-1, the inverse TBN (tangent-binormal-normal) matrix.
-        tangent_space_direction.x = dot(light_dir, vTangent);
+        tangent_space_direction.x = dot(light_dir, tangent);
         tangent_space_direction.y = dot(light_dir, vBinormal);
-        tangent_space_direction.z = dot(light_dir, vNormal);
+        tangent_space_direction.z = dot(light_dir, normal);
         fTangentSpaceDirectionalLightDirections[i] = tangent_space_direction;
     }
 }
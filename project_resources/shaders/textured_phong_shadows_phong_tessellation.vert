@@ -1,5 +1,8 @@
 #version 420
 
+#block Standard3D
+#block VertexDecoding
+
 out vertex {
     vec2 fTexCoord;
     vec4 fModelPosition;
@@ -11,7 +14,7 @@ layout (location = 3) in vec2 vTexCoord;
 
 void main(void)
 {
-    fModelPosition = vPosition;
-    fModelNormal = vNormal;
+    fModelPosition = decode_position(vPosition);
+    fModelNormal = decode_direction(vNormal);
     fTexCoord = vTexCoord;
 }
@@ -0,0 +1,52 @@
+#!/bin/bash
+#
+# Regression check of the renderer's GL call counts.
+# Each app below is run headless for a fixed number of frames at a fixed timestep, recording GL calls, and its
+# frames, draw calls, state changes and GL objects created are compared with scripts/gl_expected/<app>.txt (see the
+# Engine's -e option). A missing expected file fails the check.
+# With --record, the counts of this run are written as the expected files instead (the Engine's -E option). Do this
+# when a change is meant to alter the counts, and commit the files with it.
+#
+# NOTE: No expected files have been recorded yet, so until scripts/gl_expected/ is committed this check is not active,
+# and fails for every app. Record them with a working build: scripts/gl_check.sh --record
+#
+# Args:
+#   [--record] [app ...] (default: every app below)
+# Run from the project directory.
+
+APPS="collision shadows font_test"
+FRAMES=300
+DT=0.0166666
+
+PROJDIR="$(pwd)"
+EXPECTED_DIR="$PROJDIR/scripts/gl_expected"
+if [ ! -x "$PROJDIR/run" ] ; then
+    echo "gl_check: Run this from the project directory."
+    exit 1
+fi
+option="-e"
+if [ "$1" = "--record" ] ; then
+    option="-E"
+    mkdir -p "$EXPECTED_DIR"
+    shift
+fi
+if [ $# -gt 0 ] ; then
+    APPS="$@"
+fi
+
+failed=""
+for app in $APPS ; do
+    echo "gl_check: $app"
+    if ! ./run $app -H -n $FRAMES -d $DT $option "$EXPECTED_DIR/$app.txt" ; then
+        failed="$failed $app"
+    fi
+done
+if [ -n "$failed" ] ; then
+    echo "gl_check failed:$failed"
+    exit 1
+fi
+if [ "$option" = "-E" ] ; then
+    echo "gl_check recorded the expected GL stats in $EXPECTED_DIR."
+else
+    echo "gl_check passed."
+fi
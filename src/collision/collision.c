@@ -147,8 +147,22 @@ extern void input_event(int key, int action, int mods)
     }
 }
     
+// Static bodies (the ground) can't be knocked, so picking looks past them.
+static bool pick_moving(Body *body, vec3 origin, vec3 direction, float *t, void *data)
+{
+    return !body->is_static;
+}
 extern void mouse_button_event(MouseButton button, bool click, float x, float y)
 {
+    // Left-clicking a body knocks it away from the camera.
+    if (click && button == MouseLeft) {
+        Body *body = Camera_pick(g_main_camera, x, y, pick_moving, NULL);
+        if (body == NULL) return;
+        vec3 origin, direction;
+        Camera_ray(g_main_camera, x, y, &origin, &direction);
+        RigidBody *rb = other_aspect(body, RigidBody);
+        rb->linear_momentum = vec3_add(rb->linear_momentum, vec3_mul(vec3_normalize(direction), rb->mass * 300));
+    }
 }
 extern void mouse_position_event(double x, double y)
 {
@@ -188,6 +202,7 @@ extern void init_program(void)
     body->geometry = new_resource_handle(Geometry, "Models/block -a");
     body->material = Material_create("Materials/textured_phong_shadows");
     body->is_ground = true;
+    body->is_static = true;
     material_set_texture_path(resource_data(Material, body->material), "diffuse_map", "Textures/marble_tile");
     Geometry *block_geometry = resource_data(Geometry, body->geometry);
     RigidBody_init_polytope(add_aspect(e, RigidBody), block_geometry->mesh_data->attribute_data[Position], block_geometry->num_vertices, 0);
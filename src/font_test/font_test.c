@@ -1,12 +1,32 @@
 /*--------------------------------------------------------------------------------
 project_libs:
     + Engine
+
+The counter text is rebuilt every frame into the frame ring (Text_set_frame), so no GL objects are made for it after
+the first few frames. Recording GL calls headless shows objects_created staying the same however many frames are run:
+    ./run font_test -H -r -n 100
+    ./run font_test -H -r -n 1000
 --------------------------------------------------------------------------------*/
 #include "Engine.h"
 
 Font *font;
 EntityID overlay_text;
 
+void counter_update(Logic *logic)
+{
+    // The fonts only have glyphs for letters, so the frame number is written in base 26.
+    static int frame = 0;
+    char string[16];
+    int n = 0;
+    int remaining = frame ++;
+    do {
+        string[n++] = 'a' + remaining % 26;
+        remaining /= 26;
+    } while (remaining > 0);
+    string[n] = '\0';
+    Text_set_frame(get_sibling_aspect(logic, Text), string);
+}
+
 extern void input_event(int key, int action, int mods)
 {
     if (action == GLFW_PRESS) {
@@ -18,9 +38,9 @@ extern void input_event(int key, int action, int mods)
         }
     }
 }
-extern void mouse_button_event(int button, int action, int mods)
+extern void mouse_button_event(MouseButton button, bool click, float x, float y)
 {
-    if (action == GLFW_PRESS && button == GLFW_MOUSE_BUTTON_LEFT) {
+    if (click && button == MouseLeft) {
         vec2 pos = pixel_to_rect(mouse_x,mouse_y,  0,0,  1,1);
         Transform_set(get_aspect_type(overlay_text, Transform), pos.vals[0],pos.vals[1],0,0,0,0);
     }
@@ -35,10 +55,11 @@ extern void init_program(void)
 
     {
         EntityID text_entity = new_entity(3);
-        Transform_set(entity_add_aspect(text_entity, Transform),  0,0,-200,  0,0,0);
+        Transform *transform = entity_add_aspect(text_entity, Transform);
+        Transform_set(transform,  0,0,-200,  0,0,0);
+        transform->scale = 100;
         Text_init(entity_add_aspect(text_entity, Text), TextOriented, "Fonts/computer_modern", "This is a block", 0.2);
         Body *body = entity_add_aspect(text_entity, Body);
-        body->scale = 100;
         body->geometry = new_resource_handle(Geometry, "Models/block");
         body->material = Material_create("Materials/texture");
         material_set_texture_path(resource_data(Material, body->material), "diffuse_map", "Textures/mario/sand_bricks");
@@ -49,6 +70,12 @@ extern void init_program(void)
         Text_init(entity_add_aspect(text_entity, Text), Text2D, "Fonts/arial_regular", "This is overlay text", 0.004);
         overlay_text = text_entity;
     }
+    {
+        EntityID text_entity = new_entity(3);
+        Transform_set(entity_add_aspect(text_entity, Transform),  0.3,0.2,0,  0,0,0);
+        Text_init(entity_add_aspect(text_entity, Text), Text2D, "Fonts/arial_regular", "a", 0.004);
+        Logic_init(entity_add_aspect(text_entity, Logic), counter_update);
+    }
 
 
     create_key_camera_man(0,0,0,  0,0,0);
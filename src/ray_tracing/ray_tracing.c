@@ -1,8 +1,13 @@
 /*--------------------------------------------------------------------------------
+The tracer's grid is filled in by the CPU path tracer, one sample per pixel each frame, accumulating while the tracer
+stays still. Press P to write a larger render of the same view to ray_tracing.png.
+
 project_libs:
     + Engine
+    + path_tracer
 --------------------------------------------------------------------------------*/
 #include "Engine.h"
+#include "path_tracer.h"
 
 #define GRID_WIDTH 32
 #define GRID_HEIGHT 24
@@ -24,6 +29,42 @@ Camera *camera;
 Polyhedron icosahedron_geometry;
 EntityID icosahedron;
 
+PTScene pt_scene;
+PTMesh *pt_icosahedron;
+PTMesh *pt_ground;
+int pt_icosahedron_instance;
+PathTracer path_tracer;
+mat4x4 path_tracer_camera;
+
+#define RENDER_SCALE 20
+#define RENDER_SAMPLES 64
+#define RENDER_PATH "ray_tracing.png"
+
+PTMesh *polyhedron_pt_mesh(Polyhedron *poly)
+{
+    int num_points = polyhedron_num_points(poly);
+    int num_triangles = polyhedron_num_triangles(poly);
+    float *positions = malloc(sizeof(float)*3*num_points);
+    mem_check(positions);
+    uint32_t *triangles = malloc(sizeof(uint32_t)*3*num_triangles);
+    mem_check(triangles);
+    int pi = 0;
+    for (PolyhedronPoint *p = (PolyhedronPoint *) poly->points.first; p != NULL; p = p->next) {
+        p->mark = pi; // mark this point with an index so the triangles can reference it by index.
+        memcpy(&positions[3*pi], &p->position, sizeof(vec3));
+        pi ++;
+    }
+    int ti = 0;
+    for (PolyhedronTriangle *t = (PolyhedronTriangle *) poly->triangles.first; t != NULL; t = t->next) {
+        for (int i = 0; i < 3; i++) triangles[3*ti + i] = t->points[i]->mark;
+        ti ++;
+    }
+    PTMesh *mesh = pt_mesh_create(num_points, positions, NULL, num_triangles, triangles);
+    free(positions);
+    free(triangles);
+    return mesh;
+}
+
 void tracer_update(Logic *logic)
 {
     Transform *t = get_sibling_aspect(logic, Transform);
@@ -45,13 +86,18 @@ void tracer_update(Logic *logic)
 
     // tl, bl, br, tr.
     mat4x4 matrix = Transform_matrix(t);
+    // The path tracer looks through the same image plane. Moving the tracer restarts its accumulation.
+    if (memcmp(&matrix, &path_tracer_camera, sizeof(mat4x4)) != 0) {
+        path_tracer_camera = matrix;
+        path_tracer_set_camera(&path_tracer, matrix, half_width / distance);
+    }
     vec3 camera_space_points[4];
     camera_space_points[0] = new_vec3(-half_width, (GRID_HEIGHT * 1.0 / GRID_WIDTH) * half_width, -distance);
     camera_space_points[1] = new_vec3(-half_width, (GRID_HEIGHT * 1.0 / GRID_WIDTH) * -half_width, -distance);
     camera_space_points[2] = new_vec3(half_width, (GRID_HEIGHT * 1.0 / GRID_WIDTH) * -half_width, -distance);
     camera_space_points[3] = new_vec3(half_width, (GRID_HEIGHT * 1.0 / GRID_WIDTH) * half_width, -distance);
     for (int i = 0; i < 4; i++) {
-        points[i] = mat4x4_vec3(&matrix, camera_space_points[i]);
+        points[i] = mat4x4_vec3(matrix, camera_space_points[i]);
     }
 
     paint_points_c(Canvas3D, &position, 1, "k", 12);
@@ -92,6 +138,19 @@ extern void input_event(int key, int action, int mods)
             controlling_tracer = !controlling_tracer;
             get_aspect_type(camera_man, Logic)->updating = !controlling_tracer;
         }
+        if (key == GLFW_KEY_P) {
+            PathTracer render;
+            path_tracer_init(&render, &pt_scene, RENDER_SCALE * GRID_WIDTH, RENDER_SCALE * GRID_HEIGHT);
+            path_tracer_set_camera(&render, path_tracer_camera, half_width / distance);
+            path_tracer_render(&render, RENDER_SAMPLES);
+            if (path_tracer_write_png(&render, RENDER_PATH)) {
+                printf("Wrote %s (%dx%d, %d samples, %.2f s, %.2f Mrays/s).\n", RENDER_PATH, render.width, render.height,
+                       render.num_samples, render.render_time, render.num_rays / render.render_time * 1e-6);
+            } else {
+                fprintf(stderr, ERROR_ALERT "Could not write %s.\n", RENDER_PATH);
+            }
+            path_tracer_destroy(&render);
+        }
     }
 }
 extern void mouse_button_event(int button, int action, int mods)
@@ -139,12 +198,36 @@ extern void init_program(void)
     icosahedron_geometry = make_icosahedron(100);
     icosahedron = new_entity(4);
     Transform_set(add_aspect(icosahedron, Transform), 0,0,-300, 0,0,0);
+
+    pt_scene_init(&pt_scene);
+    pt_icosahedron = polyhedron_pt_mesh(&icosahedron_geometry);
+    pt_icosahedron_instance = pt_scene_add(&pt_scene, pt_icosahedron, Transform_matrix(get_aspect_type(icosahedron, Transform)),
+                                           new_vec3(0.8,0.3,0.3), vec3_zero());
+    float g = 5000;
+    float ground_positions[] = { -g,-120,-g,  -g,-120,g,  g,-120,g,  g,-120,-g };
+    uint32_t ground_triangles[] = { 0,1,2,  0,2,3 };
+    pt_ground = pt_mesh_create(4, ground_positions, NULL, 2, ground_triangles);
+    pt_scene_add(&pt_scene, pt_ground, identity_mat4x4(), new_vec3(0.6,0.6,0.6), vec3_zero());
+    path_tracer_init(&path_tracer, &pt_scene, GRID_WIDTH, GRID_HEIGHT);
 }
 extern void loop_program(void)
 {
     mat4x4 matrix = Transform_matrix(get_aspect_type(icosahedron, Transform));
     draw_polyhedron2(&icosahedron_geometry, &matrix, "k", 1);
+
+    // Progressively refine the grid.
+    pt_scene_set_matrix(&pt_scene, pt_icosahedron_instance, matrix);
+    path_tracer_render(&path_tracer, 1);
+    for (int i = 0; i < GRID_HEIGHT; i++) {
+        for (int j = 0; j < GRID_WIDTH; j++) {
+            grid[i][j] = path_tracer_pixel(&path_tracer, j, i);
+        }
+    }
 }
 extern void close_program(void)
 {
+    path_tracer_destroy(&path_tracer);
+    pt_scene_destroy(&pt_scene);
+    pt_mesh_destroy(pt_icosahedron);
+    pt_mesh_destroy(pt_ground);
 }
@@ -0,0 +1,53 @@
+/*================================================================================
+    compile_dd
+    Compile a data-dictionary (.dd) file and the files it includes into an image which
+    dd_fopen maps instead of parsing the text (see data_dictionary_binary.c).
+
+Run this from the same directory as the application which opens the file, since #include(...)
+paths are relative to it. For example, from an application directory,
+    compile_dd /home/lucas/collision/lib/Engine/Engine.dd
+writes Engine.ddb next to Engine.dd, which dd_fopen then uses as long as none of the source files change.
+================================================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "helper_definitions.h"
+#include "data_dictionary.h"
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: compile_dd [-d prebuilt_depth] [-o output.ddb] file.dd\n");
+    fprintf(stderr, "    -d: Resolve subdictionary tables this many levels below the root ahead of time (default 3).\n");
+    fprintf(stderr, "    -o: Where to write the image (default: the .dd path with a \"b\" appended).\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    int prebuilt_depth = 3;
+    char *output_path = NULL;
+    int option;
+    while ((option = getopt(argc, argv, "d:o:")) != -1) {
+        switch (option) {
+        case 'd': prebuilt_depth = atoi(optarg); break;
+        case 'o': output_path = optarg; break;
+        default: usage();
+        }
+    }
+    if (optind != argc - 1) usage();
+    char *path = argv[optind];
+
+    const int n = 4096;
+    char default_output_path[n];
+    if (output_path == NULL) {
+        if (snprintf(default_output_path, n, "%sb", path) >= n) usage();
+        output_path = default_output_path;
+    }
+    if (!dd_compile(path, output_path, prebuilt_depth)) {
+        fprintf(stderr, ERROR_ALERT "Failed to compile \"%s\".\n", path);
+        exit(EXIT_FAILURE);
+    }
+    printf("Compiled \"%s\" to \"%s\".\n", path, output_path);
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*================================================================================
+    condition_assets
+    Bake Geometry and Texture resources into binary blobs, which the loaders in the
+    rendering module map directly instead of parsing PLY files and decoding PNGs.
+
+Run this from an application directory, like the application itself, so that the Engine
+.dd file can include the application's resources.dd. Resources are given by their resource
+paths (the same as given to new_resource_handle):
+    condition_assets -g Models/bunny -g "Models/dolphin -a" -t Textures/minecraft/dirt
+Blobs that are already fresh are left alone. The blobs are written next to the source assets, see
+"Conditioned asset blobs" in rendering.h.
+================================================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include "helper_definitions.h"
+#include "memory.h"
+#include "data_dictionary.h"
+#include "resources.h"
+#include "rendering.h"
+
+#define BASE_DIRECTORY "/home/lucas/collision/lib/Engine/"
+#define PROJECT_DIRECTORY "/home/lucas/collision/"
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: condition_assets [-e engine_dd] [-p Drive:directory]... [-g geometry_path]... [-t texture_path]...\n");
+    fprintf(stderr, "    -e: The Engine .dd file to read resource manifests from (default " BASE_DIRECTORY "Engine.dd).\n");
+    fprintf(stderr, "    -p: Bind another resource drive to a directory. The Engine's default drives are always bound.\n");
+    fprintf(stderr, "    -g: Condition a Geometry resource.\n");
+    fprintf(stderr, "    -t: Condition a Texture resource.\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    char *engine_dd_path = BASE_DIRECTORY "Engine.dd";
+    // Arguments are gathered first, since resource drives must be bound before anything is conditioned.
+    char **geometry_paths = calloc(argc, sizeof(char *));
+    char **texture_paths = calloc(argc, sizeof(char *));
+    mem_check(geometry_paths);
+    mem_check(texture_paths);
+    int num_geometry = 0;
+    int num_textures = 0;
+    int num_drives = 0;
+    char **drives = calloc(argc, sizeof(char *));
+    mem_check(drives);
+
+    int option;
+    while ((option = getopt(argc, argv, "e:p:g:t:")) != -1) {
+        switch (option) {
+        case 'e': engine_dd_path = optarg; break;
+        case 'p': drives[num_drives ++] = optarg; break;
+        case 'g': geometry_paths[num_geometry ++] = optarg; break;
+        case 't': texture_paths[num_textures ++] = optarg; break;
+        default: usage();
+        }
+    }
+    if (optind != argc || num_geometry + num_textures == 0) usage();
+
+    // The same drives as the Engine binds.
+    resource_path_add("Meshes", PROJECT_DIRECTORY "project_resources/meshes");
+    resource_path_add("Images", PROJECT_DIRECTORY "project_resources/images");
+    resource_path_add("Shaders", PROJECT_DIRECTORY "project_resources/shaders");
+    resource_path_add("Fonts", PROJECT_DIRECTORY "project_resources/fonts");
+    resource_path_add("Meshes", "resources/meshes");
+    resource_path_add("Images", "resources/images");
+    resource_path_add("Shaders", "resources/shaders");
+    resource_path_add("Fonts", "resources/fonts");
+    for (int i = 0; i < num_drives; i++) {
+        char *colon = strchr(drives[i], ':');
+        if (colon == NULL) usage();
+        *colon = '\0';
+        resource_path_add(drives[i], colon + 1);
+    }
+
+    DD *base_config = dd_fopen(engine_dd_path);
+    if (base_config == NULL) {
+        fprintf(stderr, ERROR_ALERT "Could not open \"%s\".\n", engine_dd_path);
+        exit(EXIT_FAILURE);
+    }
+    g_resource_dictionary = dd_open(base_config, "Resources");
+    if (g_resource_dictionary == NULL) {
+        fprintf(stderr, ERROR_ALERT "Could not open resource dictionary.\n");
+        exit(EXIT_FAILURE);
+    }
+    // note: init_resources_rendering is not called, since there is no GL context. Conditioning only uses the
+    //       parts of the loaders before vram upload, which don't need the resource types.
+    for (int i = 0; i < num_geometry; i++) {
+        printf("Geometry \"%s\": %s\n", geometry_paths[i], Geometry_condition(geometry_paths[i]) ? "conditioned" : "up to date");
+    }
+    for (int i = 0; i < num_textures; i++) {
+        printf("Texture \"%s\": %s\n", texture_paths[i], Texture_condition(texture_paths[i]) ? "conditioned" : "up to date");
+    }
+    exit(EXIT_SUCCESS);
+}
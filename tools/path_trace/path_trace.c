@@ -0,0 +1,122 @@
+/*================================================================================
+    path_trace
+    Render a PLY mesh, standing on a ground plane under the sky, with the CPU path tracer, and write a PNG.
+    The time and throughput are reported after each pass, so this also serves as a benchmark.
+    path_trace -o bunny.png ../../project_resources/__unsorted_stuff/models/stanford_bunny.ply
+    path_trace -s 256 -p 16 -t 1 ../../project_resources/meshes/stanford_bunny_low.ply
+================================================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "helper_definitions.h"
+#include "matrix_mathematics.h"
+#include "ply.h"
+#include "path_tracer.h"
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: path_trace [-w width] [-h height] [-s samples] [-p samples_per_pass] [-t threads] [-o out.png] file.ply\n");
+    fprintf(stderr, "    -w, -h: Image size (default 640x480).\n");
+    fprintf(stderr, "    -s: Samples per pixel (default 64).\n");
+    fprintf(stderr, "    -p: Samples per pixel in each pass, after which the progress is reported (default 8).\n");
+    fprintf(stderr, "    -t: Threads (default 0, one per core).\n");
+    fprintf(stderr, "    -o: Output file (default path_trace.png).\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    int width = 640;
+    int height = 480;
+    int samples = 64;
+    int samples_per_pass = 8;
+    int num_threads = 0;
+    char *out_path = "path_trace.png";
+    int option;
+    while ((option = getopt(argc, argv, "w:h:s:p:t:o:")) != -1) {
+        switch (option) {
+        case 'w': width = atoi(optarg); break;
+        case 'h': height = atoi(optarg); break;
+        case 's': samples = atoi(optarg); break;
+        case 'p': samples_per_pass = atoi(optarg); break;
+        case 't': num_threads = atoi(optarg); break;
+        case 'o': out_path = optarg; break;
+        default: usage();
+        }
+    }
+    if (optind != argc - 1 || width < 1 || height < 1 || samples < 1 || samples_per_pass < 1) usage();
+
+    FILE *file = fopen(argv[optind], "rb");
+    if (file == NULL) {
+        fprintf(stderr, ERROR_ALERT "Could not open \"%s\".\n", argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+    PLY *ply = read_ply(file);
+    PLYRequest requests[2] = {0};
+    requests[0].query_string = "[vertex]: float x, float y, float z";
+    requests[1].query_string = "[face]: list int vertex_indices";
+    requests[1].list_length = 3;
+    ply_get_many(file, ply, 2, requests);
+    destroy_ply(ply);
+    fclose(file);
+    PTMesh *mesh = pt_mesh_create(requests[0].num_entries, requests[0].data, NULL, requests[1].num_entries, requests[1].data);
+    free(requests[0].data);
+    free(requests[1].data);
+    printf("%s: %d vertices, %d triangles.\n", argv[optind], mesh->num_vertices, mesh->num_triangles);
+
+    // Stand the mesh on a ground plane, and look at it from the front and a little above.
+    vec3 center = new_vec3(0.5 * (mesh->box_min[0] + mesh->box_max[0]),
+                           0.5 * (mesh->box_min[1] + mesh->box_max[1]),
+                           0.5 * (mesh->box_min[2] + mesh->box_max[2]));
+    float size = 0;
+    for (int i = 0; i < 3; i++) size = fmax(size, mesh->box_max[i] - mesh->box_min[i]);
+    float ground_y = mesh->box_min[1];
+    float g = 50 * size;
+    float ground_positions[] = { -g + center.vals[0], ground_y, -g + center.vals[2],
+                                 -g + center.vals[0], ground_y,  g + center.vals[2],
+                                  g + center.vals[0], ground_y,  g + center.vals[2],
+                                  g + center.vals[0], ground_y, -g + center.vals[2] };
+    uint32_t ground_triangles[] = { 0, 1, 2,  0, 2, 3 };
+    PTMesh *ground = pt_mesh_create(4, ground_positions, NULL, 2, ground_triangles);
+
+    PTScene scene;
+    pt_scene_init(&scene);
+    pt_scene_add(&scene, mesh, identity_mat4x4(), new_vec3(0.8, 0.75, 0.7), vec3_zero());
+    pt_scene_add(&scene, ground, identity_mat4x4(), new_vec3(0.5, 0.5, 0.5), vec3_zero());
+
+    vec3 eye = vec3_add(center, new_vec3(0, 0.4 * size, 1.8 * size));
+    vec3 back = vec3_normalize(vec3_sub(eye, center));
+    vec3 right = vec3_normalize(vec3_cross(new_vec3(0, 1, 0), back));
+    vec3 up = vec3_cross(back, right);
+    mat4x4 camera_matrix = identity_mat4x4();
+    for (int i = 0; i < 3; i++) {
+        camera_matrix.vals[i] = right.vals[i];
+        camera_matrix.vals[4 + i] = up.vals[i];
+        camera_matrix.vals[8 + i] = back.vals[i];
+        camera_matrix.vals[12 + i] = eye.vals[i];
+    }
+    PathTracer pt;
+    path_tracer_init(&pt, &scene, width, height);
+    pt.num_threads = num_threads;
+    path_tracer_set_camera(&pt, camera_matrix, 0.5);
+
+    while (pt.num_samples < samples) {
+        int pass = samples - pt.num_samples < samples_per_pass ? samples - pt.num_samples : samples_per_pass;
+        path_tracer_render(&pt, pass);
+        printf("%5d samples %10.3f s %10.2f Mrays/s\n", pt.num_samples, pt.render_time, pt.num_rays / pt.render_time * 1e-6);
+    }
+    if (!path_tracer_write_png(&pt, out_path)) {
+        fprintf(stderr, ERROR_ALERT "Could not write \"%s\".\n", out_path);
+        exit(EXIT_FAILURE);
+    }
+    printf("Wrote %s.\n", out_path);
+
+    path_tracer_destroy(&pt);
+    pt_scene_destroy(&scene);
+    pt_mesh_destroy(mesh);
+    pt_mesh_destroy(ground);
+    return 0;
+}
@@ -0,0 +1,260 @@
+/*================================================================================
+    ply_benchmark
+    Time the decoding of PLY files (read_ply then ply_get_binary_data) and report the throughput in MB/s.
+
+With no files given, a synthetic grid mesh (positions, normals, uvs, and triangle faces) is written
+as ascii, binary_little_endian and binary_big_endian files in /tmp, each is timed, and the decoded
+data of the three is checked to be the same.
+With -c, each file is also streamed through a PLYCursor (vertex positions, and triangle faces for the synthetic grid),
+and the streamed records are checked against ply_get_many.
+    ply_benchmark -n 1000000
+    ply_benchmark -c -n 100000
+    ply_benchmark ../../src/__old/__really_old/render_test/meshes/___extra/stanford_bunny.ply
+================================================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "helper_definitions.h"
+#include "ply.h"
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: ply_benchmark [-c] [-n num_vertices] [-r runs] [-t threads] [file.ply ...]\n");
+    fprintf(stderr, "    -c: Also stream the files through a cursor, and check the records against ply_get_many.\n");
+    fprintf(stderr, "    -n: Number of vertices in the synthetic mesh (default 1000000).\n");
+    fprintf(stderr, "    -r: Take the best of this many runs (default 3).\n");
+    fprintf(stderr, "    -t: Threads for parsing large ASCII files (default 0, one per core).\n");
+    exit(EXIT_FAILURE);
+}
+
+static double time_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static size_t file_size(char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, ERROR_ALERT "Could not stat \"%s\".\n", path);
+        exit(EXIT_FAILURE);
+    }
+    return st.st_size;
+}
+
+// Decode the file, returning the best time over the runs. The decoded PLY of the last run is returned through ply_out.
+static double time_decode(char *path, int runs, PLY **ply_out)
+{
+    double best = -1;
+    for (int run = 0; run < runs; run++) {
+        FILE *file = fopen(path, "rb");
+        if (file == NULL) {
+            fprintf(stderr, ERROR_ALERT "Could not open \"%s\".\n", path);
+            exit(EXIT_FAILURE);
+        }
+        double start = time_now();
+        PLY *ply = read_ply(file);
+        ply_get_binary_data(file, ply);
+        double t = time_now() - start;
+        fclose(file);
+        if (best < 0 || t < best) best = t;
+        if (run == runs - 1 && ply_out != NULL) *ply_out = ply;
+        else destroy_ply(ply);
+    }
+    return best;
+}
+
+// Stream the query through a cursor, in small batches so that records straddle the read window, and compare against ply_get_many.
+// Returns whether the streamed records match.
+static bool check_cursor(char *path, char *query_string, int list_length, int record_size)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, ERROR_ALERT "Could not open \"%s\".\n", path);
+        exit(EXIT_FAILURE);
+    }
+    PLY *ply = read_ply(file);
+    PLYRequest request = {0};
+    request.query_string = query_string;
+    request.list_length = list_length;
+    ply_get_many(file, ply, 1, &request);
+
+    double start = time_now();
+    PLYCursor *cursor = ply_cursor_open(file, ply, query_string, list_length, 1000);
+    size_t num_streamed = 0;
+    bool same = true;
+    int n;
+    char *records;
+    while ((records = ply_cursor_next(cursor, &n)) != NULL) {
+        if (num_streamed + n > request.num_entries
+                || memcmp(records, ((char *) request.data) + num_streamed * record_size, n * record_size) != 0) same = false;
+        num_streamed += n;
+    }
+    ply_cursor_close(cursor);
+    double t = time_now() - start;
+    if (num_streamed != request.num_entries) same = false;
+    printf("    cursor %-40s %10zu records %10.3f s %s\n", query_string, num_streamed, t, same ? "ok" : "MISMATCH");
+    if (!same) fprintf(stderr, ERROR_ALERT "Streamed \"%s\" of \"%s\" differs from ply_get_many.\n", query_string, path);
+
+    free(request.data);
+    destroy_ply(ply);
+    fclose(file);
+    return same;
+}
+
+static void report(char *name, char *path, double t)
+{
+    double mb = file_size(path) / (1024.0 * 1024.0);
+    printf("%-24s %10.2f MB %10.3f s %10.2f MB/s\n", name, mb, t, mb / t);
+}
+
+//--------------------------------------------------------------------------------
+// Synthetic mesh
+//--------------------------------------------------------------------------------
+static void write_u32(FILE *file, uint32_t v, bool big_endian)
+{
+    if (big_endian) v = __builtin_bswap32(v);
+    fwrite(&v, sizeof(uint32_t), 1, file);
+}
+static void write_f32(FILE *file, float f, bool big_endian)
+{
+    uint32_t v;
+    memcpy(&v, &f, sizeof(float));
+    write_u32(file, v, big_endian);
+}
+
+static void write_grid(char *path, PLYFormat format, int side)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, ERROR_ALERT "Could not open \"%s\" for writing.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    int num_vertices = side * side;
+    int num_faces = 2 * (side - 1) * (side - 1);
+    bool big_endian = format == PLY_FORMAT_BINARY_BIG_ENDIAN_1;
+    fprintf(file, "ply\nformat %s 1.0\ncomment ply_benchmark grid\n",
+            format == PLY_FORMAT_ASCII_1 ? "ascii" : big_endian ? "binary_big_endian" : "binary_little_endian");
+    fprintf(file, "element vertex %d\n", num_vertices);
+    fprintf(file, "property float x\nproperty float y\nproperty float z\n");
+    fprintf(file, "property float nx\nproperty float ny\nproperty float nz\n");
+    fprintf(file, "property float u\nproperty float v\n");
+    fprintf(file, "element face %d\nproperty list uchar uint vertex_indices\nend_header\n", num_faces);
+
+    for (int i = 0; i < side; i++) {
+        for (int j = 0; j < side; j++) {
+            float u = i / (float) (side - 1);
+            float v = j / (float) (side - 1);
+            float vals[8] = { u * 100 - 50, 0.25f * ((i * 7 + j * 13) % 17), v * 100 - 50, 0, 1, 0, u, v };
+            if (format == PLY_FORMAT_ASCII_1) {
+                fprintf(file, "%.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n",
+                        vals[0], vals[1], vals[2], vals[3], vals[4], vals[5], vals[6], vals[7]);
+            } else {
+                for (int k = 0; k < 8; k++) write_f32(file, vals[k], big_endian);
+            }
+        }
+    }
+    for (int i = 0; i < side - 1; i++) {
+        for (int j = 0; j < side - 1; j++) {
+            uint32_t a = i*side + j, b = a + 1, c = a + side, d = c + 1;
+            uint32_t tris[2][3] = {{a, c, b}, {b, c, d}};
+            for (int t = 0; t < 2; t++) {
+                if (format == PLY_FORMAT_ASCII_1) {
+                    fprintf(file, "3 %u %u %u\n", tris[t][0], tris[t][1], tris[t][2]);
+                } else {
+                    fputc(3, file);
+                    for (int k = 0; k < 3; k++) write_u32(file, tris[t][k], big_endian);
+                }
+            }
+        }
+    }
+    fclose(file);
+}
+
+static size_t ply_data_size(PLY *ply)
+{
+    // The data ends after the furthest entry of any element.
+    size_t size = 0;
+    for (PLYElement *element = ply->first_element; element != NULL; element = element->next_element) {
+        if (element->property_offsets == NULL) {
+            if (element->offset + element->count * element->stride > size) size = element->offset + element->count * element->stride;
+        } else {
+            for (int i = 0; i < element->count; i++) {
+                // The last property of the last entry is the furthest along.
+                size_t at = element->property_offsets[element->num_properties - 1][i];
+                PLYProperty *last = element->first_property;
+                while (last->next_property != NULL) last = last->next_property;
+                size_t n = last->is_list ? 1 + ((uint32_t *) (ply->data + at))[0] : 1;
+                if (at + n * sizeof(uint32_t) > size) size = at + n * sizeof(uint32_t);
+            }
+        }
+    }
+    return size;
+}
+
+int main(int argc, char *argv[])
+{
+    int num_vertices = 1000000;
+    int runs = 3;
+    bool cursors = false;
+    int option;
+    while ((option = getopt(argc, argv, "cn:r:t:")) != -1) {
+        switch (option) {
+        case 'c': cursors = true; break;
+        case 'n': num_vertices = atoi(optarg); break;
+        case 'r': runs = atoi(optarg); break;
+        case 't': ply_set_num_threads(atoi(optarg)); break;
+        default: usage();
+        }
+    }
+    if (num_vertices < 4 || runs < 1) usage();
+
+    if (optind < argc) {
+        bool same = true;
+        for (int i = optind; i < argc; i++) {
+            report(argv[i], argv[i], time_decode(argv[i], runs, NULL));
+            if (cursors) same &= check_cursor(argv[i], "[vertex]: float x, float y, float z", 0, 3 * sizeof(float));
+        }
+        return same ? 0 : 1;
+    }
+
+    int side = 2;
+    while (side * side < num_vertices) side ++;
+    char *names[3] = { "ascii", "binary_little_endian", "binary_big_endian" };
+    PLYFormat formats[3] = { PLY_FORMAT_ASCII_1, PLY_FORMAT_BINARY_LITTLE_ENDIAN_1, PLY_FORMAT_BINARY_BIG_ENDIAN_1 };
+    char paths[3][64];
+    PLY *plys[3];
+    printf("Synthetic grid: %d vertices, %d faces.\n", side * side, 2 * (side - 1) * (side - 1));
+    for (int i = 0; i < 3; i++) {
+        snprintf(paths[i], 64, "/tmp/ply_benchmark_%d_%s.ply", (int) getpid(), names[i]);
+        write_grid(paths[i], formats[i], side);
+        report(names[i], paths[i], time_decode(paths[i], runs, &plys[i]));
+    }
+    bool same = true;
+    if (cursors) {
+        // The face query skips the vertices, and the binary faces go through the list path.
+        for (int i = 0; i < 3; i++) {
+            printf("%s\n", names[i]);
+            same &= check_cursor(paths[i], "[vertex]: float x, float y, float z", 0, 3 * sizeof(float));
+            same &= check_cursor(paths[i], "[face]: list int vertex_indices", 3, 3 * sizeof(int));
+        }
+    }
+    size_t size = ply_data_size(plys[0]);
+    for (int i = 1; i < 3; i++) {
+        if (ply_data_size(plys[i]) != size || memcmp(plys[i]->data, plys[0]->data, size) != 0) {
+            fprintf(stderr, ERROR_ALERT "Decoded data of %s differs from %s.\n", names[i], names[0]);
+            same = false;
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        destroy_ply(plys[i]);
+        remove(paths[i]);
+    }
+    return same ? 0 : 1;
+}
@@ -0,0 +1,208 @@
+/*================================================================================
+    ray_benchmark
+    Time nearest-hit ray queries against a triangle mesh through its triangle BVH, and report the throughput in Mrays/s.
+
+Two sets of rays are cast: a coherent grid of camera rays looking at the mesh, and incoherent rays from random points
+around it toward random points in its bounding box. A sample of the rays is also tested against every triangle, which
+is timed for comparison and checked to give the same hits.
+    ray_benchmark ../../project_resources/__unsorted_stuff/models/stanford_bunny.ply
+    ray_benchmark -w 1024 -n 4000000 ../../project_resources/meshes/stanford_bunny_low.ply
+================================================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "helper_definitions.h"
+#include "matrix_mathematics.h"
+#include "ply.h"
+#include "triangle_bvh.h"
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: ray_benchmark [-w grid_width] [-n num_random_rays] [-b num_brute_force_rays] [-r runs] file.ply\n");
+    fprintf(stderr, "    -w: Width and height of the camera ray grid (default 512).\n");
+    fprintf(stderr, "    -n: Number of incoherent rays (default 1000000).\n");
+    fprintf(stderr, "    -b: Number of rays of each set to also test against every triangle (default 1000).\n");
+    fprintf(stderr, "    -r: Take the best of this many runs (default 3).\n");
+    exit(EXIT_FAILURE);
+}
+
+static double time_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+typedef struct Mesh_s {
+    int num_vertices;
+    float *positions;
+    int num_triangles;
+    uint32_t *triangles;
+} Mesh;
+
+static Mesh load_mesh(char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, ERROR_ALERT "Could not open \"%s\".\n", path);
+        exit(EXIT_FAILURE);
+    }
+    PLY *ply = read_ply(file);
+    PLYRequest requests[2] = {0};
+    requests[0].query_string = "[vertex]: float x, float y, float z";
+    requests[1].query_string = "[face]: list int vertex_indices";
+    requests[1].list_length = 3;
+    ply_get_many(file, ply, 2, requests);
+    destroy_ply(ply);
+    fclose(file);
+    Mesh mesh;
+    mesh.num_vertices = requests[0].num_entries;
+    mesh.positions = (float *) requests[0].data;
+    mesh.num_triangles = requests[1].num_entries;
+    mesh.triangles = (uint32_t *) requests[1].data;
+    return mesh;
+}
+
+// Test against every triangle, for comparison.
+static bool brute_force_raycast(Mesh *mesh, vec3 origin, vec3 direction, float *t_out)
+{
+    bool found = false;
+    float best_t = INFINITY;
+    for (int i = 0; i < mesh->num_triangles; i++) {
+        vec3 a, b, c;
+        memcpy(&a, &mesh->positions[3*mesh->triangles[3*i]], sizeof(vec3));
+        memcpy(&b, &mesh->positions[3*mesh->triangles[3*i + 1]], sizeof(vec3));
+        memcpy(&c, &mesh->positions[3*mesh->triangles[3*i + 2]], sizeof(vec3));
+        vec3 ab = vec3_sub(b, a);
+        vec3 ac = vec3_sub(c, a);
+        vec3 p = vec3_cross(direction, ac);
+        float det = vec3_dot(ab, p);
+        if (det == 0) continue;
+        vec3 s = vec3_sub(origin, a);
+        float u = vec3_dot(s, p) / det;
+        if (u < 0 || u > 1) continue;
+        vec3 q = vec3_cross(s, ab);
+        float v = vec3_dot(direction, q) / det;
+        if (v < 0 || u + v > 1) continue;
+        float t = vec3_dot(ac, q) / det;
+        if (t >= 0 && t < best_t) {
+            best_t = t;
+            found = true;
+        }
+    }
+    *t_out = best_t;
+    return found;
+}
+
+static void run(char *name, TriangleBVH *bvh, Mesh *mesh, int num_rays, vec3 *origins, vec3 *directions, int runs, int num_brute_force)
+{
+    TriangleRayHit *hits = malloc(num_rays * sizeof(TriangleRayHit));
+    mem_check(hits);
+    bool *hit = malloc(num_rays * sizeof(bool));
+    mem_check(hit);
+    double best = -1;
+    int num_hits = 0;
+    for (int r = 0; r < runs; r++) {
+        double start = time_now();
+        for (int i = 0; i < num_rays; i++) hit[i] = triangle_bvh_raycast(bvh, origins[i], directions[i], INFINITY, &hits[i]);
+        double t = time_now() - start;
+        if (best < 0 || t < best) best = t;
+    }
+    for (int i = 0; i < num_rays; i++) num_hits += hit[i];
+    printf("%-12s %10d rays %6.1f%% hit %10.3f s %10.2f Mrays/s\n", name, num_rays, 100.0 * num_hits / num_rays, best, num_rays / best * 1e-6);
+
+    if (num_brute_force > num_rays) num_brute_force = num_rays;
+    if (num_brute_force <= 0) return;
+    int mismatches = 0;
+    double start = time_now();
+    for (int i = 0; i < num_brute_force; i++) {
+        float t;
+        bool brute_hit = brute_force_raycast(mesh, origins[i], directions[i], &t);
+        if (brute_hit != hit[i] || (brute_hit && fabs(t - hits[i].t) > 1e-4 * t)) mismatches ++;
+    }
+    double t = time_now() - start;
+    printf("%-12s %10d rays %18s %10.3f s %10.4f Mrays/s (every triangle, %d differing)\n", "", num_brute_force, "", t, num_brute_force / t * 1e-6, mismatches);
+    free(hits);
+    free(hit);
+}
+
+int main(int argc, char *argv[])
+{
+    int grid_width = 512;
+    int num_random = 1000000;
+    int num_brute_force = 1000;
+    int runs = 3;
+    int option;
+    while ((option = getopt(argc, argv, "w:n:b:r:")) != -1) {
+        switch (option) {
+        case 'w': grid_width = atoi(optarg); break;
+        case 'n': num_random = atoi(optarg); break;
+        case 'b': num_brute_force = atoi(optarg); break;
+        case 'r': runs = atoi(optarg); break;
+        default: usage();
+        }
+    }
+    if (optind != argc - 1 || grid_width < 1 || num_random < 1 || runs < 1) usage();
+
+    Mesh mesh = load_mesh(argv[optind]);
+    double start = time_now();
+    TriangleBVH bvh;
+    triangle_bvh_build(&bvh, mesh.num_vertices, mesh.positions, mesh.num_triangles, mesh.triangles);
+    double build_time = time_now() - start;
+    printf("%s: %d vertices, %d triangles.\n", argv[optind], mesh.num_vertices, mesh.num_triangles);
+    printf("Built in %.3f s: %d nodes, depth %d.\n", build_time, bvh.num_nodes, bvh.depth);
+
+    vec3 min = new_vec3(INFINITY, INFINITY, INFINITY);
+    vec3 max = new_vec3(-INFINITY, -INFINITY, -INFINITY);
+    for (int i = 0; i < mesh.num_vertices; i++) {
+        for (int j = 0; j < 3; j++) {
+            if (mesh.positions[3*i + j] < min.vals[j]) min.vals[j] = mesh.positions[3*i + j];
+            if (mesh.positions[3*i + j] > max.vals[j]) max.vals[j] = mesh.positions[3*i + j];
+        }
+    }
+    vec3 center = vec3_mul(vec3_add(min, max), 0.5);
+    float radius = 0.5 * vec3_length(vec3_sub(max, min));
+
+    // Camera rays, from in front of the mesh along +z, with the grid just covering its bounding sphere.
+    int num_grid = grid_width * grid_width;
+    vec3 *origins = malloc((num_grid > num_random ? num_grid : num_random) * sizeof(vec3));
+    mem_check(origins);
+    vec3 *directions = malloc((num_grid > num_random ? num_grid : num_random) * sizeof(vec3));
+    mem_check(directions);
+    vec3 eye = vec3_add(center, new_vec3(0, 0, 3 * radius));
+    for (int i = 0; i < grid_width; i++) {
+        for (int j = 0; j < grid_width; j++) {
+            float x = radius * (2 * (j + 0.5) / grid_width - 1);
+            float y = radius * (1 - 2 * (i + 0.5) / grid_width);
+            origins[i*grid_width + j] = eye;
+            directions[i*grid_width + j] = vec3_normalize(vec3_sub(vec3_add(center, new_vec3(x, y, 0)), eye));
+        }
+    }
+    run("coherent", &bvh, &mesh, num_grid, origins, directions, runs, num_brute_force);
+
+    // Incoherent rays, from random points on a sphere around the mesh toward random points in its box.
+    srand(1);
+    for (int i = 0; i < num_random; i++) {
+        vec3 v;
+        do {
+            v = new_vec3(2 * frand() - 1, 2 * frand() - 1, 2 * frand() - 1);
+        } while (vec3_dot(v, v) > 1 || vec3_dot(v, v) < 1e-4);
+        origins[i] = vec3_add(center, vec3_mul(vec3_normalize(v), 2 * radius));
+        vec3 target = new_vec3(min.vals[0] + frand() * (max.vals[0] - min.vals[0]),
+                               min.vals[1] + frand() * (max.vals[1] - min.vals[1]),
+                               min.vals[2] + frand() * (max.vals[2] - min.vals[2]));
+        directions[i] = vec3_normalize(vec3_sub(target, origins[i]));
+    }
+    run("incoherent", &bvh, &mesh, num_random, origins, directions, runs, num_brute_force);
+
+    free(origins);
+    free(directions);
+    triangle_bvh_destroy(&bvh);
+    free(mesh.positions);
+    free(mesh.triangles);
+    return 0;
+}